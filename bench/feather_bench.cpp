@@ -0,0 +1,122 @@
+/*--- Code file for feather_bench ---*/
+
+// Microbenchmarks of the per-request costs of feather, see bench/README.md.
+
+#include "bench.hpp"
+
+#include <feather.hpp>
+
+#include <filesystem>
+
+using namespace feather::core;
+using namespace feather::core::plug;
+using namespace feather::router;
+using namespace feather::controller;
+
+namespace
+{
+    std::string const raw_request =
+        "GET /bench/users/42?page=3&sort=name&filter=active HTTP/1.1\r\n"
+        "Host: localhost:4000\r\n"
+        "User-Agent: feather_bench\r\n"
+        "Accept: text/html,application/xhtml+xml\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, br\r\n"
+        "Cookie: id_cookie=8f3e2a; theme=dark; lang=en\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n";
+
+    Conn make_conn(std::string const& target)
+    {
+        http::Request req = ParseRequest(raw_request).second;
+        req.target = target;
+        req.path = target.substr(0, target.find('?'));
+        return Conn(std::move(req), std::make_shared<CookieSession>());
+    }
+
+    // Adds count routes under /routesN, so that N routes are registered once every step ran.
+    void add_routes(std::string const& scope, size_t count)
+    {
+        Router::fetch_instance()
+            CHAIN(Router::scope, scope, ([count](Scope&& s)
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    s.get = s.get.insert({"/items" + std::to_string(i) + "/:id", [](Conn const& c) { return c; }});
+                }
+                return std::move(s);
+            }));
+        Router::freeze(Router::fetch_instance());
+    }
+
+    void bench_parsing(bench::Suite& suite)
+    {
+        suite.run("parse_request", []() { bench::DoNotOptimize(Server::parse_request(raw_request)); });
+        suite.run("conn_from_request", []()
+        {
+            bench::DoNotOptimize(Conn(http::Request(ParseRequest(raw_request).second), std::make_shared<CookieSession>()));
+        });
+
+        Conn const conn = make_conn("/bench/users/42?page=3&sort=name&filter=active");
+        suite.run("fetch_cookies", [&conn]() { bench::DoNotOptimize(Conn::fetch_cookies(conn)); });
+        suite.run("fetch_query_params", [&conn]() { bench::DoNotOptimize(Conn::fetch_query_params(conn)); });
+    }
+
+    void bench_routing(bench::Suite& suite)
+    {
+        size_t registered = 0;
+        for (size_t const total : {10, 100, 1000})
+        {
+            add_routes("/routes" + std::to_string(total), total - registered);
+            registered = total;
+
+            // The last route of the last scope: every level of the trie has all its siblings.
+            Conn const conn = make_conn("/routes" + std::to_string(total) + "/items" + std::to_string(total - 1) + "/7");
+            suite.run("router_handler/" + std::to_string(total), [&conn]() { bench::DoNotOptimize(Router::handler(conn)); });
+        }
+    }
+
+    void bench_plugs(bench::Suite& suite)
+    {
+        Plug const step = [](Conn conn, PlugOptions) { return unwrap<Conn>(Conn::put_status(std::move(conn), 200)); };
+        Conn const conn = make_conn("/bench");
+
+        for (size_t const length : {1, 4, 16, 64})
+        {
+            Plugs const plugs = std::make_shared<std::vector<Plug> const>(length, step);
+            suite.run("plug_chain/" + std::to_string(length), [&plugs, &conn]() { bench::DoNotOptimize(Router::run(plugs, conn)); });
+        }
+    }
+
+    void bench_rendering(bench::Suite& suite)
+    {
+        std::filesystem::path const path = std::filesystem::temp_directory_path() / "feather_bench_template.html";
+        std::ofstream(path) << "<h1>{{ title }}</h1><ul>{% for item in items %}<li>{{ item.name }}: {{ item.price }}</li>{% endfor %}</ul>";
+
+        auto const tm = TemplateManager::fetch_instance() CHAIN(TemplateManager::add_template, "bench", path.string());
+        json data = { {"title", "Products"}, {"items", json::array()} };
+        for (int i = 0; i < 20; ++i)
+        {
+            data["items"].push_back({ {"name", "item " + std::to_string(i)}, {"price", i * 3} });
+        }
+
+        suite.run("template_render", [&tm, &data]() { bench::DoNotOptimize(TemplateManager::render(tm, "bench", data)); });
+
+        Conn const conn = make_conn("/bench");
+        suite.run("controller_render", [&conn, &data]() { bench::DoNotOptimize(render(conn, "bench", data)); });
+
+        std::filesystem::remove(path);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bench::Suite suite(bench::Options::Parse(argc, argv));
+
+    bench_parsing(suite);
+    bench_routing(suite);
+    bench_plugs(suite);
+    bench_rendering(suite);
+
+    return suite.report();
+}
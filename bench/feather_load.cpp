@@ -0,0 +1,159 @@
+/*--- Code file for feather_load ---*/
+
+/*
+    End-to-end load harness: starts a Server with its HTTP transport on the loopback,
+    then clients send keep-alive requests and time each response.
+    Reports the p50 / p99 / p999 latency and the throughput, see bench/README.md.
+
+    Options, besides the ones of bench::Options:
+        - --connections <n> : concurrent client connections, defaults to 16
+        - --requests <n>    : requests sent by each connection, defaults to 5000
+        - --threads <n>     : worker threads of the server, defaults to one per core
+        - --port <n>        : HTTP port of the server, defaults to 18080 (the WebSocket port is the next one)
+*/
+
+#include "bench.hpp"
+
+#include <feather.hpp>
+
+#include <boost/algorithm/string/find.hpp>
+#include <boost/asio.hpp>
+
+#include <thread>
+
+using namespace feather::core;
+using namespace feather::core::plug;
+using namespace feather::router;
+
+namespace
+{
+    size_t option(std::vector<std::string> const& extra, std::string const& name, size_t fallback)
+    {
+        auto const found = std::find(extra.begin(), extra.end(), name);
+        return found == extra.end() || found + 1 == extra.end() ? fallback : std::stoull(*(found + 1));
+    }
+
+    // Sends requests keep-alive requests on one connection, appending each latency in microseconds.
+    void client(uint16_t port, size_t requests, std::vector<double>& latencies)
+    {
+        using clock = std::chrono::steady_clock;
+
+        boost::asio::io_service io;
+        boost::asio::ip::tcp::socket socket(io);
+        socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+        socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+        std::string const request = "GET /load/hello HTTP/1.1\r\nHost: localhost\r\nCookie: theme=dark\r\n\r\n";
+        std::string buffer;
+        char chunk[16 * 1024];
+
+        latencies.reserve(requests);
+        for (size_t i = 0; i < requests; ++i)
+        {
+            auto const start = clock::now();
+            boost::asio::write(socket, boost::asio::buffer(request));
+
+            // Reads one response: its head, then Content-Length bytes of body.
+            std::optional<size_t> head_end;
+            size_t length = 0;
+            while (!head_end.has_value() || buffer.size() < *head_end + length)
+            {
+                boost::system::error_code ec;
+                size_t const read = socket.read_some(boost::asio::buffer(chunk), ec);
+                if (ec)
+                {
+                    throw boost::system::system_error(ec);
+                }
+                buffer.append(chunk, read);
+                if (!head_end.has_value() && (head_end = FindHeadEnd(buffer)).has_value())
+                {
+                    std::string_view const head(buffer.data(), *head_end);
+                    auto const header = boost::ifind_first(head, "\ncontent-length:");
+                    length = header.empty() ? 0 : std::strtoull(&*header.end(), nullptr, 10);
+                }
+            }
+            buffer.erase(0, *head_end + length);
+
+            latencies.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bench::Options const options = bench::Options::Parse(argc, argv);
+    size_t const connections = option(options.extra, "--connections", 16);
+    size_t const requests = option(options.extra, "--requests", 5000);
+    uint16_t const port = static_cast<uint16_t>(option(options.extra, "--port", 18080));
+
+    Router::fetch_instance()
+        CHAIN(Router::pipeline, "load",
+            (CALLBACK_PLINE
+            {
+                PLUG( Conn::fetch_cookies );
+                PLUG( Conn::fetch_query_params );
+                END_PLINE;
+            }))
+        CHAIN(Router::scope, "/load",
+            (CALLBACK_SCOPE
+            {
+                PIPE_THROUGH( "load" );
+                GET( "/hello", [](Conn const& c) { return Conn::resp(c, 200, std::string("hello, world")); } );
+                END_SCOPE;
+            }));
+
+    Server server;
+    Server::Options server_options;
+    server_options.threads = option(options.extra, "--threads", server_options.threads);
+    server_options.http_port = port;
+    server_options.http.max_requests = 0;
+    Server::start(server, "127.0.0.1", static_cast<uint16_t>(port + 1), server_options);
+
+    std::vector<std::vector<double>> latencies(connections);
+    size_t const allocations = bench::Allocations::count.load();
+    size_t const allocated = bench::Allocations::bytes.load();
+    std::vector<std::thread> clients;
+    auto const start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < connections; ++i)
+    {
+        clients.emplace_back([port, requests, &latencies, i]() { client(port, requests, latencies[i]); });
+    }
+    for (auto& thread : clients)
+    {
+        thread.join();
+    }
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t const total_allocations = bench::Allocations::count.load() - allocations;
+    size_t const total_allocated = bench::Allocations::bytes.load() - allocated;
+
+    Server::stop(server);
+    Server::join(server);
+
+    std::vector<double> all;
+    for (auto const& samples : latencies)
+    {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    nlohmann::json const extra = {
+        {"connections", connections},
+        {"requests", all.size()},
+        {"requests_per_second", static_cast<double>(all.size()) / seconds},
+        {"p50_us", bench::Percentile(all, 50)},
+        {"p99_us", bench::Percentile(all, 99)},
+        {"p999_us", bench::Percentile(all, 99.9)},
+    };
+    std::cout << extra.dump(2) << std::endl;
+
+    bench::Suite suite(options);
+    bench::Result result;
+    result.name = "http_keep_alive/" + std::to_string(connections);
+    result.iterations = all.size();
+    result.ns_per_op = 1e3 * bench::Percentile(all, 50);
+    // Client and server together, the client side is a handful of allocations per request.
+    result.allocs_per_op = static_cast<double>(total_allocations) / static_cast<double>(std::max<size_t>(1, all.size()));
+    result.bytes_per_op = static_cast<double>(total_allocated) / static_cast<double>(std::max<size_t>(1, all.size()));
+    suite.add(std::move(result), extra);
+    return suite.report();
+}
@@ -0,0 +1,273 @@
+/*--- Header file for bench ---*/
+
+#ifndef FEATHER_BENCH_HPP
+#define FEATHER_BENCH_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+/*
+    Minimal benchmark harness of feather_bench and feather_load.
+
+    Allocations are counted by replacing the global operator new,
+    so this header is included by exactly one translation unit of each executable.
+*/
+namespace bench
+{
+
+/*--- Allocations ---*/
+// Number and size of the allocations made since the start of the process.
+struct Allocations
+{
+    inline static std::atomic<size_t> count{0};
+    inline static std::atomic<size_t> bytes{0};
+};
+
+} // namespace bench
+
+void* operator new(std::size_t size)
+{
+    bench::Allocations::count.fetch_add(1, std::memory_order_relaxed);
+    bench::Allocations::bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace bench
+{
+
+/*--- DoNotOptimize ---*/
+// Keeps the compiler from eliding the computation of value.
+template <typename T>
+inline void DoNotOptimize(T const& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/*--- Options ---*/
+/*
+    Command line of the benchmark executables.
+
+    - --filter <text>       : only runs the benchmarks whose name contains text
+    - --min-time <ms>       : minimum duration of each measured batch, defaults to 200 ms
+    - --json <path>         : writes the results as JSON to path
+    - --baseline <path>     : compares the results to a previous JSON report
+    - --tolerance <percent> : slowdown allowed against the baseline, defaults to 10
+*/
+struct Options
+{
+    std::string                 filter;
+    std::chrono::milliseconds   min_time{200};
+    std::optional<std::string>  json;
+    std::optional<std::string>  baseline;
+    double                      tolerance = 10.0;
+    std::vector<std::string>    extra;
+
+    static Options Parse(int argc, char** argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string const arg = argv[i];
+            bool const has_value = i + 1 < argc;
+            if (arg == "--filter" && has_value)          options.filter = argv[++i];
+            else if (arg == "--min-time" && has_value)   options.min_time = std::chrono::milliseconds(std::stoll(argv[++i]));
+            else if (arg == "--json" && has_value)       options.json = argv[++i];
+            else if (arg == "--baseline" && has_value)   options.baseline = argv[++i];
+            else if (arg == "--tolerance" && has_value)  options.tolerance = std::stod(argv[++i]);
+            else                                         options.extra.push_back(arg);
+        }
+        return options;
+    }
+};
+
+/*--- Result ---*/
+// Measure of one benchmark, per operation.
+struct Result
+{
+    std::string     name;
+    size_t          iterations = 0;
+    double          ns_per_op = 0;
+    double          allocs_per_op = 0;
+    double          bytes_per_op = 0;
+};
+
+/*--- Suite ---*/
+/*
+    Runs benchmarks and reports them.
+
+    Usage:
+
+    bench::Suite suite(bench::Options::Parse(argc, argv));
+    suite.run("parse_request", [&]() { bench::DoNotOptimize(Server::parse_request(raw)); });
+    return suite.report();
+*/
+class Suite
+{
+    public:
+        explicit Suite(Options o) : options(std::move(o)) {}
+
+        /*- run -*/
+        /*
+            Measures op: the iteration count doubles until a batch lasts options.min_time,
+            then the fastest of five batches is kept, with the allocations of the last one.
+        */
+        template <typename Op>
+        void run(std::string const& name, Op&& op)
+        {
+            if (!options.filter.empty() && name.find(options.filter) == std::string::npos)
+            {
+                return;
+            }
+
+            using clock = std::chrono::steady_clock;
+            auto const batch = [&op](size_t iterations)
+            {
+                auto const start = clock::now();
+                for (size_t i = 0; i < iterations; ++i)
+                {
+                    op();
+                }
+                return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+            };
+
+            size_t iterations = 1;
+            batch(iterations);
+            while (batch(iterations) < std::chrono::duration<double, std::nano>(options.min_time).count()
+                   && iterations < (size_t(1) << 40))
+            {
+                iterations *= 2;
+            }
+
+            double best = std::numeric_limits<double>::max();
+            size_t const count = Allocations::count.load();
+            size_t const bytes = Allocations::bytes.load();
+            for (int i = 0; i < 5; ++i)
+            {
+                best = std::min(best, batch(iterations));
+            }
+
+            Result result;
+            result.name = name;
+            result.iterations = iterations;
+            result.ns_per_op = best / iterations;
+            result.allocs_per_op = double(Allocations::count.load() - count) / (5.0 * iterations);
+            result.bytes_per_op = double(Allocations::bytes.load() - bytes) / (5.0 * iterations);
+            add(std::move(result));
+        }
+
+        /*- add -*/
+        // Records a result measured outside of run, such as the ones of the load harness.
+        void add(Result result, nlohmann::json extra = nlohmann::json::object())
+        {
+            std::cout << std::left << std::setw(40) << result.name
+                      << std::right << std::setw(14) << std::fixed << std::setprecision(1) << result.ns_per_op << " ns/op"
+                      << std::setw(10) << std::setprecision(2) << result.allocs_per_op << " allocs/op"
+                      << std::setw(12) << std::setprecision(0) << result.bytes_per_op << " B/op" << std::endl;
+            results.push_back(std::move(result));
+            extras.push_back(std::move(extra));
+        }
+
+        /*- report -*/
+        /*
+            Writes the JSON report and compares the results to the baseline.
+            Returns the exit code of the executable: 1 when a benchmark regressed.
+        */
+        int report() const
+        {
+            nlohmann::json json = { {"benchmarks", nlohmann::json::array()} };
+            for (size_t i = 0; i < results.size(); ++i)
+            {
+                nlohmann::json entry = extras[i];
+                entry["name"] = results[i].name;
+                entry["iterations"] = results[i].iterations;
+                entry["ns_per_op"] = results[i].ns_per_op;
+                entry["allocs_per_op"] = results[i].allocs_per_op;
+                entry["bytes_per_op"] = results[i].bytes_per_op;
+                json["benchmarks"].push_back(std::move(entry));
+            }
+            if (options.json.has_value())
+            {
+                std::ofstream(*options.json) << json.dump(2) << std::endl;
+            }
+            return options.baseline.has_value() ? compare(*options.baseline) : 0;
+        }
+
+    private:
+        Options                         options;
+        std::vector<Result>             results;
+        std::vector<nlohmann::json>     extras;
+
+        // A benchmark regresses when it is slower than the tolerance allows, or allocates more.
+        int compare(std::string const& path) const
+        {
+            std::ifstream file(path);
+            nlohmann::json const baseline = nlohmann::json::parse(file, nullptr, false);
+            if (baseline.is_discarded() || !baseline.contains("benchmarks"))
+            {
+                std::cerr << "Unreadable baseline: " << path << std::endl;
+                return 1;
+            }
+
+            int status = 0;
+            for (auto const& previous : baseline["benchmarks"])
+            {
+                auto const current = std::find_if(results.begin(), results.end(),
+                    [&previous](Result const& r) { return r.name == previous.value("name", ""); });
+                if (current == results.end())
+                {
+                    continue;
+                }
+                double const slower = 100.0 * (current->ns_per_op / previous.value("ns_per_op", current->ns_per_op) - 1.0);
+                bool const allocates = current->allocs_per_op > previous.value("allocs_per_op", current->allocs_per_op) + 0.01;
+                if (slower > options.tolerance || allocates)
+                {
+                    std::cerr << "Regression: " << current->name << " is " << std::setprecision(1) << slower
+                              << "% slower, " << current->allocs_per_op << " allocs/op" << std::endl;
+                    status = 1;
+                }
+            }
+            return status;
+        }
+};
+
+/*--- Percentile ---*/
+// Returns the p-th percentile of sorted samples.
+inline double Percentile(std::vector<double> const& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t const rank = static_cast<size_t>(p / 100.0 * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+} // namespace bench
+
+#endif
@@ -6,6 +6,21 @@
 #define FEATHER_H
 
 #include <feather/core.hpp>
+#include <feather/scan.hpp>
+#include <feather/slots.hpp>
+#include <feather/async.hpp>
+#include <feather/metrics.hpp>
+#include <feather/log.hpp>
+#include <feather/parsers.hpp>
+#include <feather/channel.hpp>
+#include <feather/http.hpp>
+#include <feather/tls.hpp>
+#include <feather/compress.hpp>
+#include <feather/cache.hpp>
+#include <feather/json.hpp>
+#include <feather/published.hpp>
+#include <feather/session.hpp>
+#include <feather/arena.hpp>
 #include <feather/server.hpp>
 #include <feather/controller.hpp>
 #include <feather/router.hpp>
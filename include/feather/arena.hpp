@@ -0,0 +1,156 @@
+/*--- Header file for arena ---*/
+
+#ifndef FEATHER_ARENA_HPP
+#define FEATHER_ARENA_HPP
+
+#include <immer/memory_policy.hpp>
+#include <immer/heap/heap_policy.hpp>
+#include <immer/refcount/unsafe_refcount_policy.hpp>
+#include <immer/lock/no_lock_policy.hpp>
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+namespace feather::core
+{
+
+/*--- RequestArena ---*/
+/*
+    Monotonic memory arena owning the scratch memory of a single request.
+
+    Deallocation is a no-op: everything allocated from the arena is released at once
+    when the arena is destroyed (or released), once the response has been sent.
+    The first kilobytes are served from a buffer inside the arena itself,
+    so a request that stays under that size does not touch the global heap at all.
+
+    An arena is made current for the thread with a RequestArena::Scope.
+    Code that needs scratch memory asks for RequestArena::resource(),
+    which falls back on the default memory resource outside of a request.
+
+    Only memory that does not outlive the request should be allocated here.
+    Values stored in a Conn can escape the request (into the Session, a before_send callback,
+    a channel...), so the Conn itself keeps using the global heap.
+*/
+class RequestArena
+{
+    public:
+        static constexpr size_t initial_size = 4096;
+
+        /*- Scope -*/
+        /*
+            Makes an arena current for the calling thread until the end of the scope.
+            Scopes can be nested, the previous arena is restored on destruction.
+        */
+        class Scope
+        {
+            private:
+                RequestArena* previous;
+            public:
+                explicit Scope(RequestArena& arena) : previous(current)
+                {
+                    current = &arena;
+                }
+                ~Scope()
+                {
+                    current = previous;
+                }
+                Scope(Scope const&)             = delete;
+                Scope& operator=(Scope const&)  = delete;
+        };
+
+    private:
+        alignas(std::max_align_t) std::array<std::byte, initial_size> buffer;
+        std::pmr::monotonic_buffer_resource                            monotonic;
+
+        static inline thread_local RequestArena* current = nullptr;
+
+    public:
+        RequestArena() : monotonic(buffer.data(), buffer.size(), std::pmr::new_delete_resource()) {}
+        RequestArena(RequestArena const&)               = delete;
+        RequestArena& operator=(RequestArena const&)    = delete;
+        ~RequestArena()                                 = default;
+
+        /*- get -*/
+        // Returns the memory resource of this arena.
+        std::pmr::memory_resource* get()
+        {
+            return &this->monotonic;
+        }
+
+        /*- release -*/
+        /*
+            Releases every allocation made from the arena.
+            Allocations made from the inline buffer are reused afterwards.
+        */
+        void release()
+        {
+            this->monotonic.release();
+        }
+
+        /*- resource -*/
+        /*
+            Returns the memory resource of the current arena of the thread,
+            or the default memory resource if no arena is current.
+        */
+        static std::pmr::memory_resource* resource()
+        {
+            return current != nullptr ? current->get() : std::pmr::get_default_resource();
+        }
+
+        /*- active -*/
+        // Returns true if an arena is current for the calling thread.
+        static bool active()
+        {
+            return current != nullptr;
+        }
+};
+
+/*--- arena_heap ---*/
+/*
+    Heap for immer's memory policy that allocates from the current RequestArena.
+
+    Each block remembers the resource it came from,
+    so a container built inside a request can still be freed after the Scope has ended
+    as long as the arena itself is alive.
+    Containers using this heap must never outlive the arena they were built in.
+*/
+struct arena_heap
+{
+    private:
+        static constexpr size_t header = alignof(std::max_align_t);
+    public:
+        template <typename... Tags>
+        static void* allocate(size_t size, Tags...)
+        {
+            std::pmr::memory_resource* resource = RequestArena::resource();
+            void* block = resource->allocate(size + header, alignof(std::max_align_t));
+            *static_cast<std::pmr::memory_resource**>(block) = resource;
+            return static_cast<std::byte*>(block) + header;
+        }
+
+        template <typename... Tags>
+        static void deallocate(size_t size, void* data, Tags...)
+        {
+            void* block = static_cast<std::byte*>(data) - header;
+            auto* resource = *static_cast<std::pmr::memory_resource**>(block);
+            resource->deallocate(block, size + header, alignof(std::max_align_t));
+        }
+};
+
+/*--- arena_memory_policy ---*/
+/*
+    Memory policy for immer containers local to a request, e.g.
+        immer::vector<int, arena_memory_policy>
+    Reference counting is kept unsafe (single threaded) since a request runs on one thread.
+*/
+using arena_memory_policy = immer::memory_policy<
+    immer::heap_policy<arena_heap>,
+    immer::unsafe_refcount_policy,
+    immer::no_lock_policy
+>;
+
+} // namespace feather::core
+
+#endif
@@ -0,0 +1,175 @@
+/*--- Header file for async ---*/
+
+#ifndef FEATHER_ASYNC_HPP
+#define FEATHER_ASYNC_HPP
+
+#include <feather/core.hpp>
+
+// Boost 1.74 uses std::exchange in awaitable.hpp without including <utility>.
+#include <utility>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+
+/*
+    C++20 coroutines for the plugs and the route handlers that wait for I/O.
+
+    A coroutine returns a Task, awaits the asynchronous operations below with co_await
+    and gives the io threads back to the other requests meanwhile.
+    The router and the transports resume it on the executor of its connection,
+    so a slow database or upstream service only delays the requests awaiting it.
+
+    Coroutines should take their arguments by value: a reference does not outlive the first suspension.
+
+    Usage:
+
+    Task<Conn> load_user(Conn conn)
+    {
+        auto socket = co_await AsyncConnect("users.internal", "8080");
+        ...
+        co_return Conn::assign(std::move(conn), "user", user);
+    }
+
+    PLUG( load_user );
+    GET( "/profile", [](Conn conn) -> Task<Conn> { co_return Conn::resp(std::move(conn), 200, std::string("ok")); } );
+*/
+namespace feather::core
+{
+
+/*--- Task ---*/
+// Result of a coroutine run by the asio executor of a connection.
+template <typename T>
+using Task = boost::asio::awaitable<T>;
+
+/*--- MaybeAsync ---*/
+// Either the value computed synchronously, or the task computing it.
+template <typename T>
+using MaybeAsync = std::variant<T, Task<T>>;
+
+/*--- AsyncPlug ---*/
+// Plug returning a task, e.g. a coroutine loading the user from a database.
+using AsyncPlug = std::function<Task<plug::Conn>(plug::Conn, plug::PlugOptions)>;
+
+/*--- RunSync ---*/
+/*
+    Runs a task to completion on a private io_context and returns its result.
+    Blocks the calling thread: only used where a synchronous Conn is expected, such as Router::handler.
+    Rethrows the exception the task ended with.
+*/
+template <typename T>
+T RunSync(Task<T> task)
+{
+    boost::asio::io_context io;
+    std::optional<T> result;
+    std::exception_ptr error;
+    boost::asio::co_spawn(io,
+        [&result, task = std::move(task)]() mutable -> Task<void> { result.emplace(co_await std::move(task)); },
+        [&error](std::exception_ptr e) { error = e; });
+    io.run();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    return std::move(*result);
+}
+
+/*--- AsyncStep ---*/
+/*
+    An AsyncPlug stored where a synchronous Plug is expected, in a pipeline.
+    The router finds it back with Plug::target<AsyncStep>() and awaits it,
+    a plain call runs it with RunSync.
+*/
+struct AsyncStep
+{
+    AsyncPlug   plug;
+
+    plug::Conn operator()(plug::Conn conn, plug::PlugOptions opts) const
+    {
+        return RunSync(plug(std::move(conn), std::move(opts)));
+    }
+};
+
+/*--- AsAsyncStep ---*/
+// Returns the asynchronous plug stored in a Plug, or nullptr for a synchronous one.
+inline AsyncStep const* AsAsyncStep(plug::Plug const& p)
+{
+    return p.target<AsyncStep>();
+}
+
+/*--- AsyncSleep ---*/
+// Suspends the coroutine for a duration without holding its thread.
+inline Task<void> AsyncSleep(std::chrono::steady_clock::duration duration)
+{
+    boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor, duration);
+    co_await timer.async_wait(boost::asio::use_awaitable);
+}
+
+/*--- AsyncConnect ---*/
+// Resolves host and connects to the first of its addresses that accepts, on the executor of the coroutine.
+inline Task<boost::asio::ip::tcp::socket> AsyncConnect(std::string host, std::string service)
+{
+    auto const executor = co_await boost::asio::this_coro::executor;
+    boost::asio::ip::tcp::resolver resolver(executor);
+    auto const endpoints = co_await resolver.async_resolve(host, service, boost::asio::use_awaitable);
+
+    boost::asio::ip::tcp::socket socket(executor);
+    co_await boost::asio::async_connect(socket, endpoints, boost::asio::use_awaitable);
+    socket.set_option(boost::asio::ip::tcp::no_delay(true));
+    co_return socket;
+}
+
+/*--- AsyncWrite ---*/
+// Writes the whole of data to the socket. The data must stay alive until the task completes.
+inline Task<size_t> AsyncWrite(boost::asio::ip::tcp::socket& socket, std::string_view data)
+{
+    co_return co_await boost::asio::async_write(socket, boost::asio::buffer(data.data(), data.size()), boost::asio::use_awaitable);
+}
+
+/*--- AsyncRead ---*/
+// Reads what the socket has available, up to max_size bytes, appending it to out. Returns the number of bytes read.
+inline Task<size_t> AsyncRead(boost::asio::ip::tcp::socket& socket, std::string& out, size_t max_size = 16 * 1024)
+{
+    size_t const size = out.size();
+    out.resize(size + max_size);
+    boost::system::error_code ec;
+    size_t const read = co_await socket.async_read_some(boost::asio::buffer(out.data() + size, max_size),
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    out.resize(size + read);
+    if (ec && ec != boost::asio::error::eof)
+    {
+        throw boost::system::system_error(ec);
+    }
+    co_return read;
+}
+
+/*--- AsyncReadUntil ---*/
+/*
+    Reads until out holds delimiter, e.g. the end of a response head.
+    Returns the size of out up to and including the delimiter, the bytes read past it stay in out.
+*/
+inline Task<size_t> AsyncReadUntil(boost::asio::ip::tcp::socket& socket, std::string& out, std::string_view delimiter)
+{
+    co_return co_await boost::asio::async_read_until(socket, boost::asio::dynamic_buffer(out),
+        std::string(delimiter), boost::asio::use_awaitable);
+}
+
+} // namespace feather::core
+
+#endif
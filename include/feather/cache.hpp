@@ -0,0 +1,544 @@
+/*--- Header file for cache ---*/
+
+#ifndef FEATHER_CACHE_HPP
+#define FEATHER_CACHE_HPP
+
+#include <feather/core.hpp>
+#include <feather/compress.hpp>
+#include <feather/metrics.hpp>
+
+#include <algorithm>
+#include <any>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+    Response cache of feather: a plug answering the pages already rendered from memory,
+    before the rest of the pipeline, the route handler and the templates run again.
+
+    A response is stored with its persistent headers and its body shared,
+    so a hit costs a single hash lookup and the write of the response.
+    The headers are put back in resp_headers, where the before_send callbacks and the header API find them.
+*/
+namespace feather::core
+{
+
+/*--- CachedVariant ---*/
+// One representation of a cached response: its headers, its body and its entity tag.
+struct CachedVariant
+{
+    Encoding            encoding;
+    ImmutHeaders        headers;
+    SharedString        body;
+    std::string         etag;
+};
+
+/*--- CachedResponse ---*/
+/*
+    A stored response. The identity variant comes first,
+    the compressed ones follow when the cache compresses its responses.
+*/
+struct CachedResponse
+{
+    uint32_t                                status;
+    std::vector<CachedVariant>              variants;
+    immer::vector<HeaderBlockPtr>           header_blocks;
+    std::chrono::steady_clock::time_point   expires;
+};
+
+using CachedResponsePtr = std::shared_ptr<CachedResponse const>;
+
+/*--- ResponseCache ---*/
+/*
+    Cache of the responses stored by the cache_response plug.
+
+    Responses expire after their lifetime and are removed when next looked up,
+    the least recently used ones are evicted once the cache holds capacity bytes.
+*/
+class ResponseCache
+{
+    private:
+        struct Entry
+        {
+            std::string         key;
+            CachedResponsePtr   response;
+            size_t              weight;
+        };
+
+        std::mutex                                                  lock;
+        std::list<Entry>                                            lru;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t                                                      bytes = 0;
+        size_t                                                      capacity;
+
+        static size_t weight(std::string const& key, CachedResponse const& response)
+        {
+            size_t total = key.size() + sizeof(CachedResponse);
+            for (auto const& variant : response.variants)
+            {
+                for (auto const& [name, value] : variant.headers)
+                {
+                    total += name.size() + value.size();
+                }
+                total += variant.body->size() + variant.etag.size();
+            }
+            for (auto const& block : response.header_blocks)
+            {
+                total += block->wire.size();
+            }
+            return total;
+        }
+
+        void remove(std::unordered_map<std::string, std::list<Entry>::iterator>::iterator found)
+        {
+            bytes -= found->second->weight;
+            lru.erase(found->second);
+            index.erase(found);
+        }
+    public:
+        explicit ResponseCache(size_t capacity_bytes = 64 << 20) : capacity(capacity_bytes) {}
+
+        /*- global -*/
+        // Cache used by default by the cache_response plug.
+        static std::shared_ptr<ResponseCache> const& global()
+        {
+            static std::shared_ptr<ResponseCache> const cache = std::make_shared<ResponseCache>();
+            return cache;
+        }
+
+        /*- find -*/
+        // Returns the response stored under key, or nullptr if there is none or it expired.
+        CachedResponsePtr find(std::string const& key, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto const found = index.find(key);
+            if (found == index.end())
+            {
+                return nullptr;
+            }
+            if (found->second->response->expires <= now)
+            {
+                remove(found);
+                return nullptr;
+            }
+            lru.splice(lru.begin(), lru, found->second);
+            return found->second->response;
+        }
+
+        /*- insert -*/
+        // Stores a response, replacing the previous one under the same key.
+        void insert(std::string key, CachedResponsePtr response)
+        {
+            size_t const size = weight(key, *response);
+            std::lock_guard<std::mutex> guard(lock);
+            if (auto const found = index.find(key); found != index.end())
+            {
+                remove(found);
+            }
+            lru.push_front({std::move(key), std::move(response), size});
+            index.emplace(lru.front().key, lru.begin());
+            bytes += size;
+
+            while (bytes > capacity && !lru.empty())
+            {
+                bytes -= lru.back().weight;
+                index.erase(lru.back().key);
+                lru.pop_back();
+            }
+        }
+
+        /*- erase -*/
+        // Removes the response stored under key, e.g. once the page it renders changed.
+        void erase(std::string const& key)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (auto const found = index.find(key); found != index.end())
+            {
+                remove(found);
+            }
+        }
+
+        /*- clear -*/
+        void clear()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            lru.clear();
+            index.clear();
+            bytes = 0;
+        }
+
+        /*- size -*/
+        // Returns the number of bytes held.
+        size_t size()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return bytes;
+        }
+
+        /*- count -*/
+        // Returns the number of responses held.
+        size_t count()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return index.size();
+        }
+};
+
+/*--- CacheOptions ---*/
+/*
+    - ttl       : lifetime of a response without max-age or s-maxage in its Cache-Control
+    - vary      : request headers the responses depend on, part of the key.
+                  A response whose Vary names any other header is not stored
+    - assigns   : assigns the responses depend on, part of the key, e.g. the locale.
+                  They must be strings, integers or booleans, the request is not cached otherwise
+    - max_size  : bodies larger than this are not stored
+    - compress  : when set, each response is also stored compressed with the encodings of these options,
+                  and the variant accepted by the client is sent
+    - cache     : where the responses are stored
+*/
+struct CacheOptions
+{
+    std::chrono::seconds                ttl         = std::chrono::seconds(60);
+    std::vector<std::string>            vary;
+    std::vector<std::string>            assigns;
+    size_t                              max_size    = 1 << 20;
+    std::optional<CompressOptions>      compress;
+    std::shared_ptr<ResponseCache>      cache       = ResponseCache::global();
+};
+
+namespace cache_detail
+{
+    // Value of an assign in a cache key, nullopt for a type that has no stable text form.
+    inline std::optional<std::string> AssignKey(std::any const& value)
+    {
+        if (auto const* text = std::any_cast<std::string>(&value))  return *text;
+        if (auto const* text = std::any_cast<char const*>(&value))  return std::string(*text);
+        if (auto const* flag = std::any_cast<bool>(&value))         return std::string(*flag ? "true" : "false");
+        if (auto const* number = std::any_cast<int>(&value))        return std::to_string(*number);
+        if (auto const* number = std::any_cast<int64_t>(&value))    return std::to_string(*number);
+        if (auto const* number = std::any_cast<uint64_t>(&value))   return std::to_string(*number);
+        return std::nullopt;
+    }
+
+    /*
+        Key of a request: its method, its target with the query string, its lowercased Host
+        so that virtual hosts never share a page, then the values of the selected request headers and assigns.
+        Returns nullopt if an assign cannot be part of a key.
+    */
+    inline std::optional<std::string> Key(plug::Conn const& conn, CacheOptions const& options)
+    {
+        std::string key = *conn.method;
+        key.append(" ").append(*conn.request_url).append("\nhost:");
+        std::transform(conn.host->begin(), conn.host->end(), std::back_inserter(key),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        for (auto const& name : options.vary)
+        {
+            key.append("\n").append(name).append(":");
+            auto const [first, last] = conn.req_headers.equal_range(name);
+            for (auto it = first; it != last; ++it)
+            {
+                key.append(it == first ? "" : ",").append(it->second);
+            }
+        }
+        for (auto const& name : options.assigns)
+        {
+            key.append("\n").append(name);
+            if (auto const found = conn.assigns.find(name))
+            {
+                auto const value = AssignKey(*found);
+                if (!value.has_value())
+                {
+                    return std::nullopt;
+                }
+                key.append("=").append(*value);
+            }
+        }
+        return key;
+    }
+
+    // Strong entity tag of a body: its size and its 64-bit FNV-1a hash.
+    inline std::string StrongETag(std::string_view body)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char const c : body)
+        {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        auto const hex = [](auto value)
+        {
+            char buffer[2 * sizeof(value)];
+            return std::string(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value, 16).ptr);
+        };
+        return "\"" + hex(body.size()) + "-" + hex(hash) + "\"";
+    }
+
+    // Value in seconds of a directive of Cache-Control, e.g. max-age=3600.
+    inline std::optional<long> Directive(std::string_view control, std::string_view name)
+    {
+        auto const found = boost::ifind_first(control, name);
+        size_t const end = static_cast<size_t>(found.end() - control.begin());
+        if (found.empty() || end >= control.size() || control[end] != '=')
+        {
+            return std::nullopt;
+        }
+        long seconds = 0;
+        if (std::from_chars(control.data() + end + 1, control.data() + control.size(), seconds).ec != std::errc())
+        {
+            return std::nullopt;
+        }
+        return seconds;
+    }
+
+    /*
+        Lifetime of a response in a shared cache, nullopt if it must not be stored:
+        a Cache-Control with no-store, private or no-cache, a Set-Cookie,
+        a Vary on a header outside of the key, or a request with credentials the response is not public for.
+    */
+    inline std::optional<std::chrono::seconds> Lifetime(plug::Conn const& conn, CacheOptions const& options)
+    {
+        using compress_detail::RespHeader;
+
+        if (!conn.resp_cookies.empty())
+        {
+            return std::nullopt;
+        }
+
+        auto const control = RespHeader(conn, "cache-control");
+        std::string_view const directives = control == nullptr ? std::string_view() : std::string_view(*control);
+        if (!boost::ifind_first(directives, "no-store").empty()
+            || !boost::ifind_first(directives, "private").empty()
+            || !boost::ifind_first(directives, "no-cache").empty())
+        {
+            return std::nullopt;
+        }
+        if (conn.req_headers.find("authorization") != conn.req_headers.end()
+            && boost::ifind_first(directives, "public").empty()
+            && boost::ifind_first(directives, "s-maxage").empty())
+        {
+            return std::nullopt;
+        }
+
+        if (auto const vary = RespHeader(conn, "vary"))
+        {
+            std::string_view rest = *vary;
+            while (!rest.empty())
+            {
+                size_t const comma = rest.find(',');
+                std::string_view const name = TrimSpaces(rest.substr(0, comma));
+                rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+                if (!name.empty() && std::none_of(options.vary.begin(), options.vary.end(),
+                    [name](std::string const& header) { return boost::iequals(header, name); }))
+                {
+                    return std::nullopt;
+                }
+            }
+        }
+
+        std::optional<long> const seconds = Directive(directives, "s-maxage").has_value()
+            ? Directive(directives, "s-maxage")
+            : Directive(directives, "max-age");
+        if (!seconds.has_value())
+        {
+            return options.ttl;
+        }
+        if (*seconds <= 0)
+        {
+            return std::nullopt;
+        }
+        return std::chrono::seconds(*seconds);
+    }
+
+    // Builds the stored form of a response, compressed with each encoding the options offer.
+    inline CachedResponsePtr Build(plug::Conn const& conn, std::chrono::seconds lifetime, CacheOptions const& options)
+    {
+        using compress_detail::RespHeader;
+
+        auto response = std::make_shared<CachedResponse>();
+        response->status = static_cast<uint32_t>(conn.status.value_or(200));
+        response->header_blocks = conn.resp_header_blocks;
+        response->expires = std::chrono::steady_clock::now() + lifetime;
+        response->variants.push_back({Encoding::IDENTITY, {}, conn.resp_body, *RespHeader(conn, "etag")});
+
+        // The identity variant varies on Accept-Encoding as well once it has compressed siblings.
+        ImmutHeaders identity = conn.resp_headers;
+        auto const type = RespHeader(conn, "content-type");
+        if (!options.compress.has_value() || type == nullptr || !Compressible(*type)
+            || RespHeader(conn, "content-encoding") != nullptr || conn.resp_body->size() < options.compress->min_size)
+        {
+            response->variants.front().headers = identity;
+            return response;
+        }
+        for (Encoding const encoding : options.compress->preference)
+        {
+            if (!EncodingAvailable(encoding))
+            {
+                continue;
+            }
+            SharedString compressed = Compress(encoding, *conn.resp_body, *options.compress);
+            if (compressed == nullptr || compressed->size() >= conn.resp_body->size())
+            {
+                continue;
+            }
+            ImmutHeaders const headers = compress_detail::EncodedHeaders(conn.resp_headers, encoding);
+            response->variants.push_back({encoding, headers, std::move(compressed), headers.find("etag")->second});
+            identity = identity.set("vary", headers.find("vary")->second);
+        }
+        response->variants.front().headers = identity;
+        return response;
+    }
+
+    // Variant accepted by the client, the identity one unless the request accepts a stored encoding.
+    inline CachedVariant const& Negotiate(plug::Conn const& conn, CachedResponse const& response, CacheOptions const& options)
+    {
+        auto const accept = conn.req_headers.find("accept-encoding");
+        if (response.variants.size() == 1 || accept == conn.req_headers.end() || !options.compress.has_value())
+        {
+            return response.variants.front();
+        }
+        Encoding const encoding = NegotiateEncoding(accept->second, *options.compress);
+        for (auto const& variant : response.variants)
+        {
+            if (variant.encoding == encoding)
+            {
+                return variant;
+            }
+        }
+        return response.variants.front();
+    }
+
+    // Returns true if the request holds the entity tag of the variant in If-None-Match.
+    inline bool NotModified(plug::Conn const& conn, std::string_view etag)
+    {
+        auto const inm = conn.req_headers.find("if-none-match");
+        return inm != conn.req_headers.end()
+            && MatchETag(inm->second, etag.starts_with("W/") ? etag.substr(2) : etag);
+    }
+
+    // Sets the response to a stored one: 304 with no body when the client holds it already.
+    inline plug::Conn Apply(plug::Conn&& conn, CachedResponse const& response, CacheOptions const& options)
+    {
+        CachedVariant const& variant = Negotiate(conn, response, options);
+        bool const not_modified = NotModified(conn, variant.etag);
+
+        plug::Conn new_conn(std::move(conn));
+        new_conn.resp_headers = variant.headers;
+        new_conn.resp_header_blocks = response.header_blocks;
+        return not_modified
+            ? plug::Conn::resp(std::move(new_conn), 304, std::string())
+            : plug::Conn::resp(std::move(new_conn), response.status, variant.body);
+    }
+
+    /*
+        Before send callback of the plug, on a miss.
+        A full 200 response gets a strong ETag if it has none,
+        a GET response that may be shared is stored under key,
+        and the client is answered 304 when it already holds the response.
+    */
+    inline plug::Conn StoreResponse(plug::Conn const& conn, std::string const& key, CacheOptions const& options)
+    {
+        using plug::Unsent;
+
+        if (conn.status.value_or(200) != 200
+            || conn.resp_body == nullptr
+            || !std::holds_alternative<Unsent>(conn.state)
+            || std::get<Unsent>(conn.state) != Unsent::SET)
+        {
+            return conn;
+        }
+
+        plug::Conn new_conn(conn);
+        if (compress_detail::RespHeader(new_conn, "etag") == nullptr)
+        {
+            new_conn.resp_headers = new_conn.resp_headers.set("etag", StrongETag(*new_conn.resp_body));
+        }
+
+        auto const lifetime = *new_conn.method == "get" && new_conn.resp_body->size() <= options.max_size
+            ? Lifetime(new_conn, options)
+            : std::nullopt;
+        if (!lifetime.has_value())
+        {
+            if (NotModified(new_conn, *compress_detail::RespHeader(new_conn, "etag")))
+            {
+                return plug::Conn::resp(std::move(new_conn), 304, std::string());
+            }
+            return new_conn;
+        }
+
+        CachedResponsePtr const response = Build(new_conn, *lifetime, options);
+        options.cache->insert(key, response);
+        return Apply(std::move(new_conn), *response, options);
+    }
+}
+
+/*--- cache_response ---*/
+/*
+    Plug answering GET requests from the response cache.
+    HEAD is not routed by the Router, so it never reaches this plug.
+
+    On a hit the stored status, headers and body replace the response and the connection is halted:
+    the rest of the pipeline and the route handler do not run.
+    The client gets 304 with no body when If-None-Match holds the entity tag of the response.
+
+    On a miss a before_send callback gives the 200 response a strong ETag unless it has one,
+    then stores it, with its compressed variants when options.compress is set,
+    if a shared cache may: no Set-Cookie, no no-store, private or no-cache,
+    and no Vary on a header outside of options.vary.
+    Its Cache-Control s-maxage or max-age overrides options.ttl.
+
+    The key is made of the method, the target, options.vary and options.assigns:
+    anything else the page depends on, such as the session, makes it unfit for this plug.
+    Plug it ahead of the plugs that load the user, and ahead of compress.
+
+    Usage:
+
+    CacheOptions options;
+    options.vary = {"accept-language"};
+    PLUG( ([options](Conn&& c, PlugOptions) { return cache_response(std::move(c), options); }) );
+*/
+inline plug::Conn cache_response(plug::Conn&& conn, CacheOptions const& options = {})
+{
+    static Counter& hits = Metrics::instance().counter("feather_response_cache_hits_total", "Requests answered by the response cache.");
+    static Counter& misses = Metrics::instance().counter("feather_response_cache_misses_total", "Cacheable requests the response cache could not answer.");
+
+    if (*conn.method != "get" || options.cache == nullptr)
+    {
+        return std::move(conn);
+    }
+
+    auto key = cache_detail::Key(conn, options);
+    if (!key.has_value())
+    {
+        return std::move(conn);
+    }
+
+    if (CachedResponsePtr const response = options.cache->find(*key))
+    {
+        hits.add();
+        return plug::Conn::halt(cache_detail::Apply(std::move(conn), *response, options));
+    }
+
+    misses.add();
+    return plug::Conn::register_before_send(std::move(conn), [key = std::move(*key), options](plug::Conn const& c)
+    {
+        return cache_detail::StoreResponse(c, key, options);
+    });
+}
+
+inline plug::Conn const cache_response(plug::Conn const& conn, CacheOptions const& options = {})
+{
+    return cache_response(plug::Conn(conn), options);
+}
+
+} // namespace feather::core
+
+#endif
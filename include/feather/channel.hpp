@@ -0,0 +1,567 @@
+/*--- Header file for channel ---*/
+
+#ifndef FEATHER_CHANNEL_HPP
+#define FEATHER_CHANNEL_HPP
+
+#include <feather/core.hpp>
+#include <feather/json.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include <any>
+#include <array>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace feather::core
+{
+
+/*--- Frame ---*/
+/*
+    A WebSocket text frame encoded once and shared by every socket it is sent to.
+
+    Server frames are never masked, so the frame header only depends on the payload length:
+    the websocketpp message is prepared here once, and websocketpp queues the same message
+    (header and payload buffers) on every connection without copying or re-framing it.
+*/
+struct Frame
+{
+    using Message = websocketpp::server<websocketpp::config::asio>::message_ptr;
+
+    Message message;
+
+    /*- text -*/
+    // The payload of the frame.
+    std::string const& text() const
+    {
+        return message->get_payload();
+    }
+};
+
+using FramePtr = std::shared_ptr<Frame const>;
+
+/*--- MakeFrame ---*/
+// Encodes a text frame, see Frame.
+inline FramePtr MakeFrame(std::string text)
+{
+    using MessageType = websocketpp::config::asio::message_type;
+
+    std::string header;
+    header.push_back(static_cast<char>(0x80 | websocketpp::frame::opcode::text));
+    size_t const size = text.size();
+    if (size < 126)
+    {
+        header.push_back(static_cast<char>(size));
+    }
+    else
+    {
+        int const bytes = size <= 0xffff ? 2 : 8;
+        header.push_back(static_cast<char>(bytes == 2 ? 126 : 127));
+        for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8)
+        {
+            header.push_back(static_cast<char>((static_cast<uint64_t>(size) >> shift) & 0xff));
+        }
+    }
+
+    auto message = std::make_shared<MessageType>(MessageType::con_msg_man_ptr(), websocketpp::frame::opcode::text, 0);
+    message->set_header(header);
+    message->get_raw_payload() = std::move(text);
+    message->set_prepared(true);
+    return std::make_shared<Frame const>(Frame{std::move(message)});
+}
+
+/*--- ChannelMessage ---*/
+/*
+    A message of the Phoenix channel protocol (serializer v2),
+    sent on the wire as the JSON array [join_ref, ref, topic, event, payload].
+*/
+struct ChannelMessage
+{
+    std::optional<std::string>  join_ref;
+    std::optional<std::string>  ref;
+    std::string                 topic;
+    std::string                 event;
+    nlohmann::json              payload;
+};
+
+/*--- DecodeChannelMessage ---*/
+/*
+    Decodes a channel message.
+    Accepts the v2 array and the v1 object {"topic", "event", "payload", "ref"}.
+    Returns an error if the text is not a channel message.
+*/
+inline Result<ChannelMessage> DecodeChannelMessage(std::string_view text)
+{
+    ChannelMessage message;
+    nlohmann::json const json = nlohmann::json::parse(text, nullptr, false);
+
+    auto const ref = [](nlohmann::json const& value) -> std::optional<std::string>
+    {
+        if (value.is_string())
+        {
+            return value.get<std::string>();
+        }
+        if (value.is_number_integer())
+        {
+            return std::to_string(value.get<int64_t>());
+        }
+        return std::nullopt;
+    };
+
+    if (json.is_array() && json.size() == 5 && json[2].is_string() && json[3].is_string())
+    {
+        message.join_ref = ref(json[0]);
+        message.ref      = ref(json[1]);
+        message.topic    = json[2].get<std::string>();
+        message.event    = json[3].get<std::string>();
+        message.payload  = json[4];
+        return { ResultType::Ok, std::move(message) };
+    }
+    if (json.is_object() && json.contains("topic") && json["topic"].is_string()
+        && json.contains("event") && json["event"].is_string())
+    {
+        message.ref      = json.contains("ref") ? ref(json["ref"]) : std::nullopt;
+        message.topic    = json["topic"].get<std::string>();
+        message.event    = json["event"].get<std::string>();
+        message.payload  = json.value("payload", nlohmann::json::object());
+        return { ResultType::Ok, std::move(message) };
+    }
+    return { ResultType::Err, std::move(message) };
+}
+
+/*--- EncodeChannelMessage ---*/
+// Encodes a channel message as a v2 array.
+inline std::string EncodeChannelMessage(ChannelMessage const& message)
+{
+    std::string out;
+    out.push_back('[');
+    WriteJson(out, message.join_ref);
+    out.push_back(',');
+    WriteJson(out, message.ref);
+    out.push_back(',');
+    WriteJson(out, message.topic);
+    out.push_back(',');
+    WriteJson(out, message.event);
+    out.push_back(',');
+    WriteJson(out, message.payload);
+    out.push_back(']');
+    return out;
+}
+
+/*--- ChannelSocket ---*/
+/*
+    A client connected to the channels, e.g. a WebSocket connection.
+
+    The transport implements deliver, everything else is the state of the client:
+    the topics it joined, its session and the assigns of the channel handlers.
+    The messages of one socket are handled one at a time, the handlers never run concurrently for it.
+*/
+class ChannelSocket
+{
+    friend class Channels;
+
+    private:
+        std::unordered_set<std::string>                 joined;
+
+    public:
+        std::string                                     id;
+        plug::SessionPtr                                session;
+        std::unordered_map<std::string, std::any>       assigns;
+
+        explicit ChannelSocket(std::string i, plug::SessionPtr s = nullptr) : id(std::move(i)), session(std::move(s)) {}
+        virtual ~ChannelSocket() = default;
+
+        /*- deliver -*/
+        // Queues a frame on the socket. Returns false if the socket is closed.
+        virtual bool deliver(FramePtr const& frame) = 0;
+
+        /*- joined_topic -*/
+        // Whether the socket joined the topic.
+        bool joined_topic(std::string const& topic) const
+        {
+            return joined.contains(topic);
+        }
+};
+
+using ChannelSocketPtr = std::shared_ptr<ChannelSocket>;
+
+/*--- PubSub ---*/
+/*
+    Adapter carrying broadcasts between the nodes of a cluster (redis, NATS, postgres NOTIFY...).
+
+    A node publishes the encoded message of each broadcast once, whatever the number of subscribers.
+    The adapter calls the receiver registered by every other node with it,
+    never the node that published it. The receiver may be called from any thread.
+*/
+struct PubSub
+{
+    using Receiver = std::function<void(std::string const& topic, std::string const& text)>;
+
+    virtual ~PubSub() = default;
+
+    /*- publish -*/
+    virtual void publish(std::string const& topic, std::string const& text) = 0;
+
+    /*- subscribe -*/
+    // Registers the receiver of the node, called once by Channels::set_pubsub.
+    virtual void subscribe(Receiver receiver) = 0;
+};
+
+/*--- Channels ---*/
+/*
+    Phoenix-style channels: clients join topics and exchange events on them.
+
+    Channel handlers are registered by topic, either exact ("lobby") or by prefix ("room:*"),
+    before the server starts. The subscribers of each topic are kept in a sharded index,
+    as a persistent set: a broadcast copies the set of its topic in O(1) under the shard lock,
+    encodes its frame once, then hands the same frame to every subscriber outside of the lock.
+
+    Usage:
+
+    server.channels.channel("room:*", {
+        .join = [](ChannelSocket& socket, std::string const& topic, json const& payload) -> Result<json>
+        {
+            return { ResultType::Ok, json::object() };
+        },
+        .handle_in = [&](ChannelSocket& socket, std::string const& topic, std::string const& event, json const& payload)
+            -> std::optional<json>
+        {
+            server.channels.broadcast(topic, event, payload);
+            return std::nullopt;
+        }
+    });
+*/
+class Channels
+{
+    public:
+        using json = nlohmann::json;
+
+        /*- Handlers -*/
+        /*
+            - join      : accepts (Ok) or refuses (Err) a join, the json is the response of the reply
+            - handle_in : handles an event sent by a joined socket, the json returned if any is sent back as ok reply
+            - leave     : called when a socket leaves the topic or disconnects
+        */
+        struct Handlers
+        {
+            std::function<Result<json>(ChannelSocket&, std::string const& topic, json const& payload)>   join;
+            std::function<std::optional<json>(ChannelSocket&, std::string const& topic,
+                                              std::string const& event, json const& payload)>           handle_in;
+            std::function<void(ChannelSocket&, std::string const& topic)>                                leave;
+        };
+
+        static constexpr size_t shard_count = 16;
+
+    private:
+        using Subscribers = immer::set<ChannelSocketPtr>;
+
+        struct Shard
+        {
+            std::mutex                                      lock;
+            std::unordered_map<std::string, Subscribers>    topics;
+        };
+
+        std::vector<std::pair<std::string, Handlers>>       handlers;
+        std::array<Shard, shard_count>                      shards;
+        std::shared_ptr<PubSub>                             pubsub;
+
+        Shard& shard(std::string const& topic)
+        {
+            return shards[std::hash<std::string>{}(topic) % shard_count];
+        }
+
+        Handlers const* find_handlers(std::string const& topic) const
+        {
+            for (auto const& [pattern, handler] : handlers)
+            {
+                bool const prefix = !pattern.empty() && pattern.back() == '*';
+                if (prefix ? topic.starts_with(std::string_view(pattern).substr(0, pattern.size() - 1)) : topic == pattern)
+                {
+                    return &handler;
+                }
+            }
+            return nullptr;
+        }
+
+        Subscribers snapshot(std::string const& topic)
+        {
+            Shard& s = shard(topic);
+            std::lock_guard<std::mutex> lock(s.lock);
+            auto const entry = s.topics.find(topic);
+            return entry == s.topics.end() ? Subscribers() : entry->second;
+        }
+
+        void subscribe(std::string const& topic, ChannelSocketPtr const& socket)
+        {
+            Shard& s = shard(topic);
+            std::lock_guard<std::mutex> lock(s.lock);
+            auto& subscribers = s.topics[topic];
+            subscribers = subscribers.insert(socket);
+        }
+
+        void unsubscribe(std::string const& topic, ChannelSocketPtr const& socket)
+        {
+            Shard& s = shard(topic);
+            std::lock_guard<std::mutex> lock(s.lock);
+            if (auto const entry = s.topics.find(topic); entry != s.topics.end())
+            {
+                entry->second = entry->second.erase(socket);
+                if (entry->second.empty())
+                {
+                    s.topics.erase(entry);
+                }
+            }
+        }
+
+        // Hands a frame to every local subscriber of the topic but the excluded one.
+        size_t fan_out(std::string const& topic, FramePtr const& frame, ChannelSocket const* excluded = nullptr)
+        {
+            size_t delivered = 0;
+            for (auto const& subscriber : snapshot(topic))
+            {
+                if (subscriber.get() != excluded && subscriber->deliver(frame))
+                {
+                    ++delivered;
+                }
+            }
+            return delivered;
+        }
+
+        static void reply(ChannelSocket& socket, ChannelMessage const& message, bool ok, json response)
+        {
+            ChannelMessage const out{
+                message.join_ref, message.ref, message.topic, "phx_reply",
+                json{{"status", ok ? "ok" : "error"}, {"response", std::move(response)}}
+            };
+            socket.deliver(MakeFrame(EncodeChannelMessage(out)));
+        }
+
+        void leave(ChannelSocketPtr const& socket, std::string const& topic)
+        {
+            socket->joined.erase(topic);
+            unsubscribe(topic, socket);
+            if (auto const handler = find_handlers(topic); handler != nullptr && handler->leave)
+            {
+                handler->leave(*socket, topic);
+            }
+        }
+
+    public:
+        Channels() = default;
+        Channels(Channels const&)               = delete;
+        Channels& operator=(Channels const&)    = delete;
+
+        /*- channel -*/
+        // Registers the handlers of a topic or of a topic prefix ending with '*'. Not thread safe.
+        void channel(std::string pattern, Handlers channel_handlers)
+        {
+            handlers.emplace_back(std::move(pattern), std::move(channel_handlers));
+        }
+
+        /*- set_pubsub -*/
+        // Connects the channels to the other nodes of a cluster. Not thread safe.
+        void set_pubsub(std::shared_ptr<PubSub> adapter)
+        {
+            pubsub = std::move(adapter);
+            if (pubsub != nullptr)
+            {
+                pubsub->subscribe([this](std::string const& topic, std::string const& text)
+                {
+                    fan_out(topic, MakeFrame(text));
+                });
+            }
+        }
+
+        /*- handle -*/
+        /*
+            Handles a message received from a socket:
+                - "phx_join" and "phx_leave" join and leave the topic, with a reply
+                - "heartbeat" on the "phoenix" topic is answered with an ok reply
+                - any other event on a joined topic goes to handle_in
+            Malformed messages are ignored, events on topics the socket did not join get an error reply.
+        */
+        void handle(ChannelSocketPtr const& socket, std::string_view text)
+        {
+            auto const decoded = DecodeChannelMessage(text);
+            if (decoded.first == ResultType::Err)
+            {
+                return;
+            }
+            ChannelMessage const& message = decoded.second;
+
+            if (message.topic == "phoenix" && message.event == "heartbeat")
+            {
+                reply(*socket, message, true, json::object());
+                return;
+            }
+
+            Handlers const* handler = find_handlers(message.topic);
+            if (message.event == "phx_join")
+            {
+                if (handler == nullptr)
+                {
+                    reply(*socket, message, false, json{{"reason", "unmatched topic"}});
+                    return;
+                }
+                if (socket->joined_topic(message.topic))
+                {
+                    reply(*socket, message, false, json{{"reason", "already joined"}});
+                    return;
+                }
+
+                auto const joined = handler->join
+                    ? handler->join(*socket, message.topic, message.payload)
+                    : Result<json>{ ResultType::Ok, json::object() };
+                if (joined.first == ResultType::Ok)
+                {
+                    socket->joined.insert(message.topic);
+                    subscribe(message.topic, socket);
+                }
+                reply(*socket, message, joined.first == ResultType::Ok, joined.second);
+                return;
+            }
+
+            if (!socket->joined_topic(message.topic))
+            {
+                reply(*socket, message, false, json{{"reason", "unmatched topic"}});
+                return;
+            }
+
+            if (message.event == "phx_leave")
+            {
+                leave(socket, message.topic);
+                reply(*socket, message, true, json::object());
+                return;
+            }
+
+            if (handler != nullptr && handler->handle_in)
+            {
+                if (auto response = handler->handle_in(*socket, message.topic, message.event, message.payload); response.has_value())
+                {
+                    reply(*socket, message, true, std::move(*response));
+                }
+            }
+        }
+
+        /*- disconnect -*/
+        // Makes a socket leave every topic it joined, e.g. once its connection closed.
+        void disconnect(ChannelSocketPtr const& socket)
+        {
+            std::vector<std::string> const topics(socket->joined.begin(), socket->joined.end());
+            for (auto const& topic : topics)
+            {
+                leave(socket, topic);
+            }
+        }
+
+        /*- broadcast -*/
+        /*
+            Sends an event to every subscriber of the topic, on this node and through the PubSub on the others.
+            The message is encoded once into a single frame shared by all the subscribers.
+            Returns the number of local subscribers the frame was queued on.
+        */
+        size_t broadcast(std::string const& topic, std::string const& event, json const& payload)
+        {
+            std::string text = EncodeChannelMessage({std::nullopt, std::nullopt, topic, event, payload});
+            if (pubsub != nullptr)
+            {
+                pubsub->publish(topic, text);
+            }
+            return fan_out(topic, MakeFrame(std::move(text)));
+        }
+
+        /*- broadcast_from -*/
+        // Like broadcast, but the local frame is not sent to the sender.
+        size_t broadcast_from(ChannelSocket const& sender, std::string const& topic, std::string const& event, json const& payload)
+        {
+            std::string text = EncodeChannelMessage({std::nullopt, std::nullopt, topic, event, payload});
+            if (pubsub != nullptr)
+            {
+                pubsub->publish(topic, text);
+            }
+            return fan_out(topic, MakeFrame(std::move(text)), &sender);
+        }
+
+        /*- push -*/
+        // Sends an event to a single socket.
+        static bool push(ChannelSocket& socket, std::string const& topic, std::string const& event, json const& payload)
+        {
+            return socket.deliver(MakeFrame(EncodeChannelMessage({std::nullopt, std::nullopt, topic, event, payload})));
+        }
+
+        /*- subscribers -*/
+        // Returns the number of local subscribers of the topic.
+        size_t subscribers(std::string const& topic)
+        {
+            return snapshot(topic).size();
+        }
+};
+
+/*--- MemoryPubSub ---*/
+/*
+    In-process PubSub connecting several Channels, e.g. one per worker process under test.
+    Every node subscribes to the same MemoryPubSub through its own Node.
+*/
+class MemoryPubSub
+{
+    private:
+        std::mutex                      lock;
+        std::vector<PubSub::Receiver>   receivers;
+
+    public:
+        /*- Node -*/
+        // The PubSub of one node of the hub.
+        class Node : public PubSub
+        {
+            private:
+                std::shared_ptr<MemoryPubSub>   hub;
+                std::optional<size_t>           index;
+
+            public:
+                explicit Node(std::shared_ptr<MemoryPubSub> h) : hub(std::move(h)) {}
+
+                void publish(std::string const& topic, std::string const& text) override
+                {
+                    std::vector<PubSub::Receiver> others;
+                    {
+                        std::lock_guard<std::mutex> guard(hub->lock);
+                        for (size_t i = 0; i < hub->receivers.size(); ++i)
+                        {
+                            if (i != index)
+                            {
+                                others.push_back(hub->receivers[i]);
+                            }
+                        }
+                    }
+                    for (auto const& receiver : others)
+                    {
+                        receiver(topic, text);
+                    }
+                }
+
+                void subscribe(PubSub::Receiver receiver) override
+                {
+                    std::lock_guard<std::mutex> guard(hub->lock);
+                    index = hub->receivers.size();
+                    hub->receivers.push_back(std::move(receiver));
+                }
+        };
+
+        /*- node -*/
+        // Creates the PubSub of a new node.
+        static std::shared_ptr<PubSub> node(std::shared_ptr<MemoryPubSub> const& hub)
+        {
+            return std::make_shared<Node>(hub);
+        }
+};
+
+} // namespace feather::core
+
+#endif
@@ -0,0 +1,769 @@
+/*--- Header file for compress ---*/
+
+#ifndef FEATHER_COMPRESS_HPP
+#define FEATHER_COMPRESS_HPP
+
+#include <feather/core.hpp>
+
+#include <zlib.h>
+#ifdef FEATHER_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef FEATHER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <array>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace feather::core
+{
+
+/*--- Encoding ---*/
+// Content codings a response can be compressed with.
+enum struct Encoding
+{
+    IDENTITY,
+    GZIP,
+    BROTLI,
+    ZSTD,
+};
+
+/*--- EncodingName ---*/
+// Returns the Content-Encoding token of an encoding.
+inline std::string_view EncodingName(Encoding encoding)
+{
+    switch (encoding)
+    {
+        case Encoding::GZIP:    return "gzip";
+        case Encoding::BROTLI:  return "br";
+        case Encoding::ZSTD:    return "zstd";
+        case Encoding::IDENTITY:
+        default:                return "identity";
+    }
+}
+
+/*--- EncodingAvailable ---*/
+// Returns true if the library was built with support for the encoding.
+inline constexpr bool EncodingAvailable(Encoding encoding)
+{
+    switch (encoding)
+    {
+#ifdef FEATHER_WITH_BROTLI
+        case Encoding::BROTLI:  return true;
+#endif
+#ifdef FEATHER_WITH_ZSTD
+        case Encoding::ZSTD:    return true;
+#endif
+        case Encoding::IDENTITY:
+        case Encoding::GZIP:    return true;
+        default:                return false;
+    }
+}
+
+/*--- Compressor ---*/
+/*
+    Streaming compressor of one response.
+    write compresses data at the end of out, flushing the output when asked so the client can decode it
+    straight away (e.g. for each chunk), finish terminates the stream.
+    Both return false if the codec failed.
+*/
+struct Compressor
+{
+    virtual ~Compressor() = default;
+    virtual bool write(std::string_view data, std::string& out, bool flush) = 0;
+    virtual bool finish(std::string& out) = 0;
+};
+
+/*--- GzipCompressor ---*/
+class GzipCompressor : public Compressor
+{
+    private:
+        z_stream    stream{};
+        bool        ready;
+
+        bool run(std::string_view data, std::string& out, int mode)
+        {
+            if (!ready)
+            {
+                return false;
+            }
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+            stream.avail_in = static_cast<uInt>(data.size());
+
+            int code = Z_OK;
+            do
+            {
+                size_t const before = out.size();
+                size_t const room = std::max<size_t>(deflateBound(&stream, stream.avail_in), 4096);
+                out.resize(before + room);
+                stream.next_out = reinterpret_cast<Bytef*>(out.data() + before);
+                stream.avail_out = static_cast<uInt>(room);
+                code = deflate(&stream, mode);
+                out.resize(before + room - stream.avail_out);
+                if (code == Z_STREAM_ERROR)
+                {
+                    return false;
+                }
+            } while (stream.avail_out == 0 || (mode == Z_FINISH && code != Z_STREAM_END));
+            return true;
+        }
+    public:
+        explicit GzipCompressor(int level)
+            : ready(deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK) {}
+        ~GzipCompressor() override
+        {
+            if (ready)
+            {
+                deflateEnd(&stream);
+            }
+        }
+        GzipCompressor(GzipCompressor const&) = delete;
+        GzipCompressor& operator=(GzipCompressor const&) = delete;
+
+        bool write(std::string_view data, std::string& out, bool flush) override
+        {
+            return run(data, out, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        }
+        bool finish(std::string& out) override
+        {
+            return run({}, out, Z_FINISH);
+        }
+};
+
+#ifdef FEATHER_WITH_BROTLI
+/*--- BrotliCompressor ---*/
+class BrotliCompressor : public Compressor
+{
+    private:
+        BrotliEncoderState* state;
+
+        bool run(std::string_view data, std::string& out, BrotliEncoderOperation operation)
+        {
+            if (state == nullptr)
+            {
+                return false;
+            }
+            size_t available_in = data.size();
+            auto const* next_in = reinterpret_cast<uint8_t const*>(data.data());
+            while (true)
+            {
+                size_t available_out = 0;
+                if (!BrotliEncoderCompressStream(state, operation, &available_in, &next_in, &available_out, nullptr, nullptr))
+                {
+                    return false;
+                }
+                size_t size = 0;
+                uint8_t const* output = BrotliEncoderTakeOutput(state, &size);
+                out.append(reinterpret_cast<char const*>(output), size);
+                if (available_in == 0 && !BrotliEncoderHasMoreOutput(state)
+                    && (operation != BROTLI_OPERATION_FINISH || BrotliEncoderIsFinished(state)))
+                {
+                    return true;
+                }
+            }
+        }
+    public:
+        explicit BrotliCompressor(int level) : state(BrotliEncoderCreateInstance(nullptr, nullptr, nullptr))
+        {
+            if (state != nullptr)
+            {
+                BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, static_cast<uint32_t>(level));
+            }
+        }
+        ~BrotliCompressor() override
+        {
+            BrotliEncoderDestroyInstance(state);
+        }
+        BrotliCompressor(BrotliCompressor const&) = delete;
+        BrotliCompressor& operator=(BrotliCompressor const&) = delete;
+
+        bool write(std::string_view data, std::string& out, bool flush) override
+        {
+            return run(data, out, flush ? BROTLI_OPERATION_FLUSH : BROTLI_OPERATION_PROCESS);
+        }
+        bool finish(std::string& out) override
+        {
+            return run({}, out, BROTLI_OPERATION_FINISH);
+        }
+};
+#endif
+
+#ifdef FEATHER_WITH_ZSTD
+/*--- ZstdCompressor ---*/
+class ZstdCompressor : public Compressor
+{
+    private:
+        ZSTD_CCtx* context;
+
+        bool run(std::string_view data, std::string& out, ZSTD_EndDirective mode)
+        {
+            if (context == nullptr)
+            {
+                return false;
+            }
+            ZSTD_inBuffer input{data.data(), data.size(), 0};
+            while (true)
+            {
+                size_t const before = out.size();
+                size_t const room = ZSTD_CStreamOutSize();
+                out.resize(before + room);
+                ZSTD_outBuffer output{out.data() + before, room, 0};
+                size_t const remaining = ZSTD_compressStream2(context, &output, &input, mode);
+                out.resize(before + output.pos);
+                if (ZSTD_isError(remaining))
+                {
+                    return false;
+                }
+                if (mode == ZSTD_e_continue ? input.pos == input.size : remaining == 0)
+                {
+                    return true;
+                }
+            }
+        }
+    public:
+        explicit ZstdCompressor(int level) : context(ZSTD_createCCtx())
+        {
+            if (context != nullptr)
+            {
+                ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level);
+            }
+        }
+        ~ZstdCompressor() override
+        {
+            ZSTD_freeCCtx(context);
+        }
+        ZstdCompressor(ZstdCompressor const&) = delete;
+        ZstdCompressor& operator=(ZstdCompressor const&) = delete;
+
+        bool write(std::string_view data, std::string& out, bool flush) override
+        {
+            return run(data, out, flush ? ZSTD_e_flush : ZSTD_e_continue);
+        }
+        bool finish(std::string& out) override
+        {
+            return run({}, out, ZSTD_e_end);
+        }
+};
+#endif
+
+/*--- CompressionCache ---*/
+/*
+    Cache of precompressed variants, so a static file or a cacheable page is compressed once.
+
+    Each variant is stored under a key with the source it was compressed from:
+    the entity tag of a file, or the body itself, and is only returned for that same source.
+    The least recently used variants are evicted once the cache holds capacity bytes.
+*/
+class CompressionCache
+{
+    private:
+        struct Entry
+        {
+            std::string     key;
+            SharedString    source;
+            SharedString    compressed;
+        };
+
+        std::mutex                                                  lock;
+        std::list<Entry>                                            lru;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t                                                      bytes = 0;
+        size_t                                                      capacity;
+
+        static size_t weight(Entry const& entry)
+        {
+            return entry.key.size() + entry.source->size() + entry.compressed->size();
+        }
+    public:
+        explicit CompressionCache(size_t capacity_bytes = 64 << 20) : capacity(capacity_bytes) {}
+
+        /*- global -*/
+        // Cache used by default by the compression plug.
+        static std::shared_ptr<CompressionCache> const& global()
+        {
+            static std::shared_ptr<CompressionCache> const cache = std::make_shared<CompressionCache>();
+            return cache;
+        }
+
+        /*- find -*/
+        // Returns the variant stored under key if it was compressed from source, or nullptr.
+        SharedString find(std::string const& key, std::string_view source)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto const found = index.find(key);
+            if (found == index.end() || *found->second->source != source)
+            {
+                return nullptr;
+            }
+            lru.splice(lru.begin(), lru, found->second);
+            return found->second->compressed;
+        }
+
+        /*- insert -*/
+        // Stores a variant, replacing the previous one under the same key.
+        void insert(std::string key, SharedString source, SharedString compressed)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (auto const found = index.find(key); found != index.end())
+            {
+                bytes -= weight(*found->second);
+                lru.erase(found->second);
+                index.erase(found);
+            }
+            lru.push_front({std::move(key), std::move(source), std::move(compressed)});
+            index.emplace(lru.front().key, lru.begin());
+            bytes += weight(lru.front());
+
+            while (bytes > capacity && !lru.empty())
+            {
+                bytes -= weight(lru.back());
+                index.erase(lru.back().key);
+                lru.pop_back();
+            }
+        }
+
+        /*- size -*/
+        // Returns the number of bytes held.
+        size_t size()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return bytes;
+        }
+};
+
+/*--- CompressOptions ---*/
+/*
+    - preference        : encodings offered, in the order the server prefers them when the client does not
+    - gzip_level        : zlib level, 1 (fast) to 9 (small)
+    - brotli_level      : brotli quality, 0 (fast) to 11 (small)
+    - zstd_level        : zstd level, 1 (fast) to 19 (small)
+    - min_size          : bodies smaller than this are not worth compressing
+    - max_cached_file   : files larger than this are not compressed in memory, precompressed siblings still are used
+    - cache             : cache of precompressed variants, nullptr to disable it
+*/
+struct CompressOptions
+{
+    std::array<Encoding, 3>             preference      = {Encoding::BROTLI, Encoding::ZSTD, Encoding::GZIP};
+    int                                 gzip_level      = 6;
+    int                                 brotli_level    = 5;
+    int                                 zstd_level      = 3;
+    size_t                              min_size        = 1024;
+    size_t                              max_cached_file = 8 << 20;
+    std::shared_ptr<CompressionCache>   cache           = CompressionCache::global();
+};
+
+/*--- MakeCompressor ---*/
+// Returns a streaming compressor for the encoding, nullptr for identity or an unavailable encoding.
+inline std::unique_ptr<Compressor> MakeCompressor(Encoding encoding, CompressOptions const& options = {})
+{
+    switch (encoding)
+    {
+        case Encoding::GZIP:    return std::make_unique<GzipCompressor>(options.gzip_level);
+#ifdef FEATHER_WITH_BROTLI
+        case Encoding::BROTLI:  return std::make_unique<BrotliCompressor>(options.brotli_level);
+#endif
+#ifdef FEATHER_WITH_ZSTD
+        case Encoding::ZSTD:    return std::make_unique<ZstdCompressor>(options.zstd_level);
+#endif
+        default:                return nullptr;
+    }
+}
+
+/*--- Compress ---*/
+// Compresses a whole body. Returns nullptr if the codec failed.
+inline SharedString Compress(Encoding encoding, std::string_view data, CompressOptions const& options = {})
+{
+    auto const compressor = MakeCompressor(encoding, options);
+    std::string out;
+    out.reserve(data.size() / 4 + 64);
+    if (compressor == nullptr || !compressor->write(data, out, false) || !compressor->finish(out))
+    {
+        return nullptr;
+    }
+    return ShareStr(std::move(out));
+}
+
+/*--- NegotiateEncoding ---*/
+/*
+    Picks the encoding of a response from the Accept-Encoding header of the request.
+    The encoding with the highest quality wins, ties are broken by the server preference.
+    "*" stands for every encoding not listed. Returns Encoding::IDENTITY when nothing better is accepted.
+*/
+inline Encoding NegotiateEncoding(std::string_view accept_encoding, CompressOptions const& options = {})
+{
+    auto const entries = ParseQualityList(accept_encoding);
+    auto const quality = [&entries](Encoding encoding)
+    {
+        std::optional<float> wildcard;
+        for (auto const& [value, q] : entries)
+        {
+            if (boost::iequals(value, EncodingName(encoding))
+                || (encoding == Encoding::GZIP && boost::iequals(value, "x-gzip")))
+            {
+                return q;
+            }
+            if (value == "*")
+            {
+                wildcard = q;
+            }
+        }
+        return wildcard.value_or(0.f);
+    };
+
+    Encoding best = Encoding::IDENTITY;
+    float best_quality = 0;
+    for (Encoding const encoding : options.preference)
+    {
+        if (!EncodingAvailable(encoding))
+        {
+            continue;
+        }
+        if (float const q = quality(encoding); q > best_quality)
+        {
+            best = encoding;
+            best_quality = q;
+        }
+    }
+    return best;
+}
+
+/*--- Compressible ---*/
+// Returns true for the content types that compress well: text, JSON, JavaScript, XML and SVG.
+inline bool Compressible(std::string_view content_type)
+{
+    std::string const type = boost::to_lower_copy(std::string(content_type.substr(0, content_type.find(';'))));
+    return type.starts_with("text/")
+        || type.find("json") != std::string::npos
+        || type.find("javascript") != std::string::npos
+        || type.find("xml") != std::string::npos
+        || type == "application/wasm";
+}
+
+/*--- CompressingAdapter ---*/
+/*
+    Adapter compressing the chunks of a chunked response on their way to the adapter it wraps.
+    Each chunk is flushed so the client can decode it as soon as it arrives.
+*/
+class CompressingAdapter : public plug::Adapter
+{
+    private:
+        std::shared_ptr<plug::Adapter>  inner;
+        std::unique_ptr<Compressor>     compressor;
+        std::string                     buffer;
+    public:
+        CompressingAdapter(std::shared_ptr<plug::Adapter> adapter, std::unique_ptr<Compressor> c)
+            : inner(std::move(adapter)), compressor(std::move(c)) {}
+
+        bool send_chunked(plug::Conn const& conn) override
+        {
+            return inner->send_chunked(conn);
+        }
+
+        bool chunk(std::string_view data) override
+        {
+            buffer.clear();
+            return compressor->write(data, buffer, true) && (buffer.empty() || inner->chunk(buffer));
+        }
+
+        bool finish() override
+        {
+            buffer.clear();
+            bool const written = compressor->finish(buffer) && (buffer.empty() || inner->chunk(buffer));
+            return inner->finish() && written;
+        }
+
+        bool send_file(plug::Conn const& conn, int fd, size_t offset, size_t length) override
+        {
+            return inner->send_file(conn, fd, offset, length);
+        }
+
+        std::optional<Result<std::string>> read_body(size_t length, size_t read_length, std::chrono::milliseconds timeout) override
+        {
+            return inner->read_body(length, read_length, timeout);
+        }
+};
+
+namespace compress_detail
+{
+    // Returns the value of a response header, or nullptr.
+    inline std::string const* RespHeader(plug::Conn const& conn, std::string_view key)
+    {
+        auto const it = conn.resp_headers.find(key);
+        return it == conn.resp_headers.end() ? nullptr : &it->second;
+    }
+
+    // Sets the headers of an encoded representation: Content-Encoding, Vary and a weak ETag.
+    inline ImmutHeaders EncodedHeaders(ImmutHeaders headers, Encoding encoding)
+    {
+        auto const vary = headers.find("vary");
+        if (vary == headers.end())
+        {
+            headers = headers.set("vary", "accept-encoding");
+        }
+        else if (boost::ifind_first(vary->second, "accept-encoding").empty() && vary->second != "*")
+        {
+            headers = headers.set("vary", vary->second + ", accept-encoding");
+        }
+        if (auto const etag = headers.find("etag"); etag != headers.end() && !etag->second.starts_with("W/"))
+        {
+            headers = headers.set("etag", "W/" + etag->second);
+        }
+        return headers
+            .erase("content-length")
+            .set("content-encoding", std::string(EncodingName(encoding)));
+    }
+
+    // Returns true if a response with this Cache-Control may be stored in the variant cache.
+    inline bool Cacheable(plug::Conn const& conn)
+    {
+        auto const control = RespHeader(conn, "cache-control");
+        if (control == nullptr)
+        {
+            return RespHeader(conn, "etag") != nullptr;
+        }
+        return boost::ifind_first(*control, "no-store").empty()
+            && boost::ifind_first(*control, "private").empty();
+    }
+
+    // Compresses the body of a response, through the cache when it is cacheable.
+    inline plug::Conn CompressBody(plug::Conn const& conn, Encoding encoding, CompressOptions const& options)
+    {
+        auto const& body = *conn.resp_body;
+        bool const cacheable = options.cache != nullptr && Cacheable(conn);
+
+        std::string key;
+        SharedString compressed = nullptr;
+        if (cacheable)
+        {
+            key = std::string(EncodingName(encoding)) + ":body:"
+                + std::to_string(std::hash<std::string_view>{}(body)) + ":" + std::to_string(body.size());
+            compressed = options.cache->find(key, body);
+        }
+        if (compressed == nullptr)
+        {
+            compressed = Compress(encoding, body, options);
+            if (compressed == nullptr || compressed->size() >= body.size())
+            {
+                return conn;
+            }
+            if (cacheable)
+            {
+                options.cache->insert(std::move(key), conn.resp_body, compressed);
+            }
+        }
+
+        plug::Conn new_conn(conn);
+        new_conn.resp_headers = EncodedHeaders(new_conn.resp_headers, encoding);
+        new_conn.resp_body = std::move(compressed);
+        return new_conn;
+    }
+
+    // Before send callback of the compression plug.
+    inline plug::Conn CompressResponse(plug::Conn const& conn, CompressOptions const& options)
+    {
+        using plug::Unsent;
+
+        auto const accept = conn.req_headers.find("accept-encoding");
+        auto const type = RespHeader(conn, "content-type");
+        uint32_t const status = conn.status.value_or(200);
+        if (accept == conn.req_headers.end()
+            || type == nullptr
+            || !Compressible(*type)
+            || RespHeader(conn, "content-encoding") != nullptr
+            || status < 200 || status == 204 || status == 206 || status == 304
+            || !std::holds_alternative<Unsent>(conn.state))
+        {
+            return conn;
+        }
+
+        Unsent const state = std::get<Unsent>(conn.state);
+        if (state == Unsent::SET && (conn.resp_body == nullptr || conn.resp_body->size() < options.min_size))
+        {
+            return conn;
+        }
+        if (state != Unsent::SET && state != Unsent::SET_CHUNKED)
+        {
+            return conn;
+        }
+
+        Encoding const encoding = NegotiateEncoding(accept->second, options);
+        if (encoding == Encoding::IDENTITY)
+        {
+            return conn;
+        }
+
+        if (state == Unsent::SET)
+        {
+            return CompressBody(conn, encoding, options);
+        }
+
+        auto compressor = MakeCompressor(encoding, options);
+        if (conn.adapter == nullptr || compressor == nullptr)
+        {
+            return conn;
+        }
+        plug::Conn new_conn(conn);
+        new_conn.resp_headers = EncodedHeaders(new_conn.resp_headers, encoding);
+        new_conn.adapter = std::make_shared<CompressingAdapter>(conn.adapter, std::move(compressor));
+        return new_conn;
+    }
+
+    // Reads a whole file.
+    inline std::optional<std::string> ReadFile(std::string const& path, size_t size)
+    {
+        int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return std::nullopt;
+        }
+        std::string data(size, '\0');
+        size_t done = 0;
+        while (done < size)
+        {
+            ssize_t const count = ::read(fd, data.data() + done, size - done);
+            if (count <= 0)
+            {
+                break;
+            }
+            done += static_cast<size_t>(count);
+        }
+        ::close(fd);
+        if (done != size)
+        {
+            return std::nullopt;
+        }
+        return data;
+    }
+}
+
+/*--- compress ---*/
+/*
+    Plug compressing the response with the best encoding accepted by the client.
+
+    Registers a before_send callback which, for a compressible Content-Type:
+        - compresses resp_body when it holds at least options.min_size bytes,
+          reusing the variant cache when the response is cacheable
+          (it carries an ETag or a Cache-Control that is neither no-store nor private),
+        - compresses the chunks of a chunked response on the fly.
+    Files sent with Conn::send_file are left alone, send_compressed_file compresses them.
+    The response gets Content-Encoding, Vary: accept-encoding and its ETag is made weak.
+
+    Usage:
+
+    PLUG( compress );
+*/
+inline plug::Conn compress(plug::Conn&& conn, CompressOptions const& options = {})
+{
+    return plug::Conn::register_before_send(std::move(conn), [options](plug::Conn const& c)
+    {
+        return compress_detail::CompressResponse(c, options);
+    });
+}
+
+inline plug::Conn const compress(plug::Conn const& conn, CompressOptions const& options = {})
+{
+    return compress(plug::Conn(conn), options);
+}
+
+/*--- send_compressed_file ---*/
+/*
+    Sends a static file with the best encoding accepted by the client, as Conn::send_file does otherwise.
+
+    The Content-Type of the response should be set before, it tells whether the file compresses well.
+    A precompressed sibling (path.br, path.zst or path.gz) at least as recent as the file is sent as is.
+    Otherwise files up to options.max_cached_file bytes are compressed once and kept in the variant cache
+    until they change, and answered with ETag, Last-Modified and 304 on a matching If-None-Match.
+    Larger files, and files that do not compress, are sent with Conn::send_file.
+*/
+inline Result<plug::Conn const> send_compressed_file(
+    plug::Conn&& conn,
+    uint32_t status,
+    std::string const& path,
+    CompressOptions const& options = {})
+{
+    using plug::Conn;
+    using namespace compress_detail;
+
+    auto const accept = conn.req_headers.find("accept-encoding");
+    auto const type = RespHeader(conn, "content-type");
+    struct stat st{};
+    if (status != 200 || accept == conn.req_headers.end() || type == nullptr || !Compressible(*type)
+        || ::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return Conn::send_file(std::move(conn), status, path);
+    }
+
+    Encoding const encoding = NegotiateEncoding(accept->second, options);
+    if (encoding == Encoding::IDENTITY || static_cast<size_t>(st.st_size) < options.min_size)
+    {
+        return Conn::send_file(std::move(conn), status, path);
+    }
+
+    static constexpr std::array<std::pair<Encoding, std::string_view>, 3> siblings = {{
+        {Encoding::BROTLI, ".br"}, {Encoding::ZSTD, ".zst"}, {Encoding::GZIP, ".gz"}
+    }};
+    for (auto const& [sibling_encoding, extension] : siblings)
+    {
+        struct stat sibling{};
+        std::string const sibling_path = path + std::string(extension);
+        if (sibling_encoding == encoding && ::stat(sibling_path.c_str(), &sibling) == 0
+            && S_ISREG(sibling.st_mode) && sibling.st_mtime >= st.st_mtime)
+        {
+            conn.resp_headers = EncodedHeaders(conn.resp_headers, encoding);
+            return Conn::send_file(std::move(conn), status, sibling_path);
+        }
+    }
+
+    if (options.cache == nullptr || static_cast<size_t>(st.st_size) > options.max_cached_file)
+    {
+        return Conn::send_file(std::move(conn), status, path);
+    }
+
+    std::string const etag = FileETag(st);
+    std::string key = std::string(EncodingName(encoding)) + ":file:" + path;
+    SharedString compressed = options.cache->find(key, etag);
+    if (compressed == nullptr)
+    {
+        auto const data = ReadFile(path, static_cast<size_t>(st.st_size));
+        if (!data.has_value())
+        {
+            return Conn::send_file(std::move(conn), status, path);
+        }
+        compressed = Compress(encoding, *data, options);
+        if (compressed == nullptr || compressed->size() >= data->size())
+        {
+            return Conn::send_file(std::move(conn), status, path);
+        }
+        options.cache->insert(std::move(key), ShareStr(etag), compressed);
+    }
+
+    conn.resp_headers = EncodedHeaders(conn.resp_headers
+        .set("etag", etag)
+        .set("last-modified", FormatHttpDate(st.st_mtime)), encoding);
+
+    auto const inm = conn.req_headers.find("if-none-match");
+    if (inm != conn.req_headers.end() && MatchETag(inm->second, etag))
+    {
+        return { ResultType::Ok, Conn::resp(std::move(conn), 304, std::string()) };
+    }
+    return { ResultType::Ok, Conn::resp(std::move(conn), 200, std::move(compressed)) };
+}
+
+inline Result<plug::Conn const> send_compressed_file(
+    plug::Conn const& conn,
+    uint32_t status,
+    std::string const& path,
+    CompressOptions const& options = {})
+{
+    return send_compressed_file(plug::Conn(conn), status, path, options);
+}
+
+} // namespace feather::core
+
+#endif
@@ -4,10 +4,30 @@
 #define CONTROLLER_HPP
 
 #include <feather/core.hpp>
+#include <feather/json.hpp>
+#include <feather/published.hpp>
+#include <feather/log.hpp>
 #include <inja.hpp>
 #include <nlohmann/json.hpp>
+#include <atomic>
+#include <exception>
 #include <filesystem>
-#include <iostream>
+#include <ostream>
+#include <mutex>
+#include <streambuf>
+#include <string_view>
+#include <unordered_map>
+
+#ifdef FEATHER_TEMPLATE_RELOAD
+#include <regex>
+#include <unordered_set>
+#include <vector>
+#if __has_include(<sys/inotify.h>)
+#include <sys/inotify.h>
+#include <unistd.h>
+#define FEATHER_TEMPLATE_INOTIFY
+#endif
+#endif
 
 namespace feather::controller
 {
@@ -16,16 +36,301 @@ namespace feather::controller
     using json = nlohmann::json;
     using Controller = std::function<Conn(Conn const&, std::unordered_map<std::string, std::any>&&)>;
     
+    /*- StringSink -*/
+    /*
+        Stream buffer appending everything written to it to a string.
+        Lets inja render straight into a response body.
+    */
+    class StringSink : public std::streambuf
+    {
+        private:
+            std::string& out;
+        protected:
+            int_type overflow(int_type c) override
+            {
+                if (!traits_type::eq_int_type(c, traits_type::eof()))
+                {
+                    out.push_back(traits_type::to_char_type(c));
+                }
+                return traits_type::not_eof(c);
+            }
+            std::streamsize xsputn(char const* s, std::streamsize n) override
+            {
+                out.append(s, static_cast<size_t>(n));
+                return n;
+            }
+        public:
+            explicit StringSink(std::string& str) : out(str) {}
+    };
+
+#ifdef FEATHER_TEMPLATE_RELOAD
+    /*- TemplateWatcher -*/
+    /*
+        Development helper reporting the template files changed on disk.
+
+        Uses inotify where available, watching the directories of the templates
+        so that editors replacing a file by renaming are seen too.
+        Elsewhere the modification time of every file is compared on each call.
+        Only compiled with FEATHER_TEMPLATE_RELOAD.
+    */
+    class TemplateWatcher
+    {
+        private:
+#ifdef FEATHER_TEMPLATE_INOTIFY
+            int                                                 fd;
+            std::unordered_map<int, std::filesystem::path>      dirs;
+#else
+            std::unordered_map<std::string, std::filesystem::file_time_type> files;
+#endif
+        public:
+#ifdef FEATHER_TEMPLATE_INOTIFY
+            TemplateWatcher() : fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {}
+            ~TemplateWatcher()
+            {
+                if (fd >= 0)
+                {
+                    ::close(fd);
+                }
+            }
+#else
+            TemplateWatcher() = default;
+            ~TemplateWatcher() = default;
+#endif
+            TemplateWatcher(TemplateWatcher const&) = delete;
+            TemplateWatcher& operator=(TemplateWatcher const&) = delete;
+
+            /*- watch -*/
+            // Starts watching a file, given as an absolute normalized path.
+            void watch(std::filesystem::path const& file)
+            {
+#ifdef FEATHER_TEMPLATE_INOTIFY
+                auto const dir = file.parent_path();
+                if (fd < 0 || std::any_of(dirs.begin(), dirs.end(), [&](auto const& d) { return d.second == dir; }))
+                {
+                    return;
+                }
+                if (int const wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO); wd >= 0)
+                {
+                    dirs.emplace(wd, dir);
+                }
+#else
+                std::error_code ec;
+                files.insert_or_assign(file.string(), std::filesystem::last_write_time(file, ec));
+#endif
+            }
+
+            /*- changed -*/
+            // Returns the files changed since the previous call, never blocks.
+            std::vector<std::filesystem::path> changed()
+            {
+                std::vector<std::filesystem::path> result;
+#ifdef FEATHER_TEMPLATE_INOTIFY
+                if (fd < 0)
+                {
+                    return result;
+                }
+                alignas(inotify_event) char buffer[4096];
+                ssize_t length;
+                while ((length = ::read(fd, buffer, sizeof(buffer))) > 0)
+                {
+                    for (char const* it = buffer; it < buffer + length;)
+                    {
+                        auto const* event = reinterpret_cast<inotify_event const*>(it);
+                        if (auto const dir = dirs.find(event->wd); dir != dirs.end() && event->len > 0)
+                        {
+                            result.push_back(dir->second / event->name);
+                        }
+                        it += sizeof(inotify_event) + event->len;
+                    }
+                }
+#else
+                for (auto& [file, time] : files)
+                {
+                    std::error_code ec;
+                    auto const now = std::filesystem::last_write_time(file, ec);
+                    if (!ec && now != time)
+                    {
+                        time = now;
+                        result.emplace_back(file);
+                    }
+                }
+#endif
+                return result;
+            }
+    };
+#endif
+
     /*- TemplateManager -*/
     /*
         Singleton that handles all the templates in the application.
+
+        Templates are parsed once and kept as handles: named templates by name,
+        raw templates by content. Rendering walks the cached AST without parsing anything.
+
+        The parsed templates form immutable snapshots, published once and read through a Published pointer:
+        a lookup or a render takes no lock. Adding templates builds the next snapshot under the write lock,
+        the next lookup or render swaps it in once for all of them, renders in flight finish on the previous one.
+        env is where the next snapshot is built: configure it before adding the templates,
+        or call TemplateManager::publish after changing it.
+
+        Built with FEATHER_TEMPLATE_RELOAD, the files of the named templates are watched
+        and compile recompiles the changed ones, with every template including or extending them,
+        before answering. Without it none of this exists and templates never change once compiled.
     */
 struct TemplateManager
 {
     using TMInstance = std::shared_ptr<TemplateManager>;
+    using Handle = std::shared_ptr<inja::Template const>;
+
+    // Number of raw templates kept before the raw cache is flushed.
+    static constexpr size_t raw_capacity = 256;
+
     private:
-        static inline TMInstance instance = nullptr;
         TemplateManager() = default;
+
+        // Named templates and the environment they render in.
+        struct Templates
+        {
+            // Rendering does not modify the environment, inja just does not mark it const.
+            mutable inja::Environment                   env;
+            std::unordered_map<std::string, Handle>     named;
+        };
+
+        // Raw templates, keys view the content of the template they map to.
+        using RawTemplates = std::unordered_map<std::string_view, Handle>;
+
+        core::Published<Templates>      templates;
+        core::Published<RawTemplates>   raw;
+
+        // Serializes the writers, guards env and named.
+        std::mutex                                  write_lock;
+        std::unordered_map<std::string, Handle>     named;
+        // Set when templates were added since the last snapshot, which the next read publishes.
+        std::atomic<bool>                           unpublished{false};
+
+#ifdef FEATHER_TEMPLATE_RELOAD
+        TemplateWatcher                                                 watcher;
+        // Template name to the path it was parsed from, as given and as watched.
+        std::unordered_map<std::string, std::pair<std::string, std::filesystem::path>> sources;
+        // Template name to the names of the templates including or extending it.
+        std::unordered_map<std::string, std::unordered_set<std::string>> dependents;
+        // Templates to recompile, kept when recompiling fails so the next request retries.
+        std::unordered_set<std::string>                                 stale;
+
+        // Records where a template comes from and what it depends on. Expects the write lock held.
+        void track(std::string const& name, std::string const& path, std::string const& content)
+        {
+            static std::regex const reference(R"re(\{%[-+]?\s*(?:include|extends)\s+"([^"]+)")re");
+
+            auto file = std::filesystem::absolute(path).lexically_normal();
+            watcher.watch(file);
+            sources.insert_or_assign(name, std::make_pair(path, std::move(file)));
+            for (auto it = std::sregex_iterator(content.begin(), content.end(), reference); it != std::sregex_iterator(); ++it)
+            {
+                dependents[(*it)[1].str()].insert(name);
+            }
+        }
+
+        // Marks a template and everything depending on it as stale.
+        void invalidate(std::string const& name)
+        {
+            if (!stale.insert(name).second)
+            {
+                return;
+            }
+            if (auto const found = dependents.find(name); found != dependents.end())
+            {
+                for (auto const& dependent : found->second)
+                {
+                    invalidate(dependent);
+                }
+            }
+        }
+
+        /*
+            Recompiles the templates changed on disk and publishes them. Expects the write lock held.
+            A template failing to parse keeps its previous version and stays stale, the others are reloaded:
+            its error is only thrown when it is the requested one.
+        */
+        void reload(std::string const& requested)
+        {
+            for (auto const& file : watcher.changed())
+            {
+                for (auto const& [name, source] : sources)
+                {
+                    if (source.second == file)
+                    {
+                        invalidate(name);
+                    }
+                }
+            }
+            if (stale.empty())
+            {
+                return;
+            }
+
+            bool reloaded = false;
+            std::exception_ptr error;
+            for (auto const& name : std::vector<std::string>(stale.begin(), stale.end()))
+            {
+                if (auto const source = sources.find(name); source != sources.end())
+                {
+                    try
+                    {
+                        store(name, source->second.first, env.parse_template(source->second.first));
+                        reloaded = true;
+                    }
+                    catch (std::exception const&)
+                    {
+                        error = name == requested ? std::current_exception() : error;
+                        continue;
+                    }
+                }
+                stale.erase(name);
+            }
+            if (reloaded)
+            {
+                publish_locked();
+            }
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+#endif
+
+        // Stores a parsed template under a name. Expects the write lock held.
+        Handle store(std::string const& name, [[maybe_unused]] std::string const& path, inja::Template&& temp)
+        {
+#ifdef FEATHER_TEMPLATE_RELOAD
+            track(name, path, temp.content);
+#endif
+            env.include_template(name, temp);
+            auto handle = std::make_shared<inja::Template const>(std::move(temp));
+            named.insert_or_assign(name, handle);
+            return handle;
+        }
+
+        // Publishes env and the named templates as the next snapshot. Expects the write lock held.
+        void publish_locked()
+        {
+            templates.publish(std::make_shared<Templates const>(Templates{env, named}));
+            unpublished.store(false, std::memory_order_release);
+        }
+
+        // Returns the current snapshot of the named templates, publishing the templates added since the last one.
+        std::shared_ptr<Templates const> current()
+        {
+            if (unpublished.load(std::memory_order_acquire) || templates.get() == nullptr)
+            {
+                std::lock_guard<std::mutex> guard(write_lock);
+                if (unpublished.load(std::memory_order_relaxed) || templates.get() == nullptr)
+                {
+                    publish_locked();
+                }
+            }
+            return templates.get();
+        }
     public:
         inja::Environment env;
 
@@ -36,14 +341,12 @@ struct TemplateManager
         /*- fetch_instance -*/
         /*
             Request the instance of the singleton TemplateManager.
-            If it is the first request, initialize the instance.
+            The instance is created, thread safely, by the first call.
+            A reference is returned so the reference count is left alone.
         */
-        static TMInstance fetch_instance()
+        static TMInstance const& fetch_instance()
         {
-            if (!instance)
-            {
-                instance = TMInstance(new TemplateManager());
-            }
+            static TMInstance const instance(new TemplateManager());
             return instance;
         }
 
@@ -51,21 +354,110 @@ struct TemplateManager
         /*
             Adds a template file in memory.
             All template files should be registred with this function.
+            Registering a name again replaces its template.
+            The templates added in a row are published together, by the next lookup or render.
         */
         static TMInstance add_template(TMInstance instance, std::string const& name, std::string const& path)
         {
-            auto temp = instance->env.parse_template(path);
-            instance->env.include_template(name, temp);
+            std::lock_guard<std::mutex> guard(instance->write_lock);
+            instance->store(name, path, instance->env.parse_template(path));
+            instance->unpublished.store(true, std::memory_order_release);
             return instance;
         }
 
+        /*- publish -*/
+        // Publishes the changes made to env since the last template was added.
+        static TMInstance publish(TMInstance instance)
+        {
+            std::lock_guard<std::mutex> guard(instance->write_lock);
+            instance->publish_locked();
+            return instance;
+        }
+
+        /*- compile -*/
+        /*
+            Returns the handle of a named template.
+            A name that was never registered is loaded as a template file and kept under that name.
+        */
+        static Handle compile(TMInstance const& instance, std::string const& name)
+        {
+#ifdef FEATHER_TEMPLATE_RELOAD
+            {
+                std::lock_guard<std::mutex> guard(instance->write_lock);
+                instance->reload(name);
+            }
+#endif
+            {
+                auto const snapshot = instance->current();
+                if (auto const found = snapshot->named.find(name); found != snapshot->named.end())
+                {
+                    return found->second;
+                }
+            }
+            std::lock_guard<std::mutex> guard(instance->write_lock);
+            if (auto const found = instance->named.find(name); found != instance->named.end())
+            {
+                return found->second;
+            }
+            auto handle = instance->store(name, name, instance->env.parse_template(name));
+            instance->publish_locked();
+            return handle;
+        }
+
+        /*- compile_raw -*/
+        /*
+            Returns the handle of a raw template, parsing it the first time its content is seen.
+            The content is the key of the cache, so templates built on the fly should stay rare.
+        */
+        static Handle compile_raw(TMInstance const& instance, std::string_view temp)
+        {
+            if (auto const cache = instance->raw.get(); cache != nullptr)
+            {
+                if (auto const found = cache->find(temp); found != cache->end())
+                {
+                    return found->second;
+                }
+            }
+            std::lock_guard<std::mutex> guard(instance->write_lock);
+            auto const previous = instance->raw.load();
+            if (previous)
+            {
+                if (auto const found = previous->find(temp); found != previous->end())
+                {
+                    return found->second;
+                }
+            }
+            auto next = previous && previous->size() < raw_capacity
+                ? std::make_shared<RawTemplates>(*previous)
+                : std::make_shared<RawTemplates>();
+            auto handle = std::make_shared<inja::Template const>(instance->env.parse(temp));
+            next->emplace(std::string_view(handle->content), handle);
+            instance->raw.publish(std::move(next));
+            return handle;
+        }
+
+        /*- render_to -*/
+        /*
+            Renders a compiled template at the end of out.
+            Returns out.
+        */
+        static std::string& render_to(TMInstance const& instance, Handle const& handle, json const& data, std::string& out)
+        {
+            StringSink sink(out);
+            std::ostream stream(&sink);
+            instance->current()->env.render_to(stream, *handle, data);
+            return out;
+        }
+
         /*- render -*/
         /*
-            Renders a template with the inja::Environment.
+            Renders a named template with the inja::Environment.
         */
-        static std::string render(TMInstance instance, std::string const& name, json const& data)
+        static std::string render(TMInstance const& instance, std::string const& name, json const& data)
         {
-            return instance->env.render("{% include \""+ name + "\" %}", data);
+            std::string out;
+            render_to(instance, compile(instance, name), data, out);
+            return out;
         }
 
         /*- render_raw -*/
@@ -73,42 +465,61 @@ struct TemplateManager
             Renders a template with the inja::Environment.
             Returns the raw template string.
         */
-        static std::string render_raw(TMInstance instance, std::string const& temp, json const& data)
+        static std::string render_raw(TMInstance const& instance, std::string const& temp, json const& data)
         {
-            return instance->env.render(temp, data);
+            std::string out;
+            render_to(instance, compile_raw(instance, temp), data, out);
+            return out;
         }
         
 };
 
+    /*- render_error -*/
+    // Response of a template that failed to compile or render.
+    inline Conn const render_error(Conn const& conn, std::exception const& e)
+    {
+        Log<LogLevel::Error>("template rendering error", {{"error", e.what()}});
+        return conn
+            CHAIN( Conn::put_resp_header, "Content-Type", "text/plain" )
+            CHAIN( core::unwrap<Conn> )
+            CHAIN( Conn::resp, 500, std::string("Template rendering error: ") + e.what() );
+    }
+
+    /*- render -*/
+    /*
+        Render a compiled template and return the response.
+        The template is rendered straight into a pooled BodyBuffer that becomes the response body.
+    */
+Conn const render(Conn const& conn, TemplateManager::Handle const& handle, json const& data)
+{
+    try {
+        BodyBuffer body;
+        body->reserve(handle->content.size());
+        TemplateManager::render_to(TemplateManager::fetch_instance(), handle, data, *body);
+        return Conn::resp(
+            conn
+                CHAIN( Conn::put_resp_header, "Content-Type", "text/html" )
+                CHAIN( core::unwrap<Conn> ),
+            200, std::move(body).share());
+    } catch (const std::exception& e) {
+        return render_error(conn, e);
+    }
+}
+
     /*- render -*/
     /*
         Render a template and return the response.
+        The template is only parsed the first time it is rendered.
     */
 Conn const render(Conn const& conn, std::string const& template_name, json const& data, bool is_raw = false)
 {
     try {
-        if (is_raw)
-        {
-            auto body = TemplateManager::fetch_instance()
-                CHAIN( TemplateManager::render_raw, template_name, data);
-            return conn
-                CHAIN( Conn::put_resp_header, "Content-Type", "text/html" )
-                CHAIN( core::unwrap<Conn> )
-                CHAIN( Conn::resp, 200, body );
-        }
-        auto body = TemplateManager::fetch_instance()
-            CHAIN( TemplateManager::render, template_name, data);
-        return conn
-            CHAIN( Conn::put_resp_header, "Content-Type", "text/html" )
-            CHAIN( core::unwrap<Conn> )
-            CHAIN( Conn::resp, 200, body );
+        auto const& tm = TemplateManager::fetch_instance();
+        return render(conn,
+            is_raw ? TemplateManager::compile_raw(tm, template_name) : TemplateManager::compile(tm, template_name),
+            data);
     } catch (const std::exception& e) {
-        std::cerr << "Template rendering error: " << e.what() << std::endl;
-        auto result = conn
-            CHAIN( Conn::put_resp_header, "Content-Type", "text/plain" )
-            CHAIN( core::unwrap<Conn> )
-            CHAIN( Conn::resp, 500, std::string("Template rendering error: ") + e.what() );
-        return result;
+        return render_error(conn, e);
     }
 }
     
@@ -127,13 +538,25 @@ Conn const render(Conn const& conn, std::string const& template_name, json const
     /*- JSON -*/
     /*
         Return a JSON response.
+
+        The value is serialized by WriteJson straight into a pooled BodyBuffer that becomes the response body,
+        so structs described by json_fields, containers and strings never go through a json DOM.
     */
-    Conn const JSON(Conn const& conn, json const& data)
+    template <typename T>
+    Conn const JSON(Conn const& conn, T const& data)
     {
-        return conn
-            CHAIN( Conn::put_resp_header, "Content-Type", "application/json" )
-            CHAIN( core::unwrap<Conn> )
-            CHAIN( Conn::resp, 200, data.dump() );
+        BodyBuffer body;
+        WriteJson(*body, data);
+        return Conn::resp(
+            conn
+                CHAIN( Conn::put_resp_header, "Content-Type", "application/json" )
+                CHAIN( core::unwrap<Conn> ),
+            200, std::move(body).share());
+    }
+
+    inline Conn const JSON(Conn const& conn, json const& data)
+    {
+        return JSON<json>(conn, data);
     }
 
     /*- text -*/
@@ -150,28 +573,56 @@ Conn const render(Conn const& conn, std::string const& template_name, json const
 
     /*- accepts -*/
     /*
-        Return true if the client accepts the given mime types.
+        Return true if the client accepts one of the given mime types.
+        The media ranges of the Accept header are matched exactly or through their wildcards
+        ("text/*", "*/*"), ranges with a zero quality are refused.
     */
     bool accepts(Conn const& conn, s_list const& mime_types)
     {
-        return conn.req_headers.find("Accept") != conn.req_headers.end()
-            && conn.req_headers.at("Accept").find(mime_types) != std::string::npos;
+        auto const accept = conn.req_headers.find("accept");
+        if (accept == conn.req_headers.end())
+        {
+            return false;
+        }
+        auto const ranges = ParseQualityList(accept->second);
+        return std::any_of(mime_types.begin(), mime_types.end(), [&](auto const& mime)
+        {
+            std::string_view const type(mime);
+            return std::any_of(ranges.begin(), ranges.end(), [&](auto const& range)
+            {
+                auto const& [media, quality] = range;
+                return quality > 0
+                    && (boost::iequals(media, type)
+                        || media == "*/*"
+                        || (media.ends_with("/*") && boost::istarts_with(type, media.substr(0, media.size() - 1))));
+            });
+        });
+    }
+
+    /*- secure_browser_headers -*/
+    // The secure browser headers, compiled once into a header block.
+    inline HeaderBlockPtr const& secure_browser_headers()
+    {
+        static HeaderBlockPtr const block = MakeHeaderBlock({
+            {"X-Frame-Options", "SAMEORIGIN"},
+            {"X-XSS-Protection", "1; mode=block"},
+            {"X-Content-Type-Options", "nosniff"},
+            {"Referrer-Policy", "strict-origin-when-cross-origin"},
+            {"Content-Security-Policy", "default-src 'self'; img-src *; script-src 'self' 'unsafe-inline' 'unsafe-eval'; style-src 'self' 'unsafe-inline'; connect-src 'self' https://fonts.googleapis.com https://fonts.gstatic.com; font-src 'self' https://fonts.googleapis.com https://fonts.gstatic.com; frame-src 'none'"},
+            {"Strict-Transport-Security", "max-age=31536000; includeSubDomains"},
+            {"X-Content-Security-Policy", "default-src 'self'; img-src *; script-src 'self' 'unsafe-inline' 'unsafe-eval'; style-src 'self' 'unsafe-inline'; connect-src 'self' https://fonts.googleapis.com https://fonts.gstatic.com; font-src 'self' https://fonts.googleapis.com https://fonts.gstatic.com; frame-src 'none'"}
+        });
+        return block;
     }
 
     /*- put_secure_browser_headers -*/
     /*
         Put the secure browser headers to the response.
+        They are added as a single precompiled block, see secure_browser_headers.
     */
     Conn const put_secure_browser_headers(Conn const& conn)
     {
-        return conn
-            CHAIN( Conn::put_resp_header, "X-Frame-Options", "SAMEORIGIN" )
-            CHAIN( Conn::put_resp_header, "X-XSS-Protection", "1; mode=block" )
-            CHAIN( Conn::put_resp_header, "X-Content-Type-Options", "nosniff" )
-            CHAIN( Conn::put_resp_header, "Referrer-Policy", "strict-origin-when-cross-origin" )
-            CHAIN( Conn::put_resp_header, "Content-Security-Policy", "default-src 'self'; img-src *; script-src 'self' 'unsafe-inline' 'unsafe-eval'; style-src 'self' 'unsafe-inline'; connect-src 'self' https://fonts.googleapis.com https://fonts.gstatic.com; font-src 'self' https://fonts.googleapis.com https://fonts.gstatic.com; frame-src 'none'" )
-            CHAIN( Conn::put_resp_header, "Strict-Transport-Security", "max-age=31536000; includeSubDomains" )
-            CHAIN( Conn::put_resp_header, "X-Content-Security-Policy", "default-src 'self'; img-src *; script-src 'self' 'unsafe-inline' 'unsafe-eval'; style-src 'self' 'unsafe-inline'; connect-src 'self' https://fonts.googleapis.com https://fonts.gstatic.com; font-src 'self' https://fonts.googleapis.com https://fonts.gstatic.com; frame-src 'none'" );
+        return core::unwrap<Conn>(Conn::put_resp_header_block(conn, secure_browser_headers()));
     }
 }
 
@@ -3,9 +3,6 @@
 #ifndef CORE_HPP
 #define CORE_HPP
 
-/*--- httplib for server ---*/
-#include <httplib.h> // TODO: change the parsing of the request so httplib would not be necessary
-
 /*--- websocket ---*/
 #include <websocketpp/server.hpp>
 #include <websocketpp/config/asio_no_tls.hpp>
@@ -20,30 +17,102 @@
 
 /*--- Boost includes for parsing ---*/
 #include <boost/tokenizer.hpp>
-#include <boost/regex.hpp>
 #include <boost/algorithm/string.hpp>
-#include <boost/locale/encoding_utf.hpp>
 
 /*--- Immer includes for immutable data structures ---*/
 #include <immer/vector.hpp>
 #include <immer/vector_transient.hpp>
+#include <immer/flex_vector.hpp>
+#include <immer/flex_vector_transient.hpp>
 #include <immer/map.hpp>
 #include <immer/map_transient.hpp>
 #include <immer/set.hpp>
 #include <immer/set_transient.hpp>
 
+#include <algorithm>
 #include <array>
 #include <queue>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <optional>
+#include <initializer_list>
+#include <stdexcept>
+#include <memory>
 #include <variant>
+#include <vector>
 #include <utility>
 #include <any>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <ctime>
+#include <map>
 #include <mutex>
 
+/*--- POSIX includes for files ---*/
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*--- Byte scanning of the parsers ---*/
+#include <feather/scan.hpp>
+#include <feather/slots.hpp>
+
 namespace process = boost::process::v2; // From <boost/process/v2/pid.hpp>
-namespace http = httplib;
+
+/*--- http ---*/
+/*
+    Minimal representation of a parsed HTTP request.
+    It is the intermediate form produced by feather::core::Server::parse_request,
+    and the input type of the header merging functions of the Conn.
+*/
+namespace http
+{
+
+/*--- ci_less ---*/
+// Case-insensitive ordering of header keys.
+struct ci_less
+{
+    bool operator()(std::string const& lhs, std::string const& rhs) const
+    {
+        return std::lexicographical_compare(
+            lhs.begin(), lhs.end(),
+            rhs.begin(), rhs.end(),
+            [](unsigned char l, unsigned char r) { return std::tolower(l) < std::tolower(r); });
+    }
+};
+
+using Headers = std::multimap<std::string, std::string, ci_less>;
+using Params = std::multimap<std::string, std::string>;
+
+struct Request
+{
+    std::string method;
+    std::string target;
+    std::string path;
+    std::string version;
+    Headers     headers;
+    std::string body;
+    Params      params;
+
+    /*- get_header_value -*/
+    // Returns the id-th value of the header key, or an empty string.
+    std::string get_header_value(std::string const& key, size_t id = 0) const
+    {
+        auto range = headers.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it, --id)
+        {
+            if (id == 0)
+            {
+                return it->second;
+            }
+        }
+        return "";
+    }
+};
+
+} // namespace http
 
 /*--- pipe operator ---*/
 /*
@@ -405,6 +474,301 @@ struct multimap
 };
 
 
+/*--- header_map ---*/
+/*
+    Immutable container for HTTP headers. Based on immer::flex_vector.
+
+    Keys keep the case they were written with and are compared case-insensitively,
+    the entries are kept sorted by key so values of the same key are contiguous
+    and keep their insertion order.
+    Copies share their structure: copying a header_map does not copy any header.
+*/
+struct header_map
+{
+    using key_type        = std::string;
+    using mapped_type     = std::string;
+    using value_type      = std::pair<std::string, std::string>;
+    using size_type       = size_t;
+    using container_type  = immer::flex_vector<value_type>;
+    using iterator        = typename container_type::iterator;
+    using const_iterator  = iterator;
+
+    private:
+        container_type  container;
+
+        /*- compare -*/
+        // Case-insensitive three-way comparison of a stored key with any key.
+        static int compare(std::string_view stored, std::string_view key)
+        {
+            size_t const len = std::min(stored.size(), key.size());
+            for (size_t i = 0; i < len; ++i)
+            {
+                int const s = std::tolower(static_cast<unsigned char>(stored[i]));
+                int const k = std::tolower(static_cast<unsigned char>(key[i]));
+                if (s != k)
+                {
+                    return s < k ? -1 : 1;
+                }
+            }
+            return stored.size() == key.size() ? 0 : stored.size() < key.size() ? -1 : 1;
+        }
+
+        /*- lower_bound -*/
+        // Index of the first entry whose key is not less than key.
+        size_type lower_bound(std::string_view key) const
+        {
+            size_type first = 0;
+            size_type count = container.size();
+            while (count > 0)
+            {
+                size_type const step = count / 2;
+                if (compare(container[first + step].first, key) < 0)
+                {
+                    first += step + 1;
+                    count -= step + 1;
+                }
+                else
+                {
+                    count = step;
+                }
+            }
+            return first;
+        }
+
+        /*- upper_bound -*/
+        // Index of the first entry whose key is greater than key.
+        size_type upper_bound(std::string_view key) const
+        {
+            size_type last = lower_bound(key);
+            while (last < container.size() && compare(container[last].first, key) == 0)
+            {
+                ++last;
+            }
+            return last;
+        }
+
+        explicit header_map(container_type c) : container(std::move(c)) {}
+    public:
+        /* Constructor */
+        /*
+            Constructs a header_map from a range of key/value pairs.
+            Values of the same key keep the order of the range.
+        */
+        template<typename Iterator>
+        header_map(Iterator first, Iterator last)
+        {
+            std::vector<value_type> entries;
+            for (; first != last; ++first)
+            {
+                entries.emplace_back(*first);
+            }
+            std::stable_sort(entries.begin(), entries.end(),
+                [](value_type const& lhs, value_type const& rhs) { return compare(lhs.first, rhs.first) < 0; });
+
+            auto tmp = container_type().transient();
+            for (auto& entry : entries)
+            {
+                tmp.push_back(std::move(entry));
+            }
+            this->container = tmp.persistent();
+        }
+        header_map(std::initializer_list<value_type> values) : header_map(values.begin(), values.end()) {}
+        header_map()                    = default;
+        header_map(header_map const&)   = default;
+        header_map(header_map&&)        = default;
+        ~header_map()                   = default;
+
+        header_map& operator=(header_map const&) = default;
+        header_map& operator=(header_map&&)      = default;
+
+        /*-- begin --*/
+        /*
+            Returns an iterator pointing at the first header.
+            It does not allocate memory and its complexity is O(1).
+        */
+        iterator begin() const
+        {
+            return this->container.begin();
+        }
+
+        /*-- end --*/
+        /*
+            Returns an iterator pointing just after the last header.
+            It does not allocate memory and its complexity is O(1).
+        */
+        iterator end() const
+        {
+            return this->container.end();
+        }
+
+        /*-- size --*/
+        /*
+            Returns the number of headers, counting every value of a key.
+            It does not allocate memory and its complexity is O(1).
+        */
+        size_type size() const
+        {
+            return this->container.size();
+        }
+
+        /*-- empty --*/
+        /*
+            Returns true if there are no headers.
+            It does not allocate memory and its complexity is O(1).
+        */
+        bool empty() const
+        {
+            return this->container.empty();
+        }
+
+        /*-- find --*/
+        /*
+            Returns an iterator to the first value of the key, or end() if the key is not contained.
+            It does not allocate memory and its complexity is O(log n).
+        */
+        iterator find(std::string_view key) const
+        {
+            size_type const pos = lower_bound(key);
+            if (pos < this->container.size() && compare(this->container[pos].first, key) == 0)
+            {
+                return this->begin() + static_cast<std::ptrdiff_t>(pos);
+            }
+            return this->end();
+        }
+
+        /*-- equal_range --*/
+        /*
+            Returns the range of all the values of the key.
+            It does not allocate memory.
+        */
+        std::pair<iterator, iterator> equal_range(std::string_view key) const
+        {
+            return {
+                this->begin() + static_cast<std::ptrdiff_t>(lower_bound(key)),
+                this->begin() + static_cast<std::ptrdiff_t>(upper_bound(key))
+            };
+        }
+
+        /*-- count --*/
+        /*
+            Returns the number of values of the key.
+            It does not allocate memory.
+        */
+        size_type count(std::string_view key) const
+        {
+            return upper_bound(key) - lower_bound(key);
+        }
+
+        /*-- at --*/
+        /*
+            Returns the first value of the key.
+            If the key is not contained, throws an std::out_of_range error.
+        */
+        std::string const& at(std::string_view key) const
+        {
+            if (auto it = this->find(key); it != this->end())
+            {
+                return it->second;
+            }
+            throw std::out_of_range(std::string(key));
+        }
+
+        /*-- operator== --*/
+        /*
+            Returns whether the header_maps are equal.
+        */
+        bool operator==(header_map const& hm) const
+        {
+            return this->container == hm.container;
+        }
+
+        /*-- insert --*/
+        /*
+            Returns a header_map with the value added after the existing values of its key.
+        */
+        header_map insert(value_type value) const
+        {
+            return header_map(this->container.insert(upper_bound(value.first), std::move(value)));
+        }
+
+        /*
+            Returns a header_map with all the values of the range added after the existing values of their key.
+        */
+        template<typename Iterator>
+        header_map insert(Iterator first, Iterator last) const
+        {
+            header_map result(*this);
+            for (; first != last; ++first)
+            {
+                result = result.insert(value_type(*first));
+            }
+            return result;
+        }
+
+        /*-- prepend --*/
+        /*
+            Returns a header_map with all the values of the range added before the existing values of their key.
+            Values of the same key keep the order of the range.
+        */
+        template<typename Iterator>
+        header_map prepend(Iterator first, Iterator last) const
+        {
+            std::vector<value_type> const entries(first, last);
+            header_map result(*this);
+            for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+            {
+                result.container = result.container.insert(result.lower_bound(it->first), *it);
+            }
+            return result;
+        }
+
+        /*-- set --*/
+        /*
+            Returns a header_map where the key only has the given value.
+        */
+        header_map set(std::string_view key, std::string value) const
+        {
+            size_type const first = lower_bound(key);
+            size_type const last = upper_bound(key);
+            value_type const entry{std::string(key), std::move(value)};
+
+            return header_map(this->container.take(first).push_back(entry) + this->container.drop(last));
+        }
+
+        /*-- update --*/
+        /*
+            Returns a header_map where the first value of the key is replaced by func(value).
+            If the key is not contained, initial is inserted instead.
+        */
+        template<typename Func>
+        header_map update(std::string_view key, std::string initial, Func&& func) const
+        {
+            if (auto it = this->find(key); it != this->end())
+            {
+                size_type const pos = lower_bound(key);
+                return header_map(this->container.set(pos, {it->first, func(it->second)}));
+            }
+            return this->insert({std::string(key), std::move(initial)});
+        }
+
+        /*-- erase --*/
+        /*
+            Returns a header_map without any value of the key.
+            If the key is not contained, returns the same header_map.
+        */
+        header_map erase(std::string_view key) const
+        {
+            size_type const first = lower_bound(key);
+            size_type const last = upper_bound(key);
+
+            if (first == last)
+            {
+                return *this;
+            }
+            return header_map(this->container.take(first) + this->container.drop(last));
+        }
+};
+
 } // namespace functional
 
 /*--- SharedString ---*/
@@ -417,6 +781,66 @@ inline SharedString    ShareStr(std::string str)
     return std::make_shared<std::string const>(std::move(str));
 }
 
+/*--- BodyBuffer ---*/
+/*
+    Response body buffer recycled through a per-thread pool.
+
+    It is filled like a std::string, then handed to Conn::resp with std::move(buffer).share():
+    the Conn shares the buffer itself, nothing is copied.
+    Once the last reference to the body is gone, the buffer goes back, with its capacity,
+    to the pool of the thread releasing it. Buffers grown past max_capacity are freed instead.
+*/
+class BodyBuffer
+{
+    public:
+        static constexpr size_t pool_size       = 8;
+        static constexpr size_t max_capacity    = 4 << 20;
+    private:
+        std::unique_ptr<std::string> buffer;
+
+        static std::vector<std::unique_ptr<std::string>>& pool()
+        {
+            static thread_local std::vector<std::unique_ptr<std::string>> buffers;
+            return buffers;
+        }
+
+        static void recycle(std::string const* released)
+        {
+            // The string was allocated mutable, only the shared view of it is const.
+            std::unique_ptr<std::string> owned(const_cast<std::string*>(released));
+            auto& buffers = pool();
+            if (owned->capacity() <= max_capacity && buffers.size() < pool_size)
+            {
+                owned->clear();
+                buffers.push_back(std::move(owned));
+            }
+        }
+    public:
+        BodyBuffer()
+        {
+            auto& buffers = pool();
+            if (buffers.empty())
+            {
+                buffer = std::make_unique<std::string>();
+            }
+            else
+            {
+                buffer = std::move(buffers.back());
+                buffers.pop_back();
+            }
+        }
+
+        std::string& operator*()    { return *buffer; }
+        std::string* operator->()   { return buffer.get(); }
+
+        /*- share -*/
+        // Hands the buffer over as a SharedString, the BodyBuffer is empty afterwards.
+        SharedString share() &&
+        {
+            return SharedString(buffer.release(), &recycle);
+        }
+};
+
 /*--- ImmutVecString ---*/
 // A shortcut for a vector of shared pointers containing a string
 using ImmutVecString = immer::vector<SharedString>;
@@ -425,6 +849,10 @@ using ImmutVecString = immer::vector<SharedString>;
 // A shortcut for the most used map
 using ImmutMapString = immer::map<std::string, SharedString>;
 
+/*--- ImmutHeaders ---*/
+// A shortcut for the persistent headers of a connection
+using ImmutHeaders = functional::header_map;
+
 /*--- ImmutSetString ---*/
 // A shortcut for an immutable set of strings
 using ImmutSetString = immer::set<std::string>;
@@ -491,20 +919,82 @@ inline ImmutVecString BuildPathInfo(std::string const& target)
 }
 
 /*--- GetPortFromHost ---*/
-// A host parser to get the port as an optional int
-inline std::optional<int const> GetPortFromHost(std::string const& host)
+/*
+    A host parser to get the port as an optional int.
+    The host is a name, an IPv4 or a bracketed IPv6 address, optionally followed by ":port".
+    Without a port, localhost defaults to 80 and any other host to 443.
+    Returns std::nullopt for an empty or malformed host.
+*/
+inline std::optional<int const> GetPortFromHost(std::string_view host)
 {
-    static boost::regex const expr(R"(^([\w\.-]+|\[?[a-fA-F0-9:\.]+\]?)(?::(\d+))?$)", boost::regex::optimize);
-    boost::smatch   matches;
-    if (boost::regex_match(host, matches, expr))
+    auto const is_name = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '-'; };
+    auto const is_address = [](char c) { return std::isxdigit(static_cast<unsigned char>(c)) || c == ':' || c == '.'; };
+
+    std::string_view name = host;
+    std::string_view port;
+    if (!host.empty() && host.front() == '[')
+    {
+        size_t const close = host.find(']');
+        if (close == std::string_view::npos)
+        {
+            return std::nullopt;
+        }
+        name = host.substr(1, close - 1);
+        if (close + 1 < host.size())
+        {
+            if (host[close + 1] != ':')
+            {
+                return std::nullopt;
+            }
+            port = host.substr(close + 2);
+        }
+        if (name.empty() || !std::all_of(name.begin(), name.end(), is_address))
+        {
+            return std::nullopt;
+        }
+    }
+    else if (size_t const colon = host.find(':'); colon != std::string_view::npos && host.find(':', colon + 1) == std::string_view::npos)
+    {
+        name = host.substr(0, colon);
+        port = host.substr(colon + 1);
+        if (name.empty() || !std::all_of(name.begin(), name.end(), is_name))
+        {
+            return std::nullopt;
+        }
+    }
+    else if (host.empty() || !(std::all_of(host.begin(), host.end(), is_name) || std::all_of(host.begin(), host.end(), is_address)))
+    {
+        // A bare IPv6 address has several colons and no port.
+        return std::nullopt;
+    }
+
+    if (host.back() == ':')
     {
-        if (matches.size() == 3 && !matches[2].str().empty())
+        return std::nullopt;
+    }
+    if (!port.empty())
+    {
+        int value = 0;
+        auto const [end, error] = std::from_chars(port.data(), port.data() + port.size(), value);
+        if (error != std::errc() || end != port.data() + port.size())
         {
-            return std::stoi(matches[2]);
+            return std::nullopt;
         }
-        return matches[1].str() == "localhost" ? 80 : 443;
+        return value;
+    }
+    return name == "localhost" ? 80 : 443;
+}
+
+/*--- GetPathFromTarget ---*/
+// A target parser to extract the path (without query nor fragment)
+inline std::string_view GetPathFromTarget(std::string_view target)
+{
+    size_t const slash = target.find('/');
+    if (slash == std::string_view::npos)
+    {
+        return {};
     }
-    return std::nullopt;
+    return target.substr(slash, target.find_first_of("?#", slash) - slash);
 }
 
 /*--- GetQueryFromTarget ---*/
@@ -525,69 +1015,334 @@ inline SharedString GetQueryFromTarget(std::string const& target)
 }
 
 /*--- ParseCookie ---*/
-// A cookie parser
-inline ImmutMapString ParseCookie(std::string const& cookie)
+/*
+    A cookie parser.
+    The header is scanned once over a std::string_view: each pair is trimmed in place
+    and only its key and value are copied, into the map.
+    Pairs without '=' and keys starting with an uppercase letter (attributes such as Path) are skipped.
+*/
+inline ImmutMapString ParseCookie(std::string_view cookie)
 {
-    boost::char_separator<char> const sep(";");
-    boost::tokenizer<boost::char_separator<char>> tok(cookie, sep);
     auto map = ImmutMapString().transient();
 
-    for (auto it = tok.begin(); it != tok.end(); ++it)
+    for (size_t start = 0; start < cookie.size();)
     {
-        if (it->empty())
+        size_t const next = FindEither(cookie, start, ';', '=');
+        if (next == std::string_view::npos || cookie[next] == ';')
         {
+            start = next == std::string_view::npos ? cookie.size() : next + 1;
             continue;
         }
-        if (auto equal_pos = it->find("="); equal_pos == std::string::npos)
+
+        size_t const end = std::min(FindByte(cookie, next + 1, ';'), cookie.size());
+        std::string_view const key = TrimSpaces(cookie.substr(start, next - start));
+        std::string_view const value = TrimSpaces(cookie.substr(next + 1, end - next - 1));
+        start = end + 1;
+
+        if (key.empty() || std::isupper(static_cast<unsigned char>(key.front())))
         {
             continue;
         }
-        else
-        {
-            std::string key = 
-                it->substr(0, equal_pos)
-                CHAIN( boost::trim_copy );
-            std::string value =
-                it->substr(equal_pos + 1)
-                CHAIN( boost::trim_copy );
-
-            if (std::isupper(key[0]))
-            {
-                continue;
-            }
-            
-            map.set(key, ShareStr(value));
-        }
+        map.set(std::string(key), ShareStr(std::string(value)));
     }
 
     return map.persistent();
 }
 
-/*--- ErrorType ---*/
-// Enum containing all the errors related to the plug namespace
+/*--- DecodeQuery ---*/
+/*
+    Decodes an "x-www-form-urlencoded" string, such as a query string, into a map.
 
-enum struct ErrorType
+    The input is scanned once for '&' and '=' over a std::string_view,
+    each key and value is percent-decoded (see UrlDecode) into buffers reused for every pair,
+    then copied once into the map. A pair without '=' is a key with an empty value.
+    When validate_utf8 is set, the decoded keys and values must be valid UTF-8.
+    Returns std::nullopt on a malformed percent-encoding or an invalid UTF-8 sequence.
+*/
+inline std::optional<ImmutMapString> DecodeQuery(std::string_view query, bool validate_utf8 = true)
 {
-    INCORRECT_CONN_STATE,
-};
+    auto params = ImmutMapString().transient();
+    std::string key;
+    std::string value;
 
+    for (size_t start = 0; start < query.size();)
+    {
+        size_t const next = std::min(FindEither(query, start, '&', '='), query.size());
+        size_t const end = next < query.size() && query[next] == '='
+            ? std::min(FindByte(query, next + 1, '&'), query.size())
+            : next;
 
-/*--- Session ---*/
-// Interface for any type of session.
+        std::string_view const raw_key = query.substr(start, next - start);
+        std::string_view const raw_value = next < end ? query.substr(next + 1, end - next - 1) : std::string_view();
+        start = end + 1;
+        if (raw_key.empty() && raw_value.empty())
+        {
+            continue;
+        }
+
+        if (!UrlDecode(raw_key, key) || !UrlDecode(raw_value, value)
+            || (validate_utf8 && !(ValidUtf8(key) && ValidUtf8(value))))
+        {
+            return std::nullopt;
+        }
+        params.set(key, ShareStr(value));
+    }
+
+    return params.persistent();
+}
+
+/*--- FormatHttpDate ---*/
+// Formats a time as an HTTP date (RFC 9110 IMF-fixdate), e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+inline std::string FormatHttpDate(std::time_t time)
+{
+    std::tm tm{};
+    gmtime_r(&time, &tm);
+
+    char buffer[32];
+    size_t const len = std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buffer, len);
+}
+
+/*--- ParseHttpDate ---*/
+// Parses an HTTP date in the IMF-fixdate format, returns std::nullopt if it is malformed.
+inline std::optional<std::time_t> ParseHttpDate(std::string const& date)
+{
+    std::tm tm{};
+    if (char const* end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm); end == nullptr || *end != '\0')
+    {
+        return std::nullopt;
+    }
+    return timegm(&tm);
+}
+
+/*--- MatchETag ---*/
+/*
+    Returns true if the list of entity tags of an If-None-Match header contains etag.
+    Uses the weak comparison: the W/ prefix is ignored. "*" matches any entity tag.
+*/
+inline bool MatchETag(std::string_view header, std::string_view etag)
+{
+    while (!header.empty())
+    {
+        size_t const comma = header.find(',');
+        std::string_view tag = header.substr(0, comma);
+        header = comma == std::string_view::npos ? std::string_view() : header.substr(comma + 1);
+
+        while (!tag.empty() && std::isspace(static_cast<unsigned char>(tag.front())))
+        {
+            tag.remove_prefix(1);
+        }
+        while (!tag.empty() && std::isspace(static_cast<unsigned char>(tag.back())))
+        {
+            tag.remove_suffix(1);
+        }
+        if (tag.substr(0, 2) == "W/")
+        {
+            tag.remove_prefix(2);
+        }
+        if (tag == "*" || tag == etag)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*--- MatchStrongETag ---*/
+/*
+    Returns true if the entity tag of an If-Range header is etag, with the strong comparison of RFC 9110:
+    both must be strong (no W/ prefix) and equal.
+*/
+inline bool MatchStrongETag(std::string_view tag, std::string_view etag)
+{
+    while (!tag.empty() && std::isspace(static_cast<unsigned char>(tag.front())))
+    {
+        tag.remove_prefix(1);
+    }
+    while (!tag.empty() && std::isspace(static_cast<unsigned char>(tag.back())))
+    {
+        tag.remove_suffix(1);
+    }
+    return !tag.starts_with("W/") && !etag.starts_with("W/") && tag == etag;
+}
+
+/*--- FileETag ---*/
+/*
+    Entity tag of the length bytes of a file starting at offset, by default the whole file,
+    built from its size and modification time. A part of the file gets its own tag, so it never validates another part or the whole file.
+*/
+inline std::string FileETag(struct stat const& st, size_t offset = 0, std::optional<size_t> length = std::nullopt)
+{
+    auto const hex = [](auto value)
+    {
+        char buffer[2 * sizeof(value)];
+        return std::string(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value, 16).ptr);
+    };
+    size_t const size = length.value_or(static_cast<size_t>(st.st_size) - offset);
+    std::string etag = "\"" + hex(st.st_size) + "-" + hex(st.st_mtime);
+    if (offset != 0 || size != static_cast<size_t>(st.st_size))
+    {
+        etag.append("-").append(hex(offset)).append("-").append(hex(size));
+    }
+    return etag + "\"";
+}
+
+/*--- ParseQualityList ---*/
+/*
+    Parses a header made of comma separated values with an optional quality, e.g. Accept or Accept-Encoding.
+    Returns each value, stripped of its parameters, with its quality: 1 when absent, 0 when malformed.
+    The values are views into the header.
+*/
+inline std::vector<std::pair<std::string_view, float>> ParseQualityList(std::string_view header)
+{
+    auto const trim = [](std::string_view str)
+    {
+        while (!str.empty() && std::isspace(static_cast<unsigned char>(str.front())))
+        {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+        {
+            str.remove_suffix(1);
+        }
+        return str;
+    };
+
+    std::vector<std::pair<std::string_view, float>> result;
+    while (!header.empty())
+    {
+        size_t const comma = header.find(',');
+        std::string_view const item = header.substr(0, comma);
+        header = comma == std::string_view::npos ? std::string_view() : header.substr(comma + 1);
+
+        size_t const semicolon = item.find(';');
+        std::string_view const value = trim(item.substr(0, semicolon));
+        if (value.empty())
+        {
+            continue;
+        }
+
+        float quality = 1;
+        std::string_view params = semicolon == std::string_view::npos ? std::string_view() : item.substr(semicolon + 1);
+        while (!params.empty())
+        {
+            size_t const next = params.find(';');
+            std::string_view const param = trim(params.substr(0, next));
+            params = next == std::string_view::npos ? std::string_view() : params.substr(next + 1);
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+            {
+                if (std::from_chars(param.data() + 2, param.data() + param.size(), quality).ec != std::errc())
+                {
+                    quality = 0;
+                }
+            }
+        }
+        result.emplace_back(value, quality);
+    }
+    return result;
+}
+
+/*--- ParseByteRange ---*/
+/*
+    Parses the Range header of a request for a body of size bytes.
+    Returns {Ok, {first, last}}, the half-open range of bytes to send:
+    the whole body if the header is malformed, inverted or asks for several ranges (they are ignored).
+    Returns {Err, {}} if the range cannot be satisfied.
+*/
+inline Result<std::pair<size_t, size_t>> ParseByteRange(std::string_view header, size_t size)
+{
+    auto const parse = [](std::string_view digits) -> std::optional<size_t>
+    {
+        size_t value = 0;
+        if (auto const [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+            digits.empty() || ec != std::errc() || end != digits.data() + digits.size())
+        {
+            return std::nullopt;
+        }
+        return value;
+    };
+
+    std::pair<size_t, size_t> const whole = {0, size};
+    if (header.substr(0, 6) != "bytes=" || header.find(',') != std::string_view::npos)
+    {
+        return { ResultType::Ok, whole };
+    }
+    header.remove_prefix(6);
+
+    size_t const dash = header.find('-');
+    if (dash == std::string_view::npos)
+    {
+        return { ResultType::Ok, whole };
+    }
+
+    std::string_view const last_digits = header.substr(dash + 1);
+    auto const first = parse(header.substr(0, dash));
+    auto const last = parse(last_digits);
+
+    if (!first.has_value())
+    {
+        // Suffix range: the last n bytes.
+        if (!last.has_value() || dash != 0)
+        {
+            return { ResultType::Ok, whole };
+        }
+        if (*last == 0 || size == 0)
+        {
+            return { ResultType::Err, {} };
+        }
+        return { ResultType::Ok, {size - std::min(*last, size), size} };
+    }
+
+    if (!last_digits.empty() && !last.has_value())
+    {
+        return { ResultType::Ok, whole };
+    }
+    if (last.has_value() && *last < *first)
+    {
+        // An invalid range-spec is ignored (RFC 9110 14.1.1).
+        return { ResultType::Ok, whole };
+    }
+    if (*first >= size)
+    {
+        return { ResultType::Err, {} };
+    }
+    return { ResultType::Ok, {*first, last.has_value() ? (*last >= size ? size : *last + 1) : size} };
+}
+
+/*--- ErrorType ---*/
+// Enum containing all the errors related to the plug namespace
+
+enum struct ErrorType
+{
+    INCORRECT_CONN_STATE,
+};
+
+
+/*--- Session ---*/
+// Interface for any type of session.
 // A session is stored in a cookie by default.
 // You can implement a session mechanism based on a database
 // or redis and configue it in the configuration file.
+//
+// Sessions are immutable snapshots shared between connections and session stores:
+// a write never modifies a session, it returns the root of a new one.
+struct Session;
+using SessionPtr = std::shared_ptr<Session const>;
+
 struct Session
 {
     public:
         virtual ~Session() = default;
 
-        virtual std::any const&             get_session(std::string const&) const = 0;
-        virtual std::unique_ptr<Session>    put_session(std::string const&, std::any const&) const = 0;
-        virtual std::unique_ptr<Session>    delete_session(std::string const&) const = 0;
-        virtual std::unique_ptr<Session>    reset_session() const = 0;
-        virtual std::unique_ptr<Session>    clone() const = 0;
-        virtual std::shared_ptr<Session>    shared_clone() const = 0;
+        virtual std::any const& get_session(std::string const&) const = 0;
+        virtual SessionPtr      put_session(std::string const&, std::any const&) const = 0;
+        virtual SessionPtr      delete_session(std::string const&) const = 0;
+        virtual SessionPtr      reset_session() const = 0;
+
+        // Typed values, see TypedKey. A session without slots returns nullptr from both,
+        // its typed values are then kept under TypedKey::name() as an std::any.
+        virtual SlotStore const* get_slots() const { return nullptr; }
+        virtual SessionPtr      put_slots(SlotStore) const { return nullptr; }
 };
 
 /*--- SessionOpt ---*/
@@ -606,6 +1361,7 @@ struct CookieSession : public Session
 {
     private:
         immer::map<std::string, std::any>     storage;
+        SlotStore                             slots;
     public:
 
         using Session::Session;
@@ -615,18 +1371,9 @@ struct CookieSession : public Session
         CookieSession(CookieSession const&) = default;
         CookieSession(immer::map<std::string, std::any> const& s) : storage(s) {}
         CookieSession(immer::map<std::string, std::any>&& s) : storage(std::move(s)) {}
+        CookieSession(immer::map<std::string, std::any> s, SlotStore t) : storage(std::move(s)), slots(std::move(t)) {}
         ~CookieSession()                    = default;
 
-        std::unique_ptr<Session> clone() const override
-        {
-            return std::make_unique<CookieSession>(*this);
-        }
-
-        std::shared_ptr<Session> shared_clone() const override
-        {
-            return std::make_shared<CookieSession>(*this);
-        }
-
         std::any const& get_session(std::string const& key) const override
         {
             static std::any const empty_any;
@@ -637,27 +1384,29 @@ struct CookieSession : public Session
             return empty_any;
         }
 
-        std::unique_ptr<Session> put_session(std::string const& key, std::any const& value) const override
+        SessionPtr put_session(std::string const& key, std::any const& value) const override
         {
-            CookieSession updated_sessions(*this);
-
-            updated_sessions.storage = updated_sessions.storage.set(key, value);
-
-            return std::make_unique<CookieSession>(updated_sessions);
+            return std::make_shared<CookieSession const>(storage.set(key, value), slots);
         }
 
-        std::unique_ptr<Session> delete_session(std::string const& key) const override
+        SessionPtr delete_session(std::string const& key) const override
         {
-            CookieSession updated_sessions(*this);
+            return std::make_shared<CookieSession const>(storage.erase(key), slots);
+        }
 
-            updated_sessions.storage = updated_sessions.storage.erase(key);
+        SessionPtr reset_session() const override
+        {
+            return std::make_shared<CookieSession const>();
+        }
 
-            return std::make_unique<CookieSession>(updated_sessions);
+        SlotStore const* get_slots() const override
+        {
+            return &slots;
         }
 
-        std::unique_ptr<Session> reset_session() const override
+        SessionPtr put_slots(SlotStore s) const override
         {
-            return std::make_unique<CookieSession>();
+            return std::make_shared<CookieSession const>(storage, std::move(s));
         }
 };
 
@@ -680,38 +1429,371 @@ using ConnState = std::variant<Sent, Unsent>;
 
 /*--- HeaderRange---*/
 // Helper for the return type of the getters for Headers.
-using HeaderRange = std::pair<http::Headers::const_iterator, http::Headers::const_iterator>;
+using HeaderRange = std::pair<ImmutHeaders::const_iterator, ImmutHeaders::const_iterator>;
+
+/*--- HeaderBlock ---*/
+/*
+    A set of response headers compiled once, e.g. a security bundle shared by every response.
+
+    The headers are kept as pairs and serialized in wire format ("key: value\r\n" lines),
+    so a transport writing raw HTTP appends the whole block with a single copy.
+    Blocks are sent on top of resp_headers, they are not looked up by get_resp_header.
+    A header of resp_headers overrides the headers of the blocks with the same key: only it is sent,
+    so put_resp_header replaces a header of a block as it replaces any other.
+*/
+struct HeaderBlock
+{
+    std::vector<std::pair<std::string, std::string>>    headers;
+    std::string                                         wire;
+};
+
+using HeaderBlockPtr = std::shared_ptr<HeaderBlock const>;
+
+/*--- MakeHeaderBlock ---*/
+/*
+    Compiles a header block. Keys are sent as written, like the other response headers.
+    Throws std::invalid_argument if a key or a value contains '\r' or '\n'.
+
+    Usage:
+
+    static HeaderBlockPtr const block = MakeHeaderBlock({{"x-frame-options", "SAMEORIGIN"}});
+*/
+inline HeaderBlockPtr MakeHeaderBlock(std::initializer_list<std::pair<std::string_view, std::string_view>> headers)
+{
+    auto block = std::make_shared<HeaderBlock>();
+    block->headers.reserve(headers.size());
+    for (auto const& [key, value] : headers)
+    {
+        if (key.find_first_of("\r\n") != std::string_view::npos || value.find_first_of("\r\n") != std::string_view::npos)
+        {
+            throw std::invalid_argument("header block: line break in " + std::string(key));
+        }
+        auto& header = block->headers.emplace_back(std::string(key), std::string(value));
+        block->wire.append(header.first).append(": ").append(header.second).append("\r\n");
+    }
+    return block;
+}
+
+/*--- Adapter ---*/
+/*
+    Interface between a Conn and the server owning its socket.
+
+    An adapter lets a connection write its response progressively
+    instead of buffering it whole in resp_body.
+    Writes block until the transport accepted the data,
+    so a producer never runs ahead of a slow client (backpressure).
+    Every method returns false if the client went away.
+*/
+struct Conn;
+struct Adapter
+{
+    virtual ~Adapter() = default;
+
+    /*- send_chunked -*/
+    // Writes the status line, the headers and the cookies of a chunked response.
+    virtual bool send_chunked(Conn const& conn) = 0;
+
+    /*- chunk -*/
+    // Writes one chunk of a chunked response.
+    virtual bool chunk(std::string_view data) = 0;
+
+    /*- finish -*/
+    // Terminates the chunked response.
+    virtual bool finish() = 0;
+
+    /*- send_file -*/
+    /*
+        Writes the status line, the headers and the cookies of the response,
+        followed by length bytes of the file descriptor fd starting at offset.
+        The descriptor is only read by the adapter, it is closed by the caller.
+    */
+    virtual bool send_file(Conn const& conn, int fd, size_t offset, size_t length) = 0;
+
+    /*- read_body -*/
+    /*
+        Reads up to length bytes of the request body from the socket, read_length bytes at a time,
+        waiting at most timeout for each read.
+        Returns More while some body is left, Ok once it is done and Err if the read failed.
+        Adapters whose server already buffered the whole body return std::nullopt,
+        the connection is then read from req_body.
+    */
+    virtual std::optional<Result<std::string>> read_body(
+        size_t /*length*/,
+        size_t /*read_length*/,
+        std::chrono::milliseconds /*timeout*/)
+    {
+        return std::nullopt;
+    }
+};
+
+/*--- MultipartReader ---*/
+/*
+    Incremental multipart/form-data parser, fed from the request body one slice at a time.
+
+    The body slices handed out are views into the buffer of the parser, nothing is copied out of it.
+    They stay valid until the next call on the reader, which drops what was consumed.
+    The head of each part is copied once aside, its header views stay valid until the next part.
+    Only the bytes that may still hold a boundary are kept between two slices,
+    so a part of any size is read in constant memory.
+
+    Used by Conn::read_part_headers and Conn::read_part_body.
+*/
+class MultipartReader
+{
+    public:
+        using PartHeaders = std::vector<std::pair<std::string_view, std::string_view>>;
+
+        /*- Status -*/
+        // NEED_DATA: feed more of the body. PART / SLICE / DONE: a value is ready. ERROR: malformed body.
+        enum class Status { NEED_DATA, PART, SLICE, PART_END, DONE, ERROR };
+
+    private:
+        enum class State { HEADERS, BODY, DONE };
+
+        std::string     delimiter;
+        std::string     buffer = "\r\n";   // The first boundary has no line break before it.
+        size_t          position = 0;
+        State           state = State::HEADERS;
+        std::string     head;
+        PartHeaders     headers;
+        size_t          max_header_size;
+        bool            input_done = false;
+
+    public:
+        explicit MultipartReader(std::string_view boundary, size_t header_limit = 64 * 1024)
+        :
+        delimiter("\r\n--" + std::string(boundary)),
+        max_header_size(header_limit)
+        {}
+
+        /*- Boundary -*/
+        // Extracts the boundary of a multipart content type, empty if there is none.
+        static std::string_view Boundary(std::string_view content_type)
+        {
+            size_t const at = boost::to_lower_copy(std::string(content_type)).find("boundary=");
+            if (at == std::string::npos)
+            {
+                return {};
+            }
+            std::string_view boundary = content_type.substr(at + 9);
+            if (!boundary.empty() && boundary.front() == '"')
+            {
+                boundary.remove_prefix(1);
+                return boundary.substr(0, boundary.find('"'));
+            }
+            return boundary.substr(0, boundary.find_first_of("; \t"));
+        }
+
+        /*- compact -*/
+        // Drops the consumed bytes, invalidating the views handed out so far.
+        void compact()
+        {
+            buffer.erase(0, position);
+            position = 0;
+        }
+
+        /*- feed -*/
+        // Appends a slice of the body, last tells whether the body is over.
+        void feed(std::string_view data, bool last)
+        {
+            buffer.append(data);
+            input_done = last;
+        }
+
+        /*- exhausted -*/
+        // Whether the whole body was fed.
+        bool exhausted() const
+        {
+            return input_done;
+        }
+
+        /*- next_part -*/
+        /*
+            Moves to the headers of the next part, skipping what is left of the current one.
+            Returns PART once the headers are available through part_headers, DONE after the last part.
+        */
+        Status next_part()
+        {
+            if (state == State::DONE)
+            {
+                return Status::DONE;
+            }
+
+            size_t const found = buffer.find(delimiter, position);
+            if (found == std::string::npos)
+            {
+                // Everything but a possible beginning of the delimiter can go.
+                position = std::max(position, buffer.size() - std::min(buffer.size(), delimiter.size() - 1));
+                return Status::NEED_DATA;
+            }
+
+            size_t const after = found + delimiter.size();
+            if (buffer.size() < after + 2)
+            {
+                position = found;
+                return Status::NEED_DATA;
+            }
+            if (buffer.compare(after, 2, "--") == 0)
+            {
+                state = State::DONE;
+                position = buffer.size();
+                return Status::DONE;
+            }
+
+            size_t const line_end = buffer.find("\r\n", after);
+            size_t const head_end = buffer.find("\r\n\r\n", line_end == std::string::npos ? after : line_end);
+            if (line_end == std::string::npos || head_end == std::string::npos)
+            {
+                position = found;
+                return buffer.size() - found > max_header_size ? Status::ERROR : Status::NEED_DATA;
+            }
+            if (head_end - found > max_header_size)
+            {
+                return Status::ERROR;
+            }
+
+            // The head is kept aside so that its views outlive the body slices, keys are lowercased in place.
+            head.assign(buffer, line_end + 2, head_end - line_end);
+            headers.clear();
+            for (size_t line = 0, eol = 0; line < head.size(); line = eol + 2)
+            {
+                eol = head.find("\r\n", line);
+                std::string_view const header(head.data() + line, eol - line);
+
+                size_t const colon = header.find(':');
+                if (colon == std::string_view::npos)
+                {
+                    continue;
+                }
+                std::transform(head.begin() + line, head.begin() + line + colon, head.begin() + line,
+                               [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+                std::string_view value = header.substr(colon + 1);
+                value.remove_prefix(std::min(value.find_first_not_of(" \t"), value.size()));
+                value.remove_suffix(value.size() - std::min(value.size(), value.find_last_not_of(" \t") + 1));
+                headers.emplace_back(header.substr(0, colon), value);
+            }
+
+            position = head_end + 4;
+            state = State::BODY;
+            return Status::PART;
+        }
+
+        /*- part_headers -*/
+        // The headers of the current part, with lowercase keys.
+        PartHeaders const& part_headers() const
+        {
+            return headers;
+        }
+
+        /*- next_slice -*/
+        /*
+            Hands out at most length bytes of the body of the current part through slice.
+            Returns SLICE while more of the part is left, PART_END with its last slice.
+        */
+        Status next_slice(size_t length, std::string_view& slice)
+        {
+            if (state != State::BODY)
+            {
+                slice = {};
+                return state == State::DONE ? Status::DONE : Status::PART_END;
+            }
+
+            size_t const found = buffer.find(delimiter, position);
+            size_t const available = found == std::string::npos
+                ? buffer.size() - std::min(buffer.size() - position, delimiter.size() - 1) - position
+                : found - position;
+
+            if (found == std::string::npos && available == 0)
+            {
+                return Status::NEED_DATA;
+            }
+
+            size_t const size = std::min(available, length);
+            slice = std::string_view(buffer.data() + position, size);
+            position += size;
+
+            if (found != std::string::npos && position == found)
+            {
+                state = State::HEADERS;
+                return Status::PART_END;
+            }
+            return Status::SLICE;
+        }
+};
 
 /*--- Conn ---*/
 /*
     This module defines a struct and the main functions for working
     with requests and responses in an HTTP connection.
     
-    Note request headers are normalized to lowercase
-    and response headers are expected to have lowercase keys.
+    Note header keys are looked up case-insensitively
+    and sent with the case they were written with.
+
+    Every transformation comes in two flavours:
+        - Conn const& in, Conn const out: the given connection is copied, value semantics.
+        - Conn&& in, Conn out: the given connection is moved from and updated in place.
+    Plugs receive their connection by value and thread it through the rvalue overloads,
+    so a pipeline of N plugs costs N moves instead of N copies.
+
+        conn = Conn::assign(std::move(conn), "user", user);
 */
 struct Conn
 {
 private:
-    // Should add adapter for socket upgrade such as WebSocket
     // Should add private for private methods. Though I think it is not the best idea.
-    std::shared_ptr<Session>    session;
-    std::shared_ptr<Session>    session_copy;
-    SessionOpt                  session_info;
+    // session is the snapshot the request came with, session_copy the current root.
+    // Both are immutable, copying a connection only copies the pointers.
+    SessionPtr                  session;
+    SessionPtr                  session_copy;
+    SessionOpt                  session_info = SessionOpt::IGNORE;
 
     /*- private put_session -*/
     // Helper for session related interaction
-    static Conn const  put_session(Conn&& conn, std::function<std::unique_ptr<Session>(std::unique_ptr<Session>)> func)
+    static Conn  put_session(Conn&& conn, std::function<SessionPtr(Session const&)> const& func)
     {
-        if (auto ptr = func(conn.session_copy->clone()); ptr == nullptr)
+        if (auto ptr = func(*conn.session_copy); ptr == nullptr)
         {
-            conn.session_copy = std::move(conn.session_copy->reset_session());
+            conn.session_copy = conn.session_copy->reset_session();
         } else
         {
             conn.session_copy = std::move(ptr);
         }
         conn.session_info = SessionOpt::WRITE;
-        return conn;
+        return std::move(conn);
+    }
+
+    /*- private fill_multipart -*/
+    // Feeds the next slice of the body to the multipart parser. Returns false once the body is over or on error.
+    static bool fill_multipart(Conn& conn, ImmutMapString const& opts)
+    {
+        if (conn.multipart->exhausted())
+        {
+            return false;
+        }
+
+        auto const read_length = opts.find("read_length");
+        auto body_opts = ImmutMapString()
+            .set("length", read_length == nullptr ? ShareStr("1000000") : *read_length);
+        if (read_length != nullptr)
+        {
+            body_opts = body_opts.set("read_length", *read_length);
+        }
+        if (auto const read_timeout = opts.find("read_timeout"); read_timeout != nullptr)
+        {
+            body_opts = body_opts.set("read_timeout", *read_timeout);
+        }
+
+        auto read = read_body(std::move(conn), body_opts);
+        conn = Conn(read.second.second);
+        if (read.first == ResultType::Err)
+        {
+            return false;
+        }
+        auto const multipart = conn.multipart;
+        multipart->compact();
+        multipart->feed(read.second.first, read.first == ResultType::Ok);
+        return true;
     }
 
 public:
@@ -724,10 +1806,11 @@ public:
     SharedString    request_path;
     std::optional<int>  port;
     std::array<int, 4>  remote_ip;
-    http::Headers   req_headers;
+    ImmutHeaders    req_headers;
     SharedString    scheme;
     SharedString    query_string;
     SharedString    req_body;
+    size_t          req_body_offset = 0;
 
     // Fetchable fields
     std::optional<ImmutMapString> cookies;
@@ -740,22 +1823,28 @@ public:
     // Response fields
     SharedString                            resp_body;
     immer::map<std::string, ImmutMapString> resp_cookies;
-    http::Headers                           resp_headers;
+    ImmutHeaders                            resp_headers;
+    immer::vector<HeaderBlockPtr>           resp_header_blocks;
     std::optional<int>                      status;
+    // Bytes of the file sent by send_file, set before its before_send callbacks run.
+    size_t                                  resp_file_length = 0;
 
     // Connection fields
     immer::vector<std::function<Conn const(Conn const&)>>   callbacks_before_send;
     immer::map<std::string, std::any>       assigns;
+    SlotStore                               typed_assigns;
+    std::shared_ptr<Adapter>                adapter;
+    std::shared_ptr<MultipartReader>        multipart;
     process::pid_type                       owner;
     bool                                    halted;
     SharedString                            secret_key_base;
     ConnState                               state;
 
     /*- Constructors -*/ 
-    Conn(http::Request&& req, std::shared_ptr<Session> s)
+    Conn(http::Request&& req, SessionPtr s)
     :
     session(s),
-    session_copy(s->shared_clone()),
+    session_copy(s),
     host(ShareStr(req.get_header_value("Host"))),
     method(ShareStr(boost::to_lower_copy(req.method))),
     path_info(BuildPathInfo(req.path)),
@@ -764,10 +1853,36 @@ public:
     request_path(ShareStr(req.path)),
     port(GetPortFromHost(*host)),
     remote_ip({127, 0, 0, 1}/*TODO: default to peer's IP*/),
-    req_headers(req.headers),
-    scheme(ShareStr(req.version)/*TODO: find a way to choose between ws, wss and https*/),
+    req_headers(std::make_move_iterator(req.headers.begin()), std::make_move_iterator(req.headers.end())),
+    scheme(ShareStr("http")/*https is set by the TLS servers, see BasicServer::dispatch*/),
     query_string(GetQueryFromTarget(req.target)),
-    req_body(ShareStr(req.body)),
+    req_body(ShareStr(std::move(req.body))),
+    owner(process::current_pid()),
+    halted(false),
+    secret_key_base(/*TODO: generate key from a crypto lib*/),
+    state(Unsent::UNSET)
+    {}
+
+    /*
+        Builds the connection straight from the request already parsed by websocketpp.
+        Every header and body byte is copied once, from the receive buffer into the Conn.
+    */
+    Conn(websocketpp::http::parser::request const& req, SessionPtr s)
+    :
+    session(s),
+    session_copy(s),
+    host(ShareStr(req.get_header("Host"))),
+    method(ShareStr(boost::to_lower_copy(req.get_method()))),
+    path_info(BuildPathInfo(std::string(GetPathFromTarget(req.get_uri())))),
+    script_name(/*TODO: extract path from route in application*/),
+    request_url(ShareStr(req.get_uri())),
+    request_path(ShareStr(std::string(GetPathFromTarget(req.get_uri())))),
+    port(GetPortFromHost(*host)),
+    remote_ip({127, 0, 0, 1}/*TODO: default to peer's IP*/),
+    req_headers(req.get_headers().begin(), req.get_headers().end()),
+    scheme(ShareStr("http")/*https is set by the TLS servers, see BasicServer::dispatch*/),
+    query_string(GetQueryFromTarget(req.get_uri())),
+    req_body(ShareStr(req.get_body())),
     owner(process::current_pid()),
     halted(false),
     secret_key_base(/*TODO: generate key from a crypto lib*/),
@@ -778,44 +1893,7 @@ public:
     Conn(Conn const&)            = default;
     Conn(Conn&&)                 = default;
     Conn& operator=(Conn&&)      = default;
-    Conn& operator=(Conn const& other)
-    {
-        if (this != &other)
-        {
-            session = other.session ? other.session->clone() : nullptr;
-            session_copy = other.session_copy ? other.session_copy->clone() : nullptr;
-            session_info = other.session_info;
-            host = other.host;
-            method = other.method;
-            path_info = other.path_info;
-            script_name = other.script_name;
-            request_url = other.request_url;
-            request_path = other.request_path;
-            port = other.port;
-            remote_ip = other.remote_ip;
-            req_headers = other.req_headers;
-            scheme = other.scheme;
-            query_string = other.query_string;
-            req_body = other.req_body;
-            cookies = other.cookies;
-            req_cookies = other.req_cookies;
-            body_params = other.body_params;
-            query_params = other.query_params;
-            path_params = other.path_params;
-            params = other.params;
-            resp_body = other.resp_body;
-            resp_cookies = other.resp_cookies;
-            resp_headers = other.resp_headers;
-            status = other.status;
-            callbacks_before_send = other.callbacks_before_send;
-            assigns = other.assigns;
-            owner = other.owner;
-            halted = other.halted;
-            secret_key_base = other.secret_key_base;
-            state = other.state;
-        }
-        return *this;
-    }
+    Conn& operator=(Conn const&) = default;
     ~Conn()                      = default;
 
     /*- assign -*/
@@ -826,22 +1904,76 @@ public:
         so that other plugs in your plug pipeline can access them.
         The assigns storage is a map.
     */
-    static Conn const   assign(Conn const& conn, std::string const& key, std::any const& value)
+    static Conn assign(Conn&& conn, std::string const& key, std::any const& value)
     {
-        Conn    new_conn(conn);
+        Conn    new_conn(std::move(conn));
         new_conn.assigns = new_conn.assigns.set(key, value);
         return new_conn;
     }
 
+    static Conn const   assign(Conn const& conn, std::string const& key, std::any const& value)
+    {
+        return assign(Conn(conn), key, value);
+    }
+
+    /*
+        Assigns a value to a typed key, see TypedKey.
+
+        The value lives in a slot of typed_assigns instead of the string map,
+        and get_assign reads it back without hashing nor any_cast:
+
+            struct CurrentUser : TypedKey<CurrentUser, User> { static constexpr std::string_view key = "current_user"; };
+
+            conn = Conn::assign<CurrentUser>(std::move(conn), user);
+            User const* user = Conn::get_assign<CurrentUser>(conn);
+    */
+    template <typename Key>
+    static Conn assign(Conn&& conn, typename Key::value_type value)
+    {
+        Conn    new_conn(std::move(conn));
+        new_conn.typed_assigns = std::move(new_conn.typed_assigns).template set<Key>(std::move(value));
+        return new_conn;
+    }
+
+    template <typename Key>
+    static Conn const   assign(Conn const& conn, typename Key::value_type value)
+    {
+        return assign<Key>(Conn(conn), std::move(value));
+    }
+
+    /*- get_assign -*/
+    // Returns the value assigned to a typed key, nullptr if there is none.
+    template <typename Key>
+    static typename Key::value_type const*  get_assign(Conn const& conn)
+    {
+        return conn.typed_assigns.template get<Key>();
+    }
+
+    /*- delete_assign -*/
+    // Removes the value assigned to a typed key.
+    template <typename Key>
+    static Conn delete_assign(Conn&& conn)
+    {
+        Conn    new_conn(std::move(conn));
+        new_conn.typed_assigns = std::move(new_conn.typed_assigns).template erase<Key>();
+        return new_conn;
+    }
+
+    template <typename Key>
+    static Conn const   delete_assign(Conn const& conn)
+    {
+        return delete_assign<Key>(Conn(conn));
+    }
+
     /*- merge_assigns -*/
     /*
         Assigns multiple values to keys in the connection.
 
         More performant than multiple call to assign/3
     */
-    static Conn const merge_assigns(Conn const& conn, immer::map<std::string, std::any> const& new_assigns)
+    static Conn merge_assigns(Conn&& conn, immer::map<std::string, std::any> const& new_assigns)
     {
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
         auto mut_assigns = new_conn.assigns.transient();
 
         for (auto const& [key, value]: new_assigns)
@@ -852,29 +1984,59 @@ public:
         return new_conn;
     }
 
+    static Conn const merge_assigns(Conn const& conn, immer::map<std::string, std::any> const& new_assigns)
+    {
+        return merge_assigns(Conn(conn), new_assigns);
+    }
+
     /*- chunk -*/
     /*
         Sends a chunk as part of a chunked response.
 
-        It expects a connection with the state Unsent::CHUNKED.
-        It returns a std::expected<Conn, ErrorType>
-        ErrorType is defined in the namespace core::plug
+        It expects a connection with the state Unsent::CHUNKED, see send_chunked.
+        The chunk is written to the socket through the adapter of the connection
+        before the function returns.
+        Returns an error if the connection is not chunked or if the client went away.
+        An empty chunk is ignored, as it would terminate the response.
     */
-    static Result<Conn const> const   chunk(Conn const& conn, std::string const& chk)
+    static Result<Conn const> const   chunk(Conn&& conn, std::string_view chk)
     {
         if (chk.empty())
         {
-            return { ResultType::Ok, conn };
+            return { ResultType::Ok, std::move(conn) };
         }
 
-        if (std::holds_alternative<Unsent>(conn.state) 
-            && std::get<Unsent>(conn.state) == Unsent::CHUNKED)
+        if (std::holds_alternative<Unsent>(conn.state)
+            && std::get<Unsent>(conn.state) == Unsent::CHUNKED
+            && conn.adapter != nullptr
+            && conn.adapter->chunk(chk))
         {
-            // TODO: write a send chunk through an adapter
-            return { ResultType::Ok, conn };
+            return { ResultType::Ok, std::move(conn) };
         }
 
-        return { ResultType::Err, conn };
+        return { ResultType::Err, std::move(conn) };
+    }
+
+    static Result<Conn const> const   chunk(Conn const& conn, std::string_view chk)
+    {
+        return chunk(Conn(conn), chk);
+    }
+
+    /*- get_session_opt -*/
+    /*
+        Returns what should be done with the session once the pipeline returned:
+        IGNORE until the session is written or configured with configure_session.
+    */
+    static SessionOpt get_session_opt(Conn const& conn)
+    {
+        return conn.session_info;
+    }
+
+    /*- share_session -*/
+    // Returns the session as modified by the pipeline, to be kept by a session store.
+    static SessionPtr share_session(Conn const& conn)
+    {
+        return conn.session_copy;
     }
 
     /*- get_session -*/
@@ -892,30 +2054,91 @@ public:
         return conn.session_copy->get_session(key);
     }
 
+    // Value of a typed key, nullptr if there is none. See TypedKey.
+    template <typename Key>
+    static typename Key::value_type const*  get_session(Conn const& conn)
+    {
+        if (auto const* slots = conn.session_copy->get_slots(); slots != nullptr)
+        {
+            return slots->template get<Key>();
+        }
+        return std::any_cast<typename Key::value_type>(&conn.session_copy->get_session(Key::name()));
+    }
+
     /*- put_session -*/
     /*
         Put the specified value in the session for the given key.
     */
-    static Conn const put_session(Conn const& conn, std::string const& key, std::any const& value)
+    static Conn put_session(Conn&& conn, std::string const& key, std::any const& value)
     {
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
-        new_conn.session_copy = std::move(new_conn.session_copy->put_session(key, value));
+        new_conn.session_copy = new_conn.session_copy->put_session(key, value);
+        new_conn.session_info = SessionOpt::WRITE;
         return new_conn;
     }
 
+    static Conn const put_session(Conn const& conn, std::string const& key, std::any const& value)
+    {
+        return put_session(Conn(conn), key, value);
+    }
+
+    // Put the value of a typed key in the session.
+    template <typename Key>
+    static Conn put_session(Conn&& conn, typename Key::value_type value)
+    {
+        if (auto const* slots = conn.session_copy->get_slots(); slots != nullptr)
+        {
+            conn.session_copy = conn.session_copy->put_slots(slots->template set<Key>(std::move(value)));
+            conn.session_info = SessionOpt::WRITE;
+            return std::move(conn);
+        }
+        return Conn::put_session(std::move(conn), Key::name(), std::any(std::move(value)));
+    }
+
+    template <typename Key>
+    static Conn const put_session(Conn const& conn, typename Key::value_type value)
+    {
+        return put_session<Key>(Conn(conn), std::move(value));
+    }
+
     /*- delete_session -*/
     /*
         Deletes key from session.
     */
-    static Conn const   delete_session(Conn const& conn, std::string const& key)
+    static Conn delete_session(Conn&& conn, std::string const& key)
     {
-        Conn new_conn(conn);
-        new_conn.session_copy = std::move(new_conn.session_copy->delete_session(key));
+        Conn new_conn(std::move(conn));
+        new_conn.session_copy = new_conn.session_copy->delete_session(key);
+        new_conn.session_info = SessionOpt::WRITE;
 
         return new_conn;
     }
 
+    static Conn const   delete_session(Conn const& conn, std::string const& key)
+    {
+        return delete_session(Conn(conn), key);
+    }
+
+    // Deletes a typed key from session.
+    template <typename Key>
+    static Conn delete_session(Conn&& conn)
+    {
+        if (auto const* slots = conn.session_copy->get_slots(); slots != nullptr)
+        {
+            conn.session_copy = conn.session_copy->put_slots(slots->template erase<Key>());
+            conn.session_info = SessionOpt::WRITE;
+            return std::move(conn);
+        }
+        return Conn::delete_session(std::move(conn), Key::name());
+    }
+
+    template <typename Key>
+    static Conn const   delete_session(Conn const& conn)
+    {
+        return delete_session<Key>(Conn(conn));
+    }
+
     /*- clear_session -*/
     /*
         Clears the entire session.
@@ -924,10 +2147,15 @@ public:
         client. If the session should be effectively *dropped*, `configure_session/2`
         should be used with the `:drop` option set to `true`.
     */
+    static Conn clear_session(Conn&& conn)
+    {
+        Conn new_conn(std::move(conn));
+        return Conn::put_session(std::move(new_conn), [](Session const& s) { return s.reset_session(); });
+    }
+
     static Conn const   clear_session(Conn const& conn)
     {
-        Conn new_conn(conn);
-        return Conn::put_session(std::move(new_conn), [](std::unique_ptr<Session> s) { return s->reset_session(); });
+        return clear_session(Conn(conn));
     }
 
     /*- configure_session -*/
@@ -936,24 +2164,29 @@ public:
 
         Options:
             - "renew" -> generates a new session id for the cookie
-            - "drop"  -> drops the session, a session cookie will not be included in the response
+            - "drop"  -> drops the session, the session cookie of the request is expired by the response
             - "ignore"-> ignore all changes made to the session in this request cycle        
     */
-    static Result<Conn const>   configure_session(Conn const& conn, SessionOpt const& opt)
+    static Result<Conn const>   configure_session(Conn&& conn, SessionOpt const& opt)
     {
         if (std::holds_alternative<Sent>(conn.state))
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
 
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         if (opt != SessionOpt::WRITE)
         {
             new_conn.session_info = opt;
         }
 
-        return { ResultType::Ok, new_conn };
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const>   configure_session(Conn const& conn, SessionOpt const& opt)
+    {
+        return configure_session(Conn(conn), opt);
     }
 
     /*- get_req_header -*/
@@ -989,25 +2222,29 @@ public:
 
         Returns an error if the connection has already been sent, chunked or upgraded. 
     */
-    static Result<Conn const>   put_req_header(Conn const& conn, std::string const& key, std::string const& value)
+    static Result<Conn const>   put_req_header(Conn&& conn, std::string const& key, std::string const& value)
     {
         if (std::holds_alternative<Sent>(conn.state)
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
             || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
         if (key == "host")
         {
             new_conn.host = ShareStr(value);
         }
         else
         {
-            new_conn.req_headers.erase(key);
-            new_conn.req_headers.insert({key, value});
+            new_conn.req_headers = new_conn.req_headers.set(key, value);
         }
-        return { ResultType::Ok, new_conn };
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const>   put_req_header(Conn const& conn, std::string const& key, std::string const& value)
+    {
+        return put_req_header(Conn(conn), key, value);
     }
     
     /*- update_req_header -*/
@@ -1019,7 +2256,7 @@ public:
         Only the first value of the header key is updated if present.
     */
     static Result<Conn const> update_req_header(
-        Conn const& conn,
+        Conn&& conn,
         std::string const& key,
         std::string const& initial,
         std::function<std::string(std::string const&)> func)
@@ -1028,24 +2265,23 @@ public:
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
             || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
 
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
-        if (auto handle = new_conn.req_headers.extract(key); handle.empty())
-        {
-            handle.key() = key;
-            handle.mapped() = initial;
-            new_conn.req_headers.insert(std::move(handle));
-        }
-        else
-        {
-            handle.mapped() = func(handle.mapped());
-            new_conn.req_headers.insert(std::move(handle));
-        }
+        new_conn.req_headers = new_conn.req_headers.update(key, initial, func);
 
-        return { ResultType::Ok, new_conn };
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const> update_req_header(
+        Conn const& conn,
+        std::string const& key,
+        std::string const& initial,
+        std::function<std::string(std::string const&)> func)
+    {
+        return update_req_header(Conn(conn), key, initial, std::move(func));
     }
 
     /*- prepend_req_headers -*/
@@ -1065,24 +2301,31 @@ public:
 
         Returns an error if the connection has already been sent, chunked or upgraded.
     */
-    static Result<Conn const> prepend_req_headers(Conn const& conn, http::Headers&& headers)
+    static Result<Conn const> prepend_req_headers(Conn&& conn, http::Headers&& headers)
     {
         if (std::holds_alternative<Sent>(conn.state)
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
             || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
 
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         if (auto host = headers.find("host"); host != headers.end())
         {
             new_conn.host = ShareStr(host->second);
             headers.erase("host");
         }
-        new_conn.req_headers.merge(std::move(headers));
-        return { ResultType::Ok, new_conn };
+        new_conn.req_headers = new_conn.req_headers.prepend(
+            std::make_move_iterator(headers.begin()),
+            std::make_move_iterator(headers.end()));
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const> prepend_req_headers(Conn const& conn, http::Headers&& headers)
+    {
+        return prepend_req_headers(Conn(conn), std::move(headers));
     }
 
     /*- merge_req_headers -*/
@@ -1092,27 +2335,31 @@ public:
 
         Returns an error if the connection has already been sent, chunked or upgraded. 
     */
-    static Result<Conn const> merge_req_headers(Conn const& conn, http::Headers&& headers)
+    static Result<Conn const> merge_req_headers(Conn&& conn, http::Headers&& headers)
     {
         if (std::holds_alternative<Sent>(conn.state)
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
             || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
 
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
         if (auto host = headers.find("host"); host != headers.end())
         {
             new_conn.host = ShareStr(host->second);
             headers.erase("host");
         }
-        for (auto&& hd : headers)
+        for (auto& hd : headers)
         {
-            new_conn.req_headers.erase(hd.first);
-            new_conn.req_headers.insert(std::move(hd));
+            new_conn.req_headers = new_conn.req_headers.set(hd.first, std::move(hd.second));
         }
-        return { ResultType::Ok, new_conn };
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const> merge_req_headers(Conn const& conn, http::Headers&& headers)
+    {
+        return merge_req_headers(Conn(conn), std::move(headers));
     }
 
     /*- delete_req_header -*/
@@ -1120,23 +2367,29 @@ public:
         Deletes a request header if present.
         Return an error if the response is already sent.
     */
-    static Result<Conn const> const delete_req_header(Conn const& conn, std::string const& key)
+    static Result<Conn const> const delete_req_header(Conn&& conn, std::string const& key)
     {
         if (std::holds_alternative<Sent>(conn.state))
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
 
-        Conn new_con(conn);
-        new_con.req_headers.erase(key);
-        return { ResultType::Ok, new_con };
+        Conn new_con(std::move(conn));
+        new_con.req_headers = new_con.req_headers.erase(key);
+        return { ResultType::Ok, std::move(new_con) };
+    }
+
+    static Result<Conn const> const delete_req_header(Conn const& conn, std::string const& key)
+    {
+        return delete_req_header(Conn(conn), key);
     }
 
     /*- fetch_query_params-*/
     /*
     Fetches query parameters from the query string.
 
-    Params are decoded as "x-www-form-urlencoded" in which key/value pairs are separated by & and keys are separated from values by =.
+    Params are decoded as "x-www-form-urlencoded" in which key/value pairs are separated by & and keys are separated from values by =,
+    see DecodeQuery. A malformed percent-encoding or, when validated, invalid UTF-8 sets the status to 400.
 
     This function does not fetch parameters from the body.
     Options
@@ -1144,86 +2397,58 @@ public:
 
         - "validate_utf8" - boolean that tells whether or not to validate the keys and values of the decoded query string are UTF-8 encoded. Defaults to true.
     */
-    static Conn const fetch_query_params(Conn const& conn, ImmutMapString&& opts = {})
+    static Conn fetch_query_params(Conn&& conn, ImmutMapString&& opts = {})
     {
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         if (!new_conn.query_params.has_value())
         {
-            auto opts_len = opts.find("length");
-            auto max_length = opts_len ? std::stof(**opts_len) : 1000000;
+            auto const opts_length = opts.find("length");
+            size_t const max_length = opts_length ? std::stoull(**opts_length) : 1000000;
+            auto const opts_validate_utf8 = opts.find("validate_utf8");
+            bool const validate_utf8 = !(opts_validate_utf8 && **opts_validate_utf8 == "false");
 
-            if (new_conn.query_string->length() > max_length)
+            std::string_view const query = new_conn.query_string ? std::string_view(*new_conn.query_string) : std::string_view();
+            if (query.size() > max_length)
             {
                 new_conn.status = std::make_optional(414);
                 return new_conn;
             }
 
-            auto query_params = ImmutMapString().transient();
-            boost::char_separator sep("&");
-            boost::tokenizer<boost::char_separator<char>> tok(*new_conn.query_string, sep);
-
-            for (auto const& param : tok)
+            auto query_params = DecodeQuery(query, validate_utf8);
+            if (!query_params.has_value())
             {
-                auto opts_validate_utf8 = opts.find("length");
-                std::string validate_ut8 = opts_validate_utf8 && **opts_validate_utf8 == "false" ? "false" : "true";
-
-                if (auto equal_sign = param.find("="); equal_sign == std::string::npos)
-                {
-                    new_conn.status = std::make_optional(414);
-                    return new_conn;
-                }
-                else
-                {
-                    std::string key = param.substr(0, equal_sign);
-                    std::string value = param.substr(equal_sign + 1);
-
-
-                    if (validate_ut8 == "true")
-                    {
-                        char const* ptr = param.c_str();
-                        char const* end = ptr + param.length();
-
-                        while (ptr < end)
-                        {
-                            auto c = boost::locale::utf::utf_traits<char>::decode(ptr, end);   
-                            if (c == boost::locale::utf::illegal || c == boost::locale::utf::incomplete)
-                            {
-                                new_conn.status = std::make_optional(414);
-                                return new_conn;
-                            }
-                        }
-                    }
-                    query_params.set(key, ShareStr(value));
-                }
+                new_conn.status = std::make_optional(400);
+                return new_conn;
             }
-
-            new_conn.query_params = std::make_optional(query_params.persistent());
+            new_conn.query_params = std::move(query_params);
         }
 
         return new_conn;
     }
 
+    static Conn const fetch_query_params(Conn const& conn, ImmutMapString&& opts = {})
+    {
+        return fetch_query_params(Conn(conn), std::move(opts));
+    }
+
     /*- fetch_cookies -*/
     /*
         Fetch the cookies from req_headers and resp_cookies.
         You need to fetch the cookies in order to access them.
     */
-    static Conn const fetch_cookies(Conn const& conn, immer::set<std::string>&& opts = {})
+    static Conn fetch_cookies(Conn&& conn, immer::set<std::string>&& opts = {})
     {
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         if (!new_conn.req_cookies.has_value())
         {
             ImmutMapString req_cookies;
         
-            for (auto const& [tag, cookie] : new_conn.req_headers)
+            auto const [first, last] = new_conn.req_headers.equal_range("cookie");
+            for (auto it = first; it != last; ++it)
             {
-                if (tag != "cookie")
-                {
-                    continue;
-                }
-                req_cookies = functional::merge(req_cookies, ParseCookie(cookie));
+                req_cookies = functional::merge(req_cookies, ParseCookie(it->second));
             }
             
             ImmutMapString cookies = functional::reduce(
@@ -1255,14 +2480,19 @@ public:
         return new_conn;
     }
 
+    static Conn const fetch_cookies(Conn const& conn, immer::set<std::string>&& opts = {})
+    {
+        return fetch_cookies(Conn(conn), std::move(opts));
+    }
+
     /*- delete_resp_cookie -*/
     /*
         Deletes a response cookie
         Deleting a cookie requires the same options as to when the cookie was put.
     */
-    static Conn const delete_resp_cookie(Conn const& conn, std::string const& key, ImmutMapString&& opts = {})
+    static Conn delete_resp_cookie(Conn&& conn, std::string const& key, ImmutMapString&& opts = {})
     {
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         opts = opts.set("universal_time", ShareStr("Thu, 01 Jan 1970 00:00:00 GMT")) ;
         opts = opts.set("max_age", ShareStr("0"));
@@ -1280,6 +2510,11 @@ public:
         return new_conn;
     }
 
+    static Conn const delete_resp_cookie(Conn const& conn, std::string const& key, ImmutMapString&& opts = {})
+    {
+        return delete_resp_cookie(Conn(conn), key, std::move(opts));
+    }
+
     /*- put_resp_cookie -*/
     /*
         Puts a response cookie in the connection.
@@ -1304,7 +2539,7 @@ public:
         with the name of the cookies that are either signed or encrypted.
     */
     static Result<Conn const> const put_resp_cookie(
-        Conn const& conn,
+        Conn&& conn,
         std::string const& key,
         std::string const& value,
         ImmutMapString&& opts = {}
@@ -1322,16 +2557,26 @@ public:
 
         if (sign && encrypt)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
         (void)max_age; // Needed for the sign/encrypt part that is to be done.
 
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         opts = opts.insert({"value", ShareStr(key + "_cookie=" + value)});
         new_conn.resp_cookies = new_conn.resp_cookies.set(key, opts);
 
-        return { ResultType::Ok, new_conn };
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const> const put_resp_cookie(
+        Conn const& conn,
+        std::string const& key,
+        std::string const& value,
+        ImmutMapString&& opts = {}
+    )
+    {
+        return put_resp_cookie(Conn(conn), key, value, std::move(opts));
     }
 
     /*- merge_resp_headers -*/
@@ -1340,22 +2585,26 @@ public:
 
         Returns an error if the connection has already been sent, chunked or upgraded. 
     */
-    static Result<Conn const> merge_resp_headers(Conn const& conn, http::Headers const& headers)
+    static Result<Conn const> merge_resp_headers(Conn&& conn, http::Headers const& headers)
     {
         if (std::holds_alternative<Sent>(conn.state)
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
             || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
 
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
         for (auto const& hd : headers)
         {
-            new_conn.resp_headers.erase(hd.first);
-            new_conn.resp_headers.insert(hd);
+            new_conn.resp_headers = new_conn.resp_headers.set(hd.first, hd.second);
         }
-        return { ResultType::Ok, new_conn };
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const> merge_resp_headers(Conn const& conn, http::Headers const& headers)
+    {
+        return merge_resp_headers(Conn(conn), headers);
     }
 
     /*- prepend_resp_header -*/
@@ -1371,21 +2620,25 @@ public:
 
         Returns an error if the connection has already been sent, chunked or upgraded.
 
-        The headers variable is not const because the merge method does not take a const reference.
-        Read the documentation of std::unordered_multimap::merge for more information.
+        The headers are copied into the connection, the headers variable is left untouched.
     */
-    static Result<Conn const> prepend_resp_header(Conn const& conn, http::Headers& headers)
+    static Result<Conn const> prepend_resp_header(Conn&& conn, http::Headers& headers)
     {
         if (std::holds_alternative<Sent>(conn.state)
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
             || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
 
-        Conn new_conn(conn);
-        new_conn.resp_headers.merge(headers);
-        return { ResultType::Ok, new_conn };
+        Conn new_conn(std::move(conn));
+        new_conn.resp_headers = new_conn.resp_headers.prepend(headers.begin(), headers.end());
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const> prepend_resp_header(Conn const& conn, http::Headers& headers)
+    {
+        return prepend_resp_header(Conn(conn), headers);
     }
 
     /*- put_resp_header -*/
@@ -1400,7 +2653,7 @@ public:
         Returns an error if the connection is sent, chunked or upgraded.
         Returns an error if the header value contains '\r' or '\n' characters.
     */
-    static Result<Conn const>   put_resp_header(Conn const& conn, std::string const& key, std::string const& value)
+    static Result<Conn const>   put_resp_header(Conn&& conn, std::string const& key, std::string const& value)
     {
         if (std::holds_alternative<Sent>(conn.state)
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
@@ -1408,13 +2661,47 @@ public:
             || value.rfind("\n") != std::string::npos
             || value.rfind("\r") != std::string::npos)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
+        }
+
+        Conn new_conn(std::move(conn));
+        new_conn.resp_headers = new_conn.resp_headers.set(key, value);
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const>   put_resp_header(Conn const& conn, std::string const& key, std::string const& value)
+    {
+        return put_resp_header(Conn(conn), key, value);
+    }
+
+    /*- put_resp_header_block -*/
+    /*
+        Adds a compiled header block to the response, see HeaderBlock.
+        The block is shared, not copied: sending it costs one append per response.
+        A block already on the response is not added twice.
+
+        Returns an error if the connection is sent, chunked or upgraded.
+    */
+    static Result<Conn const>   put_resp_header_block(Conn&& conn, HeaderBlockPtr block)
+    {
+        if (std::holds_alternative<Sent>(conn.state)
+            || std::get<Unsent>(conn.state) == Unsent::CHUNKED
+            || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
+        {
+            return { ResultType::Err, std::move(conn) };
+        }
+
+        Conn new_conn(std::move(conn));
+        if (std::find(new_conn.resp_header_blocks.begin(), new_conn.resp_header_blocks.end(), block) == new_conn.resp_header_blocks.end())
+        {
+            new_conn.resp_header_blocks = new_conn.resp_header_blocks.push_back(std::move(block));
         }
+        return { ResultType::Ok, std::move(new_conn) };
+    }
 
-        Conn new_conn(conn);
-        new_conn.resp_headers.erase(key);
-        new_conn.resp_headers.insert({key, value});
-        return { ResultType::Ok, new_conn };
+    static Result<Conn const>   put_resp_header_block(Conn const& conn, HeaderBlockPtr block)
+    {
+        return put_resp_header_block(Conn(conn), std::move(block));
     }
 
     /*- delete_resp_header -*/
@@ -1423,18 +2710,23 @@ public:
 
         Returns an error if the connection is sent, chunked or upgraded.
     */
-    static Result<Conn const>   delete_resp_header(Conn const& conn, std::string const& key)
+    static Result<Conn const>   delete_resp_header(Conn&& conn, std::string const& key)
     {
         if (std::holds_alternative<Sent>(conn.state)
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
             || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
 
-        Conn new_conn(conn);
-        new_conn.resp_headers.erase(key);
-        return { ResultType::Ok, new_conn };
+        Conn new_conn(std::move(conn));
+        new_conn.resp_headers = new_conn.resp_headers.erase(key);
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const>   delete_resp_header(Conn const& conn, std::string const& key)
+    {
+        return delete_resp_header(Conn(conn), key);
     }
 
     /*- update_resp_header -*/
@@ -1446,7 +2738,7 @@ public:
         Only the first value of the header key is updated if present.
     */
     static Result<Conn const> update_resp_header(
-        Conn const& conn,
+        Conn&& conn,
         std::string const& key,
         std::string const& initial,
         std::function<std::string(std::string const&)> func)
@@ -1455,24 +2747,23 @@ public:
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
             || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
 
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
-        if (auto handle = new_conn.resp_headers.extract(key); handle.empty())
-        {
-            handle.key() = key;
-            handle.mapped() = initial;
-            new_conn.resp_headers.insert(std::move(handle));
-        }
-        else
-        {
-            handle.mapped() = func(handle.mapped());
-            new_conn.resp_headers.insert(std::move(handle));
-        }
+        new_conn.resp_headers = new_conn.resp_headers.update(key, initial, func);
+
+        return { ResultType::Ok, std::move(new_conn) };
+    }
 
-        return { ResultType::Ok, new_conn };
+    static Result<Conn const> update_resp_header(
+        Conn const& conn,
+        std::string const& key,
+        std::string const& initial,
+        std::function<std::string(std::string const&)> func)
+    {
+        return update_resp_header(Conn(conn), key, initial, std::move(func));
     }
 
     /*- get_resp_header -*/
@@ -1502,16 +2793,22 @@ public:
 
     /*- halt -*/
     /*
-        Halts the plug pipeline (not yet implemented)
+        Halts the plug pipeline.
+        The remaining plugs of the pipeline and the route handler are not called.
     */
-    static Conn const halt(Conn const& conn)
+    static Conn halt(Conn&& conn)
     {
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         new_conn.halted = true;
         return new_conn;
     }
 
+    static Conn const halt(Conn const& conn)
+    {
+        return halt(Conn(conn));
+    }
+
     /*- put_resp_content_type -*/
     /*
         Sets the value of the "content-type" response header taking into account the charset.
@@ -1519,12 +2816,17 @@ public:
         If charset is "none", the value of the "content-type" response header
         won't specify a charset.    
     */
-    static Conn const put_resp_content_type(Conn const& conn, std::string const& content_type, std::string const& charset = "utf-8")
+    static Conn put_resp_content_type(Conn&& conn, std::string const& content_type, std::string const& charset = "utf-8")
     {
         std::string content = charset == "none"
             ? content_type
             : content_type + "; charset=" + charset;
-        return put_resp_header(conn, "Content-Type", content) CHAIN( unwrap );
+        return put_resp_header(std::move(conn), "Content-Type", content) CHAIN( unwrap );
+    }
+
+    static Conn const put_resp_content_type(Conn const& conn, std::string const& content_type, std::string const& charset = "utf-8")
+    {
+        return put_resp_content_type(Conn(conn), content_type, charset);
     }
 
     /*- put_status -*/
@@ -1533,18 +2835,23 @@ public:
         
         Returns an error if the connection has already been sent, chunked or upgraded.
     */
-    static Result<Conn const> put_status(Conn const& conn, uint32_t status)
+    static Result<Conn const> put_status(Conn&& conn, uint32_t status)
     {
         if (std::holds_alternative<Sent>(conn.state)
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
             || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
         {
-            return { ResultType::Err, conn };
+            return { ResultType::Err, std::move(conn) };
         }
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         new_conn.status = std::make_optional(status);
-        return { ResultType::Ok, new_conn };
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const> put_status(Conn const& conn, uint32_t status)
+    {
+        return put_status(Conn(conn), status);
     }
 
     /*- read_body -*/
@@ -1568,6 +2875,11 @@ public:
         as feather::plug will not cache the result of these operations.
         If you need to access the body multiple times, it is your responsibility to store it.
 
+        The body is read from the socket through the adapter of the connection
+        when its server streams request bodies.
+        When the server already buffered the whole body, successive calls hand out req_body
+        in slices of at most length bytes, the position is kept in req_body_offset.
+
         This function is able to handle both chunked and identity transfer-encoding by default.
         Options:
             - "length"      : sets the maximum number of bytes to read from the body on every call, defaults to 8_000_000 bytes
@@ -1578,15 +2890,161 @@ public:
         For example, setting the length to 8_000_000 may end up reading
         some hundred bytes more from the socket until we halt.
     */
-    static Result<std::pair<std::string, Conn const>> read_body(Conn const& conn, ImmutMapString&& opts = {})
+    static Result<std::pair<std::string, Conn>> read_body(Conn&& conn, ImmutMapString const& opts = {})
+    {
+        auto const option = [&opts](std::string const& key, size_t fallback)
+        {
+            auto const value = opts.find(key);
+            return value == nullptr ? fallback : static_cast<size_t>(std::stoull(**value));
+        };
+        size_t const length = option("length", 8000000);
+        size_t const read_length = option("read_length", 1000000);
+        std::chrono::milliseconds const read_timeout(option("read_timeout", 15000));
+
+        Conn new_conn(std::move(conn));
+
+        if (new_conn.adapter != nullptr)
+        {
+            if (auto read = new_conn.adapter->read_body(length, read_length, read_timeout); read.has_value())
+            {
+                return { read->first, { read->second, std::move(new_conn) } };
+            }
+        }
+
+        // The body was buffered by the server: hand it out in slices of at most length bytes.
+        std::string_view const body = new_conn.req_body ? std::string_view(*new_conn.req_body) : std::string_view();
+        size_t const offset = std::min(new_conn.req_body_offset, body.size());
+        std::string slice(body.substr(offset, length));
+
+        new_conn.req_body_offset = offset + slice.size();
+        ResultType const type = new_conn.req_body_offset < body.size() ? ResultType::More : ResultType::Ok;
+        return { type, { std::move(slice), std::move(new_conn) } };
+    }
+
+    static Result<std::pair<std::string, Conn>> read_body(Conn const& conn, ImmutMapString const& opts = {})
+    {
+        return read_body(Conn(conn), opts);
+    }
+
+    /*- read_part_headers -*/
+    /*
+        Reads the headers of the next part of a multipart request body.
+
+        Returns {ResultType::Ok, {headers, conn}} with the headers of the part,
+        or {ResultType::Ok, {std::nullopt, conn}} once there is no part left.
+        Returns an error if the request is not multipart, the body is malformed or the socket failed.
+        The rest of the previous part, if it was not read, is skipped.
+
+        The headers are views into the multipart parser of the connection (see MultipartReader),
+        with lowercase keys. They stay valid until the next read_part_headers call on the connection.
+
+        Options:
+            - "length"      : sets the maximum size of the headers of a part, defaults to 64_000 bytes
+            - "read_length" : sets the amount of bytes read from the body at one time, defaults to 1_000_000 bytes
+            - "read_timeout": sets the timeout of each read, defaults to 15_000 milliseconds
+    */
+    static Result<std::pair<std::optional<MultipartReader::PartHeaders>, Conn>> read_part_headers(
+        Conn&& conn,
+        ImmutMapString const& opts = {})
+    {
+        Conn new_conn(std::move(conn));
+
+        if (new_conn.multipart == nullptr)
+        {
+            auto const type = new_conn.req_headers.find("content-type");
+            std::string_view const boundary = type == new_conn.req_headers.end()
+                ? std::string_view()
+                : MultipartReader::Boundary(type->second);
+            if (boundary.empty() || !boost::istarts_with(type->second, "multipart/"))
+            {
+                return { ResultType::Err, { std::nullopt, std::move(new_conn) } };
+            }
+            auto const limit = opts.find("length");
+            new_conn.multipart = std::make_shared<MultipartReader>(boundary, limit == nullptr ? 64000 : std::stoull(**limit));
+        }
+
+        MultipartReader& reader = *new_conn.multipart;
+        reader.compact();
+        while (true)
+        {
+            switch (reader.next_part())
+            {
+                case MultipartReader::Status::PART:
+                    return { ResultType::Ok, { reader.part_headers(), std::move(new_conn) } };
+                case MultipartReader::Status::DONE:
+                    return { ResultType::Ok, { std::nullopt, std::move(new_conn) } };
+                case MultipartReader::Status::NEED_DATA:
+                    if (fill_multipart(new_conn, opts))
+                    {
+                        continue;
+                    }
+                    [[fallthrough]];
+                default:
+                    return { ResultType::Err, { std::nullopt, std::move(new_conn) } };
+            }
+        }
+    }
+
+    static Result<std::pair<std::optional<MultipartReader::PartHeaders>, Conn>> read_part_headers(
+        Conn const& conn,
+        ImmutMapString const& opts = {})
+    {
+        return read_part_headers(Conn(conn), opts);
+    }
+
+    /*- read_part_body -*/
+    /*
+        Reads a slice of the body of the current part, after read_part_headers.
+
+        Returns {ResultType::More, {slice, conn}} while some of the part is left,
+        and {ResultType::Ok, {slice, conn}} with its last slice.
+        Returns an error if there is no current part, the body is malformed or the socket failed.
+
+        The slice is a view into the buffer of the multipart parser and stays valid
+        until the next read_part_* call on the connection: a part of any size is read in constant memory.
+
+        Options:
+            - "length"      : sets the maximum size of a slice, defaults to 8_000_000 bytes
+            - "read_length" : sets the amount of bytes read from the body at one time, defaults to 1_000_000 bytes
+            - "read_timeout": sets the timeout of each read, defaults to 15_000 milliseconds
+    */
+    static Result<std::pair<std::string_view, Conn>> read_part_body(Conn&& conn, ImmutMapString const& opts = {})
+    {
+        Conn new_conn(std::move(conn));
+        if (new_conn.multipart == nullptr)
+        {
+            return { ResultType::Err, { std::string_view(), std::move(new_conn) } };
+        }
+
+        auto const limit = opts.find("length");
+        size_t const length = limit == nullptr ? 8000000 : std::stoull(**limit);
+
+        MultipartReader& reader = *new_conn.multipart;
+        reader.compact();
+        std::string_view slice;
+        while (true)
+        {
+            switch (reader.next_slice(length, slice))
+            {
+                case MultipartReader::Status::SLICE:
+                    return { ResultType::More, { slice, std::move(new_conn) } };
+                case MultipartReader::Status::PART_END:
+                    return { ResultType::Ok, { slice, std::move(new_conn) } };
+                case MultipartReader::Status::NEED_DATA:
+                    if (fill_multipart(new_conn, opts))
+                    {
+                        continue;
+                    }
+                    [[fallthrough]];
+                default:
+                    return { ResultType::Err, { std::string_view(), std::move(new_conn) } };
+            }
+        }
+    }
+
+    static Result<std::pair<std::string_view, Conn>> read_part_body(Conn const& conn, ImmutMapString const& opts = {})
     {
-        std::string body = "";
-        auto const opt_len = opts.find("length");
-        int const max_len = opt_len == nullptr
-            ? 8000000
-            : std::stof(**opt_len);
-        (void)max_len; // TODO
-        return {ResultType::Ok, {body, conn}};
+        return read_part_body(Conn(conn), opts);
     }
 
     /*- register_before_send -*/
@@ -1594,20 +3052,45 @@ public:
         Registers a callback to be invoked before the response is sent.
         Callbacks are invoked in the order they are defined.
     */
-    static Conn const register_before_send(Conn const& conn, std::function<Conn const(Conn const&)> callback)
+    static Conn register_before_send(Conn&& conn, std::function<Conn const(Conn const&)> callback)
     {
         if (std::holds_alternative<Sent>(conn.state))
         {
             throw std::logic_error("Conn already sent");
         }
         
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         new_conn.callbacks_before_send = new_conn.callbacks_before_send.push_back(callback);
 
         return new_conn;
     }
 
+    static Conn const register_before_send(Conn const& conn, std::function<Conn const(Conn const&)> callback)
+    {
+        return register_before_send(Conn(conn), std::move(callback));
+    }
+
+    /*- run_before_send -*/
+    /*
+        Invokes the callbacks registered with register_before_send,
+        in the order they were registered, and clears them.
+        Called right before the response is written.
+    */
+    static Conn run_before_send(Conn&& conn)
+    {
+        auto const callbacks = conn.callbacks_before_send;
+
+        Conn new_conn(std::move(conn));
+        new_conn.callbacks_before_send = {};
+
+        for (auto const& callback : callbacks)
+        {
+            new_conn = callback(new_conn);
+        }
+        return new_conn;
+    }
+
     /*- resp -*/
     /*
         Sets the response to the given status and body.
@@ -1617,8 +3100,11 @@ public:
 
         If you also want to send the response, use send_resp/1 after this
         or use send_resp/3.
+
+        The body is taken by value: pass an rvalue to move it into the response without a copy,
+        or a SharedString, e.g. from a BodyBuffer, to share it.
     */
-    static Conn const resp(Conn const& conn, uint32_t status, std::string const& body)
+    static Conn resp(Conn&& conn, uint32_t status, SharedString body)
     {
         if (std::holds_alternative<Sent>(conn.state)
             || std::get<Unsent>(conn.state) == Unsent::CHUNKED
@@ -1627,34 +3113,227 @@ public:
             throw std::logic_error("Conn already sent");
         }
 
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         new_conn.state = Unsent::SET;
         new_conn.status = std::make_optional(status);
-        new_conn.resp_body = ShareStr(body);
+        new_conn.resp_body = std::move(body);
 
         return new_conn;
     }
 
+    static Conn const resp(Conn const& conn, uint32_t status, SharedString body)
+    {
+        return resp(Conn(conn), status, std::move(body));
+    }
+
+    static Conn resp(Conn&& conn, uint32_t status, std::string body)
+    {
+        return resp(std::move(conn), status, ShareStr(std::move(body)));
+    }
+
+    static Conn const resp(Conn const& conn, uint32_t status, std::string body)
+    {
+        return resp(Conn(conn), status, ShareStr(std::move(body)));
+    }
+
+    /*- send_chunked -*/
+    /*
+        Sends the response headers as a chunked response.
+
+        The before_send callbacks are run, the state being Unsent::SET_CHUNKED so they can tell,
+        then the status line, the headers and the cookies are written to the socket straight away
+        through the adapter of the connection. A callback may wrap that adapter, e.g. to compress the chunks.
+        The body is then streamed with chunk, and the response is terminated by the server
+        once the pipeline returns.
+
+        It sets the connection state to Unsent::CHUNKED.
+        Raises an error if the connection was already sent, chunked or upgraded.
+        Returns an error if the connection has no adapter or if the client went away.
+    */
+    static Result<Conn const> send_chunked(Conn&& conn, uint32_t status)
+    {
+        if (std::holds_alternative<Sent>(conn.state)
+            || std::get<Unsent>(conn.state) == Unsent::CHUNKED
+            || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
+        {
+            throw std::logic_error("Conn already sent");
+        }
+
+        Conn new_conn(std::move(conn));
+        new_conn.status = std::make_optional(status);
+        new_conn.state = Unsent::SET_CHUNKED;
+        new_conn = run_before_send(std::move(new_conn));
+        new_conn.state = Unsent::CHUNKED;
+
+        if (new_conn.adapter == nullptr || !new_conn.adapter->send_chunked(new_conn))
+        {
+            return { ResultType::Err, std::move(new_conn) };
+        }
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const> send_chunked(Conn const& conn, uint32_t status)
+    {
+        return send_chunked(Conn(conn), status);
+    }
+
+    /*- send_file -*/
+    /*
+        Sends the file at path as the response, with the given status.
+
+        Only length bytes starting at offset are sent, by default the rest of the file.
+        The file is written to the socket by the adapter without being read into the connection.
+
+        When the status is 200, the response carries ETag and Last-Modified validators,
+        the ETag covering only the part of the file being sent, and:
+            - If-None-Match or If-Modified-Since matching the file turn it into a 304,
+            - a single byte range in the Range header turns it into a 206,
+              or a 416 when the range cannot be satisfied (unless If-Range does not match).
+
+        The before_send callbacks are run, the state being Unsent::SET_FILE, and the connection is marked as sent.
+        Raises an error if the connection was already sent, chunked or upgraded.
+        Returns an error if the file cannot be opened, if offset is past its end,
+        if the connection has no adapter or if the client went away.
+    */
+    static Result<Conn const> send_file(
+        Conn&& conn,
+        uint32_t status,
+        std::string const& path,
+        size_t offset = 0,
+        std::optional<size_t> length = std::nullopt)
+    {
+        if (std::holds_alternative<Sent>(conn.state)
+            || std::get<Unsent>(conn.state) == Unsent::CHUNKED
+            || std::get<Unsent>(conn.state) == Unsent::UPGRADED)
+        {
+            throw std::logic_error("Conn already sent");
+        }
+
+        int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return { ResultType::Err, std::move(conn) };
+        }
+        struct Closer { int fd; ~Closer() { ::close(fd); } } const closer{fd};
+
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || offset > static_cast<size_t>(st.st_size))
+        {
+            return { ResultType::Err, std::move(conn) };
+        }
+
+        size_t const available = static_cast<size_t>(st.st_size) - offset;
+        size_t const size = std::min(length.value_or(available), available);
+
+        std::string const etag = FileETag(st, offset, size);
+        std::string const last_modified = FormatHttpDate(st.st_mtime);
+
+        Conn new_conn(std::move(conn));
+        new_conn.resp_headers = new_conn.resp_headers
+            .set("etag", etag)
+            .set("last-modified", last_modified)
+            .set("accept-ranges", "bytes");
+
+        auto const header = [&new_conn](std::string_view key) -> std::string const*
+        {
+            auto const it = new_conn.req_headers.find(key);
+            return it == new_conn.req_headers.end() ? nullptr : &it->second;
+        };
+
+        if (status == 200)
+        {
+            if (auto const inm = header("if-none-match"); inm != nullptr)
+            {
+                status = MatchETag(*inm, etag) ? 304 : status;
+            }
+            else if (auto const ims = header("if-modified-since"); ims != nullptr)
+            {
+                auto const since = ParseHttpDate(*ims);
+                status = since.has_value() && st.st_mtime <= *since ? 304 : status;
+            }
+        }
+
+        size_t first = offset;
+        size_t count = status == 304 ? 0 : size;
+
+        if (auto const range = header("range"); status == 200 && range != nullptr)
+        {
+            auto const if_range = header("if-range");
+            // A weak or stale validator gets the whole file.
+            if (if_range == nullptr || *if_range == last_modified || MatchStrongETag(*if_range, etag))
+            {
+                auto const [type, bytes] = ParseByteRange(*range, size);
+                if (type == ResultType::Err)
+                {
+                    status = 416;
+                    count = 0;
+                    new_conn.resp_headers = new_conn.resp_headers
+                        .set("content-range", "bytes */" + std::to_string(size));
+                }
+                else if (bytes.first != 0 || bytes.second != size)
+                {
+                    status = 206;
+                    first = offset + bytes.first;
+                    count = bytes.second - bytes.first;
+                    new_conn.resp_headers = new_conn.resp_headers
+                        .set("content-range", "bytes " + std::to_string(bytes.first) + "-"
+                            + std::to_string(bytes.second - 1) + "/" + std::to_string(size));
+                }
+            }
+        }
+
+        new_conn.status = std::make_optional(status);
+        new_conn.resp_file_length = count;
+        new_conn.state = Unsent::SET_FILE;
+        new_conn = run_before_send(std::move(new_conn));
+        new_conn.state = Unsent::FILE;
+
+        if (new_conn.adapter == nullptr || !new_conn.adapter->send_file(new_conn, fd, first, count))
+        {
+            return { ResultType::Err, std::move(new_conn) };
+        }
+        new_conn.state = Sent{};
+        return { ResultType::Ok, std::move(new_conn) };
+    }
+
+    static Result<Conn const> send_file(
+        Conn const& conn,
+        uint32_t status,
+        std::string const& path,
+        size_t offset = 0,
+        std::optional<size_t> length = std::nullopt)
+    {
+        return send_file(Conn(conn), status, path, offset, length);
+    }
+
     /*- upgrade_conn -*/
     /*
         Request a protocol upgrade from the server.
     */
-    static Conn const upgrade_conn(Conn const& conn, std::string const& protocol/*, immer::set<std::string> args = {}*/)
+    static Conn upgrade_conn(Conn&& conn, std::string const& protocol/*, immer::set<std::string> args = {}*/)
     {
-        Conn new_conn(conn);
+        Conn new_conn(std::move(conn));
 
         new_conn.status = std::make_optional(426);
-        new_conn.resp_headers.insert({"Upgrade", protocol});
-        new_conn.resp_headers.insert({"Connection", "Upgrade"});
+        new_conn.resp_headers = new_conn.resp_headers
+            .insert({"Upgrade", protocol})
+            .insert({"Connection", "Upgrade"});
 
         new_conn.state = Unsent::UPGRADED;
         return new_conn;
     }
+
+    static Conn const upgrade_conn(Conn const& conn, std::string const& protocol/*, immer::set<std::string> args = {}*/)
+    {
+        return upgrade_conn(Conn(conn), protocol);
+    }
 }; // struct Conn
 
 typedef immer::vector<std::string> PlugOptions;
 
+/*--- Plug ---*/
+// A plug takes the connection by value: pass it with std::move to avoid a copy.
 typedef std::function<Conn(Conn, PlugOptions)> Plug;
 
 } // namespace plug
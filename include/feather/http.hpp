@@ -0,0 +1,1457 @@
+/*--- Header file for http ---*/
+
+#ifndef FEATHER_HTTP_HPP
+#define FEATHER_HTTP_HPP
+
+#include <feather/core.hpp>
+#include <feather/arena.hpp>
+#include <feather/metrics.hpp>
+#include <feather/async.hpp>
+#include <feather/log.hpp>
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+
+#include <cerrno>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#ifdef FEATHER_WITH_TLS
+#include <boost/asio/ssl/stream.hpp>
+#endif
+
+namespace feather::core
+{
+
+namespace http_detail
+{
+    // Waits at most timeout for fd to be ready for events. Returns false on timeout or error.
+    inline bool WaitFor(int fd, short events, std::chrono::milliseconds timeout)
+    {
+        pollfd pfd{fd, events, 0};
+        int ready = 0;
+        do
+        {
+            ready = ::poll(&pfd, 1, static_cast<int>(timeout.count()));
+        } while (ready < 0 && errno == EINTR);
+        return ready > 0;
+    }
+
+    // Whether Stream is asio's ssl::stream, whose OpenSSL state is driven through the stream itself.
+    template <typename Stream>
+    inline constexpr bool IsAsioSslStream = false;
+
+#ifdef FEATHER_WITH_TLS
+    template <typename Next>
+    inline constexpr bool IsAsioSslStream<boost::asio::ssl::stream<Next>> = true;
+#endif
+
+    // Cookie options written as Set-Cookie attributes, in the order they are serialized.
+    enum CookieAttribute { PATH, DOMAIN, MAX_AGE, EXPIRES, SECURE, HTTPONLY, SAME_SITE, ATTRIBUTE_COUNT };
+
+    inline int CookieAttributeOf(std::string_view key)
+    {
+        switch (key.size())
+        {
+            case 4:  return key == "path"      ? PATH      : -1;
+            case 6:  return key == "domain"    ? DOMAIN    : key == "secure" ? SECURE : -1;
+            case 7:  return key == "max_age"   ? MAX_AGE   : key == "expires" ? EXPIRES : -1;
+            case 8:  return key == "httponly"  ? HTTPONLY  : -1;
+            case 9:  return key == "same_site" ? SAME_SITE : -1;
+            default: return -1;
+        }
+    }
+
+    // Appends the attributes of a cookie with a single pass over its options.
+    template <typename String>
+    void AppendCookieAttributes(ImmutMapString const& cookie, String& out)
+    {
+        std::array<std::string const*, ATTRIBUTE_COUNT> found{};
+        for (auto const& [key, value] : cookie)
+        {
+            if (int const attribute = CookieAttributeOf(key); attribute >= 0)
+            {
+                found[attribute] = value.get();
+            }
+        }
+
+        static constexpr std::array<std::string_view, ATTRIBUTE_COUNT> prefixes = {
+            "; Path=", "; Domain=", "; Max-Age=", "; Expires=", "; Secure", "; HttpOnly", "; SameSite="
+        };
+        for (int attribute = 0; attribute < ATTRIBUTE_COUNT; ++attribute)
+        {
+            if (found[attribute] == nullptr)
+            {
+                if (attribute == PATH)
+                {
+                    out.append("; Path=/");
+                }
+                continue;
+            }
+            out.append(prefixes[attribute]);
+            if (attribute != SECURE && attribute != HTTPONLY)
+            {
+                out.append(*found[attribute]);
+            }
+        }
+    }
+
+    inline std::string_view Trim(std::string_view str)
+    {
+        size_t const first = str.find_first_not_of(" \t");
+        if (first == std::string_view::npos)
+        {
+            return {};
+        }
+        return str.substr(first, str.find_last_not_of(" \t") - first + 1);
+    }
+
+    // Values of every key header of a request joined into a single list, as a repeated header means (RFC 9110 5.3).
+    inline std::string JoinHeader(http::Request const& req, std::string const& key)
+    {
+        std::string joined;
+        auto const [first, last] = req.headers.equal_range(key);
+        for (auto it = first; it != last; ++it)
+        {
+            joined.append(it == first ? "" : ",").append(it->second);
+        }
+        return joined;
+    }
+
+    // Parses a Content-Length list, whose values must all be the same number (RFC 9112 6.3).
+    inline std::optional<size_t> ParseContentLength(std::string_view list)
+    {
+        std::optional<size_t> length;
+        while (true)
+        {
+            size_t const comma = list.find(',');
+            std::string_view const value = Trim(list.substr(0, comma));
+            size_t parsed = 0;
+            auto const [end, ec] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+            if (value.empty() || ec != std::errc() || end != value.data() + value.size() || (length.has_value() && *length != parsed))
+            {
+                return std::nullopt;
+            }
+            length = parsed;
+            if (comma == std::string_view::npos)
+            {
+                return length;
+            }
+            list.remove_prefix(comma + 1);
+        }
+    }
+}
+
+/*--- CompileCookieAttributes ---*/
+/*
+    Serializes the attributes of a cookie (path, domain, max_age...) once,
+    for cookies that are sent with the same options on many responses.
+    The result is given to put_resp_cookie as the "attributes" option,
+    BuildSetCookie then appends it as is instead of walking the options.
+
+    Usage:
+
+    static auto const attributes = CompileCookieAttributes(ImmutMapString().insert({"httponly", ShareStr("")}));
+    conn = Conn::put_resp_cookie(conn, "theme", "dark", ImmutMapString().insert({"attributes", attributes})).second;
+*/
+inline SharedString CompileCookieAttributes(ImmutMapString const& opts)
+{
+    std::string out;
+    http_detail::AppendCookieAttributes(opts, out);
+    return ShareStr(std::move(out));
+}
+
+/*--- BuildSetCookie ---*/
+/*
+    Serializes a response cookie into the value of a Set-Cookie header.
+    The out buffer is cleared first so it can be reused for every cookie of a response.
+    Precompiled "attributes" (see CompileCookieAttributes) replace the individual options.
+    Returns false if the cookie has no value, i.e. there is nothing to send.
+*/
+inline bool BuildSetCookie(ImmutMapString const& cookie, std::pmr::string& out)
+{
+    out.clear();
+    auto const& value = cookie.find("value");
+    if (value == nullptr)
+    {
+        return false;
+    }
+    out += **value;
+
+    if (auto const& attributes = cookie.find("attributes"); attributes != nullptr)
+    {
+        out += **attributes;
+    }
+    else
+    {
+        http_detail::AppendCookieAttributes(cookie, out);
+    }
+    return true;
+}
+
+/*--- ParseRequest ---*/
+/*
+    Parse a raw request into an http::Request.
+
+    The raw request is scanned once through a std::string_view:
+    every header and the body are copied a single time into the http::Request.
+    Lines may end with "\r\n" or "\n", everything after the empty line is the body.
+*/
+inline Result<http::Request> ParseRequest(std::string_view raw)
+{
+    using http_detail::Trim;
+
+    static Histogram& parse = Metrics::stage("parse");
+    StageTimer timer(parse);
+
+    http::Request req;
+
+    auto next_line = [&raw]() -> std::string_view
+    {
+        size_t const eol = raw.find('\n');
+        std::string_view line = raw.substr(0, eol);
+        raw.remove_prefix(eol == std::string_view::npos ? raw.size() : eol + 1);
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        return line;
+    };
+
+    std::string_view request_line = next_line();
+    size_t const method_end = request_line.find(' ');
+    size_t const target_end = request_line.find(' ', method_end + 1);
+    if (method_end == std::string_view::npos || target_end == std::string_view::npos)
+    {
+        return { ResultType::Err, req };
+    }
+
+    std::string_view const method  = request_line.substr(0, method_end);
+    std::string_view const target  = request_line.substr(method_end + 1, target_end - method_end - 1);
+    std::string_view const version = Trim(request_line.substr(target_end + 1));
+
+    static constexpr std::array<std::string_view, 10> methods
+    {
+        "GET", "HEAD", "POST", "PUT", "DELETE",
+        "CONNECT", "OPTIONS", "TRACE", "PATCH", "PRI"
+    };
+
+    if (std::find(methods.begin(), methods.end(), method) == methods.end()
+        || (version != "HTTP/1.1" && version != "HTTP/1.0"))
+    {
+        return { ResultType::Err, req };
+    }
+
+    req.method  = method;
+    req.version = version;
+    // Skip URL fragment
+    req.target  = target.substr(0, target.find('#'));
+    req.path    = plug::GetPathFromTarget(req.target);
+
+    while (!raw.empty())
+    {
+        std::string_view const line = next_line();
+
+        if (line.empty())
+        {
+            break;
+        }
+        if (size_t const colon = line.find(':'); colon != std::string_view::npos)
+        {
+            // Whitespace before the colon would hide a header from the checks of the body framing (RFC 9112 5.1).
+            if (colon == 0 || line[colon - 1] == ' ' || line[colon - 1] == '\t')
+            {
+                return { ResultType::Err, req };
+            }
+            req.headers.emplace(line.substr(0, colon), Trim(line.substr(colon + 1)));
+        }
+    }
+
+    req.body = raw;
+
+    return {ResultType::Ok, req};
+}
+
+/*--- FindHeadEnd ---*/
+/*
+    Returns the size of the request head at the start of buffer, blank line included,
+    or std::nullopt while the head is not complete.
+*/
+inline std::optional<size_t> FindHeadEnd(std::string_view buffer)
+{
+    for (size_t eol = buffer.find('\n'); eol != std::string_view::npos; eol = buffer.find('\n', eol + 1))
+    {
+        if (eol + 1 < buffer.size() && buffer[eol + 1] == '\n')
+        {
+            return eol + 2;
+        }
+        if (eol + 2 < buffer.size() && buffer[eol + 1] == '\r' && buffer[eol + 2] == '\n')
+        {
+            return eol + 3;
+        }
+    }
+    return std::nullopt;
+}
+
+/*--- ChunkedDecoder ---*/
+/*
+    Incremental decoder of a chunked request body, resumed as its bytes arrive.
+    Chunk extensions and trailers are skipped.
+
+    decode consumes the start of in and appends the data of its chunks to out. It returns:
+    - Ok with the number of bytes of in consumed once the body is complete, the decoder is then reset
+    - More with the number of bytes of in consumed while it is not: they are dropped by the caller,
+      which calls decode again with the rest once more bytes arrived
+    - Err with the status to answer: 400 if it is malformed, 413 if it would exceed max_size bytes
+
+    Each byte is read once, however small the chunks and the reads are.
+*/
+class ChunkedDecoder
+{
+    private:
+        enum struct Stage
+        {
+            SIZE,
+            DATA,
+            DATA_END,
+            TRAILERS,
+        };
+
+        Stage   stage = Stage::SIZE;
+        size_t  remaining = 0;
+        size_t  decoded = 0;
+
+    public:
+        Result<size_t> decode(std::string_view in, std::string& out, size_t max_size)
+        {
+            size_t position = 0;
+
+            while (true)
+            {
+                switch (stage)
+                {
+                    case Stage::SIZE:
+                    {
+                        size_t const eol = in.find('\n', position);
+                        if (eol == std::string_view::npos)
+                        {
+                            return in.size() - position > 64 ? Result<size_t>{ ResultType::Err, 400 } : Result<size_t>{ ResultType::More, position };
+                        }
+
+                        std::string_view const size_line = in.substr(position, eol - position);
+                        size_t size = 0;
+                        auto const [end, ec] = std::from_chars(size_line.data(), size_line.data() + size_line.size(), size, 16);
+                        if (ec == std::errc::result_out_of_range || (ec == std::errc() && size > max_size - decoded))
+                        {
+                            return { ResultType::Err, 413 };
+                        }
+                        if (ec != std::errc() || end == size_line.data())
+                        {
+                            return { ResultType::Err, 400 };
+                        }
+                        position = eol + 1;
+                        remaining = size;
+                        stage = size == 0 ? Stage::TRAILERS : Stage::DATA;
+                        break;
+                    }
+
+                    case Stage::DATA:
+                    {
+                        size_t const take = std::min(remaining, in.size() - position);
+                        if (take == 0)
+                        {
+                            return { ResultType::More, position };
+                        }
+                        out.append(in.substr(position, take));
+                        position += take;
+                        remaining -= take;
+                        decoded += take;
+                        stage = remaining == 0 ? Stage::DATA_END : Stage::DATA;
+                        break;
+                    }
+
+                    case Stage::DATA_END:
+                    {
+                        std::string_view const rest = in.substr(position);
+                        if (rest.empty() || rest == "\r")
+                        {
+                            return { ResultType::More, position };
+                        }
+                        if (rest.substr(0, 2) == "\r\n")
+                        {
+                            position += 2;
+                        }
+                        else if (rest[0] == '\n')
+                        {
+                            position += 1;
+                        }
+                        else
+                        {
+                            return { ResultType::Err, 400 };
+                        }
+                        stage = Stage::SIZE;
+                        break;
+                    }
+
+                    case Stage::TRAILERS:
+                    {
+                        // Trailers end with an empty line like the headers.
+                        size_t const trailer_end = in.find('\n', position);
+                        if (trailer_end == std::string_view::npos)
+                        {
+                            return { ResultType::More, position };
+                        }
+                        std::string_view const trailer = in.substr(position, trailer_end - position);
+                        position = trailer_end + 1;
+                        if (trailer.empty() || trailer == "\r")
+                        {
+                            *this = ChunkedDecoder();
+                            return { ResultType::Ok, position };
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+};
+
+/*--- BlockHeaderOverridden ---*/
+// Whether resp_headers also sets a header of a header block: the one of resp_headers is sent instead.
+inline bool BlockHeaderOverridden(plug::Conn const& conn, std::string const& key)
+{
+    auto const [first, last] = conn.resp_headers.equal_range(key);
+    return first != last;
+}
+
+/*--- SerializeResponseHead ---*/
+/*
+    Serializes the status line, the headers, the header blocks and the cookies of the response,
+    followed by the extra header lines, the connection header and the blank line ending the head.
+*/
+inline std::pmr::string SerializeResponseHead(plug::Conn const& conn, std::string_view extra, bool keep_alive)
+{
+    static Histogram& serialize = Metrics::stage("serialize");
+    StageTimer timer(serialize);
+
+    auto const status = static_cast<websocketpp::http::status_code::value>(conn.status.value_or(200));
+    std::pmr::string out(RequestArena::resource());
+    out.append("HTTP/1.1 ")
+        .append(std::to_string(status))
+        .append(" ")
+        .append(websocketpp::http::status_code::get_string(status))
+        .append("\r\n");
+
+    for (auto const& [key, value] : conn.resp_headers)
+    {
+        out.append(key).append(": ").append(value).append("\r\n");
+    }
+
+    for (auto const& block : conn.resp_header_blocks)
+    {
+        bool const overridden = conn.resp_headers.size() != 0
+            && std::any_of(block->headers.begin(), block->headers.end(),
+                [&conn](auto const& header) { return BlockHeaderOverridden(conn, header.first); });
+        if (!overridden)
+        {
+            out.append(block->wire);
+            continue;
+        }
+        for (auto const& [key, value] : block->headers)
+        {
+            if (!BlockHeaderOverridden(conn, key))
+            {
+                out.append(key).append(": ").append(value).append("\r\n");
+            }
+        }
+    }
+
+    std::pmr::string set_cookie(RequestArena::resource());
+    for (auto const& [key, cookie] : conn.resp_cookies)
+    {
+        if (BuildSetCookie(cookie, set_cookie))
+        {
+            out.append("set-cookie: ").append(set_cookie).append("\r\n");
+        }
+    }
+    out.append(extra).append(keep_alive ? "connection: keep-alive\r\n\r\n" : "connection: close\r\n\r\n");
+    return out;
+}
+
+/*--- BasicSocketWriter ---*/
+/*
+    Synchronous writes to a stream over a TCP socket, used by the adapters of the HTTP transports.
+
+    Files are sent with sendfile(2) on Linux, straight from the page cache,
+    and through a read-only mmap of the file elsewhere or when sendfile is not supported.
+    A TLS stream with a sendfile member, see TlsStream, goes through it when the kernel encrypts the connection.
+    The other streams that encrypt in user space, such as asio's ssl::stream, always write the mapping.
+    Closing sends the close_notify alert of a TlsStream or an ssl::stream, without waiting for the answer of the peer.
+
+    The writes block the calling thread until the client takes the data. With a stall timeout,
+    a plain socket or a TlsStream fails a write once the client took nothing for that long,
+    so a client that stops reading holds the io thread for a bounded time. Other streams wait without limit.
+*/
+template <typename Stream>
+class BasicSocketWriter
+{
+    private:
+        static constexpr bool plain = std::is_same_v<Stream, boost::asio::ip::tcp::socket>;
+
+        Stream&                                     stream;
+        std::optional<std::chrono::milliseconds>    stall_timeout;
+
+        /*- wait_writable -*/
+        // Waits for room in the socket, at most the stall timeout.
+        bool wait_writable()
+        {
+            if (stall_timeout.has_value())
+            {
+                return http_detail::WaitFor(stream.lowest_layer().native_handle(), POLLOUT, *stall_timeout);
+            }
+            boost::system::error_code ec;
+            stream.lowest_layer().wait(boost::asio::ip::tcp::socket::wait_write, ec);
+            return !ec;
+        }
+
+        /*- write_plain -*/
+        // Writes buffers to a plain socket without waiting more than the stall timeout at once.
+        template<typename Buffers>
+        bool write_plain(Buffers const& buffers)
+        {
+            boost::system::error_code ec;
+            stream.non_blocking(true, ec);
+            for (auto it = boost::asio::buffer_sequence_begin(buffers); it != boost::asio::buffer_sequence_end(buffers); ++it)
+            {
+                for (boost::asio::const_buffer buffer = *it; buffer.size() > 0;)
+                {
+                    size_t const written = stream.write_some(buffer, ec);
+                    Metrics::bytes_out().add(written);
+                    buffer += written;
+                    if (ec == boost::asio::error::would_block || ec == boost::asio::error::try_again)
+                    {
+                        if (!wait_writable())
+                        {
+                            return false;
+                        }
+                    } else if (ec)
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        /*- send -*/
+        // One sendfile(2) of the stream, with its conventions. Fails with EINVAL when the stream cannot.
+        ssize_t send(int fd, off_t& position, size_t length)
+        {
+#ifdef __linux__
+            if constexpr (plain)
+            {
+                return ::sendfile(stream.native_handle(), fd, &position, length);
+            } else if constexpr (requires { stream.sendfile(fd, position, length); })
+            {
+                ssize_t const sent = stream.sendfile(fd, position, length);
+                if (sent > 0)
+                {
+                    position += static_cast<off_t>(sent);
+                }
+                return sent;
+            }
+#endif
+            (void)fd;
+            (void)position;
+            (void)length;
+            errno = EINVAL;
+            return -1;
+        }
+
+        /*- map_file -*/
+        // Writes a part of a file through a read-only mapping, the pages are never copied into a buffer.
+        bool map_file(int fd, size_t offset, size_t length)
+        {
+            size_t const page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            size_t const start = offset - offset % page;
+            size_t const span = length + (offset - start);
+
+            void* const data = ::mmap(nullptr, span, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(start));
+            if (data == MAP_FAILED)
+            {
+                return false;
+            }
+            ::madvise(data, span, MADV_SEQUENTIAL);
+            bool const written = write(boost::asio::buffer(static_cast<char const*>(data) + (offset - start), length));
+            ::munmap(data, span);
+            return written;
+        }
+
+    public:
+        explicit BasicSocketWriter(Stream& s, std::optional<std::chrono::milliseconds> stall = std::nullopt)
+        :
+        stream(s),
+        stall_timeout(stall)
+        {
+            if constexpr (requires { s.stall_timeout(*stall); })
+            {
+                if (stall.has_value())
+                {
+                    s.stall_timeout(*stall);
+                }
+            }
+        }
+
+        /*- write -*/
+        template<typename Buffers>
+        bool write(Buffers const& buffers)
+        {
+            if constexpr (plain)
+            {
+                if (stall_timeout.has_value())
+                {
+                    return write_plain(buffers);
+                }
+            }
+            boost::system::error_code ec;
+            Metrics::bytes_out().add(boost::asio::write(stream, buffers, ec));
+            return !ec;
+        }
+
+        /*- write_chunk -*/
+        // Writes data framed as one chunk of a chunked response.
+        bool write_chunk(std::string_view data)
+        {
+            char size[sizeof(size_t) * 2 + 2];
+            auto const end = std::to_chars(size, size + sizeof(size) - 2, data.size(), 16).ptr;
+            end[0] = '\r';
+            end[1] = '\n';
+
+            std::array<boost::asio::const_buffer, 3> const buffers = {
+                boost::asio::buffer(size, end + 2 - size),
+                boost::asio::buffer(data.data(), data.size()),
+                boost::asio::buffer("\r\n", 2)
+            };
+            return write(buffers);
+        }
+
+        /*- stream_file -*/
+        // Writes a part of a file to the socket without copying it through user space when possible.
+        bool stream_file(int fd, size_t offset, size_t length)
+        {
+            off_t position = static_cast<off_t>(offset);
+            size_t remaining = length;
+
+            while (remaining > 0)
+            {
+                ssize_t const sent = send(fd, position, remaining);
+                if (sent > 0)
+                {
+                    remaining -= static_cast<size_t>(sent);
+                    Metrics::bytes_out().add(static_cast<uint64_t>(sent));
+                }
+                else if (sent < 0 && (errno == EAGAIN || errno == EINTR))
+                {
+                    // The socket is non-blocking once asio used it asynchronously, wait for room.
+                    if (!wait_writable())
+                    {
+                        return false;
+                    }
+                }
+                else if (sent < 0 && (errno == EINVAL || errno == ENOSYS) && remaining == length)
+                {
+                    return map_file(fd, offset, length);
+                }
+                else
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /*- close -*/
+        // Closes the socket, after telling the peer of a TLS stream that the connection ends.
+        void close()
+        {
+            boost::system::error_code ec;
+            if constexpr (requires { stream.close_notify(); })
+            {
+                stream.close_notify();
+            }
+#ifdef FEATHER_WITH_TLS
+            else if constexpr (http_detail::IsAsioSslStream<Stream>)
+            {
+                // Sends close_notify without waiting for the one of the peer, which OpenSSL then takes as received.
+                // The socket is made non-blocking first: the alert is dropped rather than waited for.
+                if (SSL_is_init_finished(stream.native_handle()))
+                {
+                    SSL_set_shutdown(stream.native_handle(), SSL_RECEIVED_SHUTDOWN);
+                    stream.lowest_layer().non_blocking(true, ec);
+                    stream.shutdown(ec);
+                }
+            }
+#endif
+            auto& socket = stream.lowest_layer();
+            socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            socket.close(ec);
+        }
+};
+
+/*--- SocketWriter ---*/
+using SocketWriter = BasicSocketWriter<boost::asio::ip::tcp::socket>;
+
+/*--- HttpTransportOptions ---*/
+/*
+    - idle_timeout     : time a kept-alive connection may wait for its next request, defaults to 5 seconds
+    - header_timeout   : time allowed to receive the head of a request once it started, defaults to 10 seconds
+    - body_timeout     : time allowed for each read of a request body, defaults to 15 seconds
+    - max_requests     : requests served on a connection before it is closed, 0 for no limit, defaults to 1000
+    - max_header_size  : largest request head accepted, defaults to 64 kilobytes
+    - buffer_body_size : bodies up to this size are read before the handler runs, defaults to 1 megabyte
+    - max_body_size    : largest chunked body accepted, they are always buffered, defaults to 8 megabytes
+    - stall_timeout    : longest a read of a streamed body or a write of a response may wait for the client
+                         on an io thread, the connection is closed after that. Defaults to 2 seconds
+*/
+struct HttpTransportOptions
+{
+    std::chrono::milliseconds   idle_timeout     = std::chrono::seconds(5);
+    std::chrono::milliseconds   header_timeout   = std::chrono::seconds(10);
+    std::chrono::milliseconds   body_timeout     = std::chrono::seconds(15);
+    size_t                      max_requests     = 1000;
+    size_t                      max_header_size  = 64 * 1024;
+    size_t                      buffer_body_size = 1024 * 1024;
+    size_t                      max_body_size    = 8 * 1024 * 1024;
+    std::chrono::milliseconds   stall_timeout    = std::chrono::seconds(2);
+};
+
+/*--- BasicHttpTransport ---*/
+/*
+    HTTP/1.1 server with persistent connections, running on the io_service of the Server.
+
+    Every accepted socket is served by a Session on its own strand:
+        - requests are read into a buffer reused for the whole connection,
+          pipelined requests are answered in order straight from that buffer
+        - the connection is kept alive after each response, unless the client asked otherwise,
+          sent an HTTP/1.0 request without keep-alive or reached options.max_requests
+        - an idle connection is closed after options.idle_timeout,
+          a request whose head is not received within options.header_timeout gets a 408
+        - bodies up to options.buffer_body_size are read before the handler runs,
+          larger ones are streamed to Conn::read_body through the adapter
+
+    The handler runs the pipeline and returns the final Conn, the transport then writes
+    the buffered response unless the adapter already did (chunked responses, files).
+    It may return a task instead, e.g. the one of an asynchronous route:
+    the task is awaited on the strand of the session, which reads nothing more until it completes,
+    while the io threads serve the other connections.
+
+    The adapter is synchronous: reading a streamed body (Conn::read_body) and writing a response
+    block the io thread running the session.
+    Each wait for the client is capped by options.stall_timeout, well below body_timeout,
+    after which the connection is closed: a slow uploader or reader holds its io thread for at most that long
+    per read or write, and the sessions queued behind it on that thread wait as long.
+    Run more io threads than the slow clients expected at once, or buffer the bodies (buffer_body_size).
+
+    Stream is the socket type of the connections: HttpTransport serves plain TCP sockets,
+    HttpsTransport (feather/tls.hpp) TLS streams, whose handshake runs before the first request.
+
+    Usage:
+
+    HttpTransport transport(io_service, [](http::Request&& req, std::shared_ptr<plug::Adapter> const& adapter)
+    {
+        plug::Conn conn(std::move(req), std::make_shared<plug::CookieSession>());
+        conn.adapter = adapter;
+        return router::Router::handler(conn);
+    });
+    transport.listen(boost::asio::ip::address_v4::any(), 8080);
+*/
+template <typename Stream>
+class BasicHttpTransport
+{
+    public:
+        using Clock   = std::chrono::steady_clock;
+        using Handler = std::function<MaybeAsync<plug::Conn>(http::Request&&, std::shared_ptr<plug::Adapter> const&)>;
+
+        using Options = HttpTransportOptions;
+        using Open    = std::function<Stream(boost::asio::ip::tcp::socket&&)>;
+
+    private:
+        static constexpr bool plain = std::is_same_v<Stream, boost::asio::ip::tcp::socket>;
+
+        class Session;
+
+        /*- Exchange -*/
+        /*
+            Adapter of a single request of a Session.
+            Writes are synchronous (backpressure).
+            An HTTP/1.0 client cannot decode a chunked response (RFC 9112 7):
+            its chunks are written as they are and the response ends when the connection is closed.
+        */
+        class Exchange : public plug::Adapter
+        {
+            private:
+                std::shared_ptr<Session>    session;
+                bool                        head_only;
+                bool                        unchunked;
+                bool                        responded = false;
+
+            public:
+                Exchange(std::shared_ptr<Session> s, bool head, bool http10)
+                : session(std::move(s)), head_only(head), unchunked(http10) {}
+
+                /*- started -*/
+                // Whether a part of the response was written, a status can then no longer be sent.
+                bool started() const { return responded; }
+
+                bool send_chunked(plug::Conn const& conn) override
+                {
+                    if (responded)
+                    {
+                        return false;
+                    }
+                    responded = true;
+                    if (unchunked)
+                    {
+                        session->keep_alive = false;
+                    }
+                    auto const out = SerializeResponseHead(conn, unchunked ? "" : "transfer-encoding: chunked\r\n", session->reusable());
+                    return session->written(session->writer.write(boost::asio::buffer(out.data(), out.size())));
+                }
+
+                bool chunk(std::string_view data) override
+                {
+                    if (head_only || data.empty())
+                    {
+                        return true;
+                    }
+                    return session->written(unchunked
+                        ? session->writer.write(boost::asio::buffer(data.data(), data.size()))
+                        : session->writer.write_chunk(data));
+                }
+
+                bool finish() override
+                {
+                    // The session closes an unchunked response once the request is done.
+                    return head_only || unchunked || session->written(session->writer.write(boost::asio::buffer("0\r\n\r\n", 5)));
+                }
+
+                bool send_file(plug::Conn const& conn, int fd, size_t offset, size_t length) override
+                {
+                    if (responded)
+                    {
+                        return false;
+                    }
+                    responded = true;
+
+                    // A 304 keeps no body, it must not announce the length of the one it replaces.
+                    bool const bodiless = conn.status.value_or(200) == 304;
+                    std::string const content_length = bodiless ? "" : "content-length: " + std::to_string(length) + "\r\n";
+                    auto const out = SerializeResponseHead(conn, content_length, session->reusable());
+
+                    return session->written(session->writer.write(boost::asio::buffer(out.data(), out.size()))
+                        && (head_only || bodiless || length == 0 || session->writer.stream_file(fd, offset, length)));
+                }
+
+                std::optional<Result<std::string>> read_body(
+                    size_t length,
+                    size_t read_length,
+                    std::chrono::milliseconds timeout) override
+                {
+                    return session->read_body(length, read_length, timeout);
+                }
+
+                /*- complete -*/
+                /*
+                    Writes the response buffered in the final Conn, unless it was already written.
+                    A chunked response is ended through the adapter of the Conn, which may wrap this one
+                    (e.g. a CompressingAdapter that still holds the end of its stream).
+                */
+                void complete(plug::Conn const& conn)
+                {
+                    if (std::holds_alternative<plug::Unsent>(conn.state)
+                        && std::get<plug::Unsent>(conn.state) == plug::Unsent::CHUNKED)
+                    {
+                        if (conn.adapter != nullptr)
+                        {
+                            conn.adapter->finish();
+                        } else
+                        {
+                            finish();
+                        }
+                        return;
+                    }
+                    if (responded || std::holds_alternative<plug::Sent>(conn.state))
+                    {
+                        return;
+                    }
+                    responded = true;
+
+                    int const status = conn.status.value_or(200);
+                    bool const bodiless = status == 204 || status == 304 || status < 200;
+                    std::string_view const body = conn.resp_body != nullptr && !bodiless
+                        ? std::string_view(*conn.resp_body)
+                        : std::string_view();
+
+                    std::string const content_length = bodiless ? "" : "content-length: " + std::to_string(body.size()) + "\r\n";
+                    auto const out = SerializeResponseHead(conn, content_length, session->reusable());
+                    std::array<boost::asio::const_buffer, 2> const buffers = {
+                        boost::asio::buffer(out.data(), out.size()),
+                        boost::asio::buffer(body.data(), head_only ? 0 : body.size())
+                    };
+                    session->written(session->writer.write(buffers));
+                }
+        };
+
+        /*- Session -*/
+        // A client connection, served request after request until it is closed.
+        class Session : public std::enable_shared_from_this<Session>
+        {
+            friend class Exchange;
+
+            private:
+                Stream                          socket;
+                boost::asio::steady_timer       timer;
+                uint64_t                        timer_generation = 0;
+                BasicSocketWriter<Stream>       writer;
+                Options const&                  options;
+                Handler const&                  handler;
+
+                std::string                     buffer;
+                size_t                          served = 0;
+                bool                            keep_alive = true;
+                std::optional<Clock::time_point> head_deadline;
+
+                // Request whose head was parsed, waiting for its body.
+                std::optional<http::Request>    pending;
+                bool                            chunked = false;
+                ChunkedDecoder                  decoder;
+                size_t                          content_length = 0;
+
+                // Bytes of a streamed body not read by the pipeline yet.
+                size_t                          body_left = 0;
+
+                static constexpr size_t         read_size = 16 * 1024;
+
+                /*- reusable -*/
+                // Whether the connection is kept open after the current response.
+                bool reusable() const
+                {
+                    return keep_alive && body_left == 0 && socket.is_open();
+                }
+
+                /*- written -*/
+                // Records the outcome of a write, a connection that failed one is not reused.
+                bool written(bool ok)
+                {
+                    keep_alive = keep_alive && ok;
+                    return ok;
+                }
+
+                /*- buffered -*/
+                // Whether the stream holds decrypted bytes the socket will not signal.
+                bool buffered() const
+                {
+                    if constexpr (requires { socket.pending(); })
+                    {
+                        return socket.pending() > 0;
+                    }
+                    return false;
+                }
+
+                /*- read_body -*/
+                // Streams a large body: first from the buffer, then straight from the socket.
+                std::optional<Result<std::string>> read_body(size_t length, size_t read_length, std::chrono::milliseconds timeout)
+                {
+                    if (body_left == 0)
+                    {
+                        return std::nullopt;
+                    }
+
+                    std::string out;
+                    size_t const wanted = std::min(length, body_left);
+                    size_t const from_buffer = std::min(wanted, buffer.size());
+                    out.append(buffer, 0, from_buffer);
+                    buffer.erase(0, from_buffer);
+
+                    while (out.size() < wanted)
+                    {
+                        // Blocking the io thread: never long, whatever the timeout of the pipeline.
+                        if (!buffered() && !http_detail::WaitFor(socket.native_handle(), POLLIN, std::min(timeout, options.stall_timeout)))
+                        {
+                            body_left -= out.size();
+                            keep_alive = false;
+                            return std::make_optional<Result<std::string>>(ResultType::Err, "timeout");
+                        }
+
+                        size_t const size = out.size();
+                        out.resize(size + std::min(read_length, wanted - size));
+                        boost::system::error_code ec;
+                        size_t const read = socket.read_some(boost::asio::buffer(out.data() + size, out.size() - size), ec);
+                        out.resize(size + read);
+                        Metrics::bytes_in().add(read);
+                        if (ec && ec != boost::asio::error::would_block)
+                        {
+                            body_left -= out.size();
+                            keep_alive = false;
+                            return std::make_optional<Result<std::string>>(ResultType::Err, ec.message());
+                        }
+                    }
+
+                    body_left -= out.size();
+                    return std::make_optional<Result<std::string>>(body_left > 0 ? ResultType::More : ResultType::Ok, std::move(out));
+                }
+
+                /*- close -*/
+                void close()
+                {
+                    boost::system::error_code ec;
+                    timer.cancel(ec);
+                    writer.close();
+                }
+
+                /*- reject -*/
+                // Answers a request that cannot be served and closes the connection.
+                void reject(int status)
+                {
+                    Log<LogLevel::Warn>("request rejected", {{"status", status}});
+                    auto const code = static_cast<websocketpp::http::status_code::value>(status);
+                    std::string const out = "HTTP/1.1 " + std::to_string(status) + " "
+                        + websocketpp::http::status_code::get_string(code)
+                        + "\r\ncontent-length: 0\r\nconnection: close\r\n\r\n";
+                    writer.write(boost::asio::buffer(out));
+                    close();
+                }
+
+                /*- fail -*/
+                // Ends a request whose handler threw: answers 500, or cuts the response short if a part of it was written.
+                void fail(Exchange const& exchange)
+                {
+                    if (exchange.started())
+                    {
+                        close();
+                        return;
+                    }
+                    reject(500);
+                }
+
+                /*- arm -*/
+                /*
+                    Runs on_expiry on the session once timeout elapsed, unless the timer is armed again or disarmed first.
+                    A handler the timer already queued when that happened sees a newer generation and does nothing.
+                */
+                template <typename OnExpiry>
+                void arm(Clock::duration timeout, OnExpiry on_expiry)
+                {
+                    uint64_t const armed = ++timer_generation;
+                    timer.expires_after(timeout);
+                    timer.async_wait([self = this->shared_from_this(), armed, on_expiry](boost::system::error_code const& ec)
+                    {
+                        if (!ec && self->timer_generation == armed)
+                        {
+                            on_expiry(*self);
+                        }
+                    });
+                }
+
+                /*- disarm -*/
+                void disarm()
+                {
+                    ++timer_generation;
+                    timer.cancel();
+                }
+
+                /*- wait -*/
+                // Reads more of the connection, closing it if nothing comes before the deadline.
+                void wait(Clock::duration timeout, int timeout_status)
+                {
+                    arm(timeout, [timeout_status](Session& self)
+                    {
+                        if (timeout_status != 0)
+                        {
+                            self.reject(timeout_status);
+                        }
+                        else
+                        {
+                            self.close();
+                        }
+                    });
+
+                    size_t const size = buffer.size();
+                    buffer.resize(size + read_size);
+                    socket.async_read_some(boost::asio::buffer(buffer.data() + size, read_size),
+                        [self = this->shared_from_this(), size](boost::system::error_code const& ec, size_t read)
+                        {
+                            self->buffer.resize(size + read);
+                            Metrics::bytes_in().add(read);
+                            if (ec)
+                            {
+                                self->close();
+                                return;
+                            }
+                            self->disarm();
+                            self->process();
+                        });
+                }
+
+                /*- parse_head -*/
+                // Parses the next request head of the buffer. Returns false when the connection must wait or was rejected.
+                bool parse_head()
+                {
+                    if (buffer.empty())
+                    {
+                        head_deadline.reset();
+                        wait(options.idle_timeout, 0);
+                        return false;
+                    }
+                    if (!head_deadline.has_value())
+                    {
+                        head_deadline = Clock::now() + options.header_timeout;
+                    }
+
+                    auto const head_size = FindHeadEnd(buffer);
+                    if (!head_size.has_value())
+                    {
+                        if (buffer.size() > options.max_header_size)
+                        {
+                            reject(431);
+                        }
+                        else if (Clock::now() >= *head_deadline)
+                        {
+                            reject(408);
+                        }
+                        else
+                        {
+                            wait(*head_deadline - Clock::now(), 408);
+                        }
+                        return false;
+                    }
+                    if (*head_size > options.max_header_size)
+                    {
+                        reject(431);
+                        return false;
+                    }
+
+                    auto head = ParseRequest(std::string_view(buffer).substr(0, *head_size));
+                    buffer.erase(0, *head_size);
+                    head_deadline.reset();
+                    if (head.first == ResultType::Err)
+                    {
+                        reject(400);
+                        return false;
+                    }
+
+                    http::Request req = head.second;
+                    // Repeated framing headers are joined: they must agree, or the request could be read another way by a proxy.
+                    std::string const transfer_encoding = boost::to_lower_copy(http_detail::JoinHeader(req, "Transfer-Encoding"));
+                    std::string const length = http_detail::JoinHeader(req, "Content-Length");
+                    // The last coding must be chunked, otherwise the end of the body is unknown (RFC 9112 6.3).
+                    chunked = http_detail::Trim(std::string_view(transfer_encoding).substr(transfer_encoding.rfind(',') + 1)) == "chunked";
+                    if (!transfer_encoding.empty() && !chunked)
+                    {
+                        reject(400);
+                        return false;
+                    }
+                    decoder = ChunkedDecoder();
+                    content_length = 0;
+                    if (!length.empty())
+                    {
+                        auto const parsed = http_detail::ParseContentLength(length);
+                        if (chunked || !parsed.has_value())
+                        {
+                            reject(400);
+                            return false;
+                        }
+                        content_length = *parsed;
+                    }
+
+                    bool const has_body = chunked || content_length > 0;
+                    if (has_body && boost::iequals(req.get_header_value("Expect"), "100-continue"))
+                    {
+                        static constexpr std::string_view proceed = "HTTP/1.1 100 Continue\r\n\r\n";
+                        writer.write(boost::asio::buffer(proceed.data(), proceed.size()));
+                    }
+
+                    std::string const connection = boost::to_lower_copy(req.get_header_value("Connection"));
+                    keep_alive = req.version == "HTTP/1.1"
+                        ? connection.find("close") == std::string::npos
+                        : connection.find("keep-alive") != std::string::npos;
+                    ++served;
+                    keep_alive = keep_alive && (options.max_requests == 0 || served < options.max_requests);
+
+                    pending = std::move(req);
+                    return true;
+                }
+
+                /*- read_pending_body -*/
+                // Buffers the body of the pending request when needed. Returns false when the connection must wait or was rejected.
+                bool read_pending_body()
+                {
+                    if (chunked)
+                    {
+                        auto const decoded = decoder.decode(buffer, pending->body, options.max_body_size);
+                        if (decoded.first == ResultType::Err)
+                        {
+                            reject(static_cast<int>(decoded.second));
+                            return false;
+                        }
+                        buffer.erase(0, decoded.second);
+                        if (decoded.first == ResultType::More)
+                        {
+                            wait(options.body_timeout, 408);
+                            return false;
+                        }
+                        return true;
+                    }
+
+                    if (content_length > options.buffer_body_size)
+                    {
+                        body_left = content_length;
+                        return true;
+                    }
+                    if (buffer.size() < content_length)
+                    {
+                        wait(options.body_timeout, 408);
+                        return false;
+                    }
+                    pending->body.assign(buffer, 0, content_length);
+                    buffer.erase(0, content_length);
+                    return true;
+                }
+
+                /*- process -*/
+                // Serves every complete request of the buffer, then waits for more.
+                void process()
+                {
+                    while (socket.is_open())
+                    {
+                        if (!pending.has_value() && !parse_head())
+                        {
+                            return;
+                        }
+                        if (!read_pending_body())
+                        {
+                            return;
+                        }
+
+                        http::Request req = std::move(*pending);
+                        pending.reset();
+                        bool const head_only = req.method == "HEAD";
+                        bool const http10 = req.version == "HTTP/1.0";
+
+                        auto const exchange = std::make_shared<Exchange>(this->shared_from_this(), head_only, http10);
+                        try
+                        {
+                            RequestArena arena;
+                            RequestArena::Scope arena_scope(arena);
+
+                            MaybeAsync<plug::Conn> reply = handler(std::move(req), exchange);
+                            if (auto* task = std::get_if<Task<plug::Conn>>(&reply))
+                            {
+                                resume(std::move(*task), exchange);
+                                return;
+                            }
+                            exchange->complete(std::get<plug::Conn>(reply));
+                        }
+                        catch (std::exception const& e)
+                        {
+                            Log<LogLevel::Error>("handler error", {{"error", e.what()}});
+                            fail(*exchange);
+                            return;
+                        }
+
+                        if (!reusable())
+                        {
+                            close();
+                            return;
+                        }
+                    }
+                }
+
+                /*- resume -*/
+                // Awaits the task of a request on the strand of the session, then answers it and serves the next requests.
+                void resume(Task<plug::Conn> task, std::shared_ptr<Exchange> exchange)
+                {
+                    boost::asio::co_spawn(socket.get_executor(),
+                        [exchange, task = std::move(task)]() mutable -> Task<void>
+                        {
+                            plug::Conn const conn = co_await std::move(task);
+
+                            RequestArena arena;
+                            RequestArena::Scope arena_scope(arena);
+                            exchange->complete(conn);
+                        },
+                        [self = this->shared_from_this(), exchange](std::exception_ptr error)
+                        {
+                            if (error)
+                            {
+                                try
+                                {
+                                    std::rethrow_exception(error);
+                                }
+                                catch (std::exception const& e)
+                                {
+                                    Log<LogLevel::Error>("handler error", {{"error", e.what()}});
+                                }
+                                catch (...)
+                                {
+                                }
+                                self->fail(*exchange);
+                                return;
+                            }
+                            if (!self->reusable())
+                            {
+                                self->close();
+                                return;
+                            }
+                            self->process();
+                        });
+                }
+
+            public:
+                Session(Stream&& s, Options const& opts, Handler const& h)
+                :
+                socket(std::move(s)),
+                timer(socket.get_executor()),
+                writer(socket, opts.stall_timeout),
+                options(opts),
+                handler(h)
+                {
+                    Metrics::connections().add(1);
+                }
+
+                ~Session()
+                {
+                    Metrics::connections().add(-1);
+                }
+
+                /*- start -*/
+                // Waits for the first request, after the handshake of a TLS stream, within options.header_timeout.
+                void start()
+                {
+                    boost::system::error_code ec;
+                    socket.lowest_layer().set_option(boost::asio::ip::tcp::no_delay(true), ec);
+                    head_deadline = Clock::now() + options.header_timeout;
+                    if constexpr (plain)
+                    {
+                        wait(options.header_timeout, 0);
+                    } else
+                    {
+                        arm(options.header_timeout, [](Session& self) { self.close(); });
+                        socket.async_handshake([self = this->shared_from_this()](boost::system::error_code const& ec)
+                        {
+                            self->disarm();
+                            if (ec)
+                            {
+                                self->close();
+                                return;
+                            }
+                            self->wait(*self->head_deadline - Clock::now(), 0);
+                        });
+                    }
+                }
+        };
+
+        boost::asio::io_service&            io_service;
+        boost::asio::ip::tcp::acceptor      acceptor;
+        Handler                             handler;
+        Options                             options;
+        Open                                open;
+
+        void accept()
+        {
+            acceptor.async_accept(boost::asio::make_strand(io_service),
+                [this](boost::system::error_code const& ec, boost::asio::ip::tcp::socket socket)
+                {
+                    if (!acceptor.is_open())
+                    {
+                        return;
+                    }
+                    if (!ec)
+                    {
+                        try
+                        {
+                            std::make_shared<Session>(open(std::move(socket)), options, handler)->start();
+                        }
+                        catch (std::exception const& e)
+                        {
+                            Log<LogLevel::Error>("connection setup error", {{"error", e.what()}});
+                        }
+                    }
+                    accept();
+                });
+        }
+
+    public:
+        BasicHttpTransport(boost::asio::io_service& io, Handler h) requires plain
+        : BasicHttpTransport(io, std::move(h), Options()) {}
+        BasicHttpTransport(boost::asio::io_service& io, Handler h, Options opts) requires plain
+        : BasicHttpTransport(io, std::move(h), std::move(opts), [](boost::asio::ip::tcp::socket&& s) { return std::move(s); }) {}
+        // open wraps every accepted socket into the Stream of its connection, e.g. TlsOpener.
+        BasicHttpTransport(boost::asio::io_service& io, Handler h, Options opts, Open o)
+        :
+        io_service(io),
+        acceptor(io),
+        handler(std::move(h)),
+        options(std::move(opts)),
+        open(std::move(o))
+        {}
+        BasicHttpTransport(BasicHttpTransport const&)             = delete;
+        BasicHttpTransport& operator=(BasicHttpTransport const&)  = delete;
+
+        /*- listen -*/
+        /*
+            Binds the transport and starts accepting connections, port 0 picks a free one.
+            reuse_port sets SO_REUSEPORT so that several processes can share the port.
+        */
+        void listen(boost::asio::ip::address const& address, uint16_t port, bool reuse_port = false)
+        {
+            boost::asio::ip::tcp::endpoint const endpoint(address, port);
+            acceptor.open(endpoint.protocol());
+            acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+            if (reuse_port)
+            {
+                using reuse_port_option = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+                acceptor.set_option(reuse_port_option(true));
+            }
+            acceptor.bind(endpoint);
+            acceptor.listen();
+            accept();
+        }
+
+        /*- port -*/
+        // Returns the port the transport listens on.
+        uint16_t port() const
+        {
+            return acceptor.local_endpoint().port();
+        }
+
+        /*- stop -*/
+        // Stops accepting connections, the ones in progress end with the io_service.
+        void stop()
+        {
+            boost::system::error_code ec;
+            acceptor.close(ec);
+        }
+};
+
+/*--- HttpTransport ---*/
+using HttpTransport = BasicHttpTransport<boost::asio::ip::tcp::socket>;
+
+} // namespace feather::core
+
+#endif
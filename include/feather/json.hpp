@@ -0,0 +1,233 @@
+/*--- Header file for json ---*/
+
+#ifndef FEATHER_JSON_HPP
+#define FEATHER_JSON_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <charconv>
+#include <cmath>
+#include <concepts>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace feather::core
+{
+
+/*--- json_fields ---*/
+/*
+    Opt-in reflection for WriteJson: specialize it for a struct with the tuple of its fields,
+    the struct is then written as an object without going through nlohmann::json.
+
+    Usage:
+
+    struct User { int id; std::string name; };
+
+    template <>
+    inline constexpr auto feather::core::json_fields<User> = std::make_tuple(
+        JSON_FIELD(User, id),
+        JSON_FIELD(User, name));
+*/
+template <typename T>
+inline constexpr auto json_fields = nullptr;
+
+/*--- JsonField ---*/
+// A named data member, as listed by json_fields.
+template <typename T, typename M>
+struct JsonField
+{
+    std::string_view    name;
+    M T::*              member;
+};
+
+/*- JSON_FIELD -*/
+// Macro helper naming a data member after itself in json_fields.
+#define JSON_FIELD(type, member) feather::core::JsonField<type, decltype(type::member)>{#member, &type::member}
+
+/*--- JsonReflected ---*/
+// True for the types json_fields was specialized for.
+template <typename T>
+concept JsonReflected = !std::is_null_pointer_v<std::remove_cv_t<decltype(json_fields<T>)>>;
+
+namespace json_detail
+{
+    template <typename T>
+    struct is_optional : std::false_type {};
+    template <typename T>
+    struct is_optional<std::optional<T>> : std::true_type {};
+
+    template <typename T>
+    struct is_shared_ptr : std::false_type {};
+    template <typename T>
+    struct is_shared_ptr<std::shared_ptr<T>> : std::true_type {};
+
+    template <typename T>
+    concept StringKeyed = std::ranges::range<T> && requires(std::ranges::range_value_t<T> const& entry)
+    {
+        { entry.first } -> std::convertible_to<std::string_view>;
+        entry.second;
+    };
+
+    // Appends a string as a JSON string literal, escaping only what JSON requires.
+    inline void WriteString(std::string& out, std::string_view str)
+    {
+        static constexpr char hex[] = "0123456789abcdef";
+
+        out.push_back('"');
+        size_t start = 0;
+        for (size_t i = 0; i < str.size(); ++i)
+        {
+            unsigned char const c = static_cast<unsigned char>(str[i]);
+            if (c >= 0x20 && c != '"' && c != '\\')
+            {
+                continue;
+            }
+            out.append(str.data() + start, i - start);
+            start = i + 1;
+            switch (c)
+            {
+                case '"':   out.append("\\\""); break;
+                case '\\':  out.append("\\\\"); break;
+                case '\b':  out.append("\\b"); break;
+                case '\f':  out.append("\\f"); break;
+                case '\n':  out.append("\\n"); break;
+                case '\r':  out.append("\\r"); break;
+                case '\t':  out.append("\\t"); break;
+                default:
+                    out.append("\\u00");
+                    out.push_back(hex[c >> 4]);
+                    out.push_back(hex[c & 0xf]);
+            }
+        }
+        out.append(str.data() + start, str.size() - start);
+        out.push_back('"');
+    }
+
+    // Appends a number with its shortest representation.
+    template <typename T>
+    void WriteNumber(std::string& out, T value)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            if (!std::isfinite(value))
+            {
+                out.append("null");
+                return;
+            }
+        }
+        char buffer[64];
+        auto const end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+        out.append(buffer, end);
+    }
+}
+
+/*--- WriteJson ---*/
+/*
+    Serializes a value as JSON at the end of out, without building a json DOM.
+
+    Supported values are:
+        - nlohmann::json, through its dump
+        - booleans, numbers (non-finite ones as null) and enums (as their underlying number)
+        - anything convertible to std::string_view, as a string
+        - std::optional and std::shared_ptr, as null when empty
+        - ranges of pairs with string keys (std::map...), as objects
+        - other ranges, as arrays
+        - structs described by json_fields, as objects
+        - anything else nlohmann::json can be built from, through a json value
+    Returns out.
+*/
+template <typename T>
+std::string& WriteJson(std::string& out, T const& value)
+{
+    using namespace json_detail;
+
+    if constexpr (std::is_same_v<T, nlohmann::json>)
+    {
+        out.append(value.dump());
+    }
+    else if constexpr (std::is_same_v<T, bool>)
+    {
+        out.append(value ? "true" : "false");
+    }
+    else if constexpr (std::is_arithmetic_v<T>)
+    {
+        WriteNumber(out, value);
+    }
+    else if constexpr (std::is_enum_v<T>)
+    {
+        WriteNumber(out, static_cast<std::underlying_type_t<T>>(value));
+    }
+    else if constexpr (std::is_null_pointer_v<T>)
+    {
+        out.append("null");
+    }
+    else if constexpr (std::is_convertible_v<T const&, std::string_view>)
+    {
+        WriteString(out, std::string_view(value));
+    }
+    else if constexpr (is_optional<T>::value || is_shared_ptr<T>::value)
+    {
+        if (value)
+        {
+            WriteJson(out, *value);
+        }
+        else
+        {
+            out.append("null");
+        }
+    }
+    else if constexpr (JsonReflected<T>)
+    {
+        out.push_back('{');
+        bool first = true;
+        std::apply([&](auto const&... fields)
+        {
+            ((out.append(first ? "" : ","), first = false,
+              WriteString(out, fields.name), out.push_back(':'),
+              WriteJson(out, value.*(fields.member))), ...);
+        }, json_fields<T>);
+        out.push_back('}');
+    }
+    else if constexpr (StringKeyed<T>)
+    {
+        out.push_back('{');
+        bool first = true;
+        for (auto const& [key, item] : value)
+        {
+            out.append(first ? "" : ",");
+            first = false;
+            WriteString(out, key);
+            out.push_back(':');
+            WriteJson(out, item);
+        }
+        out.push_back('}');
+    }
+    else if constexpr (std::ranges::range<T>)
+    {
+        out.push_back('[');
+        bool first = true;
+        for (auto const& item : value)
+        {
+            out.append(first ? "" : ",");
+            first = false;
+            WriteJson(out, item);
+        }
+        out.push_back(']');
+    }
+    else
+    {
+        static_assert(std::is_constructible_v<nlohmann::json, T const&>, "WriteJson: type cannot be written as JSON");
+        WriteJson(out, nlohmann::json(value));
+    }
+    return out;
+}
+
+} // namespace feather::core
+
+#endif
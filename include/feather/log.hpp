@@ -0,0 +1,566 @@
+/*--- Header file for log ---*/
+
+#ifndef FEATHER_LOG_HPP
+#define FEATHER_LOG_HPP
+
+#include <feather/core.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+/*
+    Structured logging of feather, kept off the request path.
+
+    A record is formatted on the calling thread as key=value pairs (logfmt) into a slot of a ring
+    owned by that thread: no lock, no allocation, no system call.
+    A background thread drains the rings, prefixes the records with their time and level,
+    and hands them to the sink in batches, stderr by default.
+    When the ring of a thread is full its records are dropped and counted rather than waited for,
+    a flood of malformed requests never holds the workers.
+
+    Levels below FEATHER_LOG_LEVEL are compiled out, their arguments are not even evaluated by
+    the LOG_* macros. FEATHER_LOG_LEVEL defaults to 2 (Info), see the CMake option of the same name.
+
+    Usage:
+
+    Log<LogLevel::Warn>("request rejected", {{"status", 400}, {"path", path}});
+    LOG_DEBUG("cache miss", {{"key", key}});
+
+    time=2026-10-14T09:30:00.123456Z level=warn msg="request rejected" status=400 path=/login
+*/
+
+#ifndef FEATHER_LOG_LEVEL
+#define FEATHER_LOG_LEVEL 2
+#endif
+
+namespace feather::core
+{
+
+/*--- LogLevel ---*/
+enum struct LogLevel
+{
+    Trace,
+    Debug,
+    Info,
+    Warn,
+    Error,
+    Off,
+};
+
+/*--- LogEnabled ---*/
+// Whether records of level are compiled in.
+template <LogLevel level>
+inline constexpr bool LogEnabled = level != LogLevel::Off && static_cast<int>(level) >= FEATHER_LOG_LEVEL;
+
+/*--- LogField ---*/
+// A key=value pair of a record. Strings are only viewed: the record is formatted before the call returns.
+struct LogField
+{
+    enum struct Kind { STRING, INTEGER, UNSIGNED, REAL, BOOLEAN };
+
+    std::string_view    key;
+    Kind                kind;
+    std::string_view    string;
+    int64_t             integer = 0;
+    uint64_t            unsigned_integer = 0;
+    double              real = 0;
+
+    LogField(std::string_view k, std::string_view v) : key(k), kind(Kind::STRING), string(v) {}
+    LogField(std::string_view k, char const* v) : key(k), kind(Kind::STRING), string(v) {}
+    LogField(std::string_view k, std::string const& v) : key(k), kind(Kind::STRING), string(v) {}
+    LogField(std::string_view k, bool v) : key(k), kind(Kind::BOOLEAN), integer(v) {}
+
+    template <typename T> requires (std::is_integral_v<T> && std::is_signed_v<T>)
+    LogField(std::string_view k, T v) : key(k), kind(Kind::INTEGER), integer(v) {}
+
+    template <typename T> requires (std::is_integral_v<T> && std::is_unsigned_v<T> && !std::is_same_v<T, bool>)
+    LogField(std::string_view k, T v) : key(k), kind(Kind::UNSIGNED), unsigned_integer(v) {}
+
+    template <typename T> requires std::is_floating_point_v<T>
+    LogField(std::string_view k, T v) : key(k), kind(Kind::REAL), real(static_cast<double>(v)) {}
+};
+
+namespace log_detail
+{
+    inline constexpr size_t record_size = 240;
+    inline constexpr size_t ring_capacity = 256;
+
+    /*--- Record ---*/
+    // A formatted record waiting in a ring. Longer records are truncated and end with "...".
+    struct Record
+    {
+        int64_t                         time = 0;
+        LogLevel                        level = LogLevel::Info;
+        uint16_t                        size = 0;
+        std::array<char, record_size>   text;
+    };
+
+    /*--- Writer ---*/
+    // Appends to the text of a record, stopping at its capacity.
+    struct Writer
+    {
+        Record& record;
+        bool    truncated = false;
+
+        void put(char c)
+        {
+            if (record.size < record_size)
+            {
+                record.text[record.size++] = c;
+            } else
+            {
+                truncated = true;
+            }
+        }
+
+        void put(std::string_view s)
+        {
+            size_t const room = record_size - record.size;
+            size_t const n = s.size() < room ? s.size() : room;
+            std::copy_n(s.data(), n, record.text.data() + record.size);
+            record.size += static_cast<uint16_t>(n);
+            truncated = truncated || n < s.size();
+        }
+
+        // A value, quoted when it is empty or holds a space, a quote, an equal sign or a control character.
+        void value(std::string_view s)
+        {
+            bool const quote = s.empty() || s.find_first_of(" \"=\\") != std::string_view::npos
+                || std::any_of(s.begin(), s.end(), [](char c) { return static_cast<unsigned char>(c) < 0x20; });
+            if (!quote)
+            {
+                put(s);
+                return;
+            }
+            put('"');
+            for (char const c : s)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    put('\\');
+                    put(c);
+                } else if (c == '\n')
+                {
+                    put("\\n");
+                } else if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    put(' ');
+                } else
+                {
+                    put(c);
+                }
+            }
+            put('"');
+        }
+
+        template <typename T>
+        void number(T v)
+        {
+            std::array<char, 32> buffer;
+            auto const end = std::to_chars(buffer.data(), buffer.data() + buffer.size(), v).ptr;
+            put(std::string_view(buffer.data(), static_cast<size_t>(end - buffer.data())));
+        }
+
+        void field(LogField const& f)
+        {
+            put(' ');
+            put(f.key);
+            put('=');
+            switch (f.kind)
+            {
+                case LogField::Kind::STRING:    value(f.string); break;
+                case LogField::Kind::INTEGER:   number(f.integer); break;
+                case LogField::Kind::UNSIGNED:  number(f.unsigned_integer); break;
+                case LogField::Kind::REAL:      number(f.real); break;
+                case LogField::Kind::BOOLEAN:   put(f.integer ? "true" : "false"); break;
+            }
+        }
+
+        void finish()
+        {
+            if (truncated)
+            {
+                record.size = static_cast<uint16_t>(record_size - 3);
+                put("...");
+            }
+        }
+    };
+
+    /*--- Ring ---*/
+    // Single producer, single consumer queue of records: the thread owning it writes, the drain reads.
+    struct Ring
+    {
+        std::array<Record, ring_capacity>   records;
+        std::atomic<size_t>                 head{0};
+        std::atomic<size_t>                 tail{0};
+
+        // Slot of the next record, nullptr when the ring is full.
+        Record* reserve()
+        {
+            size_t const t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) == ring_capacity)
+            {
+                return nullptr;
+            }
+            return &records[t % ring_capacity];
+        }
+
+        void commit()
+        {
+            tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        bool empty() const
+        {
+            return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+        }
+    };
+
+    inline std::string_view LevelName(LogLevel level)
+    {
+        switch (level)
+        {
+            case LogLevel::Trace:   return "trace";
+            case LogLevel::Debug:   return "debug";
+            case LogLevel::Info:    return "info";
+            case LogLevel::Warn:    return "warn";
+            case LogLevel::Error:   return "error";
+            case LogLevel::Off:     break;
+        }
+        return "off";
+    }
+
+    // time=...Z level=... prefix of a record, its time in microseconds since the epoch.
+    inline void AppendPrefix(std::string& out, int64_t time, LogLevel level)
+    {
+        std::time_t const seconds = static_cast<std::time_t>(time / 1000000);
+        std::tm tm{};
+        gmtime_r(&seconds, &tm);
+        std::array<char, 64> buffer;
+        int const n = std::snprintf(buffer.data(), buffer.size(), "time=%04d-%02d-%02dT%02d:%02d:%02d.%06dZ level=",
+            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+            static_cast<int>(time % 1000000));
+        out.append(buffer.data(), static_cast<size_t>(n));
+        out.append(LevelName(level));
+        out.push_back(' ');
+    }
+
+    // Writes a batch to stderr, retrying on partial writes.
+    inline void WriteStderr(std::string_view batch)
+    {
+        while (!batch.empty())
+        {
+            ssize_t const written = ::write(STDERR_FILENO, batch.data(), batch.size());
+            if (written <= 0)
+            {
+                return;
+            }
+            batch.remove_prefix(static_cast<size_t>(written));
+        }
+    }
+}
+
+/*--- Logger ---*/
+/*
+    Owner of the rings of the threads and of the thread draining them, see above.
+    Logger::global() is the logger of Log and of the LOG_* macros.
+*/
+class Logger
+{
+    public:
+        using Sink = std::function<void(std::string_view)>;
+
+        /*- Options -*/
+        struct Options
+        {
+            // Receives the drained lines, each ending with '\n'. Called from the drain thread only.
+            Sink                        sink = log_detail::WriteStderr;
+            // Longest time a record waits in its ring.
+            std::chrono::milliseconds   interval{50};
+        };
+
+    private:
+        using Ring = log_detail::Ring;
+
+        Options                             options;
+        uint64_t                            id;
+        std::mutex                          rings_mutex;
+        std::vector<std::shared_ptr<Ring>>  rings;
+        std::mutex                          drain_mutex;
+        std::atomic<uint64_t>               dropped_count{0};
+        std::mutex                          wake_mutex;
+        std::condition_variable             wake;
+        bool                                stopping = false;
+        std::thread                         worker;
+
+        static uint64_t next_id()
+        {
+            static std::atomic<uint64_t> next{0};
+            return next.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /*- private ring -*/
+        // Ring of the calling thread, registered on its first record.
+        // A thread keeps its rings alive, the logger forgets a ring once its thread is gone and it is drained.
+        Ring& ring()
+        {
+            struct Entry
+            {
+                uint64_t                logger;
+                std::shared_ptr<Ring>   ring;
+            };
+            thread_local std::vector<Entry> owned;
+
+            for (auto const& entry : owned)
+            {
+                if (entry.logger == id)
+                {
+                    return *entry.ring;
+                }
+            }
+            auto created = std::make_shared<Ring>();
+            {
+                std::lock_guard<std::mutex> lock(rings_mutex);
+                rings.push_back(created);
+            }
+            owned.push_back({id, created});
+            return *created;
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            while (!stopping)
+            {
+                wake.wait_for(lock, options.interval);
+                lock.unlock();
+                flush();
+                lock.lock();
+            }
+        }
+
+    public:
+        Logger() : Logger(Options()) {}
+
+        explicit Logger(Options opts) : options(std::move(opts)), id(next_id())
+        {
+            worker = std::thread([this]() { run(); });
+        }
+
+        Logger(Logger const&) = delete;
+        Logger& operator=(Logger const&) = delete;
+
+        ~Logger()
+        {
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+            flush();
+        }
+
+        static Logger& global()
+        {
+            static Logger logger;
+            return logger;
+        }
+
+        /*- log -*/
+        // Formats a record into the ring of the calling thread. Returns false if the ring was full and it was dropped.
+        template <LogLevel level>
+        bool log(std::string_view message, std::initializer_list<LogField> fields = {})
+        {
+            if constexpr (!LogEnabled<level>)
+            {
+                return false;
+            } else
+            {
+                Ring& r = ring();
+                log_detail::Record* const record = r.reserve();
+                if (record == nullptr)
+                {
+                    dropped_count.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+
+                record->time = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+                record->level = level;
+                record->size = 0;
+
+                log_detail::Writer writer{*record};
+                writer.put("msg=");
+                writer.value(message);
+                for (auto const& field : fields)
+                {
+                    writer.field(field);
+                }
+                writer.finish();
+                r.commit();
+                return true;
+            }
+        }
+
+        /*- flush -*/
+        // Drains every ring into the sink now. Also run by the drain thread every interval.
+        void flush()
+        {
+            std::lock_guard<std::mutex> drain_lock(drain_mutex);
+
+            std::vector<std::shared_ptr<Ring>> current;
+            {
+                std::lock_guard<std::mutex> lock(rings_mutex);
+                std::erase_if(rings, [](auto const& r) { return r.use_count() == 1 && r->empty(); });
+                current = rings;
+            }
+
+            std::string batch;
+            for (auto const& r : current)
+            {
+                size_t head = r->head.load(std::memory_order_relaxed);
+                size_t const tail = r->tail.load(std::memory_order_acquire);
+                for (; head != tail; ++head)
+                {
+                    auto const& record = r->records[head % log_detail::ring_capacity];
+                    log_detail::AppendPrefix(batch, record.time, record.level);
+                    batch.append(record.text.data(), record.size);
+                    batch.push_back('\n');
+                }
+                r->head.store(head, std::memory_order_release);
+            }
+
+            if (uint64_t const dropped = dropped_count.exchange(0, std::memory_order_relaxed); dropped != 0)
+            {
+                log_detail::Record note;
+                note.time = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+                log_detail::Writer writer{note};
+                writer.put("msg=\"log records dropped\"");
+                writer.field({"count", dropped});
+                log_detail::AppendPrefix(batch, note.time, LogLevel::Warn);
+                batch.append(note.text.data(), note.size);
+                batch.push_back('\n');
+            }
+
+            if (!batch.empty())
+            {
+                options.sink(batch);
+            }
+        }
+};
+
+/*--- Log ---*/
+// Logs a record of level with the global logger, see Logger::log.
+template <LogLevel level>
+inline void Log(std::string_view message, std::initializer_list<LogField> fields = {})
+{
+    if constexpr (LogEnabled<level>)
+    {
+        Logger::global().log<level>(message, fields);
+    }
+}
+
+/*--- access_log ---*/
+/*
+    Plug logging a line per request once its response is ready to be sent:
+    method, path, status, response size and the time spent since the plug, in microseconds.
+    The size is the length of the body, of the file for send_file, and "-" for a chunked response, unknown when its head goes out.
+    Logs to the global logger unless given another.
+
+    Plug it first for the time to cover the whole pipeline. In a pipeline with asynchronous plugs or handler,
+    plug it ahead of them: the before_send callbacks run once the task of the route completed,
+    so duration_us includes the time spent awaiting. Chunked responses and files are logged when their head is sent,
+    their duration does not include the streaming of the body.
+
+    time=... level=info msg=request method=get path=/users status=200 bytes=512 duration_us=84
+*/
+inline plug::Conn access_log(plug::Conn&& conn, Logger& logger = Logger::global())
+{
+    if constexpr (!LogEnabled<LogLevel::Info>)
+    {
+        return std::move(conn);
+    } else
+    {
+        auto const start = std::chrono::steady_clock::now();
+        return plug::Conn::register_before_send(std::move(conn), [start, &logger](plug::Conn const& c)
+        {
+            auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            auto const state = std::holds_alternative<plug::Unsent>(c.state) ? std::get<plug::Unsent>(c.state) : plug::Unsent::SENT;
+            LogField const bytes = state == plug::Unsent::SET_CHUNKED
+                ? LogField("bytes", "-")
+                : LogField("bytes", state == plug::Unsent::SET_FILE
+                    ? c.resp_file_length
+                    : (c.resp_body == nullptr ? size_t(0) : c.resp_body->size()));
+            logger.log<LogLevel::Info>("request", {
+                {"method", c.method == nullptr ? std::string_view() : std::string_view(*c.method)},
+                {"path", c.request_path == nullptr ? std::string_view() : std::string_view(*c.request_path)},
+                {"status", c.status.value_or(0)},
+                bytes,
+                {"duration_us", static_cast<int64_t>(elapsed.count())},
+            });
+            return c;
+        });
+    }
+}
+
+inline plug::Conn const access_log(plug::Conn const& conn, Logger& logger = Logger::global())
+{
+    return access_log(plug::Conn(conn), logger);
+}
+
+} // namespace feather::core
+
+/*
+    Level macros: below FEATHER_LOG_LEVEL they expand to nothing and their arguments are not evaluated.
+*/
+#if FEATHER_LOG_LEVEL <= 0
+#define LOG_TRACE(...) feather::core::Log<feather::core::LogLevel::Trace>(__VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#endif
+
+#if FEATHER_LOG_LEVEL <= 1
+#define LOG_DEBUG(...) feather::core::Log<feather::core::LogLevel::Debug>(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+#if FEATHER_LOG_LEVEL <= 2
+#define LOG_INFO(...) feather::core::Log<feather::core::LogLevel::Info>(__VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if FEATHER_LOG_LEVEL <= 3
+#define LOG_WARN(...) feather::core::Log<feather::core::LogLevel::Warn>(__VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if FEATHER_LOG_LEVEL <= 4
+#define LOG_ERROR(...) feather::core::Log<feather::core::LogLevel::Error>(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,568 @@
+/*--- Header file for metrics ---*/
+
+#ifndef FEATHER_METRICS_HPP
+#define FEATHER_METRICS_HPP
+
+#include <feather/core.hpp>
+#include <feather/async.hpp>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/*
+    Hot path metrics of feather: latency histograms of the stages of a request and a few counters,
+    exported in the Prometheus text format by the export_metrics handler.
+
+    Recording is lock-free: each histogram and counter is split into shards,
+    a thread always writes to its own shard with relaxed atomic increments,
+    and the exporter sums the shards when it is scraped.
+
+    Defining FEATHER_NO_METRICS (the FEATHER_METRICS CMake option set to OFF) compiles the recording out:
+    the instruments keep their interface, timers no longer read the clock and nothing is recorded.
+*/
+namespace feather::core
+{
+
+/*--- MetricsEnabled ---*/
+#ifdef FEATHER_NO_METRICS
+inline constexpr bool MetricsEnabled = false;
+#else
+inline constexpr bool MetricsEnabled = true;
+#endif
+
+namespace metrics_detail
+{
+    inline constexpr size_t shard_count = 8;
+
+    // Shard of the calling thread, threads are given one in turn on their first record.
+    inline size_t ShardIndex()
+    {
+        static std::atomic<size_t> next{0};
+        thread_local size_t const index = next.fetch_add(1, std::memory_order_relaxed) % shard_count;
+        return index;
+    }
+
+    // Escapes a Prometheus label value.
+    inline std::string EscapeLabel(std::string_view value)
+    {
+        std::string out;
+        out.reserve(value.size());
+        for (char const c : value)
+        {
+            if (c == '\\' || c == '"')
+            {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if (c == '\n')
+            {
+                out.append("\\n");
+            }
+            else
+            {
+                out.push_back(c);
+            }
+        }
+        return out;
+    }
+}
+
+/*--- Histogram ---*/
+/*
+    Log-linear histogram of durations in nanoseconds, in the spirit of HdrHistogram:
+    every power of two is split into 8 linear sub-buckets, so any value is kept within 12.5%
+    from 1 ns to the end of the uint64_t range, in a fixed array of buckets.
+*/
+class Histogram
+{
+    public:
+        static constexpr unsigned   sub_bits        = 3;
+        static constexpr size_t     sub_count       = size_t(1) << sub_bits;
+        static constexpr size_t     bucket_count    = (64 - sub_bits + 1) << sub_bits;
+
+        /*- Snapshot -*/
+        // Sum of the shards at one point in time.
+        struct Snapshot
+        {
+            std::array<uint64_t, bucket_count>  buckets{};
+            uint64_t                            count = 0;
+            uint64_t                            sum = 0;
+
+            /*- below -*/
+            // Number of values lower than or equal to limit, up to the precision of the buckets.
+            uint64_t below(uint64_t limit) const
+            {
+                uint64_t total = 0;
+                for (size_t i = 0; i < bucket_count && LowerBound(i) <= limit; ++i)
+                {
+                    total += buckets[i];
+                }
+                return total;
+            }
+
+            /*- percentile -*/
+            // Upper bound of the bucket holding the p-th percentile.
+            uint64_t percentile(double p) const
+            {
+                uint64_t const rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(count) + 0.5);
+                uint64_t seen = 0;
+                for (size_t i = 0; i < bucket_count; ++i)
+                {
+                    seen += buckets[i];
+                    if (seen >= std::max<uint64_t>(rank, 1))
+                    {
+                        return UpperBound(i);
+                    }
+                }
+                return 0;
+            }
+        };
+
+    private:
+        struct alignas(64) Shard
+        {
+            std::array<std::atomic<uint64_t>, bucket_count> buckets{};
+            std::atomic<uint64_t>                           sum{0};
+        };
+
+        std::array<Shard, metrics_detail::shard_count> shards;
+
+    public:
+        /*- BucketOf -*/
+        static constexpr size_t BucketOf(uint64_t value)
+        {
+            if (value < sub_count)
+            {
+                return static_cast<size_t>(value);
+            }
+            unsigned const shift = static_cast<unsigned>(std::bit_width(value)) - 1 - sub_bits;
+            return ((shift + 1) << sub_bits) + static_cast<size_t>((value >> shift) & (sub_count - 1));
+        }
+
+        /*- LowerBound -*/
+        static constexpr uint64_t LowerBound(size_t bucket)
+        {
+            if (bucket < sub_count)
+            {
+                return bucket;
+            }
+            unsigned const shift = static_cast<unsigned>(bucket >> sub_bits) - 1;
+            return (sub_count + (bucket & (sub_count - 1))) << shift;
+        }
+
+        /*- UpperBound -*/
+        // Largest value of a bucket.
+        static constexpr uint64_t UpperBound(size_t bucket)
+        {
+            return bucket < sub_count ? bucket : LowerBound(bucket) + ((uint64_t(1) << ((bucket >> sub_bits) - 1)) - 1);
+        }
+
+        /*- record -*/
+        void record(uint64_t nanoseconds)
+        {
+            if constexpr (MetricsEnabled)
+            {
+                Shard& shard = shards[metrics_detail::ShardIndex()];
+                shard.buckets[BucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+                shard.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+            }
+        }
+
+        /*- snapshot -*/
+        Snapshot snapshot() const
+        {
+            Snapshot snap;
+            for (Shard const& shard : shards)
+            {
+                for (size_t i = 0; i < bucket_count; ++i)
+                {
+                    uint64_t const count = shard.buckets[i].load(std::memory_order_relaxed);
+                    snap.buckets[i] += count;
+                    snap.count += count;
+                }
+                snap.sum += shard.sum.load(std::memory_order_relaxed);
+            }
+            return snap;
+        }
+};
+
+/*--- Counter ---*/
+// Monotonic counter, sharded like the histograms.
+class Counter
+{
+    private:
+        struct alignas(64) Shard
+        {
+            std::atomic<uint64_t> value{0};
+        };
+
+        std::array<Shard, metrics_detail::shard_count> shards;
+
+    public:
+        /*- add -*/
+        void add(uint64_t amount = 1)
+        {
+            if constexpr (MetricsEnabled)
+            {
+                shards[metrics_detail::ShardIndex()].value.fetch_add(amount, std::memory_order_relaxed);
+            }
+        }
+
+        /*- value -*/
+        uint64_t value() const
+        {
+            uint64_t total = 0;
+            for (Shard const& shard : shards)
+            {
+                total += shard.value.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+};
+
+/*--- Gauge ---*/
+// Value going up and down, such as the number of open connections.
+class Gauge
+{
+    private:
+        std::atomic<int64_t> current{0};
+
+    public:
+        /*- add -*/
+        void add(int64_t amount = 1)
+        {
+            if constexpr (MetricsEnabled)
+            {
+                current.fetch_add(amount, std::memory_order_relaxed);
+            }
+        }
+
+        /*- value -*/
+        int64_t value() const
+        {
+            return current.load(std::memory_order_relaxed);
+        }
+};
+
+/*--- StageTimer ---*/
+/*
+    Records the time spent in its scope into a histogram.
+
+    Usage:
+
+    static Histogram& parse = Metrics::instance().histogram("parse");
+    StageTimer timer(parse);
+*/
+class StageTimer
+{
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        Histogram&          histogram;
+        Clock::time_point   start;
+
+    public:
+        explicit StageTimer(Histogram& h) : histogram(h)
+        {
+            if constexpr (MetricsEnabled)
+            {
+                start = Clock::now();
+            }
+        }
+
+        StageTimer(StageTimer const&) = delete;
+        StageTimer& operator=(StageTimer const&) = delete;
+
+        ~StageTimer()
+        {
+            if constexpr (MetricsEnabled)
+            {
+                histogram.record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+            }
+        }
+};
+
+/*--- Metrics ---*/
+/*
+    Registry of the instruments, a singleton.
+
+    Histograms are keyed by stage ("parse", "route", "pipeline", "plug", "handler", "serialize")
+    and by name (the pipeline, the plug or the route), and exported as
+    feather_stage_duration_seconds{stage="...",name="..."}.
+    A histogram takes about 32 KB: the routes share a single "handler" histogram
+    unless set_per_route(true) was called before they are registered.
+    Looking an instrument up takes a lock: it is done once, when a route, a pipeline or a plug is registered,
+    or through a function local static. The instruments are never freed, references to them stay valid.
+
+    Built-in instruments:
+        - feather_connections_active       : open HTTP and WebSocket connections
+        - feather_bytes_received_total     : bytes read from the HTTP sockets
+        - feather_bytes_sent_total         : bytes written to the HTTP sockets
+        - feather_requests_total           : requests dispatched to the router
+        - feather_sessions                 : sessions kept by the session store of the Server
+*/
+class Metrics
+{
+    private:
+        using Key = std::pair<std::string, std::string>;
+
+        mutable std::mutex                                      lock;
+        std::map<Key, std::unique_ptr<Histogram>>               histograms;
+        std::map<std::string, std::unique_ptr<Counter>>         counters;
+        std::map<std::string, std::unique_ptr<Gauge>>           gauges;
+        std::map<std::string, std::function<double()>>          callbacks;
+        std::map<std::string, std::string>                      helps;
+        std::atomic<bool>                                       route_histograms{false};
+
+        Metrics() = default;
+
+        // Upper bounds of the exported buckets, in nanoseconds.
+        static constexpr std::array<uint64_t, 14> exported_bounds = {
+            1000, 5000, 10000, 50000, 100000, 500000,
+            1000000, 5000000, 10000000, 50000000, 100000000, 500000000,
+            1000000000, 5000000000
+        };
+
+    public:
+        Metrics(Metrics const&) = delete;
+        Metrics& operator=(Metrics const&) = delete;
+
+        /*- instance -*/
+        static Metrics& instance()
+        {
+            static Metrics metrics;
+            return metrics;
+        }
+
+        /*- histogram -*/
+        // Returns the histogram of a stage, created on first use.
+        Histogram& histogram(std::string const& stage, std::string const& name = "")
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto& slot = histograms[{stage, name}];
+            if (slot == nullptr)
+            {
+                slot = std::make_unique<Histogram>();
+            }
+            return *slot;
+        }
+
+        /*- counter -*/
+        Counter& counter(std::string const& name, std::string const& help = "")
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto& slot = counters[name];
+            if (slot == nullptr)
+            {
+                slot = std::make_unique<Counter>();
+                helps[name] = help;
+            }
+            return *slot;
+        }
+
+        /*- gauge -*/
+        Gauge& gauge(std::string const& name, std::string const& help = "")
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto& slot = gauges[name];
+            if (slot == nullptr)
+            {
+                slot = std::make_unique<Gauge>();
+                helps[name] = help;
+            }
+            return *slot;
+        }
+
+        /*- observe -*/
+        // Registers a gauge read when the metrics are exported, replacing the previous one of that name.
+        void observe(std::string const& name, std::string const& help, std::function<double()> read)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            callbacks[name] = std::move(read);
+            helps[name] = help;
+        }
+
+        /*- forget -*/
+        // Removes a gauge registered by observe, e.g. when its owner is destroyed.
+        void forget(std::string const& name)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            callbacks.erase(name);
+        }
+
+        /*- connections / bytes_in / bytes_out / requests -*/
+        static Gauge& connections()
+        {
+            static Gauge& instrument = instance().gauge("feather_connections_active", "Open HTTP and WebSocket connections.");
+            return instrument;
+        }
+
+        static Counter& bytes_in()
+        {
+            static Counter& instrument = instance().counter("feather_bytes_received_total", "Bytes read from the HTTP sockets.");
+            return instrument;
+        }
+
+        static Counter& bytes_out()
+        {
+            static Counter& instrument = instance().counter("feather_bytes_sent_total", "Bytes written to the HTTP sockets.");
+            return instrument;
+        }
+
+        static Counter& requests()
+        {
+            static Counter& instrument = instance().counter("feather_requests_total", "Requests dispatched to the router.");
+            return instrument;
+        }
+
+        /*- stage -*/
+        // Shortcut of instance().histogram(stage, name).
+        static Histogram& stage(std::string const& stage, std::string const& name = "")
+        {
+            return instance().histogram(stage, name);
+        }
+
+        /*- set_per_route / per_route -*/
+        // Whether each route registered from now on gets its own "handler" histogram, off by default.
+        void set_per_route(bool enabled)
+        {
+            route_histograms.store(enabled, std::memory_order_relaxed);
+        }
+
+        bool per_route() const
+        {
+            return route_histograms.load(std::memory_order_relaxed);
+        }
+
+        /*- handler -*/
+        // Histogram of the handler of a route: its own with per_route, the one shared by every route otherwise.
+        static Histogram& handler(std::string const& route)
+        {
+            return stage("handler", instance().per_route() ? route : "");
+        }
+
+        /*- export_prometheus -*/
+        // Writes every instrument in the Prometheus text exposition format, version 0.0.4.
+        std::string export_prometheus() const
+        {
+            using metrics_detail::EscapeLabel;
+
+            std::lock_guard<std::mutex> guard(lock);
+            std::string out;
+
+            for (auto const& [name, counter] : counters)
+            {
+                out.append("# HELP ").append(name).append(" ").append(helps.at(name)).append("\n")
+                   .append("# TYPE ").append(name).append(" counter\n")
+                   .append(name).append(" ").append(std::to_string(counter->value())).append("\n");
+            }
+            for (auto const& [name, gauge] : gauges)
+            {
+                out.append("# HELP ").append(name).append(" ").append(helps.at(name)).append("\n")
+                   .append("# TYPE ").append(name).append(" gauge\n")
+                   .append(name).append(" ").append(std::to_string(gauge->value())).append("\n");
+            }
+            for (auto const& [name, read] : callbacks)
+            {
+                out.append("# HELP ").append(name).append(" ").append(helps.at(name)).append("\n")
+                   .append("# TYPE ").append(name).append(" gauge\n")
+                   .append(name).append(" ").append(std::to_string(read())).append("\n");
+            }
+
+            if (histograms.empty())
+            {
+                return out;
+            }
+            out.append("# HELP feather_stage_duration_seconds Time spent in each stage of the requests.\n")
+               .append("# TYPE feather_stage_duration_seconds histogram\n");
+            for (auto const& [key, histogram] : histograms)
+            {
+                Histogram::Snapshot const snap = histogram->snapshot();
+                std::string const labels = "stage=\"" + EscapeLabel(key.first) + "\",name=\"" + EscapeLabel(key.second) + "\"";
+
+                for (uint64_t const bound : exported_bounds)
+                {
+                    out.append("feather_stage_duration_seconds_bucket{").append(labels)
+                       .append(",le=\"").append(std::to_string(static_cast<double>(bound) / 1e9)).append("\"} ")
+                       .append(std::to_string(snap.below(bound))).append("\n");
+                }
+                out.append("feather_stage_duration_seconds_bucket{").append(labels).append(",le=\"+Inf\"} ")
+                   .append(std::to_string(snap.count)).append("\n")
+                   .append("feather_stage_duration_seconds_sum{").append(labels).append("} ")
+                   .append(std::to_string(static_cast<double>(snap.sum) / 1e9)).append("\n")
+                   .append("feather_stage_duration_seconds_count{").append(labels).append("} ")
+                   .append(std::to_string(snap.count)).append("\n");
+            }
+            return out;
+        }
+};
+
+/*--- TimedPlug ---*/
+/*
+    Wraps a plug so that its calls are recorded under the "plug" stage, with the given name. Used by PLUG.
+    A plug returning a Task is stored as an AsyncStep, its time runs until the task completes.
+*/
+template <typename Func>
+plug::Plug TimedPlug(std::string const& name, Func&& func)
+{
+    if constexpr (std::is_same_v<std::invoke_result_t<Func&, plug::Conn, plug::PlugOptions>, Task<plug::Conn>>)
+    {
+        if constexpr (MetricsEnabled)
+        {
+            return AsyncStep{[&timer = Metrics::stage("plug", name), func = std::forward<Func>(func)](plug::Conn conn, plug::PlugOptions opts) -> Task<plug::Conn>
+            {
+                StageTimer scope(timer);
+                co_return co_await func(std::move(conn), std::move(opts));
+            }};
+        }
+        else
+        {
+            return AsyncStep{AsyncPlug(std::forward<Func>(func))};
+        }
+    }
+    else if constexpr (MetricsEnabled)
+    {
+        return [&timer = Metrics::stage("plug", name), func = std::forward<Func>(func)](plug::Conn conn, plug::PlugOptions opts) -> plug::Conn
+        {
+            StageTimer scope(timer);
+            return func(std::move(conn), std::move(opts));
+        };
+    }
+    else
+    {
+        return plug::Plug(std::forward<Func>(func));
+    }
+}
+
+/*--- export_metrics ---*/
+/*
+    Route handler answering with the metrics in the Prometheus text format.
+
+    Usage:
+
+    GET( "/metrics", feather::core::export_metrics );
+*/
+inline plug::Conn const export_metrics(plug::Conn const& conn)
+{
+    using plug::Conn;
+
+    return Conn::resp(
+        unwrap<Conn>(Conn::put_resp_header(conn, "content-type", "text/plain; version=0.0.4")),
+        200, Metrics::instance().export_prometheus());
+}
+
+} // namespace feather::core
+
+#endif
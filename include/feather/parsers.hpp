@@ -0,0 +1,432 @@
+/*--- Header file for parsers ---*/
+
+#ifndef FEATHER_PARSERS_HPP
+#define FEATHER_PARSERS_HPP
+
+#include <feather/core.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace feather::core
+{
+
+/*--- ParserOptions ---*/
+/*
+    Options of fetch_body_params and spool_part.
+
+    - length       : largest urlencoded or JSON body, and largest multipart field that is not a file,
+                     a larger one gets a 413. Defaults to 8_000_000 bytes
+    - read_length  : amount of bytes read from the socket at one time, defaults to 1_000_000 bytes
+    - read_timeout : timeout of each read, defaults to 15 seconds
+    - upload_dir   : directory the multipart files are spooled to, defaults to the temporary directory
+    - max_parts    : most parts of a multipart body, a body with more gets a 413. Defaults to 256
+    - max_upload_size : most bytes spooled to disk for the files of a multipart body, together,
+                     more gets a 413. Defaults to 100_000_000 bytes
+*/
+struct ParserOptions
+{
+    size_t                      length          = 8000000;
+    size_t                      read_length     = 1000000;
+    std::chrono::milliseconds   read_timeout    = std::chrono::seconds(15);
+    std::filesystem::path       upload_dir      = std::filesystem::temp_directory_path();
+    size_t                      max_parts       = 256;
+    size_t                      max_upload_size = 100000000;
+};
+
+/*--- Upload ---*/
+// A file part of a multipart body, spooled to disk by fetch_body_params.
+struct Upload
+{
+    std::string     path;
+    std::string     filename;
+    std::string     content_type;
+    size_t          size = 0;
+};
+
+using Uploads = immer::map<std::string, Upload>;
+
+/*--- ContentDisposition ---*/
+// The name and the filename of a multipart part.
+struct ContentDisposition
+{
+    std::string                 name;
+    std::optional<std::string>  filename;
+};
+
+/*--- ParseContentDisposition ---*/
+// Parses a Content-Disposition header value such as: form-data; name="file"; filename="a.txt"
+inline ContentDisposition ParseContentDisposition(std::string_view value)
+{
+    ContentDisposition disposition;
+    while (!value.empty())
+    {
+        size_t const semicolon = value.find(';');
+        std::string_view item = value.substr(0, semicolon);
+        value.remove_prefix(semicolon == std::string_view::npos ? value.size() : semicolon + 1);
+
+        item.remove_prefix(std::min(item.find_first_not_of(" \t"), item.size()));
+        size_t const equal = item.find('=');
+        if (equal == std::string_view::npos)
+        {
+            continue;
+        }
+        std::string_view const key = item.substr(0, equal);
+        std::string_view param = item.substr(equal + 1);
+        if (param.size() >= 2 && param.front() == '"' && param.back() == '"')
+        {
+            param = param.substr(1, param.size() - 2);
+        }
+
+        if (boost::iequals(key, "name"))
+        {
+            disposition.name = param;
+        }
+        else if (boost::iequals(key, "filename"))
+        {
+            disposition.filename = std::string(param);
+        }
+    }
+    return disposition;
+}
+
+/*--- PartHeader ---*/
+// Returns the value of a header of a multipart part, keys are lowercase.
+inline std::optional<std::string_view> PartHeader(plug::MultipartReader::PartHeaders const& headers, std::string_view key)
+{
+    for (auto const& [name, value] : headers)
+    {
+        if (name == key)
+        {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+namespace parsers_detail
+{
+    inline ImmutMapString BodyOpts(ParserOptions const& options, size_t length)
+    {
+        return ImmutMapString()
+            .set("length", ShareStr(std::to_string(length)))
+            .set("read_length", ShareStr(std::to_string(options.read_length)))
+            .set("read_timeout", ShareStr(std::to_string(options.read_timeout.count())));
+    }
+
+    // Reads a whole body into buffer, in slices. Returns 0 on success, or the status of the failure.
+    inline int ReadWhole(plug::Conn& conn, std::string& buffer, ParserOptions const& options)
+    {
+        using plug::Conn;
+
+        if (auto const length = conn.req_headers.find("content-length"); length != conn.req_headers.end())
+        {
+            size_t const expected = std::strtoull(length->second.c_str(), nullptr, 10);
+            if (expected > options.length)
+            {
+                return 413;
+            }
+            buffer.reserve(expected);
+        }
+
+        ImmutMapString const opts = BodyOpts(options, options.read_length);
+        while (true)
+        {
+            auto read = Conn::read_body(std::move(conn), opts);
+            conn = Conn(read.second.second);
+            if (read.first == ResultType::Err)
+            {
+                return 400;
+            }
+            buffer.append(read.second.first);
+            if (buffer.size() > options.length)
+            {
+                return 413;
+            }
+            if (read.first == ResultType::Ok)
+            {
+                return 0;
+            }
+        }
+    }
+
+    // Stores the members of a JSON object as body params, nested values as their JSON text.
+    inline bool DecodeJson(std::string_view body, ImmutMapString::transient_type& params)
+    {
+        nlohmann::json const json = nlohmann::json::parse(body, nullptr, false);
+        if (json.is_discarded())
+        {
+            return false;
+        }
+        if (!json.is_object())
+        {
+            params.set("_json", ShareStr(json.dump()));
+            return true;
+        }
+        for (auto const& [key, value] : json.items())
+        {
+            params.set(key, ShareStr(value.is_string() ? value.get<std::string>() : value.dump()));
+        }
+        return true;
+    }
+
+    inline plug::Conn Fail(plug::Conn&& conn, int status)
+    {
+        conn.status = std::make_optional(status);
+        return plug::Conn::halt(std::move(conn));
+    }
+}
+
+/*--- spool_part ---*/
+/*
+    Writes the body of the current multipart part (after Conn::read_part_headers) to the file at path,
+    one slice at a time: the memory used does not depend on the size of the part.
+    Returns {ResultType::Ok, {size, conn}} with the number of bytes written, or an error,
+    whose size is past options.max_upload_size when the part is larger than it.
+    The file is removed if the part could not be written whole.
+*/
+inline Result<std::pair<size_t, plug::Conn>> spool_part(
+    plug::Conn&& conn,
+    std::string const& path,
+    ParserOptions const& options = {})
+{
+    using plug::Conn;
+
+    int const fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        return { ResultType::Err, { 0, std::move(conn) } };
+    }
+
+    ImmutMapString const opts = parsers_detail::BodyOpts(options, options.read_length);
+    Conn current(std::move(conn));
+    size_t size = 0;
+    while (true)
+    {
+        auto read = Conn::read_part_body(std::move(current), opts);
+        current = Conn(read.second.second);
+
+        bool written = read.first != ResultType::Err;
+        for (std::string_view slice = read.second.first; written && !slice.empty();)
+        {
+            ssize_t const count = ::write(fd, slice.data(), slice.size());
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            written = count > 0;
+            slice.remove_prefix(written ? static_cast<size_t>(count) : slice.size());
+            size += written ? static_cast<size_t>(count) : 0;
+        }
+
+        if (!written || size > options.max_upload_size)
+        {
+            ::close(fd);
+            ::unlink(path.c_str());
+            return { ResultType::Err, { size, std::move(current) } };
+        }
+        if (read.first == ResultType::Ok)
+        {
+            ::close(fd);
+            return { ResultType::Ok, { size, std::move(current) } };
+        }
+    }
+}
+
+inline Result<std::pair<size_t, plug::Conn>> spool_part(
+    plug::Conn const& conn,
+    std::string const& path,
+    ParserOptions const& options = {})
+{
+    return spool_part(plug::Conn(conn), path, options);
+}
+
+/*--- fetch_body_params ---*/
+/*
+    Plug parsing the request body into body_params, by content type:
+        - application/x-www-form-urlencoded : decoded pairs
+        - application/json (and +json)       : the members of the object, nested values as JSON text,
+                                               anything else than an object under "_json"
+        - multipart/form-data                : fields as values, files spooled to options.upload_dir
+                                               with their path as value, and described in the "uploads"
+                                               assign (an Uploads map by field name)
+    Other content types leave the connection untouched, as does a second call.
+
+    A malformed body halts the connection with a 400, a body or field larger than options.length with a 413,
+    as do more than options.max_parts parts or files larger than options.max_upload_size together.
+    Two files under the same field name are a 400, the second would hide the first.
+    When the connection is halted, the files already spooled are removed.
+    Otherwise they are not removed by feather, the application moves or deletes them.
+
+    Usage:
+
+    conn = fetch_body_params(conn);
+    auto const name = conn.body_params->find("name");
+*/
+inline plug::Conn fetch_body_params(plug::Conn&& conn, ParserOptions const& options = {})
+{
+    using plug::Conn;
+    using namespace parsers_detail;
+
+    if (conn.body_params.has_value())
+    {
+        return std::move(conn);
+    }
+
+    auto const type = conn.req_headers.find("content-type");
+    if (type == conn.req_headers.end())
+    {
+        return std::move(conn);
+    }
+    std::string_view const content_type = std::string_view(type->second).substr(0, type->second.find(';'));
+
+    Conn new_conn(std::move(conn));
+    auto params = ImmutMapString().transient();
+
+    if (boost::iequals(content_type, "application/x-www-form-urlencoded")
+        || boost::iequals(content_type, "application/json")
+        || boost::iends_with(content_type, "+json"))
+    {
+        std::string body;
+        if (int const status = ReadWhole(new_conn, body, options); status != 0)
+        {
+            return Fail(std::move(new_conn), status);
+        }
+        if (boost::iequals(content_type, "application/x-www-form-urlencoded"))
+        {
+            auto decoded = DecodeQuery(body);
+            if (!decoded.has_value())
+            {
+                return Fail(std::move(new_conn), 400);
+            }
+            new_conn.body_params = std::move(decoded);
+            return new_conn;
+        }
+        if (!DecodeJson(body, params))
+        {
+            return Fail(std::move(new_conn), 400);
+        }
+        new_conn.body_params = std::make_optional(params.persistent());
+        return new_conn;
+    }
+
+    if (!boost::iequals(content_type, "multipart/form-data"))
+    {
+        return new_conn;
+    }
+
+    static thread_local boost::uuids::random_generator uuid_generator;
+    auto uploads = Uploads().transient();
+    ImmutMapString const header_opts = BodyOpts(options, 64000);
+    ImmutMapString const body_opts = BodyOpts(options, options.read_length);
+    std::string field;
+
+    // Field names and paths of the files spooled so far, removed if the body is rejected: the application never sees them.
+    std::vector<std::pair<std::string, std::string>> spooled;
+    ParserOptions spool_options = options;
+    auto reject = [&spooled](Conn&& c, int status)
+    {
+        for (auto const& [name, path] : spooled)
+        {
+            ::unlink(path.c_str());
+        }
+        return Fail(std::move(c), status);
+    };
+
+    for (size_t parts = 0; ; ++parts)
+    {
+        auto part = Conn::read_part_headers(std::move(new_conn), header_opts);
+        new_conn = Conn(part.second.second);
+        if (part.first == ResultType::Err)
+        {
+            return reject(std::move(new_conn), 400);
+        }
+        if (!part.second.first.has_value())
+        {
+            break;
+        }
+        if (parts == options.max_parts)
+        {
+            return reject(std::move(new_conn), 413);
+        }
+
+        auto const& headers = *part.second.first;
+        auto const disposition = ParseContentDisposition(PartHeader(headers, "content-disposition").value_or(""));
+        if (disposition.filename.has_value())
+        {
+            if (std::any_of(spooled.begin(), spooled.end(), [&disposition](auto const& file) { return file.first == disposition.name; }))
+            {
+                return reject(std::move(new_conn), 400);
+            }
+
+            Upload upload{
+                (options.upload_dir / ("feather-upload-" + boost::uuids::to_string(uuid_generator()))).string(),
+                *disposition.filename,
+                std::string(PartHeader(headers, "content-type").value_or("application/octet-stream")),
+                0
+            };
+            auto spool = spool_part(std::move(new_conn), upload.path, spool_options);
+            new_conn = Conn(spool.second.second);
+            if (spool.first == ResultType::Err)
+            {
+                return reject(std::move(new_conn), spool.second.first > spool_options.max_upload_size ? 413 : 400);
+            }
+            spooled.emplace_back(disposition.name, upload.path);
+            spool_options.max_upload_size -= spool.second.first;
+            upload.size = spool.second.first;
+            params.set(disposition.name, ShareStr(upload.path));
+            uploads.set(disposition.name, std::move(upload));
+            continue;
+        }
+
+        // A field is gathered whole, it may come in several slices.
+        field.clear();
+        while (true)
+        {
+            auto read = Conn::read_part_body(std::move(new_conn), body_opts);
+            new_conn = Conn(read.second.second);
+            if (read.first == ResultType::Err)
+            {
+                return reject(std::move(new_conn), 400);
+            }
+            field.append(read.second.first);
+            if (field.size() > options.length)
+            {
+                return reject(std::move(new_conn), 413);
+            }
+            if (read.first == ResultType::Ok)
+            {
+                break;
+            }
+        }
+        params.set(disposition.name, ShareStr(field));
+    }
+
+    new_conn.body_params = std::make_optional(params.persistent());
+    if (!uploads.empty())
+    {
+        new_conn = Conn::assign(std::move(new_conn), "uploads", uploads.persistent());
+    }
+    return new_conn;
+}
+
+inline plug::Conn const fetch_body_params(plug::Conn const& conn, ParserOptions const& options = {})
+{
+    return fetch_body_params(plug::Conn(conn), options);
+}
+
+} // namespace feather::core
+
+#endif
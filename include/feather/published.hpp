@@ -0,0 +1,99 @@
+/*--- Header file for published ---*/
+
+#ifndef FEATHER_PUBLISHED_HPP
+#define FEATHER_PUBLISHED_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace feather::core
+{
+
+/*--- Published ---*/
+/*
+    Immutable value published by a writer and read by every request thread.
+
+    A new value replaces the old one with an atomic swap, readers in flight keep the one they have.
+    Each thread caches the shared_ptr it last read together with a generation number,
+    so a read is an acquire load of a counter that only changes on publish and a reference count:
+    no lock is taken on the hot path. The reader owns what it got, whatever is published or read after.
+
+    The old value is freed once every reader released it and every thread that cached it has read again (or exited).
+
+    Usage:
+
+    Published<Config> config;
+    config.publish(std::make_shared<Config const>(...));
+    std::shared_ptr<Config const> const current = config.get();
+*/
+template <typename T>
+class Published
+{
+    private:
+        std::atomic<std::shared_ptr<T const>>   value;
+        std::atomic<uint64_t>                   generation{0};
+
+        // Generations are unique across every Published<T>, so a thread cache never mixes two of them up.
+        static uint64_t next_generation()
+        {
+            static std::atomic<uint64_t> counter{0};
+            return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+
+        struct Cache
+        {
+            uint64_t                    generation = 0;
+            std::shared_ptr<T const>    value;
+        };
+
+        /*- cached -*/
+        // The current value as cached by the calling thread, refreshed if a new one was published.
+        std::shared_ptr<T const> const& cached() const
+        {
+            static thread_local Cache cache;
+
+            uint64_t const current = generation.load(std::memory_order_acquire);
+            if (cache.generation != current)
+            {
+                cache.value = value.load(std::memory_order_acquire);
+                cache.generation = current;
+            }
+            return cache.value;
+        }
+
+    public:
+        Published() = default;
+        explicit Published(std::shared_ptr<T const> initial)
+        {
+            publish(std::move(initial));
+        }
+        Published(Published const&)             = delete;
+        Published& operator=(Published const&)  = delete;
+
+        /*- get -*/
+        // Returns the current value, or nullptr if nothing was published.
+        std::shared_ptr<T const> get() const
+        {
+            return cached();
+        }
+
+        /*- load -*/
+        // Returns the current value without going through the thread cache, e.g. for a writer.
+        std::shared_ptr<T const> load() const
+        {
+            return value.load(std::memory_order_acquire);
+        }
+
+        /*- publish -*/
+        // Replaces the current value. Readers see it on their next call to get.
+        void publish(std::shared_ptr<T const> next)
+        {
+            value.store(std::move(next), std::memory_order_release);
+            generation.store(next_generation(), std::memory_order_release);
+        }
+};
+
+} // namespace feather::core
+
+#endif
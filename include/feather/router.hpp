@@ -4,6 +4,17 @@
 #define ROUTER_HPP
 
 #include <feather/core.hpp>
+#include <feather/arena.hpp>
+#include <feather/published.hpp>
+#include <feather/metrics.hpp>
+#include <feather/async.hpp>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <variant>
 
 
 namespace feather::router
@@ -19,9 +30,54 @@ using RouterMap = immer::map<std::string, RouterVec>;
 
 using HttpHandler = std::function<plug::Conn const(plug::Conn const&)>;
 
+/*--- AsyncHandler ---*/
+// Route handler returning a task, e.g. a coroutine querying a database before rendering.
+using AsyncHandler = std::function<core::Task<plug::Conn>(plug::Conn)>;
+
+/*--- AsyncRoute ---*/
+/*
+    An AsyncHandler stored where an HttpHandler is expected, in the routes of a scope.
+    Router::dispatch finds it back with HttpHandler::target<AsyncRoute>() and awaits it,
+    a plain call runs it with core::RunSync.
+*/
+struct AsyncRoute
+{
+    AsyncHandler    handler;
+
+    plug::Conn const operator()(plug::Conn const& conn) const
+    {
+        return core::RunSync(handler(conn));
+    }
+};
+
+/*--- IntoHandler ---*/
+/*
+    Turns what GET, POST, PUT and DEL are given into an HttpHandler:
+    synchronous handlers are kept as they are, the ones returning a task are wrapped in an AsyncRoute.
+*/
+inline HttpHandler IntoHandler(std::nullptr_t)
+{
+    return nullptr;
+}
+
+template <typename Func>
+HttpHandler IntoHandler(Func&& func)
+{
+    if constexpr (std::is_invocable_r_v<core::Task<plug::Conn>, Func&, plug::Conn>
+                  && !std::is_invocable_r_v<plug::Conn const, Func&, plug::Conn const&>)
+    {
+        return AsyncRoute{AsyncHandler(std::forward<Func>(func))};
+    }
+    else
+    {
+        return HttpHandler(std::forward<Func>(func));
+    }
+}
+
 struct Scope
 {
     plug::Plug  pipeline;
+    std::vector<std::string>    pipe_through;
     immer::map<std::string, HttpHandler> get;
     immer::map<std::string, HttpHandler> post;
     immer::map<std::string, HttpHandler> put;
@@ -30,6 +86,186 @@ struct Scope
 
 using RouterMultiMap = core::functional::multimap<std::string, Scope>;
 
+/*--- Method ---*/
+// HTTP methods a route can be registered for.
+enum struct Method : size_t
+{
+    GET,
+    POST,
+    PUT,
+    DEL,
+    COUNT,
+};
+
+/*--- ParseMethod ---*/
+// Maps the lowercase method of a Conn to a Method.
+inline std::optional<Method> ParseMethod(std::string_view method)
+{
+    if (method == "get")    return Method::GET;
+    if (method == "post")   return Method::POST;
+    if (method == "put")    return Method::PUT;
+    if (method == "delete") return Method::DEL;
+    return std::nullopt;
+}
+
+/*--- Plugs ---*/
+// The pipelines of a scope flattened into one contiguous array of plugs.
+using Plugs = std::shared_ptr<std::vector<plug::Plug> const>;
+
+/*--- Route ---*/
+/*
+    A route resolved at freeze time: the flattened plugs of its scope, its handler and the histogram timing it.
+    suspends is set when one of them is asynchronous, the route then runs as a task.
+*/
+struct Route
+{
+    Plugs               plugs;
+    HttpHandler         handler;
+    core::Histogram*    timer = nullptr;
+    bool                suspends = false;
+};
+
+/*--- Suspends ---*/
+// Returns true if the plugs or the handler of a route are asynchronous.
+inline bool Suspends(Plugs const& plugs, HttpHandler const& handler)
+{
+    return handler.target<AsyncRoute>() != nullptr
+        || std::any_of(plugs->begin(), plugs->end(), [](plug::Plug const& p) { return core::AsAsyncStep(p) != nullptr; });
+}
+
+/*--- RouteNode ---*/
+/*
+    Node of the route trie. Each edge is a path segment.
+
+    A segment can be:
+        - static : "users", matched exactly
+        - param  : ":id", matches any single segment and is captured as path_params["id"]
+        - glob   : "*path", matches the rest of the path and is captured as path_params["path"]
+
+    Static children are tried first, then the param child, then the glob child.
+    A lookup only depends on the number of segments of the request path,
+    not on the number of routes.
+*/
+struct RouteNode
+{
+    /*- Capture -*/
+    // A captured parameter: its name and the [first, last) segments it spans.
+    struct Capture
+    {
+        std::string_view    name;
+        size_t              first;
+        size_t              last;
+    };
+
+    using Captures = std::pmr::vector<Capture>;
+    using Routes = std::array<std::optional<Route>, static_cast<size_t>(Method::COUNT)>;
+
+    std::map<std::string, std::unique_ptr<RouteNode>, std::less<>>  children;
+    std::unique_ptr<RouteNode>  param;
+    std::unique_ptr<RouteNode>  glob;
+    std::string                 name;
+    Routes                      routes;
+
+    /*- insert -*/
+    /*
+        Registers a route for the given path and method.
+        If the path and method are already registered, the first route is kept.
+        Throws std::logic_error if two parameters at the same position have different names.
+    */
+    void insert(std::string_view path, Method method, Route const& route)
+    {
+        RouteNode* node = this;
+
+        while (!path.empty())
+        {
+            size_t const slash = path.find('/');
+            std::string_view const segment = path.substr(0, slash);
+            path.remove_prefix(slash == std::string_view::npos ? path.size() : slash + 1);
+
+            if (segment.empty())
+            {
+                continue;
+            }
+
+            if (segment.front() == ':' || segment.front() == '*')
+            {
+                auto& child = segment.front() == ':' ? node->param : node->glob;
+                if (!child)
+                {
+                    child = std::make_unique<RouteNode>();
+                    child->name = segment.substr(1);
+                }
+                else if (child->name != segment.substr(1))
+                {
+                    throw std::logic_error("conflicting parameter names for " + std::string(segment));
+                }
+                node = child.get();
+
+                if (segment.front() == '*')
+                {
+                    break;
+                }
+            }
+            else if (auto child = node->children.find(segment); child != node->children.end())
+            {
+                node = child->second.get();
+            }
+            else
+            {
+                node = node->children.emplace(segment, std::make_unique<RouteNode>()).first->second.get();
+            }
+        }
+
+        if (auto& slot = node->routes[static_cast<size_t>(method)]; !slot.has_value())
+        {
+            slot = route;
+        }
+    }
+
+    /*- match -*/
+    /*
+        Returns the node matching path_info from the segment index with a route for method, or nullptr.
+        A node without a route for method does not match: the search backtracks to the parameters and globs,
+        so "GET /users/new" still reaches "GET /users/:id" when only "POST /users/new" is registered.
+        Captured parameters are appended to captures.
+    */
+    RouteNode const* match(core::ImmutVecString const& path_info, size_t index, Method method, Captures& captures) const
+    {
+        if (index == path_info.size())
+        {
+            return routes[static_cast<size_t>(method)].has_value() ? this : nullptr;
+        }
+
+        std::string const& segment = *path_info[index];
+
+        if (auto child = children.find(segment); child != children.end())
+        {
+            if (auto found = child->second->match(path_info, index + 1, method, captures); found != nullptr)
+            {
+                return found;
+            }
+        }
+
+        if (param)
+        {
+            captures.push_back({param->name, index, index + 1});
+            if (auto found = param->match(path_info, index + 1, method, captures); found != nullptr)
+            {
+                return found;
+            }
+            captures.pop_back();
+        }
+
+        if (glob && glob->routes[static_cast<size_t>(method)].has_value())
+        {
+            captures.push_back({glob->name, index, path_info.size()});
+            return glob.get();
+        }
+
+        return nullptr;
+    }
+};
+
 /*--- Router ---*/
 /*
     Helper struct for the user to define a pipeline and routes.
@@ -38,6 +274,16 @@ using RouterMultiMap = core::functional::multimap<std::string, Scope>;
     Router is a singleton. Therefor all its static methods directly modify the router itself.
     The reason behind this design is that they only register anonymous functions when we initialize it with a custom user defined initialize function.
 
+    The routes of a scope are prefixed by the scope name, "/admin" and "/users/:id" give "/admin/users/:id".
+    Path segments starting with ':' capture one segment and path segments starting with '*' capture
+    the rest of the path, both are available in conn.path_params once the route matched.
+    The scopes are compiled into a trie on the first request (or by calling Router::freeze).
+
+    Requests only read the published trie, through a Published pointer, and never lock anything.
+    Registering a pipeline or a scope while the server runs is a live reload:
+    the next request compiles a new trie and publishes it with an atomic swap,
+    requests in flight finish on the previous one.
+
     Usage:
 
     #include "my_plugs.hpp"
@@ -91,27 +337,32 @@ struct Router
     using Pipeline = std::function<RouterVecTransient&(RouterVecTransient&)>;
     using IntoScope = std::function<Scope(Scope&&)>;
     using RouterInstance = std::shared_ptr<Router>;
+    using Dispatch = core::MaybeAsync<plug::Conn>;
 private:
-    static inline RouterInstance instance = nullptr;
     Router() = default;
+
+    // Guards pipelines and scopes, only taken to register or to freeze.
+    std::mutex          build_lock;
+    // Set when the published trie no longer matches the registered scopes.
+    std::atomic<bool>   stale{true};
 public:
     RouterMap       pipelines;
     RouterMultiMap  scopes;
+    core::Published<RouteNode>  routes;
     ~Router()             = default;
 
+    Router(Router const& other) = delete;
     Router& operator=(Router const& other) = delete;
 
     /*- fetch_instance -*/
     /*
         Request the instance of the singleton Router.
-        If it is the first request, initialize the instance.
+        The instance is created, thread safely, by the first call.
+        A reference is returned so the reference count is left alone.
     */
-    static RouterInstance fetch_instance()
+    static RouterInstance const& fetch_instance()
     {
-        if (!instance)
-        {
-            instance = RouterInstance(new Router());
-        }
+        static RouterInstance const instance(new Router());
         return instance;
     }
 
@@ -131,12 +382,106 @@ public:
         Pipeline            pl)
     {
         RouterVecTransient new_pipeline{};
+        auto const built = pl(new_pipeline).persistent();
 
-        router->pipelines = router->pipelines.insert({name, pl(new_pipeline).persistent()});
+        std::lock_guard<std::mutex> guard(router->build_lock);
+        router->pipelines = router->pipelines.insert({name, built});
+        router->stale.store(true, std::memory_order_release);
 
         return router;
     }
 
+    /*- resolve -*/
+    /*
+        Flattens the plugs of the named pipelines, in order, into a single array.
+        Unknown pipeline names are skipped.
+        Expects the build lock held, or no concurrent registration.
+
+        With the metrics enabled, the plugs of each pipeline are grouped behind one plug
+        recording the time of the whole pipeline under the "pipeline" stage,
+        an asynchronous one when the pipeline holds an asynchronous plug.
+    */
+    static Plugs resolve(RouterInstance const& router, std::vector<std::string> const& names)
+    {
+        std::vector<plug::Plug> plugs;
+
+        for (auto const& name : names)
+        {
+            auto const pipeline = router->pipelines.find(name);
+            if (pipeline == nullptr)
+            {
+                continue;
+            }
+            if constexpr (core::MetricsEnabled)
+            {
+                auto const steps = std::make_shared<std::vector<plug::Plug> const>(pipeline->begin(), pipeline->end());
+                auto& timer = core::Metrics::stage("pipeline", name);
+                if (std::any_of(steps->begin(), steps->end(), [](plug::Plug const& p) { return core::AsAsyncStep(p) != nullptr; }))
+                {
+                    plugs.push_back(core::AsyncStep{[&timer, steps](plug::Conn conn, plug::PlugOptions) -> core::Task<plug::Conn>
+                    {
+                        core::StageTimer scope(timer);
+                        co_return co_await run_async(steps, std::move(conn));
+                    }});
+                    continue;
+                }
+                plugs.push_back([&timer, steps](plug::Conn conn, plug::PlugOptions)
+                {
+                    core::StageTimer scope(timer);
+                    return run(steps, std::move(conn));
+                });
+            }
+            else
+            {
+                plugs.insert(plugs.end(), pipeline->begin(), pipeline->end());
+            }
+        }
+        return std::make_shared<std::vector<plug::Plug> const>(std::move(plugs));
+    }
+
+    /*- run -*/
+    /*
+        Runs the plugs in order. Stops as soon as a plug halts the connection.
+        Asynchronous plugs are run to completion with core::RunSync, blocking the thread.
+    */
+    static plug::Conn run(Plugs const& plugs, plug::Conn conn)
+    {
+        for (auto const& p : *plugs)
+        {
+            if (conn.halted)
+            {
+                break;
+            }
+            conn = p(std::move(conn), {});
+        }
+        return conn;
+    }
+
+    /*- run_async -*/
+    /*
+        Runs the plugs in order like run, awaiting the asynchronous ones.
+        The synchronous plugs are called as they are, between two suspensions.
+    */
+    static core::Task<plug::Conn> run_async(Plugs plugs, plug::Conn conn)
+    {
+        for (auto const& p : *plugs)
+        {
+            if (conn.halted)
+            {
+                break;
+            }
+            if (auto const* step = core::AsAsyncStep(p))
+            {
+                conn = co_await step->plug(std::move(conn), {});
+            }
+            else
+            {
+                conn = p(std::move(conn), {});
+            }
+        }
+        co_return conn;
+    }
+
     /*- scope -*/
     /*
         Register a scope and its routes to a router.
@@ -147,7 +492,69 @@ public:
         IntoScope           handler
     )
     {
-        router->scopes = router->scopes.insert({name, handler(Scope())});
+        Scope new_scope = handler(Scope());
+
+        std::lock_guard<std::mutex> guard(router->build_lock);
+        if (!new_scope.pipe_through.empty())
+        {
+            new_scope.pipeline = [plugs = resolve(router, new_scope.pipe_through)](plug::Conn conn, plug::PlugOptions)
+            {
+                return run(plugs, std::move(conn));
+            };
+        }
+
+        router->scopes = router->scopes.insert({name, std::move(new_scope)});
+        router->stale.store(true, std::memory_order_release);
+        return router;
+    }
+
+    /*- freeze -*/
+    /*
+        Compiles the registered scopes into the route trie used by Router::handler.
+        Called on the first request if it was not called before, and again after any new scope or pipeline.
+
+        The pipelines piped through by each scope are resolved here, once,
+        so a request never looks a pipeline up by name.
+        The new trie is published atomically, requests keep running meanwhile.
+        stale is only cleared once it is published, so a request that sees it cleared finds the trie;
+        the threads that waited for the lock behind a first compilation do not compile it again.
+    */
+    static RouterInstance freeze(RouterInstance router)
+    {
+        std::lock_guard<std::mutex> guard(router->build_lock);
+        if (!router->stale.load(std::memory_order_acquire))
+        {
+            return router;
+        }
+
+        auto root = std::make_shared<RouteNode>();
+
+        for (auto const& [scope_id, scopes] : router->scopes)
+        {
+            for (auto const& scope : scopes)
+            {
+                Plugs const plugs = !scope.pipe_through.empty() || scope.pipeline == nullptr
+                    ? resolve(router, scope.pipe_through)
+                    : std::make_shared<std::vector<plug::Plug> const>(1, scope.pipeline);
+
+                auto register_routes = [&](immer::map<std::string, HttpHandler> const& routes, Method method, std::string const& verb)
+                {
+                    for (auto const& [path, handler] : routes)
+                    {
+                        std::string const pattern = scope_id + "/" + path;
+                        root->insert(pattern, method, {plugs, handler, &core::Metrics::handler(verb + " " + pattern), Suspends(plugs, handler)});
+                    }
+                };
+
+                register_routes(scope.get, Method::GET, "GET");
+                register_routes(scope.post, Method::POST, "POST");
+                register_routes(scope.put, Method::PUT, "PUT");
+                register_routes(scope.del, Method::DEL, "DELETE");
+            }
+        }
+
+        router->routes.publish(std::move(root));
+        router->stale.store(false, std::memory_order_release);
         return router;
     }
 
@@ -160,8 +567,10 @@ public:
     /*- PLUG -*/
     /*
         Macro helper for pipeline callback. Allows you to pass an optionable argument to a Plug.
+        The connection is moved into func, which picks its Conn&& overload when it has one.
+        Its calls are timed under the "plug" stage of the metrics, named after func.
     */
-#define PLUG(func, ...) vec.push_back([&](feather::core::plug::Conn const& conn, feather::core::plug::PlugOptions={}) { return func(conn __VA_OPT__(,) __VA_ARGS__); })
+#define PLUG(func, ...) vec.push_back(feather::core::TimedPlug(#func, [&](feather::core::plug::Conn conn, feather::core::plug::PlugOptions={}) { return func(std::move(conn) __VA_OPT__(,) __VA_ARGS__); }))
 
     /*- END_PLINE -*/
     /*
@@ -181,92 +590,148 @@ public:
     /*
         Macro helper to tell to a scope which pipeline(s) should be used before accessing the routes.
         If there are many pipelines, they are called in the order writen.
+
+        The names are resolved when the scope is registered and again when the router is frozen,
+        the plugs of all the pipelines are then flattened into a single array.
     */
-#define PIPE_THROUGH(p_lines...) scope.pipeline = ([&](feather::core::plug::Conn const& conn, feather::core::plug::PlugOptions={}) \
-{ \
-    feather::core::plug::Conn new_conn(conn); \
-    std::vector<std::string> p_lines_as_vec{p_lines};\
-    feather::router::Router::RouterInstance instance = feather::router::Router::fetch_instance();\
-\
-    for (auto const& p_name : p_lines_as_vec)\
-    {\
-        for (auto const& pip : instance->pipelines[p_name])\
-        {\
-            new_conn = pip(new_conn, {});\
-        }\
-    }\
-    return new_conn;\
-})
+#define PIPE_THROUGH(p_lines...) scope.pipe_through = {p_lines}
 
     /*- GET -*/
     /*
         Macro helper registering a get callback for a scope.
+        The handler may be synchronous, a function of a Conn const& returning a Conn,
+        or a coroutine of a Conn returning a core::Task<Conn>, see AsyncHandler.
     */
-#define GET(path, handler) scope.get = scope.get.insert({path, handler})
+#define GET(path, handler) scope.get = scope.get.insert({path, feather::router::IntoHandler(handler)})
 
     /*- POST -*/
     /*
         Macro helper registering a post callback for a scope.
     */
-#define POST(path, handler) scope.post = scope.post.insert({path, handler})
+#define POST(path, handler) scope.post = scope.post.insert({path, feather::router::IntoHandler(handler)})
 
     /*- PUT -*/
     /*
         Macro helper registering a put callback for a scope.
     */
-#define PUT(path, handler) scope.put = scope.put.insert({path, handler})
+#define PUT(path, handler) scope.put = scope.put.insert({path, feather::router::IntoHandler(handler)})
 
     /*- DEL -*/
     /*
         Macro helper registering a delete callback for a scope.
     */
-#define DEL(path, handler) scope.del = scope.del.insert({path, handler})
+#define DEL(path, handler) scope.del = scope.del.insert({path, feather::router::IntoHandler(handler)})
 
-/*- handler -*/
+/*- dispatch -*/
 /*
     Route handler to register to the server.
+
+    Walks the published route trie with the segments of conn.path_info,
+    compiling it first if a scope or a pipeline was registered since.
+    When a route matches, path_params is filled, the scope pipeline runs and then the handler.
+    The handler is skipped if a plug halted the connection.
+    Otherwise the connection is returned unchanged.
+
+    A route with an asynchronous plug or handler is not run here:
+    the task running it is returned instead, for the server to await on the executor of the connection.
+    The trie is held until the synchronous route returns, the task holds a copy of the route:
+    a live reload, even by a nested dispatch, does not free their plugs under them.
 */
-static plug::Conn const handler(plug::Conn const& conn)
+static Dispatch dispatch(plug::Conn const& conn)
 {
-    RouterInstance instance = fetch_instance();
+    RouterInstance const& instance = fetch_instance();
+
+    if (instance->stale.load(std::memory_order_acquire))
+    {
+        freeze(instance);
+    }
+
+    auto const method = conn.method ? ParseMethod(*conn.method) : std::nullopt;
+    if (!method.has_value())
+    {
+        return conn;
+    }
+
+    static core::Histogram& route_match = core::Metrics::stage("route");
+    // Owned for the whole dispatch: a plug or handler dispatching again may republish the trie under it.
+    std::shared_ptr<RouteNode const> const root = instance->routes.get();
+    if (root == nullptr)
+    {
+        return conn;
+    }
 
-    for (auto const& [scope_id, scopes] : instance->scopes)
+    RouteNode::Captures captures(core::RequestArena::resource());
+    RouteNode const* node = nullptr;
     {
-        if (auto path_start = conn.request_path->find(scope_id); path_start == std::string::npos)
+        core::StageTimer timer(route_match);
+        node = root->match(conn.path_info, 0, *method, captures);
+    }
+    if (node == nullptr)
+    {
+        return conn;
+    }
+
+    auto const& route = *node->routes[static_cast<size_t>(*method)];
+    plug::Conn matched(conn);
+
+    auto path_params = core::ImmutMapString().transient();
+    for (auto const& capture : captures)
+    {
+        std::string value;
+        for (size_t i = capture.first; i < capture.last; ++i)
         {
-            continue;
+            value += (i == capture.first ? "" : "/") + *conn.path_info[i];
         }
-        else
-        {
-            std::string path = conn.request_path->substr(path_start);
+        path_params.set(std::string(capture.name), core::ShareStr(std::move(value)));
+    }
+    matched.path_params = std::make_optional(path_params.persistent());
 
-            for (auto const& scope : scopes)
-            {
-                if (*conn.method == "get" && scope.get.find(path) != nullptr) // TODO: Need to handle /:id type of path
-                {
-                    if (scope.get[path] == nullptr) return scope.pipeline(conn, {});
-                    return scope.pipeline(conn, {}) pipe scope.get[path];
-                }
-                else if (*conn.method == "post" && scope.post.find(path) != nullptr)
-                {
-                    if (scope.post[path] == nullptr) return scope.pipeline(conn, {});
-                    return scope.pipeline(conn, {}) pipe scope.post[path];
-                }
-                else if (*conn.method == "put" && scope.put.find(path) != nullptr)
-                {
-                    if (scope.put[path] == nullptr) return scope.pipeline(conn, {});
-                    return scope.pipeline(conn, {}) pipe scope.put[path];
-                }
-                else if (*conn.method == "delete" && scope.del.find(path) != nullptr)
-                {
-                    if (scope.del[path] == nullptr) return scope.pipeline(conn, {});
-                    return scope.pipeline(conn, {}) pipe scope.del[path];
-                }
-            }
-        }
+    if (route.suspends)
+    {
+        return run_route(route, std::move(matched));
     }
 
-    return conn;
+    matched = run(route.plugs, std::move(matched));
+
+    if (route.handler == nullptr || matched.halted)
+    {
+        return matched;
+    }
+    core::StageTimer timer(*route.timer);
+    return matched pipe route.handler;
+}
+
+/*- run_route -*/
+// Task running an asynchronous route: its plugs, awaiting the asynchronous ones, then its handler.
+static core::Task<plug::Conn> run_route(Route route, plug::Conn conn)
+{
+    conn = co_await run_async(route.plugs, std::move(conn));
+
+    if (route.handler == nullptr || conn.halted)
+    {
+        co_return conn;
+    }
+    core::StageTimer timer(*route.timer);
+    if (auto const* async = route.handler.target<AsyncRoute>())
+    {
+        co_return co_await async->handler(std::move(conn));
+    }
+    co_return route.handler(conn);
+}
+
+/*- handler -*/
+/*
+    Synchronous form of dispatch, for the callers that need the final Conn at once.
+    An asynchronous route is run to completion with core::RunSync, blocking the calling thread.
+*/
+static plug::Conn handler(plug::Conn const& conn)
+{
+    Dispatch routed = dispatch(conn);
+    if (auto* task = std::get_if<core::Task<plug::Conn>>(&routed))
+    {
+        return core::RunSync(std::move(*task));
+    }
+    return std::get<plug::Conn>(std::move(routed));
 }
 
 
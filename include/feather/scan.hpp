@@ -0,0 +1,222 @@
+/*--- Header file for scan ---*/
+
+#ifndef FEATHER_SCAN_HPP
+#define FEATHER_SCAN_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    Byte scanning over std::string_view, the layer below the query string, cookie and Host parsers of core.
+
+    The scans compare 16 bytes at a time with SSE2 when the target has it,
+    and fall back to a byte loop otherwise and for the tail of the input.
+    Nothing here allocates except the decoders, which write into a buffer given by the caller.
+*/
+namespace feather::core
+{
+
+namespace scan_detail
+{
+#if defined(__SSE2__)
+    inline __m128i Load(char const* data)
+    {
+        return _mm_loadu_si128(reinterpret_cast<__m128i const*>(data));
+    }
+
+    inline unsigned Mask(__m128i bytes)
+    {
+        return static_cast<unsigned>(_mm_movemask_epi8(bytes));
+    }
+#endif
+
+    inline int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+}
+
+/*--- FindByte ---*/
+// Position of the first c of input from position from, std::string_view::npos if there is none.
+inline size_t FindByte(std::string_view input, size_t from, char c)
+{
+    size_t i = from;
+#if defined(__SSE2__)
+    __m128i const needle = _mm_set1_epi8(c);
+    for (; i + 16 <= input.size(); i += 16)
+    {
+        if (unsigned const mask = scan_detail::Mask(_mm_cmpeq_epi8(scan_detail::Load(input.data() + i), needle)))
+        {
+            return i + static_cast<size_t>(std::countr_zero(mask));
+        }
+    }
+#endif
+    for (; i < input.size(); ++i)
+    {
+        if (input[i] == c)
+        {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+/*--- FindEither ---*/
+// Position of the first a or b of input from position from, in a single pass.
+inline size_t FindEither(std::string_view input, size_t from, char a, char b)
+{
+    size_t i = from;
+#if defined(__SSE2__)
+    __m128i const first = _mm_set1_epi8(a);
+    __m128i const second = _mm_set1_epi8(b);
+    for (; i + 16 <= input.size(); i += 16)
+    {
+        __m128i const bytes = scan_detail::Load(input.data() + i);
+        if (unsigned const mask = scan_detail::Mask(_mm_or_si128(_mm_cmpeq_epi8(bytes, first), _mm_cmpeq_epi8(bytes, second))))
+        {
+            return i + static_cast<size_t>(std::countr_zero(mask));
+        }
+    }
+#endif
+    for (; i < input.size(); ++i)
+    {
+        if (input[i] == a || input[i] == b)
+        {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+/*--- ValidUtf8 ---*/
+/*
+    Whether input is well-formed UTF-8: no overlong form, no surrogate, nothing above U+10FFFF.
+    Runs of ASCII are skipped 16 bytes at a time, only the multi-byte sequences are decoded.
+*/
+inline bool ValidUtf8(std::string_view input)
+{
+    auto const* bytes = reinterpret_cast<unsigned char const*>(input.data());
+    size_t const size = input.size();
+    size_t i = 0;
+
+    while (i < size)
+    {
+#if defined(__SSE2__)
+        if (i + 16 <= size)
+        {
+            unsigned const high = scan_detail::Mask(scan_detail::Load(input.data() + i));
+            if (high == 0)
+            {
+                i += 16;
+                continue;
+            }
+            i += static_cast<size_t>(std::countr_zero(high));
+        }
+#endif
+        unsigned char const lead = bytes[i];
+        if (lead < 0x80)
+        {
+            ++i;
+            continue;
+        }
+
+        // Length of the sequence and the range of its second byte, which rules out overlongs and surrogates.
+        size_t length = 0;
+        unsigned char low = 0x80;
+        unsigned char high = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF)       { length = 2; }
+        else if (lead == 0xE0)                  { length = 3; low = 0xA0; }
+        else if (lead == 0xED)                  { length = 3; high = 0x9F; }
+        else if (lead >= 0xE1 && lead <= 0xEF)  { length = 3; }
+        else if (lead == 0xF0)                  { length = 4; low = 0x90; }
+        else if (lead >= 0xF1 && lead <= 0xF3)  { length = 4; }
+        else if (lead == 0xF4)                  { length = 4; high = 0x8F; }
+        else                                    { return false; }
+
+        if (i + length > size || bytes[i + 1] < low || bytes[i + 1] > high)
+        {
+            return false;
+        }
+        for (size_t k = 2; k < length; ++k)
+        {
+            if ((bytes[i + k] & 0xC0) != 0x80)
+            {
+                return false;
+            }
+        }
+        i += length;
+    }
+    return true;
+}
+
+/*--- UrlDecode ---*/
+/*
+    Decodes a component of an "x-www-form-urlencoded" string into out, which is cleared first:
+    '+' becomes a space and %XX the byte XX.
+    A component without any of them is copied as is, without looking at every byte twice.
+    Returns false if a percent sign is not followed by two hexadecimal digits.
+*/
+inline bool UrlDecode(std::string_view in, std::string& out)
+{
+    using scan_detail::HexValue;
+
+    out.clear();
+    size_t next = FindEither(in, 0, '%', '+');
+    if (next == std::string_view::npos)
+    {
+        out.assign(in);
+        return true;
+    }
+
+    out.reserve(in.size());
+    size_t done = 0;
+    while (next != std::string_view::npos)
+    {
+        out.append(in, done, next - done);
+        if (in[next] == '+')
+        {
+            out.push_back(' ');
+            done = next + 1;
+        }
+        else
+        {
+            int const high = next + 2 < in.size() ? HexValue(in[next + 1]) : -1;
+            int const low = next + 2 < in.size() ? HexValue(in[next + 2]) : -1;
+            if (high < 0 || low < 0)
+            {
+                return false;
+            }
+            out.push_back(static_cast<char>(high * 16 + low));
+            done = next + 3;
+        }
+        next = FindEither(in, done, '%', '+');
+    }
+    out.append(in, done);
+    return true;
+}
+
+/*--- TrimSpaces ---*/
+// The view without its leading and trailing spaces and tabs.
+inline std::string_view TrimSpaces(std::string_view input)
+{
+    size_t const first = input.find_first_not_of(" \t");
+    if (first == std::string_view::npos)
+    {
+        return {};
+    }
+    return input.substr(first, input.find_last_not_of(" \t") - first + 1);
+}
+
+} // namespace feather::core
+
+#endif
@@ -4,271 +4,707 @@
 #define SERVER_HPP
 
 #include <feather/router.hpp>
-
+#include <feather/arena.hpp>
+#include <feather/session.hpp>
+#include <feather/http.hpp>
+#include <feather/channel.hpp>
+
+#ifdef FEATHER_WITH_TLS
+#include <feather/tls.hpp>
+#include <websocketpp/config/asio.hpp>
+#endif
+
+#include <array>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <cerrno>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace feather::core
 {
 
-struct Server
+/*--- ServerTraits ---*/
+/*
+    Transport serving plain HTTP next to the websocketpp endpoint of a configuration:
+    a TLS endpoint gets an HttpsTransport, so that both ports are encrypted.
+*/
+template <typename Config>
+struct ServerTraits
 {
-    using WebSocketServer = websocketpp::server<websocketpp::config::asio>;
-    using ConnectionHdl = websocketpp::connection_hdl;
+    using Transport = HttpTransport;
+    static constexpr bool secure = false;
+};
 
-    struct User
+#ifdef FEATHER_WITH_TLS
+template <>
+struct ServerTraits<websocketpp::config::asio_tls>
+{
+    using Transport = HttpsTransport;
+    static constexpr bool secure = true;
+};
+#endif
+
+/*--- BasicServer ---*/
+/*
+    Server on the websocketpp endpoint of Config.
+    Server serves plain connections, TlsServer (built with FEATHER_WITH_TLS) encrypts them, see feather/tls.hpp.
+*/
+template <typename Config>
+struct BasicServer
+{
+    using WebSocketServer = websocketpp::server<Config>;
+    using ConnectionHdl = websocketpp::connection_hdl;
+    using Transport = typename ServerTraits<Config>::Transport;
+
+    // Whether the connections are encrypted, the scheme of the requests is then https.
+    static constexpr bool secure = ServerTraits<Config>::secure;
+
+    /*- SocketAdapter -*/
+    /*
+        Adapter finishing a response through websocketpp.
+
+        The websocketpp response is deferred while the pipeline writes it, then filled and sent by websocketpp,
+        which keeps the state of its connection and closes it. Chunks are gathered and sent as one body
+        once the response is finished, files are read into the body.
+        Streaming to the socket and sendfile(2) are the work of the HttpTransport (Options::http_port),
+        which owns its sockets.
+    */
+    class SocketAdapter : public plug::Adapter
     {
-        std::shared_ptr<plug::Session>  session;
-        ConnectionHdl                   hdl;
-    };
+        private:
+            typename WebSocketServer::connection_ptr    con;
+            std::string                                 body;
+            bool                                        deferred = false;
+            bool                                        responded = false;
+
+        public:
+            explicit SocketAdapter(typename WebSocketServer::connection_ptr c) : con(std::move(c)) {}
+
+            /*- started -*/
+            // Whether the response was handed to websocketpp, a status can then no longer be sent.
+            bool started() const { return responded; }
+
+            /*- defer -*/
+            /*
+                Takes the response away from websocketpp, once per request.
+                Returns false if websocketpp refused, the response can then only be written by websocketpp.
+            */
+            bool defer()
+            {
+                deferred = deferred || !con->defer_http_response();
+                return deferred;
+            }
 
-    public:
-        WebSocketServer                                     server;
-        boost::asio::io_service                            io_service;
-    private:
-        std::mutex                                          conn_lock;
-        boost::uuids::random_generator                      uuid_generator;
-        std::unordered_map<std::string, User>               connections;
-    public:
-        Server()
-        {
-            server.clear_access_channels(websocketpp::log::alevel::all);
-            server.init_asio(&io_service);
+            /*- release -*/
+            // Has websocketpp send the response set on its connection, if it was deferred and not sent yet.
+            void release()
+            {
+                if (deferred && !responded)
+                {
+                    responded = true;
+                    con->send_http_response();
+                }
+            }
 
-            server.set_http_handler([this](ConnectionHdl hdl)
+            bool send_chunked(plug::Conn const& conn) override
             {
-                using namespace feather::core::plug;
-                using namespace websocketpp::http;
+                if (responded || !defer())
+                {
+                    return false;
+                }
+                set_head(con, conn);
+                return true;
+            }
 
+            bool chunk(std::string_view data) override
+            {
+                body.append(data);
+                return !responded;
+            }
 
-                auto req = 
-                    server.get_con_from_hdl(hdl)->get_request().raw()
-                    pipe Server::parse_request
-                    pipe unwrap<http::Request>;
+            bool finish() override
+            {
+                if (responded)
+                {
+                    return false;
+                }
+                con->set_body(body);
+                release();
+                return true;
+            }
 
-                auto req_cpy = req;
-                auto session = std::make_shared<CookieSession>();
-                
-                Conn conn = [&](Conn const& c) {
-                    auto req_with_cookies = Conn::fetch_cookies(c);
-                    if (auto const& _id = req_with_cookies.req_cookies.value().find("id"); _id != nullptr)
+            bool send_file(plug::Conn const& conn, int fd, size_t offset, size_t length) override
+            {
+                if (responded || !defer())
+                {
+                    return false;
+                }
+
+                std::string data(length, '\0');
+                for (size_t read = 0; read < length;)
+                {
+                    ssize_t const got = ::pread(fd, data.data() + read, length - read, static_cast<off_t>(offset + read));
+                    if (got < 0 && errno == EINTR)
                     {
-                        std::lock_guard<std::mutex> lock(conn_lock);
-                        return Conn(std::move(req), connections[**_id].session);
+                        continue;
                     }
-                    else
+                    if (got <= 0)
                     {
-                        std::string id = uuid_generator() pipe boost::uuids::to_string;
-
-                        std::lock_guard<std::mutex> lock(conn_lock);
-                        connections[id] = {session, hdl};
-                        return Conn::put_resp_cookie(c, "id", id).second;
+                        return false;
                     }
+                    read += static_cast<size_t>(got);
+                }
 
-                }(Conn(std::move(req_cpy), session));
-                
-                auto ready_for_resp = router::Router::handler(conn);
+                set_head(con, conn);
+                // A 304 keeps no body, it must not announce the length of the one it replaces.
+                if (conn.status.value_or(200) != 304)
+                {
+                    con->set_body(data);
+                }
+                release();
+                return true;
+            }
+    };
 
-                auto response = server.get_con_from_hdl(hdl)->get_response();
-                
-                auto status = ready_for_resp.status.value_or(200);
-                response.set_status(static_cast<status_code::value>(status));
+    /*- ChannelConnection -*/
+    // Channel socket of a WebSocket connection, frames are queued on the connection as prepared messages.
+    class ChannelConnection : public ChannelSocket
+    {
+        private:
+            std::weak_ptr<typename WebSocketServer::connection_type> con;
+
+        public:
+            ChannelConnection(std::string i, plug::SessionPtr s, typename WebSocketServer::connection_ptr const& c)
+            :
+            ChannelSocket(std::move(i), std::move(s)),
+            con(c)
+            {}
+
+            bool deliver(FramePtr const& frame) override
+            {
+                auto const connection = con.lock();
+                return connection != nullptr && !connection->send(frame->message);
+            }
+    };
+
+    struct User
+    {
+        plug::SessionPtr                session;
+        ConnectionHdl                   hdl;
+        ChannelSocketPtr                socket;
+    };
+
+    /*- Registry -*/
+    /*
+        Sharded registry of the users of the server.
+
+        Users are indexed by session id, WebSocket users are also indexed by their connection,
+        so that a frame finds its sender in O(1) instead of scanning every user.
+        Each shard has its own lock: concurrent requests only contend when they hash to the same shard.
+        The two lookups of a find by connection take their locks one after the other, never nested.
+    */
+    class Registry
+    {
+        public:
+            static constexpr size_t shard_count = 16;
 
-                response.set_max_body_size(8000000);
+        private:
+            struct Shard
+            {
+                std::mutex                                          lock;
+                std::unordered_map<std::string, User>               by_id;
+                std::unordered_map<void const*, std::string>        by_hdl;
+            };
+
+            std::array<Shard, shard_count>  shards;
+
+            Shard& shard(std::string const& id)
+            {
+                return shards[std::hash<std::string>{}(id) % shard_count];
+            }
+
+            Shard& shard(void const* con)
+            {
+                return shards[std::hash<void const*>{}(con) % shard_count];
+            }
 
-                if (ready_for_resp.resp_body.use_count() != 0)
+            // The connection behind a handle, the key of the connection index.
+            static void const* key(ConnectionHdl const& hdl)
+            {
+                return hdl.lock().get();
+            }
+
+        public:
+            /*- insert -*/
+            // Records a user under the session id, replacing any previous one.
+            void insert(std::string const& id, User user)
+            {
+                Shard& s = shard(id);
+                std::lock_guard<std::mutex> lock(s.lock);
+                s.by_id[id] = std::move(user);
+            }
+
+            /*- bind -*/
+            // Indexes a WebSocket connection under the session id of its user.
+            void bind(ConnectionHdl const& hdl, std::string const& id)
+            {
+                void const* con = key(hdl);
+                if (con == nullptr)
                 {
-                    response.set_body(*ready_for_resp.resp_body);
+                    return;
                 }
+                Shard& s = shard(con);
+                std::lock_guard<std::mutex> lock(s.lock);
+                s.by_hdl[con] = id;
+            }
 
-                for (auto const& [key, value] : ready_for_resp.resp_headers)
+            /*- find -*/
+            // Returns the user with the session id, if any.
+            std::optional<User> find(std::string const& id)
+            {
+                Shard& s = shard(id);
+                std::lock_guard<std::mutex> lock(s.lock);
+                if (auto const user = s.by_id.find(id); user != s.by_id.end())
                 {
-                    response.append_header(key, value);
+                    return user->second;
                 }
+                return std::nullopt;
+            }
 
-                for (auto [key, cookie] : ready_for_resp.resp_cookies)
+            // Returns the user of a WebSocket connection, if any.
+            std::optional<User> find(ConnectionHdl const& hdl)
+            {
+                void const* con = key(hdl);
+                std::string id;
                 {
-                    std::string set_cookie = "";
-                    if (auto const& value = cookie.find("value"); value != nullptr)
-                    {
-                        set_cookie += **value;
-                    }
-                    else
+                    Shard& s = shard(con);
+                    std::lock_guard<std::mutex> lock(s.lock);
+                    auto const entry = s.by_hdl.find(con);
+                    if (entry == s.by_hdl.end())
                     {
-                        continue;
+                        return std::nullopt;
                     }
+                    id = entry->second;
+                }
+                return find(id);
+            }
 
-                    if (auto const& path = cookie.find("path"); path != nullptr)
-                    {
-                        set_cookie += "; Path=" + **path;
-                    }
-                    else
-                    {
-                        set_cookie += "; Path=/";
-                    }
+            /*- erase -*/
+            // Removes the user with the session id.
+            void erase(std::string const& id)
+            {
+                Shard& s = shard(id);
+                std::lock_guard<std::mutex> lock(s.lock);
+                s.by_id.erase(id);
+            }
 
-                    if (auto const& domain = cookie.find("domain"); domain != nullptr)
+            // Removes a WebSocket connection and its user.
+            void erase(ConnectionHdl const& hdl)
+            {
+                void const* con = key(hdl);
+                std::string id;
+                {
+                    Shard& s = shard(con);
+                    std::lock_guard<std::mutex> lock(s.lock);
+                    auto const entry = s.by_hdl.find(con);
+                    if (entry == s.by_hdl.end())
                     {
-                        set_cookie += "; Domain=" + **domain;
+                        return;
                     }
+                    id = std::move(entry->second);
+                    s.by_hdl.erase(entry);
+                }
+                erase(id);
+            }
 
-                    if (auto const& max_age = cookie.find("max_age"); max_age != nullptr)
-                    {
-                        set_cookie += "; Max-Age=" + **max_age;
-                    }
+            /*- size -*/
+            // Returns the number of users, only exact when no other thread modifies the registry.
+            size_t size()
+            {
+                size_t total = 0;
+                for (Shard& s : shards)
+                {
+                    std::lock_guard<std::mutex> lock(s.lock);
+                    total += s.by_id.size();
+                }
+                return total;
+            }
+    };
 
-                    if (auto const& expires = cookie.find("expires"); expires != nullptr)
-                    {
-                        set_cookie += "; Expires=" + **expires;
-                    }
+    /*- Options -*/
+    /*
+        Run configuration of the server.
+
+        - threads     : number of worker threads running the io_service, defaults to one per core
+        - pin_threads : pins worker i to core i (modulo the number of cores), Linux only
+        - reuse_port  : sets SO_REUSEPORT on the acceptor so that several feather processes
+                        can listen on the same port and let the kernel shard the accepts
+        - http_port   : when set, HTTP is also served on this port by an HttpTransport (HttpsTransport for a TlsServer),
+                        with persistent connections and pipelining, websocketpp keeps the WebSocket port
+        - http        : keep-alive, timeout and size limits of the transport
+    */
+    struct Options
+    {
+        size_t                      threads     = std::max(1u, std::thread::hardware_concurrency());
+        bool                        pin_threads = false;
+        bool                        reuse_port  = false;
+        std::optional<uint16_t>     http_port;
+        HttpTransportOptions        http;
+    };
 
-                    if (cookie.find("secure") != nullptr)
-                    {
-                        set_cookie += "; Secure";
-                    }
+    public:
+        WebSocketServer                                     server;
+        boost::asio::io_service                            io_service;
+        Registry                                            connections;
+        Channels                                            channels;
+        std::shared_ptr<SessionStore>                       sessions = std::make_shared<MemorySessionStore>();
 
-                    if (cookie.find("httponly") != nullptr)
-                    {
-                        set_cookie += "; HttpOnly";
-                    }
+        // Name of the cookie holding the session id.
+        // put_resp_cookie sends it as <name>_cookie=<id>, which is how it comes back.
+        inline static std::string const                     session_cookie = "id";
+    private:
+        std::vector<std::thread>                            workers;
+        std::unique_ptr<Transport>                          http_transport;
+#ifdef FEATHER_WITH_TLS
+        std::shared_ptr<boost::asio::ssl::context>          tls_context;
+#endif
+
+        // Options of the session cookie, with its attributes serialized once.
+        static ImmutMapString session_cookie_opts()
+        {
+            static ImmutMapString const opts = ImmutMapString().insert({"attributes", CompileCookieAttributes({})});
+            return opts;
+        }
 
-                    if (auto const& same_site = cookie.find("same_site"); same_site != nullptr)
-                    {
-                        set_cookie += "; SameSite=" + **same_site;
-                    }
+        // Options expiring the session cookie, with the path and security of session_cookie_opts.
+        static ImmutMapString expired_session_cookie_opts()
+        {
+            static ImmutMapString const opts = ImmutMapString().insert({"attributes", CompileCookieAttributes(ImmutMapString()
+                .insert({"max_age", ShareStr("0")})
+                .insert({"expires", ShareStr("Thu, 01 Jan 1970 00:00:00 GMT")}))});
+            return opts;
+        }
 
+        /*- persist_session -*/
+        /*
+            Applies the changes made to the session by the pipeline to the session store,
+            and updates the session cookie accordingly.
+            Registered as the first before_send callback of every HTTP request.
+        */
+        plug::Conn persist_session(plug::Conn const& conn, std::string const& id, bool fresh)
+        {
+            using plug::Conn;
+            using plug::SessionOpt;
 
-                    response.append_header("Set-Cookie", set_cookie);
+            switch (Conn::get_session_opt(conn))
+            {
+                case SessionOpt::WRITE:
+                    sessions->put(id, Conn::share_session(conn));
+                    return fresh ? Conn::put_resp_cookie(conn, session_cookie, id, session_cookie_opts()).second : conn;
+                case SessionOpt::RENEW:
+                {
+                    std::string const renewed = new_id();
+                    sessions->erase(id);
+                    sessions->put(renewed, Conn::share_session(conn));
+                    return Conn::put_resp_cookie(conn, session_cookie, renewed, session_cookie_opts()).second;
                 }
-            });
+                case SessionOpt::DROP:
+                    sessions->erase(id);
+                    // The cookie of the request is expired explicitly, resp_cookies holds no entry to delete.
+                    return fresh ? conn : Conn::put_resp_cookie(conn, session_cookie, "", expired_session_cookie_opts()).second;
+                case SessionOpt::IGNORE:
+                default:
+                    return conn;
+            }
+        }
 
-            server.set_open_handler([this](ConnectionHdl hdl)
+        /*- dispatch -*/
+        /*
+            Runs a request through the router: loads its session from the session cookie,
+            registers persist_session and runs the before_send callbacks on the result.
+            Shared by the websocketpp handler and the HttpTransport.
+            Both serve the connections of the same endpoint, the scheme of the Conn is the one of the server.
+
+            An asynchronous route gives back its task, which runs the before_send callbacks once it completes.
+        */
+        template <typename Request>
+        MaybeAsync<plug::Conn> dispatch(Request&& request, std::string const& cookie_header, std::shared_ptr<plug::Adapter> adapter)
+        {
+            using namespace feather::core::plug;
+
+            SessionPtr session = nullptr;
+            std::string id;
+            ImmutMapString const req_cookies = ParseCookie(cookie_header);
+            if (auto const& _id = req_cookies.find(session_cookie + "_cookie"); _id != nullptr)
+            {
+                id = **_id;
+                session = sessions->fetch(id);
+            }
+
+            // A new session is only stored, and its cookie sent, once the pipeline writes to it.
+            bool const fresh = session == nullptr;
+            if (fresh)
             {
-                std::string id = uuid_generator() pipe boost::uuids::to_string;
+                id = new_id();
+                session = std::make_shared<CookieSession>();
+            }
 
-                std::lock_guard<std::mutex> lock(conn_lock);
-                connections[id] = {std::make_shared<plug::CookieSession>(), hdl};
+            Conn conn = Conn::register_before_send(Conn(std::forward<Request>(request), session), [this, id, fresh](Conn const& c)
+            {
+                return persist_session(c, id, fresh);
             });
 
-            server.set_message_handler([this](ConnectionHdl hdl, WebSocketServer::message_ptr)
+            if constexpr (secure)
+            {
+                static SharedString const https = ShareStr("https");
+                conn.scheme = https;
+            }
+            conn.adapter = std::move(adapter);
+            Metrics::requests().add();
+            auto routed = router::Router::dispatch(conn);
+            if (auto* task = std::get_if<Task<Conn>>(&routed))
+            {
+                return finish(std::move(*task));
+            }
+            return Conn::run_before_send(std::get<Conn>(std::move(routed)));
+        }
+
+        /*- finish -*/
+        // Awaits an asynchronous route, then runs the before_send callbacks on its result.
+        static Task<plug::Conn> finish(Task<plug::Conn> task)
+        {
+            co_return plug::Conn::run_before_send(co_await std::move(task));
+        }
+
+        /*- set_head -*/
+        // Sets the status, the headers, the header blocks and the cookies of a response on a websocketpp connection.
+        static void set_head(typename WebSocketServer::connection_ptr const& con, plug::Conn const& conn)
+        {
+            using namespace websocketpp::http;
+
+            con->set_status(static_cast<status_code::value>(conn.status.value_or(200)));
+
+            for (auto const& [key, value] : conn.resp_headers)
             {
-                /*TODO: change all of this to Phoenix Channel*/
-                using namespace feather::core::plug;
+                con->append_header(key, value);
+            }
 
-                auto user = [&]()
+            for (auto const& block : conn.resp_header_blocks)
+            {
+                for (auto const& [key, value] : block->headers)
                 {
-                    for (auto const& conn : connections)
+                    if (!BlockHeaderOverridden(conn, key))
                     {
-                        if (server.get_con_from_hdl(conn.second.hdl) == server.get_con_from_hdl(hdl))
-                        {
-                            return conn.second;
-                        }
+                        con->append_header(key, value);
                     }
-                    throw std::runtime_error("Conn is not recorded");
-                }();
-                
-                auto req = 
-                    server.get_con_from_hdl(hdl)->get_request().raw()
-                    pipe Server::parse_request
-                    pipe unwrap<http::Request>;
-
-                Conn conn(std::move(req), user.session);
-                conn.state = Unsent::UPGRADED;
-                router::Router::handler(conn);
-            });
+                }
+            }
+
+            std::pmr::string set_cookie(RequestArena::resource());
+            for (auto const& [key, cookie] : conn.resp_cookies)
+            {
+                if (!BuildSetCookie(cookie, set_cookie))
+                {
+                    continue;
+                }
+                con->append_header("Set-Cookie", std::string(set_cookie));
+            }
         }
-        ~Server() = default;
 
-        /*- parse_request-*/
+        /*- respond -*/
         /*
-            Parse a raw request into an http::Request
+            Hands the final Conn of a request to websocketpp, unless the adapter already did.
+            Returns true if the response still has to be sent, see SocketAdapter::release.
         */
-        static Result<http::Request> parse_request(std::string const& raw)
+        static bool respond(typename WebSocketServer::connection_ptr const& con, plug::Conn const& ready_for_resp)
         {
-            http::Request req;
-            boost::char_separator sep("\n");
-            boost::char_separator line_sep(" ");
-            bool first_line = true;
-            bool is_body = false;
-            boost::tokenizer<boost::char_separator<char>> tok(raw, sep);
+            using namespace feather::core::plug;
+
+            if (std::holds_alternative<Unsent>(ready_for_resp.state)
+                && std::get<Unsent>(ready_for_resp.state) == Unsent::CHUNKED
+                && ready_for_resp.adapter != nullptr)
+            {
+                // The chunks gathered by the adapter, which may be wrapped, are sent once it is finished.
+                ready_for_resp.adapter->finish();
+                return false;
+            }
 
-            for (auto const& line : tok)
+            if (std::holds_alternative<Sent>(ready_for_resp.state))
             {
-                auto len = line.length();
+                // The whole response was handed to websocketpp by the adapter, e.g. by send_file.
+                return false;
+            }
 
-                if (first_line)
+            set_head(con, ready_for_resp);
+            if (ready_for_resp.resp_body.use_count() != 0)
+            {
+                con->set_body(*ready_for_resp.resp_body);
+            }
+            return true;
+        }
+
+        /*- new_id -*/
+        // Generates a session id. The generator is not thread safe, each thread owns one.
+        static std::string new_id()
+        {
+            static thread_local boost::uuids::random_generator uuid_generator;
+            return uuid_generator() pipe boost::uuids::to_string;
+        }
+
+        /*- init -*/
+        // Registers the handlers of the websocketpp endpoint, shared by the constructors.
+        void init()
+        {
+            Metrics::instance().observe("feather_sessions", "Sessions kept by the session store.",
+                [this]() { return static_cast<double>(sessions->size()); });
+
+            server.clear_access_channels(websocketpp::log::alevel::all);
+            server.init_asio(&io_service);
+
+#ifdef FEATHER_WITH_TLS
+            if constexpr (secure)
+            {
+                server.set_tls_init_handler([this](ConnectionHdl) { return tls_context; });
+            }
+#endif
+
+            server.set_http_handler([this](ConnectionHdl hdl)
+            {
+                // Scratch memory of the request, released once the response is written.
+                RequestArena arena;
+                RequestArena::Scope arena_scope(arena);
+
+                auto con = server.get_con_from_hdl(hdl);
+                auto const& request = con->get_request();
+
+                auto const adapter = std::make_shared<SocketAdapter>(con);
+                auto routed = dispatch(request, request.get_header("Cookie"), adapter);
+
+                // An asynchronous route answers later: websocketpp waits for send_http_response meanwhile.
+                if (auto* task = std::get_if<Task<plug::Conn>>(&routed))
                 {
-                    if (len == 1)
+                    if (!adapter->defer())
                     {
-                        return { ResultType::Err, req };
+                        return;
                     }
-                    boost::tokenizer<boost::char_separator<char>> t_line(line, line_sep);
-                    size_t count = 0;
-                    for (auto const& word : t_line)
-                    {
-                        switch (count)
+                    boost::asio::co_spawn(io_service,
+                        [this, con, adapter, task = std::move(*task)]() mutable -> Task<void>
                         {
-                            case 0: req.method = word; break;
-                            case 1: req.target = word; break;
-                            case 2: req.version = word.substr(0, word.length() - 1); break;
-                            default: break;
-                        }
-
-                        ++count;
-                    }
+                            plug::Conn const conn = co_await std::move(task);
+
+                            RequestArena arena;
+                            RequestArena::Scope arena_scope(arena);
+                            if (respond(con, conn))
+                            {
+                                adapter->release();
+                            }
+                        },
+                        [con, adapter](std::exception_ptr error)
+                        {
+                            // Nothing is on the wire before the response is handed to websocketpp.
+                            if (error && !adapter->started())
+                            {
+                                con->set_status(websocketpp::http::status_code::internal_server_error);
+                                con->set_body("");
+                                adapter->release();
+                            }
+                        });
+                    return;
+                }
 
-                    // Skip URL fragment
-                    if (auto const& pos = req.target.find('#'); pos != std::string::npos)
-                    {
-                        req.target.erase(pos);
-                    }
+                // websocketpp sends the response itself unless a plug deferred it.
+                if (respond(con, std::get<plug::Conn>(routed)))
+                {
+                    adapter->release();
+                }
+            });
 
-                    auto slash_mark = req.target.find("/");
-                    if (auto const& question_mark = req.target.find("?"); question_mark != std::string::npos)
-                    {
-                        req.path = req.target.substr(slash_mark, question_mark);
-                    }
-                    else
-                    {
-                        req.path = req.target.substr(slash_mark);
-                    }
-                    
-                    static const std::set<std::string> methods
-                    {
-                        "GET", "HEAD", "POST", "PUT", "DELETE",
-                        "CONNECT", "OPTION", "TRACE", "PATCH", "PRI"
-                    };
+            server.set_open_handler([this](ConnectionHdl hdl)
+            {
+                std::string const id = new_id();
+                auto const session = std::make_shared<plug::CookieSession>();
+                auto const socket = std::make_shared<ChannelConnection>(id, session, server.get_con_from_hdl(hdl));
+                connections.insert(id, {session, hdl, socket});
+                connections.bind(hdl, id);
+                Metrics::connections().add(1);
+            });
 
-                    if (methods.find(req.method) == methods.end()
-                        || (req.version != "HTTP/1.1"
-                            && req.version != "HTTP/1.0"))
-                    {
-                        std::cout << "Error version" << std::endl;
-                        return { ResultType::Err, req };
-                    }
+            server.set_close_handler([this](ConnectionHdl hdl)
+            {
+                auto const user = connections.find(hdl);
+                if (user.has_value())
+                {
+                    Metrics::connections().add(-1);
                 }
-                else if (len == 1)
+                if (user.has_value() && user->socket != nullptr)
                 {
-                    is_body = true;
+                    channels.disconnect(user->socket);
                 }
-                else if (is_body)
+                connections.erase(hdl);
+            });
+
+            server.set_fail_handler([this](ConnectionHdl hdl)
+            {
+                if (connections.find(hdl).has_value())
                 {
-                    req.body.append(line + "\n");
+                    Metrics::connections().add(-1);
                 }
-                else
+                connections.erase(hdl);
+            });
+
+            server.set_message_handler([this](ConnectionHdl hdl, typename WebSocketServer::message_ptr message)
+            {
+                auto const user = connections.find(hdl);
+                if (!user.has_value() || user->socket == nullptr)
                 {
-                    auto double_dot = line.find(":");
-                    std::string key = line.substr(0, double_dot);
-                    std::string value =
-                        line.substr(double_dot + 1, len - 1)
-                        CHAIN( boost::trim_copy );
-                    req.headers.emplace(key, value);
+                    throw std::runtime_error("Conn is not recorded");
                 }
 
-                first_line = false;
-            }
+                channels.handle(user->socket, message->get_payload());
+            });
+        }
+    public:
+        BasicServer() requires (!secure)
+        {
+            init();
+        }
 
-            req.body.erase(req.body.rfind("\n"));
+#ifdef FEATHER_WITH_TLS
+        // Encrypted server, its certificate, resumption and ALPN are configured by options.
+        explicit BasicServer(TlsOptions const& options) requires secure
+        :
+        tls_context(MakeTlsContext(options))
+        {
+            init();
+        }
+#endif
 
-            return {ResultType::Ok, req};
+        ~BasicServer()
+        {
+            Metrics::instance().forget("feather_sessions");
+            if (!workers.empty())
+            {
+                BasicServer::stop(*this);
+                BasicServer::join(*this);
+            }
+        }
+
+        /*- parse_request-*/
+        /*
+            Parse a raw request into an http::Request, see ParseRequest.
+        */
+        static Result<http::Request> parse_request(std::string_view raw)
+        {
+            return ParseRequest(raw);
         }
 
         /*- start -*/
@@ -276,7 +712,7 @@ struct Server
             Start the server.
             Server cannot be const because of the server.listen()
         */
-        static void start(Server& server, std::string const& host, uint16_t const& port)
+        static void start(BasicServer& server, std::string const& host, uint16_t const& port)
         {
             try {
                 // Configure server endpoint
@@ -294,27 +730,123 @@ struct Server
                 server.server.listen(addr, port);
                 server.server.start_accept();
             } catch (const std::exception& e) {
-                std::cerr << "Server configuration error: " << e.what() << std::endl;
+                Log<LogLevel::Error>("server configuration error", {{"host", host}, {"port", port}, {"error", e.what()}});
                 throw;
             }
         }
 
+        /*
+            Start the server and run its io_service on opts.threads worker threads.
+            The call returns once the workers are running, use join/1 to wait for them.
+
+            All the handlers may then run concurrently: the users of the server
+            are kept in the sharded connections registry, session ids are generated per thread.
+            When opts.http_port is set, an HttpTransport also serves HTTP on that port, an HttpsTransport for a TlsServer.
+        */
+        static void start(BasicServer& server, std::string const& host, uint16_t const& port, Options const& opts)
+        {
+            if (opts.reuse_port)
+            {
+                server.server.set_tcp_pre_bind_handler([](auto acceptor)
+                {
+                    using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+                    websocketpp::lib::error_code ec;
+                    acceptor->set_option(reuse_port(true), ec);
+                    return ec;
+                });
+            }
+
+            BasicServer::start(server, host, port);
+
+            if (opts.http_port.has_value())
+            {
+                auto handler = [&server](http::Request&& request, std::shared_ptr<plug::Adapter> const& adapter)
+                {
+                    std::string const cookie_header = request.get_header_value("Cookie");
+                    return server.dispatch(std::move(request), cookie_header, adapter);
+                };
+#ifdef FEATHER_WITH_TLS
+                if constexpr (secure)
+                {
+                    server.http_transport = std::make_unique<Transport>(server.io_service, handler, opts.http, TlsOpener(server.tls_context));
+                } else
+#endif
+                {
+                    server.http_transport = std::make_unique<Transport>(server.io_service, handler, opts.http);
+                }
+
+                boost::asio::ip::address const addr = host.empty()
+                    ? boost::asio::ip::address(boost::asio::ip::address_v4::any())
+                    : boost::asio::ip::make_address(host == "localhost" ? "127.0.0.1" : host);
+                server.http_transport->listen(addr, *opts.http_port, opts.reuse_port);
+            }
+
+            size_t const cores = std::max(1u, std::thread::hardware_concurrency());
+            for (size_t i = 0; i < std::max<size_t>(1, opts.threads); ++i)
+            {
+                server.workers.emplace_back([&server]() { server.io_service.run(); });
+#ifdef __linux__
+                if (opts.pin_threads)
+                {
+                    cpu_set_t cpu_set;
+                    CPU_ZERO(&cpu_set);
+                    CPU_SET(i % cores, &cpu_set);
+                    pthread_setaffinity_np(server.workers.back().native_handle(), sizeof(cpu_set_t), &cpu_set);
+                }
+#endif
+            }
+        }
+
+        /*- join -*/
+        /*
+            Waits for the worker threads started by start/4 to return.
+            Safe to call when no worker has been started.
+        */
+        static void join(BasicServer& server)
+        {
+            for (auto& worker : server.workers)
+            {
+                if (worker.get_id() == std::this_thread::get_id())
+                {
+                    worker.detach();
+                }
+                else if (worker.joinable())
+                {
+                    worker.join();
+                }
+            }
+            server.workers.clear();
+        }
+
         /*- stop -*/
         /*
             Stop the server.
             Server cannot be const because of the server.stop()
         */
-        static void stop(Server& server)
+        static void stop(BasicServer& server)
         {
             try {
+                if (server.http_transport != nullptr)
+                {
+                    server.http_transport->stop();
+                }
                 server.server.stop();
                 server.io_service.stop();
             } catch (const std::exception& e) {
-                std::cerr << "Server stop error: " << e.what() << std::endl;
+                Log<LogLevel::Error>("server stop error", {{"error", e.what()}});
                 throw;
             }
         }
-}; // struct Server
+}; // struct BasicServer
+
+/*--- Server ---*/
+using Server = BasicServer<websocketpp::config::asio>;
+
+#ifdef FEATHER_WITH_TLS
+/*--- TlsServer ---*/
+using TlsServer = BasicServer<websocketpp::config::asio_tls>;
+#endif
 
 } // namespace core
 #endif
\ No newline at end of file
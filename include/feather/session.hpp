@@ -0,0 +1,244 @@
+/*--- Header file for session ---*/
+
+#ifndef FEATHER_SESSION_HPP
+#define FEATHER_SESSION_HPP
+
+#include <feather/core.hpp>
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <list>
+#include <unordered_map>
+
+namespace feather::core
+{
+
+/*--- SessionStore ---*/
+/*
+    Interface for the backends keeping the sessions between two requests.
+
+    The interface is asynchronous so that a backend can live out of process
+    (a database, redis...) and share the sessions between several nodes:
+    every operation completes by calling its callback, possibly from another thread.
+    An in-memory backend simply calls it before returning.
+
+    A session that is unknown or expired is reported as nullptr.
+*/
+struct SessionStore
+{
+    using Snapshot     = plug::SessionPtr;
+    using GetCallback  = std::function<void(Snapshot)>;
+    using DoneCallback = std::function<void(bool)>;
+
+    virtual ~SessionStore() = default;
+
+    /*- get -*/
+    // Fetches the session with the given id, refreshing its idle timeout.
+    virtual void get(std::string const& id, GetCallback callback) = 0;
+
+    /*- put -*/
+    // Stores the session under the given id, replacing any previous one.
+    virtual void put(std::string const& id, Snapshot session, DoneCallback callback = {}) = 0;
+
+    /*- erase -*/
+    // Removes the session with the given id.
+    virtual void erase(std::string const& id, DoneCallback callback = {}) = 0;
+
+    /*- size -*/
+    // Returns the number of sessions kept, 0 for a backend that cannot tell it cheaply.
+    virtual size_t size()
+    {
+        return 0;
+    }
+
+    /*- fetch -*/
+    /*
+        Fetches a session and waits for the result.
+        Free for the in-memory store, blocks the calling thread for the round trip otherwise.
+    */
+    Snapshot fetch(std::string const& id)
+    {
+        auto promise = std::make_shared<std::promise<Snapshot>>();
+        auto result = promise->get_future();
+        this->get(id, [promise](Snapshot session) { promise->set_value(std::move(session)); });
+        return result.get();
+    }
+};
+
+/*--- MemorySessionStore ---*/
+/*
+    In-memory SessionStore, sharded to keep lock contention low.
+
+    Sessions expire when they were not used for options.idle_ttl,
+    and the least recently used ones are evicted once the store holds options.max_entries.
+    Expired sessions are dropped lazily by the operations of their shard, or by sweep.
+*/
+class MemorySessionStore : public SessionStore
+{
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /*- Options -*/
+        /*
+            - idle_ttl    : time after which an unused session expires, defaults to 30 minutes
+            - max_entries : maximum number of sessions kept, defaults to 100_000
+            - now         : clock of the store, can be replaced by tests
+        */
+        struct Options
+        {
+            std::chrono::seconds            idle_ttl    = std::chrono::minutes(30);
+            size_t                          max_entries = 100000;
+            std::function<Clock::time_point()> now      = &Clock::now;
+        };
+
+        static constexpr size_t shard_count = 16;
+
+    private:
+        struct Entry
+        {
+            std::string         id;
+            Snapshot            session;
+            Clock::time_point   last_access;
+        };
+
+        struct Shard
+        {
+            std::mutex                                                  lock;
+            std::list<Entry>                                            lru;
+            std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        };
+
+        Options                         options;
+        std::array<Shard, shard_count>  shards;
+
+        Shard& shard(std::string const& id)
+        {
+            return shards[std::hash<std::string>{}(id) % shard_count];
+        }
+
+        size_t shard_capacity() const
+        {
+            return std::max<size_t>(1, options.max_entries / shard_count);
+        }
+
+        bool expired(Entry const& entry, Clock::time_point now) const
+        {
+            return now - entry.last_access >= options.idle_ttl;
+        }
+
+        // Drops the expired entries at the cold end of the shard, then the extra ones. Expects the lock held.
+        void evict(Shard& s, Clock::time_point now, size_t capacity)
+        {
+            while (!s.lru.empty() && (s.lru.size() > capacity || expired(s.lru.back(), now)))
+            {
+                s.index.erase(s.lru.back().id);
+                s.lru.pop_back();
+            }
+        }
+
+    public:
+        MemorySessionStore() = default;
+        explicit MemorySessionStore(Options opts) : options(std::move(opts)) {}
+
+        void get(std::string const& id, GetCallback callback) override
+        {
+            Snapshot session = nullptr;
+            {
+                Shard& s = shard(id);
+                std::lock_guard<std::mutex> lock(s.lock);
+                auto const now = options.now();
+
+                if (auto const entry = s.index.find(id); entry != s.index.end())
+                {
+                    if (expired(*entry->second, now))
+                    {
+                        s.lru.erase(entry->second);
+                        s.index.erase(entry);
+                    }
+                    else
+                    {
+                        entry->second->last_access = now;
+                        s.lru.splice(s.lru.begin(), s.lru, entry->second);
+                        session = entry->second->session;
+                    }
+                }
+            }
+            callback(std::move(session));
+        }
+
+        void put(std::string const& id, Snapshot session, DoneCallback callback = {}) override
+        {
+            {
+                Shard& s = shard(id);
+                std::lock_guard<std::mutex> lock(s.lock);
+                auto const now = options.now();
+
+                if (auto const entry = s.index.find(id); entry != s.index.end())
+                {
+                    entry->second->session = std::move(session);
+                    entry->second->last_access = now;
+                    s.lru.splice(s.lru.begin(), s.lru, entry->second);
+                }
+                else
+                {
+                    evict(s, now, shard_capacity() - 1);
+                    s.lru.push_front({id, std::move(session), now});
+                    s.index.emplace(id, s.lru.begin());
+                }
+            }
+            if (callback)
+            {
+                callback(true);
+            }
+        }
+
+        void erase(std::string const& id, DoneCallback callback = {}) override
+        {
+            bool found = false;
+            {
+                Shard& s = shard(id);
+                std::lock_guard<std::mutex> lock(s.lock);
+
+                if (auto const entry = s.index.find(id); entry != s.index.end())
+                {
+                    s.lru.erase(entry->second);
+                    s.index.erase(entry);
+                    found = true;
+                }
+            }
+            if (callback)
+            {
+                callback(found);
+            }
+        }
+
+        /*- sweep -*/
+        // Drops every expired session, e.g. from a periodic timer.
+        void sweep()
+        {
+            for (Shard& s : shards)
+            {
+                std::lock_guard<std::mutex> lock(s.lock);
+                evict(s, options.now(), shard_capacity());
+            }
+        }
+
+        /*- size -*/
+        // Returns the number of sessions kept, including the expired ones not dropped yet.
+        size_t size() override
+        {
+            size_t total = 0;
+            for (Shard& s : shards)
+            {
+                std::lock_guard<std::mutex> lock(s.lock);
+                total += s.lru.size();
+            }
+            return total;
+        }
+};
+
+} // namespace feather::core
+
+#endif
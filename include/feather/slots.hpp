@@ -0,0 +1,189 @@
+/*--- Header file for slots ---*/
+
+#ifndef FEATHER_SLOTS_HPP
+#define FEATHER_SLOTS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+/*
+    Typed values keyed by compile-time tags, the layer below the typed assigns and sessions of core.
+
+    A key is a tag type carrying the type of its value and its name:
+
+        struct CurrentUser : TypedKey<CurrentUser, User>    { static constexpr std::string_view key = "current_user"; };
+        struct TenantId    : TypedKey<TenantId, int64_t>    { static constexpr std::string_view key = "tenant_id"; };
+
+    Each key owns a slot of a small fixed table, numbered once at its first use.
+    The table holds 64 keys per program, the 65th throws std::length_error at its first use.
+    A lookup is two indexed loads and a static_cast instead of a string hash and an std::any_cast,
+    and reading a key with the wrong type does not compile.
+
+    The table is a persistent two-level array: a write copies the top level and the block of the slot,
+    the other blocks stay shared with the previous version, so copying a store only copies a pointer.
+    A store owned by a single connection is written in place.
+*/
+namespace feather::core
+{
+
+namespace slots_detail
+{
+    inline constexpr size_t block_size = 8;
+    inline constexpr size_t block_count = 8;
+
+    /*--- NextSlot ---*/
+    // Numbers a new key. Throws std::length_error once every slot of the table is taken.
+    inline size_t NextSlot()
+    {
+        static std::atomic<size_t> next{0};
+        size_t const slot = next.fetch_add(1, std::memory_order_relaxed);
+        if (slot >= block_size * block_count)
+        {
+            throw std::length_error("feather: too many typed keys, at most " + std::to_string(block_size * block_count));
+        }
+        return slot;
+    }
+}
+
+/*--- TypedKey ---*/
+/*
+    Base of the key tags, see above.
+    name() is the string key used by the stores without typed slots, e.g. a session kept in redis:
+    "typed:" followed by Tag::key, which must be unique and stable across builds and compilers.
+    At most 64 keys take a slot (slots_detail::block_size * block_count), see NextSlot.
+*/
+template <typename Tag, typename T>
+struct TypedKey
+{
+    using value_type = T;
+
+    static size_t slot()
+    {
+        static size_t const index = slots_detail::NextSlot();
+        return index;
+    }
+
+    static std::string name()
+    {
+        static_assert(requires { std::string_view(Tag::key); }, "feather: a typed key needs a static constexpr std::string_view key");
+        return "typed:" + std::string(Tag::key);
+    }
+};
+
+/*--- SlotStore ---*/
+// Persistent store of the values of typed keys, see above. Empty stores allocate nothing.
+class SlotStore
+{
+    private:
+        using Value = std::shared_ptr<void const>;
+        using Block = std::array<Value, slots_detail::block_size>;
+        using Table = std::array<std::shared_ptr<Block>, slots_detail::block_count>;
+
+        std::shared_ptr<Table>  table;
+
+        /*- private write -*/
+        // Writes value in slot, copying the levels shared with other stores and mutating the others in place.
+        void write(size_t slot, Value value)
+        {
+            if (table == nullptr)
+            {
+                if (value == nullptr)
+                {
+                    return;
+                }
+                table = std::make_shared<Table>();
+            } else if (table.use_count() > 1)
+            {
+                table = std::make_shared<Table>(*table);
+            }
+
+            auto& block = (*table)[slot / slots_detail::block_size];
+            if (block == nullptr)
+            {
+                if (value == nullptr)
+                {
+                    return;
+                }
+                block = std::make_shared<Block>();
+            } else if (block.use_count() > 1)
+            {
+                block = std::make_shared<Block>(*block);
+            }
+            (*block)[slot % slots_detail::block_size] = std::move(value);
+        }
+
+    public:
+        /*- find -*/
+        // Type-erased value of slot, nullptr if it is not set.
+        void const* find(size_t slot) const
+        {
+            if (table == nullptr)
+            {
+                return nullptr;
+            }
+            auto const& block = (*table)[slot / slots_detail::block_size];
+            return block == nullptr ? nullptr : (*block)[slot % slots_detail::block_size].get();
+        }
+
+        /*- get -*/
+        // Value of Key, nullptr if it is not set.
+        template <typename Key>
+        typename Key::value_type const* get() const
+        {
+            return static_cast<typename Key::value_type const*>(find(Key::slot()));
+        }
+
+        /*- contains -*/
+        template <typename Key>
+        bool contains() const
+        {
+            return find(Key::slot()) != nullptr;
+        }
+
+        /*- set -*/
+        // Returns the store with value under Key. The rvalue overload reuses the levels it owns alone.
+        template <typename Key>
+        SlotStore set(typename Key::value_type value) &&
+        {
+            write(Key::slot(), std::make_shared<typename Key::value_type const>(std::move(value)));
+            return std::move(*this);
+        }
+
+        template <typename Key>
+        SlotStore set(typename Key::value_type value) const&
+        {
+            return SlotStore(*this).set<Key>(std::move(value));
+        }
+
+        /*- erase -*/
+        // Returns the store without Key.
+        template <typename Key>
+        SlotStore erase() &&
+        {
+            write(Key::slot(), nullptr);
+            return std::move(*this);
+        }
+
+        template <typename Key>
+        SlotStore erase() const&
+        {
+            return SlotStore(*this).erase<Key>();
+        }
+
+        /*- empty -*/
+        // Whether no value was ever written. A store whose values were all erased is not empty.
+        bool empty() const
+        {
+            return table == nullptr;
+        }
+};
+
+} // namespace feather::core
+
+#endif
@@ -0,0 +1,448 @@
+/*--- Header file for tls ---*/
+
+#ifndef FEATHER_TLS_HPP
+#define FEATHER_TLS_HPP
+
+#ifdef FEATHER_WITH_TLS
+
+#include <feather/http.hpp>
+#include <feather/metrics.hpp>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/error.hpp>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+    TLS termination of feather, so that no proxy hop sits in front of the server.
+
+    MakeTlsContext builds the OpenSSL context shared by the WebSocket and HTTP sides of a TlsServer:
+    TLS 1.2 and 1.3 only, a server session cache and session tickets for resumption,
+    ALPN restricted to the protocols feather speaks, and kernel TLS when it is enabled.
+
+    TlsStream runs OpenSSL straight on the file descriptor of an asio socket, so that OpenSSL can hand
+    the record layer to the kernel (kTLS) once the handshake is done. Files are then sent with SSL_sendfile:
+    sendfile(2) on the encrypted connection, the kernel encrypts the pages without copying them to user space.
+    Without kTLS (no tls module, an old kernel, a cipher the kernel does not offload) the writer falls back to
+    mapping the file and encrypting it in user space.
+
+    The websocketpp side goes through asio's ssl::stream, which keeps OpenSSL on a memory BIO:
+    it cannot use kTLS and sends files through the mapping.
+
+    Defined when FEATHER_WITH_TLS is, which CMake does when it finds OpenSSL.
+
+    Usage:
+
+    TlsOptions tls;
+    tls.certificate_chain = "/etc/feather/fullchain.pem";
+    tls.private_key = "/etc/feather/privkey.pem";
+
+    TlsServer server(tls);
+    TlsServer::Options opts;
+    opts.http_port = 8443;
+    TlsServer::start(server, "", 9443, opts);
+*/
+namespace feather::core
+{
+
+/*--- TlsOptions ---*/
+/*
+    - certificate_chain  : PEM file with the certificate followed by its intermediates
+    - private_key        : PEM file with the private key of the certificate
+    - ciphers            : OpenSSL cipher list for TLS 1.2, empty for the OpenSSL defaults
+    - alpn               : protocols offered through ALPN, in order of preference. feather speaks HTTP/1.1 only
+    - session_tickets    : resumption through tickets, stateless on the server
+    - session_cache_size : sessions kept by the server cache for resumption by id, 0 disables the cache
+    - session_timeout    : lifetime of a session, cached or ticket
+    - ktls               : lets OpenSSL offload the record layer to the kernel where it can
+*/
+struct TlsOptions
+{
+    std::string                 certificate_chain;
+    std::string                 private_key;
+    std::string                 ciphers;
+    std::vector<std::string>    alpn                = {"http/1.1"};
+    bool                        session_tickets     = true;
+    size_t                      session_cache_size  = 20 * 1024;
+    std::chrono::seconds        session_timeout     = std::chrono::minutes(5);
+    bool                        ktls                = true;
+};
+
+namespace tls_detail
+{
+    /*--- Context ---*/
+    // The asio context and the ALPN list its callback reads, which must live as long as the context.
+    struct Context
+    {
+        boost::asio::ssl::context   context{boost::asio::ssl::context::tls_server};
+        std::string                 alpn;
+    };
+
+    // Picks the first protocol of the server list the client offered.
+    // A client offering none of them goes on without ALPN rather than failing its handshake.
+    inline int SelectAlpn(SSL*, unsigned char const** out, unsigned char* out_size,
+        unsigned char const* in, unsigned int in_size, void* arg)
+    {
+        auto const* server = static_cast<std::string const*>(arg);
+        unsigned char* selected = nullptr;
+        int const found = SSL_select_next_proto(&selected, out_size,
+            reinterpret_cast<unsigned char const*>(server->data()), static_cast<unsigned int>(server->size()),
+            in, in_size);
+        if (found != OPENSSL_NPN_NEGOTIATED)
+        {
+            return SSL_TLSEXT_ERR_NOACK;
+        }
+        *out = selected;
+        return SSL_TLSEXT_ERR_OK;
+    }
+
+    // The last OpenSSL error, or the one of the system.
+    inline boost::system::error_code LastError(int result)
+    {
+        if (result == SSL_ERROR_SYSCALL && errno != 0)
+        {
+            return boost::system::error_code(errno, boost::system::system_category());
+        }
+        unsigned long const error = ERR_get_error();
+        if (error == 0)
+        {
+            return boost::asio::error::connection_reset;
+        }
+        return boost::system::error_code(static_cast<int>(error), boost::asio::error::get_ssl_category());
+    }
+}
+
+/*--- MakeTlsContext ---*/
+// Builds the server context described by options. Throws if the certificate or the key cannot be loaded.
+inline std::shared_ptr<boost::asio::ssl::context> MakeTlsContext(TlsOptions const& options)
+{
+    using boost::asio::ssl::context;
+
+    auto holder = std::make_shared<tls_detail::Context>();
+    context& ctx = holder->context;
+    ctx.set_options(context::default_workarounds | context::no_sslv2 | context::no_sslv3
+        | context::no_tlsv1 | context::no_tlsv1_1 | context::single_dh_use);
+    ctx.use_certificate_chain_file(options.certificate_chain);
+    ctx.use_private_key_file(options.private_key, context::pem);
+
+    SSL_CTX* const native = ctx.native_handle();
+    SSL_CTX_set_min_proto_version(native, TLS1_2_VERSION);
+    // Partial writes let a writer resume a large buffer where the socket stopped taking it.
+    SSL_CTX_set_mode(native, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+    if (!options.ciphers.empty() && SSL_CTX_set_cipher_list(native, options.ciphers.c_str()) != 1)
+    {
+        throw std::invalid_argument("feather: no usable cipher in " + options.ciphers);
+    }
+
+    static constexpr unsigned char session_context[] = "feather";
+    SSL_CTX_set_session_id_context(native, session_context, sizeof(session_context) - 1);
+    SSL_CTX_set_timeout(native, static_cast<long>(options.session_timeout.count()));
+    if (options.session_cache_size > 0)
+    {
+        SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(native, static_cast<long>(options.session_cache_size));
+    } else
+    {
+        SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_OFF);
+    }
+    if (!options.session_tickets)
+    {
+        SSL_CTX_set_options(native, SSL_OP_NO_TICKET);
+        SSL_CTX_set_num_tickets(native, 0);
+    }
+#ifdef SSL_OP_ENABLE_KTLS
+    if (options.ktls)
+    {
+        SSL_CTX_set_options(native, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+
+    for (auto const& protocol : options.alpn)
+    {
+        if (protocol.empty() || protocol.size() > 255)
+        {
+            throw std::invalid_argument("feather: invalid ALPN protocol " + protocol);
+        }
+        holder->alpn.push_back(static_cast<char>(protocol.size()));
+        holder->alpn.append(protocol);
+    }
+    if (!holder->alpn.empty())
+    {
+        SSL_CTX_set_alpn_select_cb(native, tls_detail::SelectAlpn, &holder->alpn);
+    }
+
+    return std::shared_ptr<context>(holder, &holder->context);
+}
+
+/*--- TlsStream ---*/
+/*
+    A TLS connection over an asio socket, accepted with async_handshake.
+
+    OpenSSL reads and writes the descriptor itself, the socket is non-blocking
+    and asio only waits for it to become readable or writable.
+    It offers the part of the asio stream interface the HttpTransport and the SocketWriter use:
+    async_read_some, read_some and write_some, plus sendfile for the zero-copy path.
+*/
+class TlsStream
+{
+    public:
+        using lowest_layer_type = boost::asio::ip::tcp::socket;
+        using executor_type     = lowest_layer_type::executor_type;
+
+    private:
+        lowest_layer_type                                       socket;
+        std::shared_ptr<boost::asio::ssl::context>              context;
+        std::unique_ptr<SSL, decltype(&SSL_free)>               ssl;
+        std::optional<std::chrono::milliseconds>                stall;
+
+        // Waits asynchronously for what the last call of OpenSSL asked for, then calls retry.
+        template <typename Retry, typename Fail>
+        void await(int result, Retry&& retry, Fail&& fail)
+        {
+            int const error = SSL_get_error(ssl.get(), result);
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+            {
+                fail(error == SSL_ERROR_ZERO_RETURN ? boost::asio::error::eof : tls_detail::LastError(error));
+                return;
+            }
+            socket.async_wait(error == SSL_ERROR_WANT_READ ? lowest_layer_type::wait_read : lowest_layer_type::wait_write,
+                [retry = std::forward<Retry>(retry), fail = std::forward<Fail>(fail)](boost::system::error_code const& ec) mutable
+                {
+                    if (ec)
+                    {
+                        fail(ec);
+                        return;
+                    }
+                    retry();
+                });
+        }
+
+        // Waits synchronously for what the last call of OpenSSL asked for, at most the stall timeout. Returns false on error.
+        bool block(int result, boost::system::error_code& ec)
+        {
+            int const error = SSL_get_error(ssl.get(), result);
+            if ((error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) && stall.has_value())
+            {
+                bool const ready = http_detail::WaitFor(socket.native_handle(), error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT, *stall);
+                ec = ready ? boost::system::error_code() : make_error_code(boost::asio::error::timed_out);
+                return ready;
+            }
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+            {
+                socket.wait(error == SSL_ERROR_WANT_READ ? lowest_layer_type::wait_read : lowest_layer_type::wait_write, ec);
+                return !ec;
+            }
+            ec = error == SSL_ERROR_ZERO_RETURN ? boost::asio::error::eof : tls_detail::LastError(error);
+            return false;
+        }
+
+    public:
+        TlsStream(lowest_layer_type&& s, std::shared_ptr<boost::asio::ssl::context> c)
+        :
+        socket(std::move(s)),
+        context(std::move(c)),
+        ssl(SSL_new(context->native_handle()), &SSL_free)
+        {
+            if (ssl == nullptr)
+            {
+                throw std::runtime_error("feather: SSL_new failed");
+            }
+            boost::system::error_code ec;
+            socket.non_blocking(true, ec);
+            SSL_set_fd(ssl.get(), socket.native_handle());
+            SSL_set_accept_state(ssl.get());
+        }
+
+        TlsStream(TlsStream&&) = default;
+
+        executor_type get_executor() { return socket.get_executor(); }
+        lowest_layer_type& lowest_layer() { return socket; }
+        bool is_open() const { return socket.is_open(); }
+        int native_handle() { return socket.native_handle(); }
+        SSL* native_ssl() const { return ssl.get(); }
+
+        // Longest a synchronous read or write waits for the socket before failing, without limit by default.
+        void stall_timeout(std::chrono::milliseconds timeout) { stall = timeout; }
+
+        // Decrypted bytes OpenSSL holds, readable without waiting for the socket.
+        size_t pending() const
+        {
+            return static_cast<size_t>(SSL_pending(ssl.get()));
+        }
+
+        // Whether the kernel encrypts what is written to the socket.
+        bool kernel_sends() const
+        {
+            return BIO_get_ktls_send(SSL_get_wbio(ssl.get())) != 0;
+        }
+
+        // Whether the session was resumed from the cache or a ticket.
+        bool resumed() const
+        {
+            return SSL_session_reused(ssl.get()) == 1;
+        }
+
+        // Protocol chosen through ALPN, empty if none was.
+        std::string_view alpn() const
+        {
+            unsigned char const* data = nullptr;
+            unsigned int size = 0;
+            SSL_get0_alpn_selected(ssl.get(), &data, &size);
+            return std::string_view(reinterpret_cast<char const*>(data), size);
+        }
+
+        /*- async_handshake -*/
+        // Runs the server side of the handshake, then calls handler with its outcome.
+        template <typename Handler>
+        void async_handshake(Handler&& handler)
+        {
+            static Counter& handshakes = Metrics::instance().counter("feather_tls_handshakes_total", "TLS handshakes completed.");
+            static Counter& resumptions = Metrics::instance().counter("feather_tls_resumed_total", "TLS handshakes resuming a session.");
+
+            int const result = SSL_do_handshake(ssl.get());
+            if (result == 1)
+            {
+                handshakes.add();
+                if (resumed())
+                {
+                    resumptions.add();
+                }
+                boost::asio::post(socket.get_executor(), [handler = std::forward<Handler>(handler)]() mutable { handler(boost::system::error_code()); });
+                return;
+            }
+            auto shared = std::make_shared<std::decay_t<Handler>>(std::forward<Handler>(handler));
+            await(result, [this, shared]() { async_handshake(std::move(*shared)); }, [shared](boost::system::error_code const& ec) { (*shared)(ec); });
+        }
+
+        /*- async_read_some -*/
+        template <typename Handler>
+        void async_read_some(boost::asio::mutable_buffer buffer, Handler&& handler)
+        {
+            size_t read = 0;
+            int const result = SSL_read_ex(ssl.get(), buffer.data(), buffer.size(), &read);
+            if (result == 1)
+            {
+                boost::asio::post(socket.get_executor(),
+                    [handler = std::forward<Handler>(handler), read]() mutable { handler(boost::system::error_code(), read); });
+                return;
+            }
+            auto shared = std::make_shared<std::decay_t<Handler>>(std::forward<Handler>(handler));
+            await(result,
+                [this, buffer, shared]() { async_read_some(buffer, std::move(*shared)); },
+                [shared](boost::system::error_code const& ec) { (*shared)(ec, size_t(0)); });
+        }
+
+        /*- read_some -*/
+        template <typename MutableBuffers>
+        size_t read_some(MutableBuffers const& buffers, boost::system::error_code& ec)
+        {
+            boost::asio::mutable_buffer const buffer = *boost::asio::buffer_sequence_begin(buffers);
+            ec.clear();
+            while (true)
+            {
+                size_t read = 0;
+                int const result = SSL_read_ex(ssl.get(), buffer.data(), buffer.size(), &read);
+                if (result == 1)
+                {
+                    return read;
+                }
+                if (!block(result, ec))
+                {
+                    return 0;
+                }
+            }
+        }
+
+        /*- write_some -*/
+        // Writes the first non-empty buffer, or part of it. Blocks until the socket takes something.
+        template <typename ConstBuffers>
+        size_t write_some(ConstBuffers const& buffers, boost::system::error_code& ec)
+        {
+            ec.clear();
+            for (auto it = boost::asio::buffer_sequence_begin(buffers); it != boost::asio::buffer_sequence_end(buffers); ++it)
+            {
+                boost::asio::const_buffer const buffer = *it;
+                if (buffer.size() == 0)
+                {
+                    continue;
+                }
+                while (true)
+                {
+                    size_t written = 0;
+                    int const result = SSL_write_ex(ssl.get(), buffer.data(), buffer.size(), &written);
+                    if (result == 1)
+                    {
+                        return written;
+                    }
+                    if (!block(result, ec))
+                    {
+                        return 0;
+                    }
+                }
+            }
+            return 0;
+        }
+
+        /*- sendfile -*/
+        /*
+            sendfile(2) through kTLS, with the conventions of sendfile: returns the bytes sent or -1 and sets errno.
+            EINVAL when the kernel does not encrypt the connection, the caller then sends the file another way.
+        */
+        ssize_t sendfile(int fd, off_t offset, size_t length)
+        {
+            if (!kernel_sends())
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            ossl_ssize_t const sent = SSL_sendfile(ssl.get(), fd, offset, length, 0);
+            if (sent < 0)
+            {
+                int const error = SSL_get_error(ssl.get(), static_cast<int>(sent));
+                errno = error == SSL_ERROR_WANT_WRITE ? EAGAIN : (errno == 0 ? EIO : errno);
+                return -1;
+            }
+            return static_cast<ssize_t>(sent);
+        }
+
+        /*- close_notify -*/
+        // Tells the peer the connection ends, without waiting for its answer.
+        void close_notify()
+        {
+            if (SSL_is_init_finished(ssl.get()))
+            {
+                SSL_shutdown(ssl.get());
+            }
+        }
+};
+
+/*--- HttpsTransport ---*/
+// The HttpTransport over TLS, see BasicHttpTransport.
+using HttpsTransport = BasicHttpTransport<TlsStream>;
+
+/*--- TlsOpener ---*/
+// Wraps the sockets accepted by an HttpsTransport into TLS streams of context.
+inline HttpsTransport::Open TlsOpener(std::shared_ptr<boost::asio::ssl::context> context)
+{
+    return [context = std::move(context)](boost::asio::ip::tcp::socket&& socket)
+    {
+        return TlsStream(std::move(socket), context);
+    };
+}
+
+} // namespace feather::core
+
+#endif // FEATHER_WITH_TLS
+
+#endif
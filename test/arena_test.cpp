@@ -0,0 +1,55 @@
+/*--- Code file for test arena ---*/
+
+#include "test_pch.hpp"
+
+#include <immer/vector.hpp>
+
+using namespace feather::core;
+
+SCENARIO("Request Arena", "[arena]") {
+    GIVEN("No arena in scope") {
+        THEN("The default memory resource is used") {
+            REQUIRE_FALSE(RequestArena::active());
+            REQUIRE(RequestArena::resource() == std::pmr::get_default_resource());
+        }
+    }
+
+    GIVEN("An arena in scope") {
+        RequestArena arena;
+
+        WHEN("Entering nested scopes") {
+            RequestArena inner;
+            {
+                RequestArena::Scope scope(arena);
+                REQUIRE(RequestArena::resource() == arena.get());
+                {
+                    RequestArena::Scope nested(inner);
+                    REQUIRE(RequestArena::resource() == inner.get());
+                }
+
+                THEN("The previous arena is restored") {
+                    REQUIRE(RequestArena::resource() == arena.get());
+                }
+            }
+            REQUIRE_FALSE(RequestArena::active());
+        }
+
+        WHEN("Allocating scratch containers") {
+            RequestArena::Scope scope(arena);
+            std::pmr::string text("a string long enough to skip the small string buffer", RequestArena::resource());
+            std::pmr::vector<int> numbers({1, 2, 3}, RequestArena::resource());
+
+            immer::vector<int, arena_memory_policy> values;
+            for (int i = 0; i < 100; ++i) {
+                values = values.push_back(i);
+            }
+
+            THEN("They behave as usual containers") {
+                REQUIRE(text.get_allocator().resource() == arena.get());
+                REQUIRE(numbers.size() == 3);
+                REQUIRE(values.size() == 100);
+                REQUIRE(values[99] == 99);
+            }
+        }
+    }
+}
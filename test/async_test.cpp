@@ -0,0 +1,178 @@
+/*--- Code file for test async ---*/
+
+#include "test_pch.hpp"
+#include <feather/async.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include <thread>
+
+using namespace feather::core;
+using namespace feather::core::plug;
+using namespace feather::router;
+using namespace Catch::Matchers;
+
+namespace
+{
+    Conn conn_for(std::string const& path)
+    {
+        http::Request req;
+        req.path = path;
+        req.method = "get";
+        req.target = path;
+        return Conn(std::move(req), std::make_shared<CookieSession>());
+    }
+
+    // Coroutine plug standing for a database lookup.
+    Task<Conn> load_user(Conn conn)
+    {
+        co_await AsyncSleep(std::chrono::milliseconds(1));
+        co_return Conn::assign(std::move(conn), "user", std::string("ada"));
+    }
+
+    // Coroutine handler standing for a slow upstream service.
+    Task<Conn> slow_reply(Conn conn)
+    {
+        co_await AsyncSleep(std::chrono::milliseconds(300));
+        co_return Conn::resp(std::move(conn), 200, std::string("slow"));
+    }
+
+    // Sends a request on its own connection and reads the response until the server closes it.
+    std::string Request(uint16_t port, std::string const& raw)
+    {
+        boost::asio::io_service io;
+        boost::asio::ip::tcp::socket socket(io);
+        socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+        boost::asio::write(socket, boost::asio::buffer(raw));
+
+        std::string response;
+        std::array<char, 4096> buffer;
+        boost::system::error_code ec;
+        while (!ec)
+        {
+            size_t const read = socket.read_some(boost::asio::buffer(buffer), ec);
+            response.append(buffer.data(), read);
+        }
+        return response;
+    }
+}
+
+SCENARIO("Tasks", "[async]") {
+    GIVEN("A coroutine awaiting a timer") {
+        auto const task = []() -> Task<int> {
+            co_await AsyncSleep(std::chrono::milliseconds(5));
+            co_return 42;
+        };
+
+        WHEN("It is run synchronously") {
+            auto const start = std::chrono::steady_clock::now();
+            int const value = RunSync(task());
+
+            THEN("Its result is returned once the timer fired") {
+                REQUIRE(value == 42);
+                REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(5));
+            }
+        }
+
+        WHEN("It throws") {
+            auto const failing = []() -> Task<int> {
+                co_await AsyncSleep(std::chrono::milliseconds(1));
+                throw std::runtime_error("upstream down");
+            };
+
+            THEN("The exception reaches the caller") {
+                REQUIRE_THROWS_WITH(RunSync(failing()), "upstream down");
+            }
+        }
+    }
+}
+
+SCENARIO("Asynchronous Routes", "[async]") {
+    GIVEN("A scope mixing asynchronous and synchronous plugs and handlers") {
+        Router::fetch_instance()
+            CHAIN(Router::pipeline, "async_user",
+                (CALLBACK_PLINE {
+                    PLUG(Conn::fetch_query_params);
+                    PLUG(load_user);
+                    END_PLINE;
+                }))
+            CHAIN(Router::scope, "/async",
+                (CALLBACK_SCOPE {
+                    PIPE_THROUGH("async_user");
+                    GET("/profile", [](Conn conn) -> Task<Conn> {
+                        co_await AsyncSleep(std::chrono::milliseconds(1));
+                        auto const user = std::any_cast<std::string>(conn.assigns.at("user"));
+                        co_return Conn::resp(std::move(conn), 200, "profile of " + user);
+                    });
+                    GET("/plain", [](Conn const& c) { return Conn::resp(c, 200, std::string("plain")); });
+                    END_SCOPE;
+                }))
+            CHAIN(Router::scope, "/sync",
+                (CALLBACK_SCOPE {
+                    GET("/plain", [](Conn const& c) { return Conn::resp(c, 200, std::string("plain")); });
+                    END_SCOPE;
+                }));
+
+        WHEN("Dispatching requests") {
+            auto const suspended = Router::dispatch(conn_for("/async/profile"));
+            auto const immediate = Router::dispatch(conn_for("/sync/plain"));
+
+            THEN("Only the routes with an asynchronous step give back a task") {
+                REQUIRE(std::holds_alternative<Task<Conn>>(suspended));
+                REQUIRE(std::holds_alternative<Conn>(immediate));
+                REQUIRE(*std::get<Conn>(immediate).resp_body == "plain");
+            }
+        }
+
+        WHEN("Running them through the synchronous handler") {
+            Conn const profile = conn_for("/async/profile") pipe Router::handler;
+            Conn const plain = conn_for("/async/plain") pipe Router::handler;
+
+            THEN("The asynchronous plugs and handler are awaited in order") {
+                REQUIRE(*profile.resp_body == "profile of ada");
+                REQUIRE(profile.query_params.has_value());
+                REQUIRE(*plain.resp_body == "plain");
+                REQUIRE(std::any_cast<std::string>(plain.assigns.at("user")) == "ada");
+            }
+        }
+    }
+}
+
+SCENARIO("Asynchronous HTTP Handlers", "[async]") {
+    GIVEN("A transport on a single io thread whose slow requests await a timer") {
+        boost::asio::io_service io;
+        HttpTransport transport(io, [](http::Request&& req, std::shared_ptr<Adapter> const& adapter) -> MaybeAsync<Conn>
+        {
+            Conn conn(std::move(req), nullptr);
+            conn.adapter = adapter;
+            if (*conn.request_path != "/slow")
+            {
+                return Conn::resp(std::move(conn), 200, std::string("fast"));
+            }
+            return slow_reply(std::move(conn));
+        });
+        transport.listen(boost::asio::ip::make_address("127.0.0.1"), 0);
+        std::thread worker([&io]() { io.run(); });
+
+        WHEN("A fast request arrives while a slow one is awaiting") {
+            std::string slow;
+            std::thread slow_client([&]() { slow = Request(transport.port(), "GET /slow HTTP/1.1\r\nConnection: close\r\n\r\n"); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+            auto const start = std::chrono::steady_clock::now();
+            std::string const fast = Request(transport.port(), "GET /fast HTTP/1.1\r\nConnection: close\r\n\r\n");
+            auto const elapsed = std::chrono::steady_clock::now() - start;
+            slow_client.join();
+
+            THEN("The io thread serves it meanwhile") {
+                REQUIRE_THAT(fast, ContainsSubstring("fast"));
+                REQUIRE(elapsed < std::chrono::milliseconds(200));
+                REQUIRE_THAT(slow, StartsWith("HTTP/1.1 200"));
+                REQUIRE_THAT(slow, ContainsSubstring("slow"));
+            }
+        }
+
+        transport.stop();
+        io.stop();
+        worker.join();
+    }
+}
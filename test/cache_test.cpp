@@ -0,0 +1,196 @@
+/*--- Code file for test cache ---*/
+
+#include "test_pch.hpp"
+#include <feather/cache.hpp>
+
+using namespace feather::core;
+using namespace feather::core::plug;
+
+namespace {
+    Conn get_conn(std::string const& target, std::vector<std::pair<std::string, std::string>> const& headers = {}) {
+        http::Request req;
+        req.path = target.substr(0, target.find('?'));
+        req.method = "get";
+        req.target = target;
+        for (auto const& [key, value] : headers) {
+            req.headers.emplace(key, value);
+        }
+        return Conn(std::move(req), std::make_shared<CookieSession>());
+    }
+
+    // Runs the cache plug, then the "handler" when it missed, then the before_send callbacks.
+    Conn serve(Conn conn, CacheOptions const& options, int& rendered, std::string const& body = "<h1>Hello</h1>") {
+        conn = cache_response(std::move(conn), options);
+        if (!conn.halted) {
+            ++rendered;
+            conn = Conn::put_resp_header(std::move(conn), "content-type", "text/html").second;
+            conn = Conn::resp(std::move(conn), 200, body);
+        }
+        return Conn::run_before_send(std::move(conn));
+    }
+
+    std::string resp_header(Conn const& conn, std::string const& key) {
+        auto const range = Conn::get_resp_header(conn, key);
+        return range.first == range.second ? "" : range.first->second;
+    }
+}
+
+SCENARIO("Response Cache", "[cache]") {
+    GIVEN("A pipeline with the cache plug") {
+        CacheOptions options;
+        options.cache = std::make_shared<ResponseCache>();
+        int rendered = 0;
+
+        WHEN("The same page is requested twice") {
+            Conn const first = serve(get_conn("/page"), options, rendered);
+            Conn const second = serve(get_conn("/page"), options, rendered);
+
+            THEN("The second request is answered from the cache") {
+                REQUIRE(rendered == 1);
+                REQUIRE(second.halted);
+                REQUIRE(second.status == 200);
+                REQUIRE(second.resp_body == first.resp_body);
+                REQUIRE(options.cache->count() == 1);
+            }
+
+            THEN("Both carry the same strong entity tag, with the other headers") {
+                std::string const etag = resp_header(first, "etag");
+                REQUIRE(etag.starts_with("\""));
+                REQUIRE(resp_header(second, "etag") == etag);
+                REQUIRE(resp_header(second, "content-type") == "text/html");
+            }
+
+            THEN("The stored headers can be overridden like any other") {
+                Conn const overridden = Conn::put_resp_header(second, "content-type", "text/plain").second;
+                auto const range = Conn::get_resp_header(overridden, "content-type");
+                REQUIRE(std::distance(range.first, range.second) == 1);
+                REQUIRE(range.first->second == "text/plain");
+                REQUIRE(overridden.resp_header_blocks.empty());
+            }
+        }
+
+        WHEN("The client already holds the page") {
+            Conn const first = serve(get_conn("/page"), options, rendered);
+            std::string const etag = resp_header(first, "etag");
+            Conn const hit = serve(get_conn("/page", {{"If-None-Match", etag}}), options, rendered);
+            Conn const other = serve(get_conn("/other", {{"If-None-Match", cache_detail::StrongETag("<h1>Hello</h1>")}}), options, rendered);
+
+            THEN("It is answered 304 with no body") {
+                REQUIRE(hit.status == 304);
+                REQUIRE(hit.resp_body->empty());
+                REQUIRE(other.status == 304);
+                REQUIRE(rendered == 2);
+            }
+        }
+
+        WHEN("Requests differ by target, selected header or assign") {
+            options.vary = {"accept-language"};
+            options.assigns = {"locale"};
+
+            serve(get_conn("/page?a=1"), options, rendered);
+            serve(get_conn("/page?a=2"), options, rendered);
+            serve(get_conn("/page?a=1", {{"Accept-Language", "fr"}}), options, rendered);
+            serve(Conn::assign(get_conn("/page?a=1"), "locale", std::string("fr")), options, rendered);
+            serve(get_conn("/page?a=1", {{"User-Agent", "test"}}), options, rendered);
+
+            THEN("Only the headers and assigns of the key split the cache") {
+                REQUIRE(rendered == 4);
+                REQUIRE(options.cache->count() == 4);
+            }
+        }
+
+        WHEN("The same target is requested on two virtual hosts") {
+            Conn const a = serve(get_conn("/page", {{"Host", "a.example"}}), options, rendered, "<h1>A</h1>");
+            Conn const b = serve(get_conn("/page", {{"Host", "b.example"}}), options, rendered, "<h1>B</h1>");
+            Conn const again = serve(get_conn("/page", {{"Host", "A.Example"}}), options, rendered);
+
+            THEN("Each host gets its own page, whatever the case of its name") {
+                REQUIRE(rendered == 2);
+                REQUIRE(*b.resp_body == "<h1>B</h1>");
+                REQUIRE(again.resp_body == a.resp_body);
+            }
+        }
+
+        WHEN("A response must not be shared") {
+            auto const handler = [&](std::string const& target, auto&& decorate) {
+                Conn conn = cache_response(get_conn(target), options);
+                conn = decorate(Conn::resp(std::move(conn), 200, std::string("private")));
+                return Conn::run_before_send(std::move(conn));
+            };
+            handler("/private", [](Conn c) { return Conn::put_resp_header(std::move(c), "cache-control", "private, max-age=60").second; });
+            handler("/vary", [](Conn c) { return Conn::put_resp_header(std::move(c), "vary", "cookie").second; });
+            handler("/cookie", [](Conn c) { return Conn::put_resp_cookie(std::move(c), "id", "1").second; });
+            Conn const expired = handler("/expired", [](Conn c) { return Conn::put_resp_header(std::move(c), "cache-control", "max-age=0").second; });
+
+            THEN("It is not stored but still gets an entity tag") {
+                REQUIRE(options.cache->count() == 0);
+                REQUIRE(Conn::get_resp_header(expired, "etag").first != expired.resp_headers.end());
+            }
+        }
+
+        WHEN("A stored response outlives its ttl") {
+            options.ttl = std::chrono::seconds(0);
+            serve(get_conn("/page"), options, rendered);
+            serve(get_conn("/page"), options, rendered);
+
+            THEN("It is rendered again") {
+                REQUIRE(rendered == 2);
+            }
+        }
+
+        WHEN("The cache is full") {
+            options.cache = std::make_shared<ResponseCache>(4096);
+            std::string const body(1500, 'x');
+            serve(get_conn("/a"), options, rendered, body);
+            serve(get_conn("/b"), options, rendered, body);
+            serve(get_conn("/a"), options, rendered, body);
+            serve(get_conn("/c"), options, rendered, body);
+
+            THEN("The least recently used response is evicted") {
+                REQUIRE(options.cache->count() == 2);
+                REQUIRE(options.cache->size() <= 4096);
+                REQUIRE(options.cache->find("get /a") != nullptr);
+                REQUIRE(options.cache->find("get /b") == nullptr);
+            }
+        }
+
+        WHEN("The cache compresses its responses") {
+            options.compress = CompressOptions{};
+            options.compress->cache = nullptr;
+            std::string body;
+            for (int i = 0; i < 200; ++i) {
+                body += "<li>item " + std::to_string(i % 10) + "</li>";
+            }
+            serve(get_conn("/list"), options, rendered, body);
+            Conn const plain = serve(get_conn("/list"), options, rendered, body);
+            Conn const gzipped = serve(get_conn("/list", {{"Accept-Encoding", "gzip"}}), options, rendered, body);
+
+            THEN("The variant accepted by the client is sent") {
+                REQUIRE(rendered == 1);
+                REQUIRE(*plain.resp_body == body);
+                REQUIRE(resp_header(plain, "vary") == "accept-encoding");
+                REQUIRE(resp_header(gzipped, "content-encoding") == "gzip");
+                REQUIRE(resp_header(gzipped, "etag").starts_with("W/"));
+                REQUIRE(gzipped.resp_body->size() < body.size());
+            }
+        }
+
+        WHEN("The compression plug runs ahead of the cache") {
+            std::string body;
+            for (int i = 0; i < 200; ++i) {
+                body += "<li>item " + std::to_string(i % 10) + "</li>";
+            }
+            CompressOptions compress_options;
+            compress_options.cache = nullptr;
+            serve(compress(get_conn("/listing"), compress_options), options, rendered, body);
+            Conn const hit = serve(compress(get_conn("/listing", {{"Accept-Encoding", "gzip"}}), compress_options), options, rendered, body);
+
+            THEN("It sees the content type of the stored response and compresses it") {
+                REQUIRE(rendered == 1);
+                REQUIRE(hit.halted);
+                REQUIRE(resp_header(hit, "content-encoding") == "gzip");
+                REQUIRE(hit.resp_body->size() < body.size());
+            }
+        }
+    }
+}
@@ -0,0 +1,208 @@
+/*--- Code file for test channel ---*/
+
+#include "test_pch.hpp"
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include <feather/channel.hpp>
+
+using namespace feather::core;
+using namespace Catch::Matchers;
+using json = nlohmann::json;
+
+namespace
+{
+    // Socket keeping the frames it was given.
+    class RecordingSocket : public ChannelSocket
+    {
+        public:
+            std::vector<FramePtr> frames;
+
+            explicit RecordingSocket(std::string i) : ChannelSocket(std::move(i)) {}
+
+            bool deliver(FramePtr const& frame) override
+            {
+                frames.push_back(frame);
+                return true;
+            }
+
+            json last() const
+            {
+                return json::parse(frames.back()->text());
+            }
+    };
+
+    std::string Join(std::string const& topic, std::string const& ref)
+    {
+        return json::array({ref, ref, topic, "phx_join", json::object()}).dump();
+    }
+}
+
+SCENARIO("Channel Messages", "[channel]") {
+    GIVEN("A message of the v2 serializer") {
+        auto const decoded = DecodeChannelMessage(R"(["1","2","room:lobby","new_msg",{"body":"hi"}])");
+
+        THEN("Its fields are decoded") {
+            REQUIRE(decoded.first == ResultType::Ok);
+            REQUIRE(decoded.second.join_ref == std::optional<std::string>("1"));
+            REQUIRE(decoded.second.ref == std::optional<std::string>("2"));
+            REQUIRE_THAT(decoded.second.topic, Equals("room:lobby"));
+            REQUIRE_THAT(decoded.second.event, Equals("new_msg"));
+            REQUIRE(decoded.second.payload["body"] == "hi");
+        }
+
+        AND_THEN("Encoding it gives the same array back") {
+            REQUIRE(json::parse(EncodeChannelMessage(decoded.second))
+                == json::parse(R"(["1","2","room:lobby","new_msg",{"body":"hi"}])"));
+        }
+    }
+
+    GIVEN("Texts that are not channel messages") {
+        THEN("They are refused") {
+            REQUIRE(DecodeChannelMessage("not json").first == ResultType::Err);
+            REQUIRE(DecodeChannelMessage(R"([1, 2, 3])").first == ResultType::Err);
+        }
+    }
+
+    GIVEN("Frames of every length encoding") {
+        THEN("Their headers announce the payload length") {
+            REQUIRE(MakeFrame("abc")->message->get_header() == std::string("\x81\x03", 2));
+            REQUIRE(MakeFrame(std::string(300, 'a'))->message->get_header() == std::string("\x81\x7e\x01\x2c", 4));
+            REQUIRE(MakeFrame(std::string(70000, 'a'))->message->get_header()
+                == std::string("\x81\x7f\x00\x00\x00\x00\x00\x01\x11\x70", 10));
+            REQUIRE(MakeFrame("abc")->message->get_prepared());
+        }
+    }
+}
+
+SCENARIO("Channel Topics", "[channel]") {
+    GIVEN("Channels accepting room topics") {
+        Channels channels;
+        std::vector<std::string> left;
+        channels.channel("room:*", {
+            .join = [](ChannelSocket&, std::string const& topic, json const&) -> Result<json>
+            {
+                if (topic == "room:private")
+                {
+                    return { ResultType::Err, json{{"reason", "unauthorized"}} };
+                }
+                return { ResultType::Ok, json::object() };
+            },
+            .handle_in = [&channels](ChannelSocket& socket, std::string const& topic, std::string const& event, json const& payload)
+                -> std::optional<json>
+            {
+                if (event == "ping")
+                {
+                    return json{{"pong", true}};
+                }
+                channels.broadcast_from(socket, topic, event, payload);
+                return std::nullopt;
+            },
+            .leave = [&left](ChannelSocket& socket, std::string const&) { left.push_back(socket.id); }
+        });
+
+        auto const alice = std::make_shared<RecordingSocket>("alice");
+        auto const bob = std::make_shared<RecordingSocket>("bob");
+
+        WHEN("Sockets join a topic") {
+            channels.handle(alice, Join("room:lobby", "1"));
+            channels.handle(bob, Join("room:lobby", "1"));
+
+            THEN("They are subscribed and get an ok reply") {
+                REQUIRE(channels.subscribers("room:lobby") == 2);
+                REQUIRE(alice->joined_topic("room:lobby"));
+                REQUIRE(alice->last()[3] == "phx_reply");
+                REQUIRE(alice->last()[4]["status"] == "ok");
+            }
+
+            AND_WHEN("Broadcasting on the topic") {
+                size_t const delivered = channels.broadcast("room:lobby", "update", json{{"value", 42}});
+
+                THEN("Every subscriber shares the same encoded frame") {
+                    REQUIRE(delivered == 2);
+                    REQUIRE(alice->frames.back() == bob->frames.back());
+                    REQUIRE(alice->last() == json::array({nullptr, nullptr, "room:lobby", "update", {{"value", 42}}}));
+                }
+            }
+
+            AND_WHEN("A socket sends an event") {
+                channels.handle(alice, R"(["1","2","room:lobby","new_msg",{"body":"hi"}])");
+                channels.handle(alice, R"(["1","3","room:lobby","ping",{}])");
+
+                THEN("The other subscribers get it and replies go to the sender only") {
+                    REQUIRE(bob->last()[3] == "new_msg");
+                    REQUIRE(alice->last()[1] == "3");
+                    REQUIRE(alice->last()[4]["response"]["pong"] == true);
+                    REQUIRE(bob->frames.size() == 2);
+                }
+            }
+
+            AND_WHEN("A socket disconnects") {
+                channels.disconnect(alice);
+
+                THEN("It leaves every topic") {
+                    REQUIRE(channels.subscribers("room:lobby") == 1);
+                    REQUIRE(left == std::vector<std::string>{"alice"});
+                    REQUIRE(channels.broadcast("room:lobby", "update", json::object()) == 1);
+                }
+            }
+        }
+
+        WHEN("Joining a refused or unknown topic") {
+            channels.handle(alice, Join("room:private", "1"));
+            auto const refused = alice->last();
+            channels.handle(alice, Join("other", "2"));
+
+            THEN("An error is replied and nothing is subscribed") {
+                REQUIRE(refused[4]["status"] == "error");
+                REQUIRE(refused[4]["response"]["reason"] == "unauthorized");
+                REQUIRE(alice->last()[4]["status"] == "error");
+                REQUIRE(channels.subscribers("room:private") == 0);
+            }
+        }
+
+        WHEN("Sending an event on a topic that was not joined") {
+            channels.handle(alice, R"(["1","2","room:lobby","new_msg",{}])");
+
+            THEN("An error is replied") {
+                REQUIRE(alice->last()[4]["status"] == "error");
+            }
+        }
+
+        WHEN("Sending a heartbeat") {
+            channels.handle(alice, R"([null,"7","phoenix","heartbeat",{}])");
+
+            THEN("It is answered") {
+                REQUIRE(alice->last()[1] == "7");
+                REQUIRE(alice->last()[4]["status"] == "ok");
+            }
+        }
+    }
+}
+
+SCENARIO("Channel PubSub", "[channel]") {
+    GIVEN("Two nodes connected through a PubSub") {
+        auto const hub = std::make_shared<MemoryPubSub>();
+        Channels first;
+        Channels second;
+        first.channel("room:*", {});
+        second.channel("room:*", {});
+        first.set_pubsub(MemoryPubSub::node(hub));
+        second.set_pubsub(MemoryPubSub::node(hub));
+
+        auto const local = std::make_shared<RecordingSocket>("local");
+        auto const remote = std::make_shared<RecordingSocket>("remote");
+        first.handle(local, Join("room:lobby", "1"));
+        second.handle(remote, Join("room:lobby", "1"));
+
+        WHEN("Broadcasting on one node") {
+            first.broadcast("room:lobby", "update", json{{"value", 1}});
+
+            THEN("The subscribers of both nodes get it once") {
+                REQUIRE(local->frames.size() == 2);
+                REQUIRE(remote->frames.size() == 2);
+                REQUIRE(remote->last()[3] == "update");
+                REQUIRE(local->frames.back()->text() == remote->frames.back()->text());
+            }
+        }
+    }
+}
@@ -0,0 +1,153 @@
+/*--- Code file for test compress ---*/
+
+#include "test_pch.hpp"
+#include <feather/compress.hpp>
+
+#include <zlib.h>
+
+using namespace feather::core;
+using namespace feather::core::plug;
+using namespace test;
+
+namespace {
+    std::string gunzip(std::string const& data) {
+        z_stream stream{};
+        inflateInit2(&stream, 15 + 16);
+        std::string out(data.size() * 64 + 1024, '\0');
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        stream.avail_in = static_cast<uInt>(data.size());
+        stream.next_out = reinterpret_cast<Bytef*>(out.data());
+        stream.avail_out = static_cast<uInt>(out.size());
+        inflate(&stream, Z_SYNC_FLUSH);
+        out.resize(out.size() - stream.avail_out);
+        inflateEnd(&stream);
+        return out;
+    }
+
+    Conn gzip_conn(std::string const& content_type) {
+        http::Request req;
+        req.path = "/page";
+        req.method = "get";
+        req.target = "/page";
+        req.headers.emplace("Accept-Encoding", "gzip;q=0.8, deflate");
+        Conn conn(std::move(req), std::make_shared<CookieSession>());
+        return Conn::put_resp_header(std::move(conn), "content-type", content_type).second;
+    }
+
+    std::string page() {
+        std::string body;
+        for (int i = 0; i < 500; ++i) {
+            body += "<li>item " + std::to_string(i % 10) + "</li>";
+        }
+        return body;
+    }
+}
+
+SCENARIO("Encoding Negotiation", "[compress]") {
+    GIVEN("Accept-Encoding headers") {
+        CompressOptions gzip_first;
+        gzip_first.preference = {Encoding::GZIP, Encoding::BROTLI, Encoding::ZSTD};
+
+        THEN("The highest quality accepted wins") {
+            REQUIRE(NegotiateEncoding("deflate, gzip;q=0.5") == Encoding::GZIP);
+            REQUIRE(NegotiateEncoding("GZIP") == Encoding::GZIP);
+            REQUIRE(NegotiateEncoding("x-gzip") == Encoding::GZIP);
+        }
+
+        THEN("Refused and unknown encodings fall back to identity") {
+            REQUIRE(NegotiateEncoding("gzip;q=0") == Encoding::IDENTITY);
+            REQUIRE(NegotiateEncoding("deflate") == Encoding::IDENTITY);
+            REQUIRE(NegotiateEncoding("") == Encoding::IDENTITY);
+        }
+
+        THEN("Ties are broken by the server preference") {
+            REQUIRE(NegotiateEncoding("*", gzip_first) == Encoding::GZIP);
+            REQUIRE(NegotiateEncoding("br, gzip", gzip_first) == Encoding::GZIP);
+        }
+
+        THEN("Content types are sorted by how well they compress") {
+            REQUIRE(Compressible("text/html; charset=utf-8"));
+            REQUIRE(Compressible("application/json"));
+            REQUIRE(Compressible("image/svg+xml"));
+            REQUIRE_FALSE(Compressible("image/png"));
+        }
+    }
+}
+
+SCENARIO("Response Compression", "[compress]") {
+    GIVEN("A pipeline with the compression plug") {
+        CompressOptions options;
+        options.cache = std::make_shared<CompressionCache>();
+        std::string const body = page();
+
+        WHEN("Sending a large compressible body") {
+            Conn conn = compress(gzip_conn("text/html"), options);
+            conn = Conn::run_before_send(Conn::resp(std::move(conn), 200, body));
+
+            THEN("It is gzipped with the matching headers") {
+                REQUIRE(Conn::get_resp_header(conn, "content-encoding").first->second == "gzip");
+                REQUIRE(Conn::get_resp_header(conn, "vary").first->second == "accept-encoding");
+                REQUIRE(conn.resp_body->size() < body.size());
+                REQUIRE(gunzip(*conn.resp_body) == body);
+            }
+
+            THEN("Uncacheable responses stay out of the cache") {
+                REQUIRE(options.cache->size() == 0);
+            }
+        }
+
+        WHEN("Sending the same cacheable body twice") {
+            auto send = [&] {
+                Conn conn = Conn::put_resp_header(gzip_conn("text/html"), "etag", "\"v1\"").second;
+                conn = compress(std::move(conn), options);
+                return Conn::run_before_send(Conn::resp(std::move(conn), 200, body));
+            };
+            Conn const first = send();
+            Conn const second = send();
+
+            THEN("The compressed variant is reused and the entity tag made weak") {
+                REQUIRE(first.resp_body == second.resp_body);
+                REQUIRE(options.cache->size() > 0);
+                REQUIRE(Conn::get_resp_header(second, "etag").first->second == "W/\"v1\"");
+            }
+        }
+
+        WHEN("Sending a small or binary body") {
+            Conn small = compress(gzip_conn("text/html"), options);
+            small = Conn::run_before_send(Conn::resp(std::move(small), 200, "tiny"));
+            Conn binary = compress(gzip_conn("image/png"), options);
+            binary = Conn::run_before_send(Conn::resp(std::move(binary), 200, body));
+
+            THEN("It is sent as is") {
+                REQUIRE(*small.resp_body == "tiny");
+                REQUIRE(*binary.resp_body == body);
+                REQUIRE(Conn::get_resp_header(binary, "content-encoding").first == binary.resp_headers.end());
+            }
+        }
+
+        WHEN("Streaming a chunked response") {
+            auto adapter = std::make_shared<RecordingAdapter>();
+            Conn conn = gzip_conn("text/plain");
+            conn.adapter = adapter;
+            conn = compress(std::move(conn), options);
+
+            auto const sent = Conn::send_chunked(std::move(conn), 200);
+            auto const first = Conn::chunk(sent.second, "hello ");
+            auto const second = Conn::chunk(first.second, "world");
+            second.second.adapter->finish();
+
+            THEN("Each chunk is compressed and flushed on its own") {
+                REQUIRE(Conn::get_resp_header(sent.second, "content-encoding").first->second == "gzip");
+                REQUIRE(adapter->finished);
+                REQUIRE(adapter->chunks.size() >= 3);
+                REQUIRE(gunzip(adapter->chunks[0]) == "hello ");
+
+                std::string stream;
+                for (auto const& chunk : adapter->chunks) {
+                    stream += chunk;
+                }
+                REQUIRE(gunzip(stream) == "hello world");
+            }
+        }
+    }
+}
@@ -330,6 +330,96 @@ TEST_CASE("Controller response functions", "[controller]") {
         }
     }
 
+    SECTION("render function - compiled template cache") {
+        auto conn = test::buildFirstConn();
+        json data = {{"name", "cache"}};
+        std::string template_content = "<p>{{ name }}</p>";
+        std::string template_path = create_test_template(template_content);
+
+        auto tm =
+            TemplateManager::fetch_instance()
+            CHAIN(TemplateManager::add_template, "cached_template", template_path);
+
+        auto handle = TemplateManager::compile(tm, "cached_template");
+        REQUIRE(handle == TemplateManager::compile(tm, "cached_template"));
+
+        auto raw_handle = TemplateManager::compile_raw(tm, template_content);
+        REQUIRE(raw_handle == TemplateManager::compile_raw(tm, std::string(template_content)));
+        REQUIRE(raw_handle != TemplateManager::compile_raw(tm, "<b>{{ name }}</b>"));
+
+        std::string out = "prefix:";
+        TemplateManager::render_to(tm, handle, data, out);
+        REQUIRE(out == "prefix:<p>cache</p>");
+
+        auto result = render(conn, handle, data);
+        REQUIRE(result.status.value() == 200);
+        REQUIRE(*result.resp_body == "<p>cache</p>");
+
+        std::filesystem::remove(template_path);
+
+        // The template stays compiled once its file is gone
+        REQUIRE(*render(conn, "cached_template", data).resp_body == "<p>cache</p>");
+    }
+
+#ifdef FEATHER_TEMPLATE_RELOAD
+    SECTION("render function - reloading changed templates") {
+        auto conn = test::buildFirstConn();
+        json data = {{"name", "reload"}};
+        std::filesystem::path temp_dir = std::filesystem::temp_directory_path();
+        std::filesystem::path layout_path = temp_dir / "reload_layout.html";
+        std::filesystem::path page_path = temp_dir / "reload_page.html";
+
+        auto write = [](std::filesystem::path const& path, std::string const& content) {
+            std::ofstream file(path, std::ios::out | std::ios::trunc);
+            file << content;
+        };
+        write(layout_path, "<main>{% block body %}{% endblock %}</main>");
+        write(page_path, R"({% extends "reload_layout" %}{% block body %}{{ name }}{% endblock %})");
+
+        auto tm =
+            TemplateManager::fetch_instance()
+            CHAIN(TemplateManager::add_template, "reload_layout", layout_path.string())
+            CHAIN(TemplateManager::add_template, "reload_page", page_path.string());
+        auto const first = TemplateManager::compile(tm, "reload_page");
+        REQUIRE(*render(conn, "reload_page", data).resp_body == "<main>reload</main>");
+
+        // Changing the layout recompiles the page extending it
+        write(layout_path, "<section>{% block body %}{% endblock %}</section>");
+        REQUIRE(*render(conn, "reload_page", data).resp_body == "<section>reload</section>");
+        REQUIRE(TemplateManager::compile(tm, "reload_page") != first);
+
+        // A template that no longer parses fails alone, the others keep reloading
+        std::filesystem::path broken_path = temp_dir / "reload_broken.html";
+        write(broken_path, "<p>{{ name }}</p>");
+        TemplateManager::add_template(tm, "reload_broken", broken_path.string());
+        write(broken_path, "<p>{{ name </p>");
+        write(layout_path, "<article>{% block body %}{% endblock %}</article>");
+        REQUIRE(*render(conn, "reload_page", data).resp_body == "<article>reload</article>");
+        REQUIRE_THROWS(TemplateManager::compile(tm, "reload_broken"));
+        REQUIRE(*render(conn, "reload_page", data).resp_body == "<article>reload</article>");
+
+        // Fixing it reloads it on the next request
+        write(broken_path, "<p>fixed {{ name }}</p>");
+        REQUIRE(*render(conn, "reload_broken", data).resp_body == "<p>fixed reload</p>");
+
+        std::filesystem::remove(layout_path);
+        std::filesystem::remove(page_path);
+        std::filesystem::remove(broken_path);
+    }
+#endif
+
+    SECTION("accepts function") {
+        http::Request req;
+        req.headers.emplace("Accept", "text/html, application/*;q=0.5, image/png;q=0");
+        Conn conn(std::move(req), std::make_shared<CookieSession>());
+
+        REQUIRE(accepts(conn, {"text/html"}));
+        REQUIRE(accepts(conn, {"image/png", "application/json"}));
+        REQUIRE_FALSE(accepts(conn, {"image/png"}));
+        REQUIRE_FALSE(accepts(conn, {"text/plain"}));
+        REQUIRE_FALSE(accepts(test::buildFirstConn(), {"text/html"}));
+    }
+
     SECTION("redirect function") {
         auto conn = test::buildFirstConn();
         std::string url = "https://example.com";
@@ -401,4 +491,30 @@ TEST_CASE("Controller error handling", "[controller]") {
         REQUIRE(content_type_range.first->second == "text/plain");
         REQUIRE(result.resp_body->find("Template rendering error") != std::string::npos);
     }
-}
\ No newline at end of file
+}
+TEST_CASE("Secure browser headers", "[controller]") {
+    auto count = [](std::string_view head, std::string_view line) {
+        size_t found = 0;
+        for (size_t at = head.find(line); at != std::string_view::npos; at = head.find(line, at + 1)) {
+            ++found;
+        }
+        return found;
+    };
+
+    SECTION("Overriding one of them") {
+        auto conn = unwrap<Conn>(Conn::put_resp_header(put_secure_browser_headers(test::buildFirstConn()), "x-frame-options", "DENY"));
+        auto const head = SerializeResponseHead(conn, "", false);
+
+        REQUIRE(count(head, "X-Frame-Options: ") == 0);
+        REQUIRE(count(head, "x-frame-options: DENY\r\n") == 1);
+        REQUIRE(count(head, "X-Content-Type-Options: nosniff\r\n") == 1);
+    }
+
+    SECTION("Putting them twice") {
+        auto conn = put_secure_browser_headers(put_secure_browser_headers(test::buildFirstConn()));
+        auto const head = SerializeResponseHead(conn, "", false);
+
+        REQUIRE(conn.resp_header_blocks.size() == 1);
+        REQUIRE(count(head, "\r\nContent-Security-Policy: ") == 1);
+    }
+}
@@ -1,6 +1,8 @@
 #include "test_pch.hpp"
 #include <catch2/matchers/catch_matchers_string.hpp>
 #include <catch2/matchers/catch_matchers_vector.hpp>
+#include <filesystem>
+#include <fstream>
 
 using namespace feather::core::plug;
 using namespace feather;
@@ -42,6 +44,51 @@ SCENARIO("Host Port Resolution", "[core]") {
             }
         }
     }
+
+    GIVEN("Malformed hosts") {
+        THEN("No port is resolved") {
+            REQUIRE_FALSE(GetPortFromHost("").has_value());
+            REQUIRE_FALSE(GetPortFromHost("example.com:").has_value());
+            REQUIRE_FALSE(GetPortFromHost("example.com:80x").has_value());
+            REQUIRE_FALSE(GetPortFromHost("bad host").has_value());
+            REQUIRE(GetPortFromHost("localhost").value_or(-1) == 80);
+        }
+    }
+}
+
+SCENARIO("Query String Decoding", "[core]") {
+    GIVEN("An encoded query string") {
+        auto const params = DecodeQuery("name=J%C3%A9r%C3%B4me&city=New+York&flag&&a%26b=c%3Dd");
+
+        THEN("Keys and values are percent-decoded") {
+            REQUIRE(params.has_value());
+            REQUIRE_THAT(**params->find("name"), Equals("J\xC3\xA9r\xC3\xB4me"));
+            REQUIRE_THAT(**params->find("city"), Equals("New York"));
+            REQUIRE_THAT(**params->find("a&b"), Equals("c=d"));
+            REQUIRE_THAT(**params->find("flag"), Equals(""));
+            REQUIRE(params->size() == 4);
+        }
+    }
+
+    GIVEN("Malformed query strings") {
+        THEN("They are refused") {
+            REQUIRE_FALSE(DecodeQuery("a=%zz").has_value());
+            REQUIRE_FALSE(DecodeQuery("a=%FF").has_value());
+            REQUIRE(DecodeQuery("a=%FF", false).has_value());
+        }
+    }
+
+    GIVEN("A connection with a malformed query string") {
+        http::Request req;
+        req.path = "/search";
+        req.target = "/search?q=%E2%82";
+        Conn const conn = Conn::fetch_query_params(Conn(std::move(req), std::make_shared<CookieSession>()));
+
+        THEN("The status is set to 400") {
+            REQUIRE(conn.status == std::optional<int>(400));
+            REQUIRE_FALSE(conn.query_params.has_value());
+        }
+    }
 }
 
 SCENARIO("URL Query Extraction", "[core]") {
@@ -64,6 +111,26 @@ SCENARIO("URL Query Extraction", "[core]") {
     }
 }
 
+SCENARIO("URL Path Extraction", "[core]") {
+    GIVEN("Targets with different formats") {
+        const std::vector<std::pair<std::string, std::string>> test_cases = {
+            {"/users/123?test=tested", "/users/123"},
+            {"/users/123#top", "/users/123"},
+            {"/", "/"},
+            {"", ""}
+        };
+
+        WHEN("GetPathFromTarget is called") {
+            THEN("Paths should be correctly extracted") {
+                for (const auto& [target, expected_path] : test_cases) {
+                    INFO("Testing target: " << target);
+                    REQUIRE(GetPathFromTarget(target) == expected_path);
+                }
+            }
+        }
+    }
+}
+
 SCENARIO("Connection State Management", "[core]") {
     GIVEN("A fresh connection") {
         Conn const initial_conn = buildFirstConn();
@@ -109,6 +176,27 @@ SCENARIO("Connection State Management", "[core]") {
     }
 }
 
+SCENARIO("Move Based Transformations", "[core]") {
+    GIVEN("A connection threaded by move") {
+        Conn conn = buildFirstConn();
+
+        WHEN("Chaining rvalue transformations") {
+            conn = Conn::assign(std::move(conn), "first", 1);
+            conn = Conn::fetch_cookies(std::move(conn));
+            conn = Conn::put_session(std::move(conn), "user", 42);
+            conn = Conn::resp(std::move(conn), 201, "created");
+
+            THEN("Every transformation is applied to the same connection") {
+                REQUIRE(std::any_cast<int>(conn.assigns.at("first")) == 1);
+                REQUIRE(conn.cookies.has_value());
+                REQUIRE(std::any_cast<int>(Conn::get_session(conn, "user")) == 42);
+                REQUIRE(conn.status.value() == 201);
+                REQUIRE_THAT(*conn.resp_body, Equals("created"));
+            }
+        }
+    }
+}
+
 SCENARIO("Cookie and Query Parameter Handling", "[core]") {
     GIVEN("A connection with cookies and query parameters") {
         Conn const conn = buildFirstConn()
@@ -192,6 +280,18 @@ SCENARIO("Session Management", "[core]") {
                 }
             }
         }
+
+        WHEN("Copying a connection") {
+            Conn copy = initial_conn;
+            Conn const written = Conn::put_session(copy, "test", 42);
+
+            THEN("The session snapshot is shared until it is written") {
+                REQUIRE(Conn::share_session(copy) == Conn::share_session(initial_conn));
+                REQUIRE(Conn::share_session(written) != Conn::share_session(initial_conn));
+                REQUIRE(Conn::get_session_opt(initial_conn) == SessionOpt::IGNORE);
+                REQUIRE(Conn::get_session_opt(written) == SessionOpt::WRITE);
+            }
+        }
     }
 }
 
@@ -281,6 +381,16 @@ SCENARIO("Cookie Parsing", "[core]") {
             }
         }
     }
+
+    GIVEN("Cookie strings with empty or padded pairs") {
+        auto const parsed_cookie = ParseCookie(" ; theme = dark ;; =orphan; lang=en;");
+
+        THEN("Only the named pairs are kept, trimmed") {
+            REQUIRE(parsed_cookie.size() == 2);
+            REQUIRE_THAT(*parsed_cookie["theme"], Equals("dark"));
+            REQUIRE_THAT(*parsed_cookie["lang"], Equals("en"));
+        }
+    }
 }
 
 SCENARIO("Connection State Transitions", "[core]") {
@@ -395,6 +505,332 @@ SCENARIO("Before Send Callbacks", "[core]") {
     }
 }
 
+SCENARIO("Chunked Responses", "[core]") {
+    GIVEN("A connection with an adapter") {
+        auto adapter = std::make_shared<RecordingAdapter>();
+        Conn conn = buildFirstConn();
+        conn.adapter = adapter;
+
+        WHEN("Sending a chunked response") {
+            bool callback_called = false;
+            conn = Conn::register_before_send(std::move(conn), [&callback_called](Conn const& c) {
+                callback_called = true;
+                return c;
+            });
+            auto result = Conn::send_chunked(std::move(conn), 200);
+
+            THEN("Headers are flushed and the state is chunked") {
+                REQUIRE(result.first == core::ResultType::Ok);
+                REQUIRE(callback_called);
+                REQUIRE(adapter->status.value() == 200);
+                REQUIRE(std::get<Unsent>(result.second.state) == Unsent::CHUNKED);
+                REQUIRE(result.second.callbacks_before_send.size() == 0);
+            }
+
+            AND_WHEN("Sending chunks") {
+                auto first = Conn::chunk(result.second, "hello ");
+                auto empty = Conn::chunk(first.second, "");
+                auto second = Conn::chunk(empty.second, "world");
+
+                THEN("Every non empty chunk is written through the adapter") {
+                    REQUIRE(second.first == core::ResultType::Ok);
+                    REQUIRE(adapter->chunks == std::vector<std::string>{"hello ", "world"});
+                }
+            }
+
+            AND_WHEN("The client went away") {
+                adapter->closed = true;
+                REQUIRE(Conn::chunk(result.second, "lost").first == core::ResultType::Err);
+            }
+
+            AND_WHEN("Sending the headers twice") {
+                REQUIRE_THROWS_AS(Conn::send_chunked(result.second, 200), std::logic_error);
+            }
+        }
+
+        WHEN("Chunking before send_chunked") {
+            THEN("An error is returned") {
+                REQUIRE(Conn::chunk(conn, "early").first == core::ResultType::Err);
+                REQUIRE(adapter->chunks.empty());
+            }
+        }
+    }
+
+    GIVEN("A connection without adapter") {
+        Conn const conn = buildFirstConn();
+
+        THEN("send_chunked returns an error") {
+            REQUIRE(Conn::send_chunked(conn, 200).first == core::ResultType::Err);
+        }
+    }
+}
+
+SCENARIO("File Responses", "[core]") {
+    GIVEN("A file on disk and a connection with an adapter") {
+        auto const path = std::filesystem::temp_directory_path() / "feather_send_file_test.txt";
+        std::ofstream(path) << "0123456789";
+
+        auto adapter = std::make_shared<RecordingAdapter>();
+        Conn conn = buildFirstConn();
+        conn.adapter = adapter;
+
+        WHEN("Sending the whole file") {
+            auto result = Conn::send_file(conn, 200, path.string());
+
+            THEN("The file is written with its validators") {
+                REQUIRE(result.first == core::ResultType::Ok);
+                REQUIRE(std::holds_alternative<Sent>(result.second.state));
+                REQUIRE_THAT(adapter->file, Equals("0123456789"));
+                REQUIRE(result.second.resp_headers.find("etag") != result.second.resp_headers.end());
+                REQUIRE(result.second.resp_headers.count("last-modified") == 1);
+            }
+
+            AND_WHEN("Revalidating with the ETag") {
+                auto const etag = result.second.resp_headers.at("etag");
+                auto revalidated = Conn::send_file(
+                    Conn::put_req_header(conn, "if-none-match", etag).second, 200, path.string());
+
+                THEN("A 304 without body is sent") {
+                    REQUIRE(revalidated.second.status.value() == 304);
+                    REQUIRE(adapter->file.empty());
+                }
+            }
+        }
+
+        WHEN("Sending a part of the file") {
+            auto result = Conn::send_file(conn, 200, path.string(), 2, 5);
+
+            THEN("Only the part is written") {
+                REQUIRE_THAT(adapter->file, Equals("23456"));
+            }
+
+            THEN("Its entity tag differs from the one of the whole file") {
+                auto const whole = Conn::send_file(conn, 200, path.string());
+                REQUIRE(result.second.resp_headers.at("etag") != whole.second.resp_headers.at("etag"));
+                REQUIRE(result.second.resp_headers.at("etag")
+                    != Conn::send_file(conn, 200, path.string(), 3, 5).second.resp_headers.at("etag"));
+            }
+        }
+
+        WHEN("Requesting a byte range") {
+            auto result = Conn::send_file(Conn::put_req_header(conn, "range", "bytes=2-4").second, 200, path.string());
+
+            THEN("A 206 with the range is sent") {
+                REQUIRE(result.second.status.value() == 206);
+                REQUIRE_THAT(adapter->file, Equals("234"));
+                REQUIRE_THAT(result.second.resp_headers.at("content-range"), Equals("bytes 2-4/10"));
+            }
+        }
+
+        WHEN("Requesting a byte range under If-Range") {
+            auto const etag = Conn::send_file(conn, 200, path.string()).second.resp_headers.at("etag");
+            auto const ranged = [&](std::string const& validator) {
+                Conn const request = Conn::put_req_header(Conn::put_req_header(conn, "range", "bytes=2-4").second, "if-range", validator).second;
+                return Conn::send_file(request, 200, path.string());
+            };
+
+            THEN("Only the current strong entity tag gets the range") {
+                REQUIRE(ranged(etag).second.status.value() == 206);
+                REQUIRE(ranged("W/" + etag).second.status.value() == 200);
+                REQUIRE(ranged("\"stale\"").second.status.value() == 200);
+                REQUIRE_THAT(adapter->file, Equals("0123456789"));
+            }
+        }
+
+        WHEN("Requesting a range whose last byte is the largest size_t") {
+            auto result = Conn::send_file(Conn::put_req_header(conn, "range", "bytes=5-18446744073709551615").second, 200, path.string());
+
+            THEN("The range is clamped to the end of the file") {
+                REQUIRE(result.second.status.value() == 206);
+                REQUIRE(result.second.resp_file_length == 5);
+                REQUIRE_THAT(result.second.resp_headers.at("content-range"), Equals("bytes 5-9/10"));
+            }
+        }
+
+        WHEN("Requesting a range past the end") {
+            auto result = Conn::send_file(Conn::put_req_header(conn, "range", "bytes=20-").second, 200, path.string());
+
+            THEN("A 416 is sent") {
+                REQUIRE(result.second.status.value() == 416);
+                REQUIRE_THAT(result.second.resp_headers.at("content-range"), Equals("bytes */10"));
+            }
+        }
+
+        WHEN("Sending a missing file") {
+            THEN("An error is returned") {
+                REQUIRE(Conn::send_file(conn, 200, "/non-existent/file").first == core::ResultType::Err);
+            }
+        }
+
+        std::filesystem::remove(path);
+    }
+}
+
+SCENARIO("Byte Range Parsing", "[core]") {
+    GIVEN("A body of 10 bytes") {
+        THEN("Ranges are resolved to half-open intervals") {
+            REQUIRE(core::ParseByteRange("bytes=0-0", 10).second == std::pair<size_t, size_t>{0, 1});
+            REQUIRE(core::ParseByteRange("bytes=5-", 10).second == std::pair<size_t, size_t>{5, 10});
+            REQUIRE(core::ParseByteRange("bytes=-3", 10).second == std::pair<size_t, size_t>{7, 10});
+            REQUIRE(core::ParseByteRange("bytes=4-100", 10).second == std::pair<size_t, size_t>{4, 10});
+            REQUIRE(core::ParseByteRange("bytes=0-1,4-5", 10).second == std::pair<size_t, size_t>{0, 10});
+            REQUIRE(core::ParseByteRange("bytes=10-", 10).first == core::ResultType::Err);
+            REQUIRE(core::ParseByteRange("bytes=-0", 10).first == core::ResultType::Err);
+        }
+        THEN("A last byte past the end is clamped without overflowing") {
+            REQUIRE(core::ParseByteRange("bytes=5-18446744073709551615", 10).second == std::pair<size_t, size_t>{5, 10});
+            REQUIRE(core::ParseByteRange("bytes=0-99999999999999999999", 10).second == std::pair<size_t, size_t>{0, 10});
+        }
+        THEN("An inverted range is ignored") {
+            auto const [type, bytes] = core::ParseByteRange("bytes=5-2", 10);
+            REQUIRE(type == core::ResultType::Ok);
+            REQUIRE(bytes == std::pair<size_t, size_t>{0, 10});
+        }
+    }
+}
+
+SCENARIO("Request Body Reading", "[core]") {
+    GIVEN("A connection with a buffered body") {
+        http::Request req;
+        req.path = "/upload";
+        req.method = "post";
+        req.target = "/upload";
+        req.body = "abcdefghij";
+        Conn conn(std::move(req), std::make_shared<CookieSession>());
+
+        auto opts = core::ImmutMapString().transient();
+        opts.set("length", core::ShareStr("4"));
+        auto const options = opts.persistent();
+
+        WHEN("Reading the body in slices") {
+            auto [first_type, first] = Conn::read_body(std::move(conn), options);
+            auto [second_type, second] = Conn::read_body(first.second, options);
+            auto [last_type, last] = Conn::read_body(second.second, options);
+
+            THEN("More is returned until the body is done") {
+                REQUIRE(first_type == core::ResultType::More);
+                REQUIRE_THAT(first.first, Equals("abcd"));
+                REQUIRE(second_type == core::ResultType::More);
+                REQUIRE_THAT(second.first, Equals("efgh"));
+                REQUIRE(last_type == core::ResultType::Ok);
+                REQUIRE_THAT(last.first, Equals("ij"));
+            }
+
+            AND_WHEN("Reading once the body is done") {
+                auto const done = Conn::read_body(last.second, options);
+                REQUIRE(done.first == core::ResultType::Ok);
+                REQUIRE(done.second.first.empty());
+            }
+        }
+    }
+
+    GIVEN("A connection whose adapter streams the body") {
+        struct StreamingAdapter : RecordingAdapter {
+            size_t calls = 0;
+            std::optional<core::Result<std::string>> read_body(size_t length, size_t, std::chrono::milliseconds) override {
+                ++calls;
+                return core::Result<std::string>{ calls < 2 ? core::ResultType::More : core::ResultType::Ok, std::string(length, 'x') };
+            }
+        };
+        Conn conn = buildFirstConn();
+        conn.adapter = std::make_shared<StreamingAdapter>();
+
+        WHEN("Reading the body") {
+            auto opts = core::ImmutMapString().transient();
+            opts.set("length", core::ShareStr("16"));
+            auto const result = Conn::read_body(conn, opts.persistent());
+
+            THEN("The adapter is read instead of req_body") {
+                REQUIRE(result.first == core::ResultType::More);
+                REQUIRE(result.second.first == std::string(16, 'x'));
+            }
+        }
+    }
+}
+
+SCENARIO("Multipart Body Reading", "[core]") {
+    GIVEN("A connection with a multipart body") {
+        http::Request req;
+        req.path = "/upload";
+        req.method = "post";
+        req.target = "/upload";
+        req.headers.emplace("content-type", "multipart/form-data; boundary=XyZ");
+        req.body = "--XyZ\r\n"
+                   "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+                   "hello\r\n"
+                   "--XyZ\r\n"
+                   "Content-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n"
+                   "Content-Type: text/plain\r\n\r\n"
+                   "0123456789\r\n"
+                   "--XyZ--\r\n";
+        Conn conn(std::move(req), std::make_shared<CookieSession>());
+
+        auto opts = core::ImmutMapString().transient();
+        opts.set("length", core::ShareStr("4"));
+        opts.set("read_length", core::ShareStr("7"));
+        auto const options = opts.persistent();
+
+        WHEN("Reading the parts one after the other") {
+            std::vector<std::vector<std::pair<std::string, std::string>>> headers;
+            std::vector<std::string> bodies;
+            size_t slices = 0;
+            Conn current(std::move(conn));
+
+            while (true) {
+                auto part = Conn::read_part_headers(std::move(current), options);
+                current = Conn(part.second.second);
+                REQUIRE(part.first == core::ResultType::Ok);
+                if (!part.second.first.has_value()) {
+                    break;
+                }
+                headers.emplace_back(part.second.first->begin(), part.second.first->end());
+
+                std::string body;
+                core::ResultType type = core::ResultType::More;
+                while (type == core::ResultType::More) {
+                    auto read = Conn::read_part_body(std::move(current), options);
+                    current = Conn(read.second.second);
+                    type = read.first;
+                    REQUIRE(type != core::ResultType::Err);
+                    REQUIRE(read.second.first.size() <= 4);
+                    body.append(read.second.first);
+                    ++slices;
+                }
+                bodies.push_back(body);
+            }
+
+            THEN("Each part has its lowercase headers and its whole body") {
+                REQUIRE(headers.size() == 2);
+                REQUIRE(headers[0][0].first == "content-disposition");
+                REQUIRE(headers[1][1] == std::pair<std::string, std::string>("content-type", "text/plain"));
+                REQUIRE(bodies == std::vector<std::string>{"hello", "0123456789"});
+                REQUIRE(slices > 2);
+            }
+        }
+
+        WHEN("Skipping the body of a part") {
+            auto first = Conn::read_part_headers(std::move(conn));
+            auto second = Conn::read_part_headers(first.second.second);
+
+            THEN("The next part is read") {
+                REQUIRE(second.first == core::ResultType::Ok);
+                REQUIRE(second.second.first->at(0).second == "form-data; name=\"file\"; filename=\"a.txt\"");
+            }
+        }
+    }
+
+    GIVEN("A connection that is not multipart") {
+        http::Request req;
+        req.body = "abc";
+        Conn conn(std::move(req), std::make_shared<CookieSession>());
+
+        THEN("Reading parts fails") {
+            REQUIRE(Conn::read_part_headers(conn).first == core::ResultType::Err);
+            REQUIRE(Conn::read_part_body(conn).first == core::ResultType::Err);
+        }
+    }
+}
+
 SCENARIO("Connection Halt", "[core]") {
     GIVEN("A fresh connection") {
         Conn const initial_conn = buildFirstConn();
@@ -472,6 +908,47 @@ SCENARIO("Cookie Security Options", "[core]") {
     }
 }
 
+SCENARIO("Persistent Header Map", "[core]") {
+    GIVEN("A header map with repeated keys") {
+        core::ImmutHeaders const headers = {
+            {"Accept", "text/html"},
+            {"X-Trace", "first"},
+            {"x-trace", "second"}
+        };
+
+        WHEN("Looking up keys") {
+            THEN("Keys are case-insensitive and values keep their order") {
+                REQUIRE(headers.size() == 3);
+                REQUIRE(headers.count("X-TRACE") == 2);
+                auto const [first, last] = headers.equal_range("x-trace");
+                REQUIRE_THAT(first->second, Equals("first"));
+                REQUIRE_THAT(std::next(first)->second, Equals("second"));
+                REQUIRE(std::next(first, 2) == last);
+                REQUIRE_THAT(headers.find("ACCEPT")->first, Equals("accept"));
+                REQUIRE(headers.find("missing") == headers.end());
+            }
+        }
+
+        WHEN("Modifying the map") {
+            core::ImmutHeaders const set = headers.set("X-Trace", "only");
+            core::ImmutHeaders const inserted = headers.insert({"X-Trace", "third"});
+            core::ImmutHeaders const erased = headers.erase("x-trace");
+            core::ImmutHeaders const updated = headers.update("accept", "", [](auto const& v) { return v + ", */*"; });
+
+            THEN("A new map is returned and the original is untouched") {
+                REQUIRE(headers.count("x-trace") == 2);
+                REQUIRE(set.count("x-trace") == 1);
+                REQUIRE_THAT(set.at("x-trace"), Equals("only"));
+                REQUIRE(inserted.count("x-trace") == 3);
+                REQUIRE_THAT(std::prev(inserted.equal_range("x-trace").second)->second, Equals("third"));
+                REQUIRE(erased.size() == 1);
+                REQUIRE_THAT(updated.at("Accept"), Equals("text/html, */*"));
+                REQUIRE_THROWS_AS(erased.at("x-trace"), std::out_of_range);
+            }
+        }
+    }
+}
+
 SCENARIO("Response Header Management with Multiple Headers", "[core]") {
     GIVEN("A fresh connection") {
         Conn const initial_conn = buildFirstConn();
@@ -507,6 +984,26 @@ SCENARIO("Response Header Management with Multiple Headers", "[core]") {
                 REQUIRE(resp_headers.find("cache-control")->second == "no-cache");
             }
         }
+
+        WHEN("Prepending a header whose key is already set") {
+            auto const with_link = Conn::put_resp_header(initial_conn, "Link", "</a.css>");
+            http::Headers headers = {
+                {"Link", "</b.js>"},
+                {"Link", "</c.js>"}
+            };
+            auto result = Conn::prepend_resp_header(with_link.second, headers);
+
+            THEN("The new values come first, in order, and the key keeps its case") {
+                REQUIRE(result.first == core::ResultType::Ok);
+                auto const [first, last] = result.second.resp_headers.equal_range("link");
+                std::vector<std::pair<std::string, std::string>> const links(first, last);
+                REQUIRE(links.size() == 3);
+                REQUIRE(links[0].first == "Link");
+                REQUIRE(links[0].second == "</b.js>");
+                REQUIRE(links[1].second == "</c.js>");
+                REQUIRE(links[2].second == "</a.css>");
+            }
+        }
     }
 }
 
@@ -553,4 +1050,46 @@ SCENARIO("Request Header Management with Multiple Headers", "[core]") {
             }
         }
     }
-}
\ No newline at end of file
+}
+SCENARIO("Response Header Blocks", "[core]") {
+    GIVEN("A compiled header block") {
+        HeaderBlockPtr const block = MakeHeaderBlock({
+            {"X-Frame-Options", "SAMEORIGIN"},
+            {"X-Content-Type-Options", "nosniff"}
+        });
+
+        THEN("Its keys keep their case and its wire format is precomputed") {
+            REQUIRE(block->headers.size() == 2);
+            REQUIRE(block->headers[0].first == "X-Frame-Options");
+            REQUIRE_THAT(block->wire, Equals("X-Frame-Options: SAMEORIGIN\r\nX-Content-Type-Options: nosniff\r\n"));
+        }
+
+        WHEN("Putting it on a connection") {
+            Conn const initial_conn = buildFirstConn();
+            auto result = Conn::put_resp_header_block(initial_conn, block);
+
+            THEN("The block is shared, not copied") {
+                REQUIRE(result.first == core::ResultType::Ok);
+                REQUIRE(result.second.resp_header_blocks.size() == 1);
+                REQUIRE(result.second.resp_header_blocks[0] == block);
+                REQUIRE(initial_conn.resp_header_blocks.empty());
+            }
+        }
+
+        WHEN("Putting it on a chunked connection") {
+            Conn conn = buildFirstConn();
+            conn.state = Unsent::CHUNKED;
+            auto result = Conn::put_resp_header_block(std::move(conn), block);
+
+            THEN("An error is returned") {
+                REQUIRE(result.first == core::ResultType::Err);
+            }
+        }
+    }
+
+    GIVEN("A header with a line break") {
+        THEN("The block is refused") {
+            REQUIRE_THROWS_AS(MakeHeaderBlock({{"x-bad", "a\r\nset-cookie: b"}}), std::invalid_argument);
+        }
+    }
+}
@@ -0,0 +1,462 @@
+/*--- Code file for test http ---*/
+
+#include "test_pch.hpp"
+#include <catch2/matchers/catch_matchers_string.hpp>
+#include <feather/compress.hpp>
+
+#include <thread>
+
+#include <zlib.h>
+
+using namespace feather::core;
+using namespace plug;
+using namespace Catch::Matchers;
+
+namespace
+{
+    // Writes raw bytes to a transport and reads until the server closes the connection.
+    std::string RoundTrip(uint16_t port, std::string const& raw)
+    {
+        boost::asio::io_service io;
+        boost::asio::ip::tcp::socket socket(io);
+        socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+        boost::asio::write(socket, boost::asio::buffer(raw));
+
+        std::string response;
+        std::array<char, 4096> buffer;
+        boost::system::error_code ec;
+        while (!ec)
+        {
+            size_t const read = socket.read_some(boost::asio::buffer(buffer), ec);
+            response.append(buffer.data(), read);
+        }
+        return response;
+    }
+
+    // Joins the data of a chunked body, up to its last chunk.
+    std::string Unchunk(std::string_view body)
+    {
+        std::string data;
+        while (!body.empty())
+        {
+            size_t const line = body.find("\r\n");
+            size_t const size = std::stoul(std::string(body.substr(0, line)), nullptr, 16);
+            if (size == 0)
+            {
+                break;
+            }
+            data.append(body.substr(line + 2, size));
+            body.remove_prefix(line + 2 + size + 2);
+        }
+        return data;
+    }
+
+    // Inflates a complete gzip stream, empty if it is truncated or invalid.
+    std::string Gunzip(std::string const& data)
+    {
+        z_stream stream{};
+        inflateInit2(&stream, 15 + 16);
+        std::string out(data.size() * 64 + 1024, '\0');
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        stream.avail_in = static_cast<uInt>(data.size());
+        stream.next_out = reinterpret_cast<Bytef*>(out.data());
+        stream.avail_out = static_cast<uInt>(out.size());
+        int const status = inflate(&stream, Z_FINISH);
+        out.resize(out.size() - stream.avail_out);
+        inflateEnd(&stream);
+        return status == Z_STREAM_END ? out : std::string();
+    }
+
+    // Asynchronous handler throwing once it awaited, after starting a chunked response if started is set.
+    Task<Conn> FailingReply(Conn conn, bool started)
+    {
+        co_await AsyncSleep(std::chrono::milliseconds(1));
+        if (started)
+        {
+            conn = Conn::chunk(Conn::send_chunked(std::move(conn), 200).second, "partial").second;
+        }
+        throw std::runtime_error("upstream failed");
+    }
+
+    size_t Count(std::string const& str, std::string_view needle)
+    {
+        size_t count = 0;
+        for (size_t at = str.find(needle); at != std::string::npos; at = str.find(needle, at + 1))
+        {
+            ++count;
+        }
+        return count;
+    }
+}
+
+SCENARIO("Set-Cookie Building", "[server]") {
+    GIVEN("A cookie with options") {
+        auto const cookie = ImmutMapString()
+            .insert({"value", ShareStr("id_cookie=abc")})
+            .insert({"same_site", ShareStr("Lax")})
+            .insert({"httponly", ShareStr("")})
+            .insert({"max_age", ShareStr("60")})
+            .insert({"unknown", ShareStr("ignored")});
+        std::pmr::string out;
+
+        WHEN("Building its header") {
+            REQUIRE(BuildSetCookie(cookie, out));
+
+            THEN("The attributes are written in a fixed order, with the default path") {
+                REQUIRE_THAT(std::string(out), Equals("id_cookie=abc; Path=/; Max-Age=60; HttpOnly; SameSite=Lax"));
+            }
+        }
+
+        WHEN("Its attributes were precompiled") {
+            auto const attributes = CompileCookieAttributes(cookie);
+            auto const compiled = ImmutMapString()
+                .insert({"value", ShareStr("id_cookie=abc")})
+                .insert({"attributes", attributes});
+            REQUIRE(BuildSetCookie(compiled, out));
+
+            THEN("The same header is built") {
+                REQUIRE_THAT(*attributes, Equals("; Path=/; Max-Age=60; HttpOnly; SameSite=Lax"));
+                REQUIRE_THAT(std::string(out), Equals("id_cookie=abc; Path=/; Max-Age=60; HttpOnly; SameSite=Lax"));
+            }
+        }
+    }
+
+    GIVEN("A cookie without value") {
+        std::pmr::string out("stale");
+
+        THEN("Nothing is built") {
+            REQUIRE_FALSE(BuildSetCookie(ImmutMapString().insert({"path", ShareStr("/")}), out));
+            REQUIRE(out.empty());
+        }
+    }
+}
+
+SCENARIO("Request Framing", "[http]") {
+    GIVEN("Request lines with each method") {
+        THEN("The standard methods are parsed and the others refused") {
+            for (std::string const method : {"GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH"}) {
+                auto const parsed = ParseRequest(method + " * HTTP/1.1\r\nHost: a\r\n\r\n");
+                REQUIRE(parsed.first == ResultType::Ok);
+                REQUIRE(parsed.second.method == method);
+            }
+            REQUIRE(ParseRequest("OPTION * HTTP/1.1\r\n\r\n").first == ResultType::Err);
+        }
+    }
+
+    GIVEN("A header name followed by whitespace") {
+        THEN("The request is refused instead of hiding the header") {
+            REQUIRE(ParseRequest("POST / HTTP/1.1\r\nContent-Length : 5\r\n\r\n").first == ResultType::Err);
+            REQUIRE(ParseRequest("POST / HTTP/1.1\r\n: 5\r\n\r\n").first == ResultType::Err);
+        }
+    }
+
+    GIVEN("Buffers holding a request head") {
+        THEN("The end of the head is found with both line endings") {
+            REQUIRE(FindHeadEnd("GET / HTTP/1.1\r\nHost: a\r\n\r\nbody") == std::optional<size_t>(27));
+            REQUIRE(FindHeadEnd("GET / HTTP/1.1\nHost: a\n\nbody") == std::optional<size_t>(24));
+            REQUIRE_FALSE(FindHeadEnd("GET / HTTP/1.1\r\nHost: a\r\n").has_value());
+        }
+    }
+
+    GIVEN("A chunked body followed by another request") {
+        std::string const raw = "3\r\nabc\r\n2;ext=1\r\nde\r\n0\r\nx-trailer: 1\r\n\r\nGET / HTTP/1.1\r\n\r\n";
+        ChunkedDecoder decoder;
+        std::string body;
+
+        WHEN("Decoding it") {
+            auto const result = decoder.decode(raw, body, 1024);
+
+            THEN("The data is joined and the next request is left untouched") {
+                REQUIRE(result.first == ResultType::Ok);
+                REQUIRE_THAT(body, Equals("abcde"));
+                REQUIRE_THAT(raw.substr(result.second), Equals("GET / HTTP/1.1\r\n\r\n"));
+            }
+        }
+
+        WHEN("Only a part of it was received") {
+            auto const result = decoder.decode(std::string_view(raw).substr(0, 12), body, 1024);
+
+            THEN("The complete chunks are consumed and decoding resumes with the rest") {
+                REQUIRE(result.first == ResultType::More);
+                REQUIRE(result.second == 8);
+                REQUIRE_THAT(body, Equals("abc"));
+
+                auto const rest = decoder.decode(std::string_view(raw).substr(8), body, 1024);
+                REQUIRE(rest.first == ResultType::Ok);
+                REQUIRE_THAT(body, Equals("abcde"));
+                REQUIRE_THAT(raw.substr(8 + rest.second), Equals("GET / HTTP/1.1\r\n\r\n"));
+            }
+        }
+
+        WHEN("It is received one byte at a time") {
+            std::string pending;
+            ResultType type = ResultType::More;
+            for (size_t i = 0; i < raw.size() && type == ResultType::More; ++i)
+            {
+                pending += raw[i];
+                auto const result = decoder.decode(pending, body, 1024);
+                type = result.first;
+                pending.erase(0, type == ResultType::Err ? 0 : result.second);
+            }
+
+            THEN("It is decoded the same") {
+                REQUIRE(type == ResultType::Ok);
+                REQUIRE_THAT(body, Equals("abcde"));
+                REQUIRE(pending.empty());
+            }
+        }
+
+        WHEN("It is larger than allowed") {
+            THEN("It is refused as too large") {
+                auto const result = decoder.decode(raw, body, 4);
+                REQUIRE(result.first == ResultType::Err);
+                REQUIRE(result.second == 413);
+            }
+        }
+    }
+
+    GIVEN("Chunk sizes past the range of size_t or past the limit once added") {
+        std::string body;
+
+        THEN("They are refused as too large instead of wrapping") {
+            REQUIRE(ChunkedDecoder().decode("fffffffffffffffffff\r\n", body, 1024).second == 413);
+            REQUIRE(ChunkedDecoder().decode("3\r\nabc\r\nffffffffffffffff\r\n", body, 1024).second == 413);
+        }
+    }
+
+    GIVEN("A malformed chunked body") {
+        std::string body;
+        auto const result = ChunkedDecoder().decode("zz\r\nabc\r\n0\r\n\r\n", body, 1024);
+
+        THEN("It is refused as a bad request") {
+            REQUIRE(result.first == ResultType::Err);
+            REQUIRE(result.second == 400);
+        }
+    }
+}
+
+SCENARIO("Persistent HTTP Connections", "[http]") {
+    GIVEN("A transport answering with the method, path and body of each request") {
+        boost::asio::io_service io;
+        HttpTransport::Options options;
+        options.max_requests = 3;
+        options.idle_timeout = std::chrono::milliseconds(100);
+        options.buffer_body_size = 8;
+
+        HttpTransport transport(io, [](http::Request&& req, std::shared_ptr<Adapter> const& adapter)
+        {
+            std::string const summary = req.method + " " + req.path + " [" + req.body + "]";
+            Conn conn(std::move(req), nullptr);
+            conn.adapter = adapter;
+            if (*conn.request_path == "/stream")
+            {
+                auto const read = Conn::read_body(conn, ImmutMapString().insert({"length", ShareStr("10")}));
+                return Conn::resp(read.second.second, 200, "streamed [" + read.second.first + "]");
+            }
+            return Conn::resp(conn, 200, summary);
+        }, options);
+        transport.listen(boost::asio::ip::make_address("127.0.0.1"), 0);
+        std::thread worker([&io]() { io.run(); });
+
+        WHEN("Pipelining requests on one connection") {
+            std::string const response = RoundTrip(transport.port(),
+                "GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                "POST /b HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+                "HEAD /c HTTP/1.1\r\n\r\n"
+                "GET /d HTTP/1.1\r\n\r\n");
+
+            THEN("They are answered in order until max_requests closes the connection") {
+                REQUIRE(Count(response, "HTTP/1.1 200") == 3);
+                REQUIRE(response.find("GET /a []") < response.find("POST /b [abc]"));
+                REQUIRE(Count(response, "connection: keep-alive") == 2);
+                REQUIRE(Count(response, "connection: close") == 1);
+                REQUIRE(response.find("HEAD /c") == std::string::npos);
+                REQUIRE(response.find("/d") == std::string::npos);
+            }
+        }
+
+        WHEN("Sending a chunked body, then an HTTP/1.0 request") {
+            std::string const response = RoundTrip(transport.port(),
+                "POST /chunked HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n"
+                "GET /old HTTP/1.0\r\n\r\n");
+
+            THEN("The body is decoded and HTTP/1.0 closes the connection") {
+                REQUIRE_THAT(response, ContainsSubstring("POST /chunked [abcde]"));
+                REQUIRE_THAT(response, ContainsSubstring("GET /old []"));
+                REQUIRE(Count(response, "connection: close") == 1);
+            }
+        }
+
+        WHEN("Sending a Transfer-Encoding whose last coding is not chunked") {
+            std::string const gzip = RoundTrip(transport.port(),
+                "POST /gzip HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\nGET /smuggled HTTP/1.1\r\n\r\n");
+            std::string const xchunked = RoundTrip(transport.port(),
+                "POST /x HTTP/1.1\r\nTransfer-Encoding: xchunked\r\n\r\n0\r\n\r\n");
+            std::string const layered = RoundTrip(transport.port(),
+                "POST /layered HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\nConnection: close\r\n\r\n3\r\nabc\r\n0\r\n\r\n");
+
+            THEN("It is rejected and the rest is never parsed as a request") {
+                REQUIRE_THAT(gzip, StartsWith("HTTP/1.1 400"));
+                REQUIRE(gzip.find("/smuggled") == std::string::npos);
+                REQUIRE_THAT(xchunked, StartsWith("HTTP/1.1 400"));
+                REQUIRE_THAT(layered, ContainsSubstring("POST /layered [abc]"));
+            }
+        }
+
+        WHEN("Sending repeated framing headers that disagree") {
+            std::string const lengths = RoundTrip(transport.port(),
+                "POST /a HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 5\r\n\r\nabcde");
+            std::string const list = RoundTrip(transport.port(),
+                "POST /b HTTP/1.1\r\nContent-Length: 3, 5\r\n\r\nabcde");
+            std::string const encodings = RoundTrip(transport.port(),
+                "POST /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: gzip\r\n\r\n0\r\n\r\n");
+            std::string const spaced = RoundTrip(transport.port(),
+                "POST /d HTTP/1.1\r\nContent-Length : 3\r\n\r\nabc");
+            std::string const same = RoundTrip(transport.port(),
+                "POST /e HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\nConnection: close\r\n\r\nabc");
+
+            THEN("Only identical lengths are accepted") {
+                REQUIRE_THAT(lengths, StartsWith("HTTP/1.1 400"));
+                REQUIRE_THAT(list, StartsWith("HTTP/1.1 400"));
+                REQUIRE_THAT(encodings, StartsWith("HTTP/1.1 400"));
+                REQUIRE_THAT(spaced, StartsWith("HTTP/1.1 400"));
+                REQUIRE_THAT(same, ContainsSubstring("POST /e [abc]"));
+            }
+        }
+
+        WHEN("Sending a body larger than buffer_body_size") {
+            std::string const response = RoundTrip(transport.port(),
+                "POST /stream HTTP/1.1\r\nContent-Length: 10\r\n\r\n0123456789"
+                "GET /after HTTP/1.1\r\n\r\n");
+
+            THEN("It is streamed to read_body and the connection is reused") {
+                REQUIRE_THAT(response, ContainsSubstring("streamed [0123456789]"));
+                REQUIRE_THAT(response, ContainsSubstring("GET /after []"));
+            }
+        }
+
+        WHEN("Sending a malformed request") {
+            std::string const response = RoundTrip(transport.port(), "NOPE\r\n\r\n");
+
+            THEN("It is rejected and the connection closed") {
+                REQUIRE_THAT(response, StartsWith("HTTP/1.1 400"));
+                REQUIRE_THAT(response, ContainsSubstring("connection: close"));
+            }
+        }
+
+        transport.stop();
+        io.stop();
+        worker.join();
+    }
+}
+
+SCENARIO("Chunked Responses", "[http]") {
+    GIVEN("A transport streaming a response in two chunks") {
+        boost::asio::io_service io;
+        HttpTransport transport(io, [](http::Request&& req, std::shared_ptr<Adapter> const& adapter)
+        {
+            Conn conn(std::move(req), nullptr);
+            conn.adapter = adapter;
+            auto const sent = Conn::send_chunked(std::move(conn), 200);
+            auto const first = Conn::chunk(sent.second, "hello ");
+            return Conn(Conn::chunk(first.second, "world").second);
+        });
+        transport.listen(boost::asio::ip::make_address("127.0.0.1"), 0);
+        std::thread worker([&io]() { io.run(); });
+
+        WHEN("An HTTP/1.1 client requests it") {
+            std::string const response = RoundTrip(transport.port(), "GET /stream HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+            THEN("The chunks are framed and ended by the last chunk") {
+                REQUIRE_THAT(response, ContainsSubstring("transfer-encoding: chunked"));
+                REQUIRE_THAT(response, EndsWith("0\r\n\r\n"));
+                REQUIRE_THAT(Unchunk(response.substr(response.find("\r\n\r\n") + 4)), Equals("hello world"));
+            }
+        }
+
+        WHEN("An HTTP/1.0 client requests it, even with keep-alive") {
+            std::string const response = RoundTrip(transport.port(), "GET /stream HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+
+            THEN("The chunks are written as they are and closing the connection ends the response") {
+                REQUIRE_THAT(response, !ContainsSubstring("transfer-encoding"));
+                REQUIRE_THAT(response, ContainsSubstring("connection: close"));
+                REQUIRE_THAT(response, EndsWith("\r\n\r\nhello world"));
+            }
+        }
+
+        transport.stop();
+        io.stop();
+        worker.join();
+    }
+}
+
+SCENARIO("Compressed Chunked Responses", "[http]") {
+    GIVEN("A transport streaming a chunked response through the compression plug") {
+        boost::asio::io_service io;
+        HttpTransport transport(io, [](http::Request&& req, std::shared_ptr<Adapter> const& adapter)
+        {
+            Conn conn(std::move(req), nullptr);
+            conn.adapter = adapter;
+            conn = compress(Conn::put_resp_header(std::move(conn), "content-type", "text/plain").second);
+            auto const sent = Conn::send_chunked(std::move(conn), 200);
+            auto const first = Conn::chunk(sent.second, "hello ");
+            return Conn(Conn::chunk(first.second, "world").second);
+        });
+        transport.listen(boost::asio::ip::make_address("127.0.0.1"), 0);
+        std::thread worker([&io]() { io.run(); });
+
+        WHEN("A client accepting gzip requests it") {
+            std::string const response = RoundTrip(transport.port(),
+                "GET /stream HTTP/1.1\r\nAccept-Encoding: gzip\r\nConnection: close\r\n\r\n");
+
+            THEN("The stream is finished by the plug and decompresses whole") {
+                REQUIRE_THAT(response, ContainsSubstring("content-encoding: gzip"));
+                REQUIRE_THAT(response, EndsWith("0\r\n\r\n"));
+                std::string const body = response.substr(response.find("\r\n\r\n") + 4);
+                REQUIRE_THAT(Gunzip(Unchunk(body)), Equals("hello world"));
+            }
+        }
+
+        transport.stop();
+        io.stop();
+        worker.join();
+    }
+}
+
+SCENARIO("Failing Asynchronous Handlers", "[http]") {
+    GIVEN("A transport whose asynchronous handler throws, before or after starting its response") {
+        boost::asio::io_service io;
+        HttpTransport transport(io, [](http::Request&& req, std::shared_ptr<Adapter> const& adapter) -> MaybeAsync<Conn>
+        {
+            bool const started = req.path == "/late";
+            Conn conn(std::move(req), nullptr);
+            conn.adapter = adapter;
+            return FailingReply(std::move(conn), started);
+        });
+        transport.listen(boost::asio::ip::make_address("127.0.0.1"), 0);
+        std::thread worker([&io]() { io.run(); });
+
+        WHEN("Nothing was written yet") {
+            std::string const response = RoundTrip(transport.port(), "GET /early HTTP/1.1\r\n\r\n");
+
+            THEN("It is answered 500") {
+                REQUIRE_THAT(response, StartsWith("HTTP/1.1 500"));
+            }
+        }
+
+        WHEN("The head of a chunked response was written") {
+            std::string const response = RoundTrip(transport.port(), "GET /late HTTP/1.1\r\n\r\n");
+
+            THEN("The response is cut short instead of followed by a 500") {
+                REQUIRE_THAT(response, StartsWith("HTTP/1.1 200"));
+                REQUIRE_THAT(response, ContainsSubstring("partial"));
+                REQUIRE(Count(response, "HTTP/1.1") == 1);
+                REQUIRE_THAT(response, !EndsWith("0\r\n\r\n"));
+            }
+        }
+
+        transport.stop();
+        io.stop();
+        worker.join();
+    }
+}
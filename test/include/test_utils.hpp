@@ -4,6 +4,38 @@
 #include <feather/router.hpp>
 
 namespace test {
+    // Adapter recording what a connection writes instead of sending it to a socket.
+    struct RecordingAdapter : feather::core::plug::Adapter {
+        std::optional<int>          status;
+        std::vector<std::string>    chunks;
+        bool                        finished = false;
+        bool                        closed = false;
+
+        bool send_chunked(feather::core::plug::Conn const& conn) override {
+            status = conn.status;
+            return !closed;
+        }
+
+        bool chunk(std::string_view data) override {
+            chunks.emplace_back(data);
+            return !closed;
+        }
+
+        bool finish() override {
+            finished = true;
+            return !closed;
+        }
+
+        bool send_file(feather::core::plug::Conn const& conn, int fd, size_t offset, size_t length) override {
+            status = conn.status;
+            file.resize(length);
+            file.resize(length > 0 ? static_cast<size_t>(::pread(fd, file.data(), length, static_cast<off_t>(offset))) : 0);
+            return !closed;
+        }
+
+        std::string                 file;
+    };
+
     inline feather::core::plug::Conn buildFirstConn() {
         using namespace feather::core::plug;
 
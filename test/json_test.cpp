@@ -0,0 +1,112 @@
+/*--- Code file for test json ---*/
+
+#include "test_pch.hpp"
+#include <feather/json.hpp>
+
+#include <map>
+#include <optional>
+#include <vector>
+
+using namespace feather::core;
+
+namespace {
+    struct Item {
+        int                     id;
+        std::string             name;
+        std::optional<double>   price;
+        std::vector<std::string> tags;
+    };
+}
+
+template <>
+inline constexpr auto feather::core::json_fields<Item> = std::make_tuple(
+    JSON_FIELD(Item, id),
+    JSON_FIELD(Item, name),
+    JSON_FIELD(Item, price),
+    JSON_FIELD(Item, tags));
+
+SCENARIO("Typed JSON Writing", "[json]") {
+    GIVEN("An output buffer") {
+        std::string out;
+
+        WHEN("Writing scalars") {
+            WriteJson(out, true);
+            out += ' ';
+            WriteJson(out, 42);
+            out += ' ';
+            WriteJson(out, 0.5);
+            out += ' ';
+            WriteJson(out, std::optional<int>());
+
+            THEN("They are written as JSON literals") {
+                REQUIRE(out == "true 42 0.5 null");
+            }
+        }
+
+        WHEN("Writing a string that needs escaping") {
+            WriteJson(out, std::string("say \"hi\"\n\x01"));
+
+            THEN("Only what JSON requires is escaped") {
+                REQUIRE(out == R"("say \"hi\"\n\u0001")");
+            }
+        }
+
+        WHEN("Writing reflected structs in a container") {
+            std::vector<Item> items = {{1, "pen", 1.5, {"office"}}, {2, "ink", std::nullopt, {}}};
+            WriteJson(out, items);
+
+            THEN("Each struct becomes an object in field order") {
+                REQUIRE(out == R"([{"id":1,"name":"pen","price":1.5,"tags":["office"]},{"id":2,"name":"ink","price":null,"tags":[]}])");
+            }
+
+            THEN("nlohmann parses the same document") {
+                auto const parsed = nlohmann::json::parse(out);
+                REQUIRE(parsed[0]["name"] == "pen");
+                REQUIRE(parsed[1]["price"].is_null());
+            }
+        }
+
+        WHEN("Writing a map of shared strings") {
+            std::map<std::string, SharedString> values = {{"a", ShareStr("x")}, {"b", nullptr}};
+            WriteJson(out, values);
+
+            THEN("It becomes an object") {
+                REQUIRE(out == R"({"a":"x","b":null})");
+            }
+        }
+
+        WHEN("Writing a json value after existing content") {
+            out = "prefix:";
+            WriteJson(out, nlohmann::json{{"key", "value"}});
+
+            THEN("The json serializer appends to the buffer") {
+                REQUIRE(out == R"(prefix:{"key":"value"})");
+            }
+        }
+    }
+}
+
+SCENARIO("Pooled Body Buffers", "[json]") {
+    GIVEN("A body buffer handed to a response") {
+        BodyBuffer body;
+        body->append(1000, 'x');
+        std::string const* storage = &*body;
+        SharedString shared = std::move(body).share();
+
+        THEN("The response shares it without a copy") {
+            REQUIRE(shared.get() == storage);
+            REQUIRE(shared->size() == 1000);
+        }
+
+        WHEN("The last reference is released") {
+            shared.reset();
+            BodyBuffer next;
+
+            THEN("The buffer is reused empty with its capacity") {
+                REQUIRE(&*next == storage);
+                REQUIRE(next->empty());
+                REQUIRE(next->capacity() >= 1000);
+            }
+        }
+    }
+}
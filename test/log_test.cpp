@@ -0,0 +1,148 @@
+/*--- Code file for test log ---*/
+
+#include "test_pch.hpp"
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include <feather/log.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+using namespace feather::core;
+using namespace feather::core::plug;
+using namespace test;
+using namespace Catch::Matchers;
+
+namespace {
+    // Logger writing its batches to a string instead of stderr.
+    struct CapturedLogger {
+        std::mutex  mutex;
+        std::string out;
+        Logger      logger;
+
+        CapturedLogger() : logger(Logger::Options{[this](std::string_view batch) {
+            std::lock_guard<std::mutex> lock(mutex);
+            out.append(batch);
+        }, std::chrono::milliseconds(10)}) {}
+
+        std::string lines() {
+            logger.flush();
+            std::lock_guard<std::mutex> lock(mutex);
+            return out;
+        }
+    };
+}
+
+SCENARIO("Structured Logging", "[log]") {
+    GIVEN("A logger with a captured sink") {
+        CapturedLogger captured;
+
+        WHEN("Logging a record with fields") {
+            REQUIRE(captured.logger.log<LogLevel::Warn>("request rejected",
+                {{"status", 400}, {"path", "/a b"}, {"keep_alive", false}, {"bytes", size_t(12)}, {"ratio", 0.5}}));
+            std::string const out = captured.lines();
+
+            THEN("It is written as a key=value line with its time and level") {
+                REQUIRE_THAT(out, StartsWith("time="));
+                REQUIRE_THAT(out, ContainsSubstring("Z level=warn msg=\"request rejected\" status=400 path=\"/a b\" keep_alive=false bytes=12 ratio=0.5\n"));
+            }
+        }
+
+        WHEN("Logging below the compiled level") {
+            bool const logged = captured.logger.log<LogLevel::Trace>("hidden");
+
+            THEN("Nothing is recorded") {
+                REQUIRE(logged == LogEnabled<LogLevel::Trace>);
+                REQUIRE(captured.lines().empty() == !LogEnabled<LogLevel::Trace>);
+            }
+        }
+
+        WHEN("A record is longer than its slot") {
+            captured.logger.log<LogLevel::Error>(std::string(1000, 'x'));
+            std::string const out = captured.lines();
+
+            THEN("It is truncated") {
+                REQUIRE(out.size() < 400);
+                REQUIRE_THAT(out, EndsWith("...\n"));
+            }
+        }
+
+        WHEN("A thread logs faster than the rings are drained") {
+            std::thread flood([&captured]() {
+                for (int i = 0; i < 100000; ++i) {
+                    captured.logger.log<LogLevel::Warn>("malformed request", {{"i", i}});
+                }
+            });
+            flood.join();
+            std::string const out = captured.lines();
+
+            THEN("The records past the capacity of its ring are dropped and counted") {
+                REQUIRE_THAT(out, ContainsSubstring("i=0\n"));
+                REQUIRE_THAT(out, ContainsSubstring("msg=\"log records dropped\" count="));
+                REQUIRE(std::count(out.begin(), out.end(), '\n') < 100000);
+            }
+        }
+
+        WHEN("The drain thread runs") {
+            captured.logger.log<LogLevel::Info>("background");
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            std::lock_guard<std::mutex> lock(captured.mutex);
+
+            THEN("Records reach the sink without a flush") {
+                REQUIRE_THAT(captured.out, ContainsSubstring("msg=background"));
+            }
+        }
+    }
+}
+
+SCENARIO("Access Log", "[log]") {
+    GIVEN("A request through the access log plug") {
+        CapturedLogger captured;
+
+        http::Request req;
+        req.path = "/users";
+        req.method = "GET";
+        req.target = "/users?page=2";
+        Conn conn = access_log(Conn(std::move(req), std::make_shared<CookieSession>()), captured.logger);
+        conn = Conn::resp(std::move(conn), 200, std::string("hello"));
+
+        WHEN("Its response is about to be sent") {
+            Conn::run_before_send(std::move(conn));
+            std::string const out = captured.lines();
+
+            THEN("A line records the request and its timing") {
+                REQUIRE_THAT(out, ContainsSubstring("level=info msg=request method=get path=/users status=200 bytes=5 duration_us="));
+            }
+        }
+    }
+
+    GIVEN("Requests answered with a file and with chunks") {
+        CapturedLogger captured;
+        auto const file = std::filesystem::temp_directory_path() / "feather_log_test_file.txt";
+        std::ofstream(file) << std::string(1234, 'x');
+
+        auto const logged = [&captured](std::string const& path) {
+            http::Request req;
+            req.path = path;
+            req.method = "GET";
+            req.target = path;
+            Conn conn = access_log(Conn(std::move(req), std::make_shared<CookieSession>()), captured.logger);
+            conn.adapter = std::make_shared<RecordingAdapter>();
+            return conn;
+        };
+
+        WHEN("Their heads are sent") {
+            Conn::send_file(logged("/file"), 200, file.string());
+            Conn::send_chunked(logged("/stream"), 200);
+            std::string const out = captured.lines();
+
+            THEN("The file is counted by its length and the chunked body as unknown") {
+                REQUIRE_THAT(out, ContainsSubstring("path=/file status=200 bytes=1234 "));
+                REQUIRE_THAT(out, ContainsSubstring("path=/stream status=200 bytes=- "));
+            }
+        }
+
+        std::filesystem::remove(file);
+    }
+}
@@ -0,0 +1,116 @@
+/*--- Code file for test metrics ---*/
+
+#include "test_pch.hpp"
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include <feather/metrics.hpp>
+
+#include <thread>
+
+using namespace feather::core;
+using namespace feather::core::plug;
+using namespace Catch::Matchers;
+
+SCENARIO("Metrics Histograms", "[metrics]") {
+    GIVEN("The buckets of a histogram") {
+        THEN("Every value falls in a bucket whose bounds hold it") {
+            for (uint64_t const value : {0ull, 1ull, 7ull, 8ull, 9ull, 1000ull, 123456789ull, ~0ull}) {
+                size_t const bucket = Histogram::BucketOf(value);
+                REQUIRE(bucket < Histogram::bucket_count);
+                REQUIRE(Histogram::LowerBound(bucket) <= value);
+                REQUIRE(value <= Histogram::UpperBound(bucket));
+            }
+        }
+
+        THEN("The buckets are contiguous") {
+            for (size_t bucket = 1; bucket < Histogram::bucket_count; ++bucket) {
+                REQUIRE(Histogram::LowerBound(bucket) == Histogram::UpperBound(bucket - 1) + 1);
+            }
+        }
+    }
+
+    GIVEN("Values recorded from several threads") {
+        auto const histogram = std::make_unique<Histogram>();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&histogram]() {
+                for (uint64_t i = 1; i <= 1000; ++i) {
+                    histogram->record(i * 1000);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        THEN("The snapshot sums every shard") {
+            auto const snapshot = histogram->snapshot();
+            if constexpr (MetricsEnabled) {
+                REQUIRE(snapshot.count == 4000);
+                REQUIRE(snapshot.sum == 4 * 500500000ull);
+                REQUIRE(snapshot.percentile(50) >= 500000);
+                REQUIRE(snapshot.percentile(50) <= 500000 * 1.125);
+                REQUIRE(snapshot.percentile(100) >= 1000000);
+            } else {
+                REQUIRE(snapshot.count == 0);
+            }
+        }
+    }
+}
+
+SCENARIO("Route Handler Histograms", "[metrics]") {
+    GIVEN("The default registry") {
+        THEN("Every route shares one handler histogram") {
+            REQUIRE(&Metrics::handler("GET /a") == &Metrics::handler("GET /b"));
+        }
+    }
+
+    GIVEN("Per-route histograms turned on") {
+        Metrics::instance().set_per_route(true);
+
+        THEN("Each route gets its own") {
+            REQUIRE(&Metrics::handler("GET /a") != &Metrics::handler("GET /b"));
+            REQUIRE(&Metrics::handler("GET /a") == &Metrics::stage("handler", "GET /a"));
+        }
+
+        Metrics::instance().set_per_route(false);
+    }
+}
+
+SCENARIO("Metrics Export", "[metrics]") {
+    GIVEN("Instruments of the registry") {
+        Metrics::instance().counter("test_events_total", "Events of the test.").add(3);
+        Metrics::instance().observe("test_level", "Level of the test.", []() { return 42.0; });
+        Metrics::stage("plug", "Conn::\"quoted\"").record(2000);
+
+        Plug const timed = TimedPlug("test_plug", [](Conn conn, PlugOptions) { return conn; });
+        timed(Conn(http::Request{}, std::make_shared<CookieSession>()), {});
+
+        WHEN("Exporting them") {
+            std::string const text = Metrics::instance().export_prometheus();
+
+            THEN("They are written in the Prometheus text format") {
+                REQUIRE_THAT(text, ContainsSubstring("# TYPE test_events_total counter"));
+                REQUIRE_THAT(text, ContainsSubstring("test_level 42"));
+                REQUIRE_THAT(text, ContainsSubstring("# TYPE feather_stage_duration_seconds histogram"));
+                REQUIRE_THAT(text, ContainsSubstring(R"(name="Conn::\"quoted\"")"));
+                REQUIRE_THAT(text, ContainsSubstring(R"(feather_stage_duration_seconds_count{stage="plug",name="test_plug"} )"));
+                if constexpr (MetricsEnabled) {
+                    REQUIRE_THAT(text, ContainsSubstring("test_events_total 3"));
+                    REQUIRE_THAT(text, ContainsSubstring(R"(stage="plug",name="Conn::\"quoted\"",le="0.000005"} 1)"));
+                }
+            }
+        }
+
+        WHEN("Serving them") {
+            Conn const conn = export_metrics(Conn(http::Request{}, std::make_shared<CookieSession>()));
+
+            THEN("The response is the exported text") {
+                REQUIRE(conn.status == std::optional<int>(200));
+                REQUIRE_THAT(*conn.resp_body, ContainsSubstring("test_events_total"));
+            }
+        }
+
+        Metrics::instance().forget("test_level");
+    }
+}
@@ -0,0 +1,194 @@
+/*--- Code file for test parsers ---*/
+
+#include "test_pch.hpp"
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include <feather/parsers.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+using namespace feather::core;
+using namespace feather::core::plug;
+using namespace Catch::Matchers;
+
+namespace
+{
+    Conn body_conn(std::string const& content_type, std::string body) {
+        http::Request req;
+        req.path = "/form";
+        req.method = "post";
+        req.target = "/form";
+        req.headers.emplace("content-type", content_type);
+        req.headers.emplace("content-length", std::to_string(body.size()));
+        req.body = std::move(body);
+        return Conn(std::move(req), std::make_shared<CookieSession>());
+    }
+
+    std::string param(Conn const& conn, std::string const& key) {
+        auto const value = conn.body_params->find(key);
+        return value == nullptr ? std::string() : **value;
+    }
+
+    std::string read_file(std::string const& path) {
+        std::ifstream file(path, std::ios::binary);
+        std::stringstream content;
+        content << file.rdbuf();
+        return content.str();
+    }
+}
+
+SCENARIO("Content Disposition", "[parsers]") {
+    GIVEN("Content-Disposition headers") {
+        auto const disposition = ParseContentDisposition(R"(form-data; name="file"; filename="a b.txt")");
+
+        THEN("The name and filename are extracted") {
+            REQUIRE_THAT(disposition.name, Equals("file"));
+            REQUIRE(disposition.filename == std::optional<std::string>("a b.txt"));
+            REQUIRE_FALSE(ParseContentDisposition(R"(form-data; name="title")").filename.has_value());
+        }
+    }
+}
+
+SCENARIO("Body Params", "[parsers]") {
+    GIVEN("An urlencoded body") {
+        Conn const conn = fetch_body_params(body_conn("application/x-www-form-urlencoded", "name=J%C3%A9r%C3%B4me&city=New+York&empty="));
+
+        THEN("Its pairs are decoded") {
+            REQUIRE(conn.body_params.has_value());
+            REQUIRE_THAT(param(conn, "name"), Equals("J\xC3\xA9r\xC3\xB4me"));
+            REQUIRE_THAT(param(conn, "city"), Equals("New York"));
+            REQUIRE(conn.body_params->find("empty") != nullptr);
+        }
+    }
+
+    GIVEN("A JSON body") {
+        Conn const conn = fetch_body_params(body_conn("application/json; charset=utf-8", R"({"name":"ada","age":36,"tags":["a"]})"));
+
+        THEN("Strings are kept and other values are their JSON text") {
+            REQUIRE_THAT(param(conn, "name"), Equals("ada"));
+            REQUIRE_THAT(param(conn, "age"), Equals("36"));
+            REQUIRE_THAT(param(conn, "tags"), Equals(R"(["a"])"));
+        }
+    }
+
+    GIVEN("Malformed or oversized bodies") {
+        ParserOptions options;
+        options.length = 8;
+        Conn const malformed = fetch_body_params(body_conn("application/json", "{nope"));
+        Conn const oversized = fetch_body_params(body_conn("application/x-www-form-urlencoded", "a=0123456789"), options);
+
+        THEN("The connection is halted with a client error") {
+            REQUIRE(malformed.halted);
+            REQUIRE(malformed.status == std::optional<int>(400));
+            REQUIRE(oversized.halted);
+            REQUIRE(oversized.status == std::optional<int>(413));
+        }
+    }
+
+    GIVEN("Another content type") {
+        Conn const conn = fetch_body_params(body_conn("text/plain", "hello"));
+
+        THEN("The body is left alone") {
+            REQUIRE_FALSE(conn.body_params.has_value());
+            REQUIRE(Conn::read_body(conn).second.first == "hello");
+        }
+    }
+
+    GIVEN("A multipart body with a field and a file") {
+        std::string const file(100000, 'z');
+        ParserOptions options;
+        options.read_length = 4096;
+        options.upload_dir = std::filesystem::temp_directory_path();
+
+        Conn const conn = fetch_body_params(body_conn("multipart/form-data; boundary=----b0und",
+            "------b0und\r\n"
+            "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+            "holidays\r\n"
+            "------b0und\r\n"
+            "Content-Disposition: form-data; name=\"photo\"; filename=\"beach.raw\"\r\n"
+            "Content-Type: image/x-raw\r\n\r\n"
+            + file + "\r\n"
+            "------b0und--\r\n"), options);
+
+        THEN("The field is a param and the file is spooled to disk") {
+            REQUIRE_FALSE(conn.halted);
+            REQUIRE_THAT(param(conn, "title"), Equals("holidays"));
+
+            auto const uploads = std::any_cast<Uploads>(*conn.assigns.find("uploads"));
+            Upload const& upload = uploads.at("photo");
+            REQUIRE_THAT(upload.filename, Equals("beach.raw"));
+            REQUIRE_THAT(upload.content_type, Equals("image/x-raw"));
+            REQUIRE(upload.size == file.size());
+            REQUIRE_THAT(param(conn, "photo"), Equals(upload.path));
+            REQUIRE(read_file(upload.path) == file);
+
+            std::filesystem::remove(upload.path);
+        }
+    }
+
+    GIVEN("Multipart bodies rejected after a file was spooled") {
+        auto const dir = std::filesystem::temp_directory_path() / "feather_parsers_test_uploads";
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directory(dir);
+        ParserOptions options;
+        options.upload_dir = dir;
+        options.length = 8;
+
+        auto const file_part = [](std::string const& name, std::string const& content) {
+            return "------b0und\r\n"
+                "Content-Disposition: form-data; name=\"" + name + "\"; filename=\"a.txt\"\r\n\r\n"
+                + content + "\r\n";
+        };
+        auto const upload = [&](std::string const& parts, ParserOptions const& opts) {
+            return fetch_body_params(body_conn("multipart/form-data; boundary=----b0und", parts + "------b0und--\r\n"), opts);
+        };
+        auto const spooled = [&dir]() {
+            return std::distance(std::filesystem::directory_iterator(dir), std::filesystem::directory_iterator());
+        };
+
+        WHEN("A later field is too large") {
+            Conn const conn = upload(file_part("doc", "hello")
+                + "------b0und\r\nContent-Disposition: form-data; name=\"note\"\r\n\r\n0123456789\r\n", options);
+
+            THEN("It gets a 413 and the spooled file is removed") {
+                REQUIRE(conn.status == std::optional<int>(413));
+                REQUIRE(spooled() == 0);
+            }
+        }
+
+        WHEN("Two files come under the same field name") {
+            Conn const conn = upload(file_part("doc", "first") + file_part("doc", "second"), options);
+
+            THEN("It gets a 400 and no file is left") {
+                REQUIRE(conn.status == std::optional<int>(400));
+                REQUIRE(spooled() == 0);
+            }
+        }
+
+        WHEN("The files are larger than max_upload_size together") {
+            ParserOptions limited = options;
+            limited.max_upload_size = 8;
+            Conn const conn = upload(file_part("a", "hello") + file_part("b", "world"), limited);
+
+            THEN("It gets a 413 and no file is left") {
+                REQUIRE(conn.status == std::optional<int>(413));
+                REQUIRE(spooled() == 0);
+            }
+        }
+
+        WHEN("There are more parts than max_parts") {
+            ParserOptions limited = options;
+            limited.max_parts = 1;
+            Conn const conn = upload(file_part("a", "hello") + file_part("b", "world"), limited);
+
+            THEN("It gets a 413 and no file is left") {
+                REQUIRE(conn.status == std::optional<int>(413));
+                REQUIRE(spooled() == 0);
+            }
+        }
+
+        std::filesystem::remove_all(dir);
+    }
+}
@@ -0,0 +1,95 @@
+/*--- Code file for test published ---*/
+
+#include "test_pch.hpp"
+#include <feather/published.hpp>
+
+#include <thread>
+#include <vector>
+
+using namespace feather::core;
+
+SCENARIO("Published Values", "[published]") {
+    GIVEN("Nothing published") {
+        Published<int> value;
+
+        THEN("Readers get nullptr") {
+            REQUIRE(value.get() == nullptr);
+            REQUIRE(value.load() == nullptr);
+        }
+    }
+
+    GIVEN("A published value") {
+        Published<int> value(std::make_shared<int const>(1));
+        REQUIRE(*value.get() == 1);
+
+        WHEN("Publishing a new value") {
+            auto const previous = value.load();
+            value.publish(std::make_shared<int const>(2));
+
+            THEN("Readers see the new value") {
+                REQUIRE(*value.get() == 2);
+            }
+
+            THEN("Shared references keep the previous value") {
+                REQUIRE(*previous == 1);
+            }
+        }
+
+        WHEN("Publishing while a read is held") {
+            auto const shared = value.get();
+            value.publish(std::make_shared<int const>(2));
+
+            THEN("The held value outlives the next read of the thread") {
+                REQUIRE(*value.get() == 2);
+                REQUIRE(*shared == 1);
+                REQUIRE(shared.use_count() == 1);
+            }
+        }
+
+        WHEN("Reading two values of the same type on one thread") {
+            Published<int> other(std::make_shared<int const>(3));
+
+            THEN("Each reader gets its own value") {
+                REQUIRE(*other.get() == 3);
+                REQUIRE(*value.get() == 1);
+                REQUIRE(*other.get() == 3);
+            }
+        }
+
+        WHEN("Publishing while other threads read") {
+            std::vector<std::thread> readers;
+            std::atomic<bool> done{false};
+            std::atomic<bool> ordered{true};
+
+            for (int i = 0; i < 4; ++i)
+            {
+                readers.emplace_back([&] {
+                    int last = 0;
+                    while (!done.load())
+                    {
+                        int const current = *value.get();
+                        if (current < last)
+                        {
+                            ordered = false;
+                        }
+                        last = current;
+                    }
+                });
+            }
+            for (int i = 2; i <= 1000; ++i)
+            {
+                value.publish(std::make_shared<int const>(i));
+            }
+            done = true;
+            for (auto& reader : readers)
+            {
+                reader.join();
+            }
+
+            THEN("Readers never go back to an older value") {
+                REQUIRE(ordered);
+                REQUIRE(*value.get() == 1000);
+            }
+        }
+    }
+}
@@ -24,6 +24,20 @@ namespace {
                     END_PLINE;
                 }));
     }
+
+    // Helper to create a connection requesting path with method
+    Conn connFor(std::string const& path, std::string const& method = "get") {
+        http::Request req;
+        req.path = path;
+        req.method = method;
+        req.target = path;
+        return Conn(std::move(req), std::make_shared<CookieSession>());
+    }
+
+    // Helper to read the name of the route that handled a connection
+    std::string routeOf(Conn const& c) {
+        return std::any_cast<std::string>(c.assigns.at("route"));
+    }
 }
 
 SCENARIO("Router Pipeline Configuration", "[router]") {
@@ -107,4 +121,121 @@ SCENARIO("Router Request Handling", "[router]") {
             }
         }
     }
-}
\ No newline at end of file
+}
+SCENARIO("Router Path Parameters", "[router]") {
+    GIVEN("Routes with parameters and globs") {
+        Router::fetch_instance()
+            CHAIN(Router::scope, "/params",
+                (CALLBACK_SCOPE {
+                    GET("/users/:id", [](Conn const& c) { return Conn::assign(c, "route", std::string("show")); });
+                    GET("/users/new", [](Conn const& c) { return Conn::assign(c, "route", std::string("new")); });
+                    GET("/users/:id/edit", [](Conn const& c) { return Conn::assign(c, "route", std::string("edit")); });
+                    GET("/files/*path", [](Conn const& c) { return Conn::assign(c, "route", std::string("files")); });
+                    END_SCOPE;
+                }));
+
+        WHEN("Requesting a path with a parameter") {
+            Conn conn = connFor("/params/users/42") pipe Router::handler;
+
+            THEN("The parameter is captured") {
+                REQUIRE_THAT(routeOf(conn), Equals("show"));
+                REQUIRE_THAT(**conn.path_params.value().find("id"), Equals("42"));
+            }
+        }
+
+        WHEN("Requesting a static path next to a parameter") {
+            Conn conn = connFor("/params/users/new") pipe Router::handler;
+
+            THEN("The static segment wins") {
+                REQUIRE_THAT(routeOf(conn), Equals("new"));
+                REQUIRE(conn.path_params.value().empty());
+            }
+        }
+
+        WHEN("Requesting a path only the parameter branch can match") {
+            Conn conn = connFor("/params/users/new/edit") pipe Router::handler;
+
+            THEN("The router falls back to the parameter") {
+                REQUIRE_THAT(routeOf(conn), Equals("edit"));
+                REQUIRE_THAT(**conn.path_params.value().find("id"), Equals("new"));
+            }
+        }
+
+        WHEN("Requesting a path under a glob") {
+            Conn conn = connFor("/params/files/css/site.css") pipe Router::handler;
+
+            THEN("The rest of the path is captured") {
+                REQUIRE_THAT(routeOf(conn), Equals("files"));
+                REQUIRE_THAT(**conn.path_params.value().find("path"), Equals("css/site.css"));
+            }
+        }
+    }
+}
+
+SCENARIO("Router Method Matching", "[router]") {
+    GIVEN("A static path registered for another method than the parameter next to it") {
+        Router::fetch_instance()
+            CHAIN(Router::scope, "/methods",
+                (CALLBACK_SCOPE {
+                    POST("/users/new", [](Conn const& c) { return Conn::assign(c, "route", std::string("create")); });
+                    GET("/users/:id", [](Conn const& c) { return Conn::assign(c, "route", std::string("show")); });
+                    GET("/users/list/all", [](Conn const& c) { return Conn::assign(c, "route", std::string("all")); });
+                    END_SCOPE;
+                }));
+
+        WHEN("Requesting the static path with the method of the parameter") {
+            Conn conn = connFor("/methods/users/new") pipe Router::handler;
+
+            THEN("The router falls back to the parameter") {
+                REQUIRE_THAT(routeOf(conn), Equals("show"));
+                REQUIRE_THAT(**conn.path_params.value().find("id"), Equals("new"));
+            }
+        }
+
+        WHEN("Requesting the static path with its own method") {
+            Conn conn = connFor("/methods/users/new", "post") pipe Router::handler;
+
+            THEN("The static route still wins") {
+                REQUIRE_THAT(routeOf(conn), Equals("create"));
+            }
+        }
+
+        WHEN("Requesting a prefix of a longer static route") {
+            Conn conn = connFor("/methods/users/list") pipe Router::handler;
+
+            THEN("The prefix without routes does not hide the parameter") {
+                REQUIRE_THAT(routeOf(conn), Equals("show"));
+                REQUIRE_THAT(**conn.path_params.value().find("id"), Equals("list"));
+            }
+        }
+    }
+}
+
+SCENARIO("Router Pipeline Halting", "[router]") {
+    GIVEN("A scope piping through a halting pipeline") {
+        setupBasicRouter()
+            CHAIN(Router::pipeline, "halting",
+                (CALLBACK_PLINE {
+                    PLUG(Conn::halt);
+                    PLUG(Conn::assign, "after_halt", true);
+                    END_PLINE;
+                }))
+            CHAIN(Router::scope, "/halt",
+                (CALLBACK_SCOPE {
+                    PIPE_THROUGH("test1", "halting");
+                    GET("/stop", [](Conn const& c) { return Conn::assign(c, "route", std::string("stop")); });
+                    END_SCOPE;
+                }));
+
+        WHEN("Handling a request through it") {
+            Conn conn = connFor("/halt/stop") pipe Router::handler;
+
+            THEN("Plugs before the halt ran, the rest and the handler did not") {
+                REQUIRE(conn.halted);
+                REQUIRE(conn.cookies.has_value());
+                REQUIRE(conn.assigns.find("after_halt") == nullptr);
+                REQUIRE(conn.assigns.find("route") == nullptr);
+            }
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/*--- Code file for test scan ---*/
+
+#include "test_pch.hpp"
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include <feather/scan.hpp>
+
+using namespace feather::core;
+using namespace Catch::Matchers;
+
+SCENARIO("Byte Scanning", "[scan]") {
+    GIVEN("Inputs longer and shorter than a vector register") {
+        std::string long_input(40, 'a');
+        long_input[33] = '&';
+        long_input[37] = '=';
+
+        THEN("The first matching byte is found from the given position") {
+            REQUIRE(FindByte(long_input, 0, '&') == 33);
+            REQUIRE(FindByte(long_input, 34, '&') == std::string_view::npos);
+            REQUIRE(FindEither(long_input, 0, '=', '&') == 33);
+            REQUIRE(FindEither(long_input, 34, '=', '&') == 37);
+            REQUIRE(FindEither("a=b", 0, '&', '=') == 1);
+            REQUIRE(FindByte("", 0, '&') == std::string_view::npos);
+        }
+    }
+}
+
+SCENARIO("UTF-8 Validation", "[scan]") {
+    GIVEN("Well-formed texts") {
+        THEN("They are accepted") {
+            REQUIRE(ValidUtf8(""));
+            REQUIRE(ValidUtf8("plain ascii text longer than sixteen bytes"));
+            REQUIRE(ValidUtf8("J\xC3\xA9r\xC3\xB4me"));
+            REQUIRE(ValidUtf8("a long enough ascii prefix, then \xF0\x9F\x98\x80"));
+        }
+    }
+
+    GIVEN("Malformed texts") {
+        THEN("They are refused") {
+            REQUIRE_FALSE(ValidUtf8("\xC0\xAF"));              // Overlong
+            REQUIRE_FALSE(ValidUtf8("\xED\xA0\x80"));          // Surrogate
+            REQUIRE_FALSE(ValidUtf8("\xF4\x90\x80\x80"));      // Above U+10FFFF
+            REQUIRE_FALSE(ValidUtf8("a long enough ascii prefix, then \xE2\x82"));
+            REQUIRE_FALSE(ValidUtf8("\xFF"));
+        }
+    }
+}
+
+SCENARIO("Percent Decoding", "[scan]") {
+    GIVEN("Encoded components") {
+        std::string out;
+
+        THEN("Plus signs and percent escapes are decoded") {
+            REQUIRE(UrlDecode("a+b%20c%2Fd", out));
+            REQUIRE_THAT(out, Equals("a b c/d"));
+            REQUIRE(UrlDecode("untouched", out));
+            REQUIRE_THAT(out, Equals("untouched"));
+        }
+
+        THEN("Truncated escapes are refused") {
+            REQUIRE_FALSE(UrlDecode("abc%2", out));
+            REQUIRE_FALSE(UrlDecode("%zz", out));
+        }
+    }
+
+    GIVEN("Padded values") {
+        THEN("Spaces and tabs are trimmed") {
+            REQUIRE(TrimSpaces(" \tvalue ") == "value");
+            REQUIRE(TrimSpaces("   ").empty());
+        }
+    }
+}
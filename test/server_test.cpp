@@ -4,6 +4,7 @@
 #include <catch2/matchers/catch_matchers_string.hpp>
 
 using namespace feather::core;
+using namespace feather::router;
 using namespace plug;
 using namespace test;
 using namespace Catch::Matchers;
@@ -36,6 +37,25 @@ SCENARIO("Server Request Parsing", "[server]") {
             }
         }
 
+        WHEN("Parsing a request with a multi-line body") {
+            std::string const post_request =
+                "POST /form#anchor HTTP/1.0\n"
+                "Content-Type:   text/plain  \n"
+                "\n"
+                "first line\n"
+                "\n"
+                "second line";
+            auto result = Server::parse_request(post_request);
+
+            THEN("The body is kept verbatim and the fragment is skipped") {
+                REQUIRE(result.first == ResultType::Ok);
+                REQUIRE_THAT(result.second.target, Equals("/form"));
+                REQUIRE_THAT(result.second.path, Equals("/form"));
+                REQUIRE_THAT(result.second.headers.find("Content-Type")->second, Equals("text/plain"));
+                REQUIRE_THAT(result.second.body, Equals("first line\n\nsecond line"));
+            }
+        }
+
         WHEN("Parsing an invalid request") {
             std::string invalid_request = "INVALID /test HTTP/1.1\r\n";
             auto result = Server::parse_request(invalid_request);
@@ -93,6 +113,53 @@ SCENARIO("Server Cookie Management", "[server]") {
     }
 }
 
+SCENARIO("Server Session Cookies", "[server]") {
+    GIVEN("A server with a stored session and a route dropping it") {
+        Server server;
+        server.sessions->put("known", std::make_shared<CookieSession>());
+
+        Router::fetch_instance()
+            CHAIN(Router::scope, "/session_drop",
+                (CALLBACK_SCOPE {
+                    GET("/logout", [](Conn const& c) {
+                        return Conn::resp(Conn::configure_session(c, SessionOpt::DROP).second, 200, std::string("bye"));
+                    });
+                    END_SCOPE;
+                }));
+
+        Server::Options opts;
+        opts.threads = 1;
+        opts.http_port = 8083;
+        Server::start(server, "localhost", 8082, opts);
+
+        WHEN("The session cookie of the request is dropped") {
+            boost::asio::io_service client_io;
+            boost::asio::ip::tcp::socket socket(client_io);
+            socket.connect({boost::asio::ip::make_address("127.0.0.1"), 8083});
+            boost::asio::write(socket, boost::asio::buffer(std::string(
+                "GET /session_drop/logout HTTP/1.1\r\nCookie: id_cookie=known\r\nConnection: close\r\n\r\n")));
+
+            std::string response;
+            std::array<char, 4096> buffer;
+            boost::system::error_code ec;
+            while (!ec)
+            {
+                size_t const read = socket.read_some(boost::asio::buffer(buffer), ec);
+                response.append(buffer.data(), read);
+            }
+
+            THEN("The response expires the cookie and the session is erased") {
+                REQUIRE_THAT(response, ContainsSubstring(
+                    "set-cookie: id_cookie=; Path=/; Max-Age=0; Expires=Thu, 01 Jan 1970 00:00:00 GMT\r\n"));
+                REQUIRE(server.sessions->fetch("known") == nullptr);
+            }
+        }
+
+        Server::stop(server);
+        Server::join(server);
+    }
+}
+
 SCENARIO("Server Start Configuration", "[server]") {
     GIVEN("A server instance") {
         Server server;
@@ -171,4 +238,61 @@ SCENARIO("Server Start Configuration", "[server]") {
             }
         }
     }
-}
\ No newline at end of file
+}
+SCENARIO("Server Worker Threads", "[server]") {
+    GIVEN("A server instance") {
+        Server server;
+
+        WHEN("Starting the server on several worker threads") {
+            Server::Options opts;
+            opts.threads = 4;
+            opts.reuse_port = true;
+
+            Server::start(server, "localhost", 8081, opts);
+
+            THEN("Server accepts connections without a caller owned run loop") {
+                boost::asio::io_service client_io;
+                boost::asio::ip::tcp::socket socket(client_io);
+                boost::system::error_code ec;
+
+                socket.connect({boost::asio::ip::make_address("127.0.0.1"), 8081}, ec);
+                REQUIRE_FALSE(ec);
+            }
+
+            Server::stop(server);
+            Server::join(server);
+        }
+    }
+}
+
+SCENARIO("Server Connection Registry", "[server]") {
+    GIVEN("A registry with a WebSocket user") {
+        Server::Registry registry;
+        auto const socket = std::make_shared<int>(0);
+        Server::ConnectionHdl const hdl = socket;
+        auto const session = std::make_shared<CookieSession>();
+
+        registry.insert("ws", {session, hdl});
+        registry.bind(hdl, "ws");
+        registry.insert("http", {std::make_shared<CookieSession>(), {}});
+
+        WHEN("Looking users up") {
+            THEN("They are found by session id and by connection") {
+                REQUIRE(registry.size() == 2);
+                REQUIRE(registry.find("ws")->session == session);
+                REQUIRE(registry.find(hdl)->session == session);
+                REQUIRE_FALSE(registry.find("missing").has_value());
+            }
+        }
+
+        WHEN("The connection is closed") {
+            registry.erase(hdl);
+
+            THEN("Its user is removed from both indexes") {
+                REQUIRE_FALSE(registry.find(hdl).has_value());
+                REQUIRE_FALSE(registry.find("ws").has_value());
+                REQUIRE(registry.size() == 1);
+            }
+        }
+    }
+}
@@ -0,0 +1,70 @@
+/*--- Code file for test session ---*/
+
+#include "test_pch.hpp"
+
+#include <feather/session.hpp>
+
+using namespace feather::core;
+using namespace plug;
+
+SCENARIO("Memory Session Store", "[session]") {
+    GIVEN("A store with a controllable clock") {
+        auto now = MemorySessionStore::Clock::time_point();
+        MemorySessionStore::Options opts;
+        opts.idle_ttl = std::chrono::seconds(60);
+        opts.max_entries = 32;
+        opts.now = [&now]() { return now; };
+        MemorySessionStore store(opts);
+
+        auto const session = std::make_shared<CookieSession>();
+        store.put("user", session);
+
+        WHEN("Fetching a stored session") {
+            THEN("The same snapshot is returned") {
+                REQUIRE(store.fetch("user") == session);
+                REQUIRE(store.fetch("unknown") == nullptr);
+            }
+        }
+
+        WHEN("The session is used before its idle timeout") {
+            now += std::chrono::seconds(45);
+            REQUIRE(store.fetch("user") == session);
+            now += std::chrono::seconds(45);
+
+            THEN("Its timeout is refreshed") {
+                REQUIRE(store.fetch("user") == session);
+            }
+        }
+
+        WHEN("The session stays idle past its timeout") {
+            now += std::chrono::seconds(61);
+
+            THEN("It expired") {
+                REQUIRE(store.fetch("user") == nullptr);
+                REQUIRE(store.size() == 0);
+            }
+        }
+
+        WHEN("Erasing the session") {
+            bool erased = false;
+            store.erase("user", [&erased](bool found) { erased = found; });
+
+            THEN("It is gone") {
+                REQUIRE(erased);
+                REQUIRE(store.fetch("user") == nullptr);
+            }
+        }
+
+        WHEN("Storing more sessions than the store holds") {
+            for (int i = 0; i < 1000; ++i) {
+                store.put("anonymous-" + std::to_string(i), std::make_shared<CookieSession>());
+            }
+
+            THEN("The least recently used ones are evicted") {
+                REQUIRE(store.size() <= 32);
+                REQUIRE(store.fetch("anonymous-999") != nullptr);
+                REQUIRE(store.fetch("user") == nullptr);
+            }
+        }
+    }
+}
@@ -0,0 +1,168 @@
+/*--- Code file for test slots ---*/
+
+#include "test_pch.hpp"
+
+#include <feather/slots.hpp>
+
+using namespace feather::core;
+using namespace plug;
+
+namespace {
+    struct User {
+        std::string name;
+        bool        admin = false;
+    };
+
+    struct CurrentUser : TypedKey<CurrentUser, User> { static constexpr std::string_view key = "current_user"; };
+    struct TenantId : TypedKey<TenantId, int64_t> { static constexpr std::string_view key = "tenant_id"; };
+    struct Locale : TypedKey<Locale, std::string> { static constexpr std::string_view key = "locale"; };
+
+    // Session keeping everything under string keys, such as one stored in a database.
+    struct StringSession : public Session {
+        immer::map<std::string, std::any> storage;
+
+        StringSession() = default;
+        StringSession(immer::map<std::string, std::any> s) : storage(std::move(s)) {}
+
+        std::any const& get_session(std::string const& key) const override {
+            static std::any const empty_any;
+            auto const search = storage.find(key);
+            return search == nullptr ? empty_any : *search;
+        }
+        SessionPtr put_session(std::string const& key, std::any const& value) const override {
+            return std::make_shared<StringSession const>(storage.set(key, value));
+        }
+        SessionPtr delete_session(std::string const& key) const override {
+            return std::make_shared<StringSession const>(storage.erase(key));
+        }
+        SessionPtr reset_session() const override {
+            return std::make_shared<StringSession const>();
+        }
+    };
+
+    Conn conn_with(SessionPtr session) {
+        http::Request req;
+        req.path = "/";
+        req.method = "get";
+        req.target = "/";
+        return Conn(std::move(req), std::move(session));
+    }
+}
+
+SCENARIO("Slot Stores", "[slots]") {
+    GIVEN("An empty store") {
+        SlotStore const empty;
+
+        THEN("It holds nothing and allocated nothing") {
+            REQUIRE(empty.empty());
+            REQUIRE(empty.get<TenantId>() == nullptr);
+        }
+
+        WHEN("Writing to copies of it") {
+            SlotStore const tenant = empty.set<TenantId>(7);
+            SlotStore const both = tenant.set<Locale>("fr");
+            SlotStore const erased = both.erase<TenantId>();
+
+            THEN("Every version keeps its own values") {
+                REQUIRE(empty.get<TenantId>() == nullptr);
+                REQUIRE(*tenant.get<TenantId>() == 7);
+                REQUIRE_FALSE(tenant.contains<Locale>());
+                REQUIRE(*both.get<TenantId>() == 7);
+                REQUIRE(*both.get<Locale>() == "fr");
+                REQUIRE_FALSE(erased.contains<TenantId>());
+                REQUIRE(*erased.get<Locale>() == "fr");
+            }
+        }
+
+        WHEN("Writing to a store owned alone") {
+            SlotStore store = empty.set<TenantId>(1);
+            int64_t const* before = store.get<TenantId>();
+            store = std::move(store).set<Locale>("en");
+
+            THEN("The values already there are not copied") {
+                REQUIRE(store.get<TenantId>() == before);
+            }
+        }
+    }
+
+    GIVEN("Distinct keys") {
+        THEN("They get distinct slots, numbered once") {
+            REQUIRE(CurrentUser::slot() != TenantId::slot());
+            REQUIRE(TenantId::slot() == TenantId::slot());
+            REQUIRE(CurrentUser::name() != TenantId::name());
+            REQUIRE(Locale::name() == "typed:locale");
+        }
+    }
+}
+
+SCENARIO("Typed Assigns", "[slots]") {
+    GIVEN("A connection") {
+        Conn const conn = conn_with(std::make_shared<CookieSession>());
+
+        WHEN("Assigning typed keys") {
+            Conn const assigned = Conn::assign<TenantId>(Conn::assign<CurrentUser>(conn, User{"ada", true}), 42);
+
+            THEN("They are read back with their type and leave the string assigns alone") {
+                REQUIRE(Conn::get_assign<CurrentUser>(assigned)->name == "ada");
+                REQUIRE(Conn::get_assign<CurrentUser>(assigned)->admin);
+                REQUIRE(*Conn::get_assign<TenantId>(assigned) == 42);
+                REQUIRE(Conn::get_assign<Locale>(assigned) == nullptr);
+                REQUIRE(assigned.assigns.size() == 0);
+                REQUIRE(Conn::get_assign<TenantId>(conn) == nullptr);
+            }
+
+            THEN("They can be deleted") {
+                Conn const deleted = Conn::delete_assign<TenantId>(assigned);
+                REQUIRE(Conn::get_assign<TenantId>(deleted) == nullptr);
+                REQUIRE(Conn::get_assign<CurrentUser>(deleted) != nullptr);
+                REQUIRE(*Conn::get_assign<TenantId>(assigned) == 42);
+            }
+        }
+
+        WHEN("Mixing typed and string keys") {
+            Conn const mixed = Conn::assign(Conn::assign<Locale>(conn, "fr"), "locale", std::string("en"));
+
+            THEN("Both are kept apart") {
+                REQUIRE(*Conn::get_assign<Locale>(mixed) == "fr");
+                REQUIRE(std::any_cast<std::string>(mixed.assigns.at("locale")) == "en");
+            }
+        }
+    }
+}
+
+SCENARIO("Typed Sessions", "[slots]") {
+    GIVEN("A cookie session") {
+        Conn const conn = conn_with(std::make_shared<CookieSession>());
+
+        WHEN("Putting typed keys along string keys") {
+            Conn const put = Conn::put_session(Conn::put_session<TenantId>(conn, 7), "theme", std::string("dark"));
+
+            THEN("The session is written and keeps both") {
+                REQUIRE(Conn::get_session_opt(put) == SessionOpt::WRITE);
+                REQUIRE(*Conn::get_session<TenantId>(put) == 7);
+                REQUIRE(std::any_cast<std::string>(Conn::get_session(put, "theme")) == "dark");
+                REQUIRE(Conn::get_session<TenantId>(conn) == nullptr);
+            }
+
+            THEN("Deleting and clearing drop the typed keys too") {
+                REQUIRE(Conn::get_session<TenantId>(Conn::delete_session<TenantId>(put)) == nullptr);
+                REQUIRE(Conn::get_session<TenantId>(Conn::clear_session(put)) == nullptr);
+                REQUIRE(*Conn::get_session<TenantId>(Conn::delete_session(put, "theme")) == 7);
+            }
+        }
+    }
+
+    GIVEN("A session without slots") {
+        Conn const conn = conn_with(std::make_shared<StringSession>());
+
+        WHEN("Putting typed keys") {
+            Conn const put = Conn::put_session<Locale>(conn, "fr");
+
+            THEN("They fall back to their string name") {
+                REQUIRE(*Conn::get_session<Locale>(put) == "fr");
+                REQUIRE(std::any_cast<std::string>(Conn::get_session(put, Locale::name())) == "fr");
+                REQUIRE(Conn::get_session<Locale>(Conn::delete_session<Locale>(put)) == nullptr);
+            }
+        }
+    }
+}
@@ -0,0 +1,241 @@
+/*--- Code file for test tls ---*/
+
+#include "test_pch.hpp"
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include <feather/tls.hpp>
+
+#ifdef FEATHER_WITH_TLS
+
+#include <boost/asio/ssl.hpp>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+using namespace feather::core;
+using namespace plug;
+using namespace feather::router;
+using namespace Catch::Matchers;
+
+namespace
+{
+    namespace ssl = boost::asio::ssl;
+
+    // Writes a self-signed certificate for localhost and its key, returns their paths.
+    std::pair<std::string, std::string> SelfSigned()
+    {
+        auto const dir = std::filesystem::temp_directory_path();
+        std::string const cert_path = (dir / "feather_tls_test_cert.pem").string();
+        std::string const key_path = (dir / "feather_tls_test_key.pem").string();
+
+        std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(EVP_EC_gen("P-256"), EVP_PKEY_free);
+        std::unique_ptr<X509, decltype(&X509_free)> cert(X509_new(), X509_free);
+        X509_set_version(cert.get(), 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert.get()), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert.get()), 3600);
+        X509_set_pubkey(cert.get(), key.get());
+        X509_NAME* const name = X509_get_subject_name(cert.get());
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<unsigned char const*>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(cert.get(), name);
+        X509_sign(cert.get(), key.get(), EVP_sha256());
+
+        FILE* out = std::fopen(cert_path.c_str(), "w");
+        PEM_write_X509(out, cert.get());
+        std::fclose(out);
+        out = std::fopen(key_path.c_str(), "w");
+        PEM_write_PrivateKey(out, key.get(), nullptr, nullptr, 0, nullptr, nullptr);
+        std::fclose(out);
+        return {cert_path, key_path};
+    }
+
+    // Client side of a test: keeps the last session to resume it on the next connection.
+    struct Client
+    {
+        ssl::context            context{ssl::context::tls_client};
+        SSL_SESSION*            session = nullptr;
+        bool                    resumed = false;
+        std::string             alpn;
+        boost::system::error_code closed;
+
+        Client()
+        {
+            SSL_CTX_set_session_cache_mode(context.native_handle(), SSL_SESS_CACHE_CLIENT);
+            static constexpr unsigned char protocols[] = "\x02h2\x08http/1.1";
+            SSL_CTX_set_alpn_protos(context.native_handle(), protocols, sizeof(protocols) - 1);
+        }
+
+        ~Client()
+        {
+            SSL_SESSION_free(session);
+        }
+
+        // Writes raw bytes over a new TLS connection and reads until the server closes it.
+        std::string round_trip(uint16_t port, std::string const& raw)
+        {
+            boost::asio::io_service io;
+            ssl::stream<boost::asio::ip::tcp::socket> stream(io, context);
+            stream.lowest_layer().connect({boost::asio::ip::make_address("127.0.0.1"), port});
+            if (session != nullptr)
+            {
+                SSL_set_session(stream.native_handle(), session);
+            }
+            stream.handshake(ssl::stream_base::client);
+            boost::asio::write(stream, boost::asio::buffer(raw));
+
+            std::string response;
+            std::array<char, 4096> buffer;
+            boost::system::error_code ec;
+            while (!ec)
+            {
+                size_t const read = stream.read_some(boost::asio::buffer(buffer), ec);
+                response.append(buffer.data(), read);
+            }
+            // eof after a close_notify, stream_truncated when the socket was closed without one.
+            closed = ec;
+
+            unsigned char const* selected = nullptr;
+            unsigned int size = 0;
+            SSL_get0_alpn_selected(stream.native_handle(), &selected, &size);
+            alpn.assign(reinterpret_cast<char const*>(selected), size);
+            resumed = SSL_session_reused(stream.native_handle()) == 1;
+
+            // A session is only resumable once the connection was shut down properly.
+            SSL_shutdown(stream.native_handle());
+            SSL_SESSION_free(session);
+            session = SSL_get1_session(stream.native_handle());
+            return response;
+        }
+    };
+}
+
+SCENARIO("TLS Contexts", "[tls]") {
+    GIVEN("Options without a certificate") {
+        TlsOptions options;
+        options.certificate_chain = "/nonexistent/fullchain.pem";
+
+        THEN("The context cannot be built") {
+            REQUIRE_THROWS(MakeTlsContext(options));
+        }
+    }
+
+    GIVEN("An invalid ALPN protocol") {
+        auto const [cert, key] = SelfSigned();
+        TlsOptions options;
+        options.certificate_chain = cert;
+        options.private_key = key;
+        options.alpn = {""};
+
+        THEN("The context cannot be built") {
+            REQUIRE_THROWS_AS(MakeTlsContext(options), std::invalid_argument);
+        }
+    }
+}
+
+SCENARIO("HTTPS Connections", "[tls]") {
+    GIVEN("An HttpsTransport answering with the path of each request, and a file") {
+        auto const [cert, key] = SelfSigned();
+        TlsOptions tls;
+        tls.certificate_chain = cert;
+        tls.private_key = key;
+
+        auto const file = std::filesystem::temp_directory_path() / "feather_tls_test_file.txt";
+        std::string const content(100000, 'x');
+        std::ofstream(file) << content;
+
+        boost::asio::io_service io;
+        HttpsTransport transport(io, [&file](http::Request&& req, std::shared_ptr<Adapter> const& adapter)
+        {
+            Conn conn(std::move(req), nullptr);
+            conn.adapter = adapter;
+            if (*conn.request_path == "/file")
+            {
+                return Conn(Conn::send_file(conn, 200, file.string()).second);
+            }
+            return Conn::resp(conn, 200, "served " + *conn.request_path);
+        }, HttpTransportOptions{}, TlsOpener(MakeTlsContext(tls)));
+        transport.listen(boost::asio::ip::make_address("127.0.0.1"), 0);
+        std::thread worker([&io]() { io.run(); });
+
+        Client client;
+
+        WHEN("Pipelining requests on one connection") {
+            std::string const response = client.round_trip(transport.port(),
+                "GET /a HTTP/1.1\r\n\r\n"
+                "GET /b HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+            THEN("They are answered in order over HTTP/1.1") {
+                REQUIRE(response.find("served /a") < response.find("served /b"));
+                REQUIRE_THAT(response, ContainsSubstring("connection: close"));
+                REQUIRE(client.alpn == "http/1.1");
+                REQUIRE_FALSE(client.resumed);
+            }
+        }
+
+        WHEN("Reconnecting with the session of a previous connection") {
+            Counter const& resumptions = Metrics::instance().counter("feather_tls_resumed_total");
+            uint64_t const before = resumptions.value();
+            client.round_trip(transport.port(), "GET /first HTTP/1.1\r\nConnection: close\r\n\r\n");
+            std::string const response = client.round_trip(transport.port(), "GET /second HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+            THEN("The handshake resumes it") {
+                REQUIRE_THAT(response, ContainsSubstring("served /second"));
+                REQUIRE(client.resumed);
+                REQUIRE(resumptions.value() == before + MetricsEnabled);
+            }
+        }
+
+        WHEN("Requesting a file") {
+            std::string const response = client.round_trip(transport.port(), "GET /file HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+            THEN("It is sent whole, through the kernel or encrypted from its mapping") {
+                REQUIRE_THAT(response, StartsWith("HTTP/1.1 200"));
+                REQUIRE_THAT(response, ContainsSubstring("content-length: 100000\r\n"));
+                REQUIRE_THAT(response, EndsWith("\r\n\r\n" + content));
+            }
+        }
+
+        transport.stop();
+        io.stop();
+        worker.join();
+    }
+}
+
+SCENARIO("TLS Server Connections", "[tls]") {
+    GIVEN("A TlsServer routing a body large enough to be written by its socket adapter") {
+        auto const [cert, key] = SelfSigned();
+        TlsOptions tls;
+        tls.certificate_chain = cert;
+        tls.private_key = key;
+
+        Router::fetch_instance()
+            CHAIN(Router::scope, "/tls",
+                (CALLBACK_SCOPE {
+                    GET("/large", [](Conn const& c) { return Conn::resp(c, 200, std::string(100000, 'x')); });
+                    END_SCOPE;
+                }));
+
+        TlsServer server(tls);
+        TlsServer::start(server, "localhost", 9443, TlsServer::Options{});
+
+        WHEN("Requesting it") {
+            Client client;
+            std::string const response = client.round_trip(9443, "GET /tls/large HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+            THEN("The response is whole and the connection ends with close_notify") {
+                REQUIRE_THAT(response, StartsWith("HTTP/1.1 200"));
+                REQUIRE_THAT(response, EndsWith(std::string(100000, 'x')));
+                REQUIRE(client.closed == boost::asio::error::eof);
+            }
+        }
+
+        TlsServer::stop(server);
+        TlsServer::join(server);
+    }
+}
+
+#endif